@@ -0,0 +1,405 @@
+// Implementation of the AsyncFileWriter class
+#include "AsyncFileWriter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#ifdef _WIN32
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
+
+#ifdef __linux__
+    #include <linux/io_uring.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+#endif
+
+#ifdef __linux__
+
+// Raw io_uring instance: the submission and completion rings mapped from the kernel
+struct AsyncFileWriter::Ring {
+    int fd = -1;
+    void* sqRing = MAP_FAILED;
+    void* cqRing = MAP_FAILED;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqesSize = 0;
+
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    ~Ring() {
+        if (sqes != MAP_FAILED) ::munmap(sqes, sqesSize);
+        if (cqRing != MAP_FAILED && cqRing != sqRing) ::munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED) ::munmap(sqRing, sqRingSize);
+        if (fd >= 0) ::close(fd);
+    }
+
+    bool setup(unsigned entries) {
+        io_uring_params params{};
+        fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0) {
+            return false;
+        }
+        // IORING_OP_WRITE arrived together with this feature bit (Linux 5.6)
+        if ((params.features & IORING_FEAT_RW_CUR_POS) == 0) {
+            return false;
+        }
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMmap) {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+
+        sqRing = ::mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) {
+            return false;
+        }
+        cqRing = singleMmap ? sqRing
+                            : ::mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                     IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) {
+            return false;
+        }
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(
+            ::mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED) {
+            return false;
+        }
+
+        char* sq = static_cast<char*>(sqRing);
+        char* cq = static_cast<char*>(cqRing);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    int enter(unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        for (;;) {
+            const long ret = ::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+            if (ret >= 0 || errno != EINTR) {
+                return static_cast<int>(ret);
+            }
+        }
+    }
+};
+
+#else
+
+struct AsyncFileWriter::Ring {};
+
+#endif
+
+AsyncFileWriter::AsyncFileWriter() = default;
+
+AsyncFileWriter::~AsyncFileWriter() {
+    stop();
+}
+
+bool AsyncFileWriter::start(CompletionFn onComplete, IoBackend backend, unsigned queueDepth) {
+    stop();
+    m_onComplete = std::move(onComplete);
+    m_queueDepth = std::max(1u, queueDepth);
+    m_inFlight = 0;
+    m_stopping = false;
+
+    if (backend != IoBackend::ThreadPool && startRing(m_queueDepth)) {
+        m_backend = IoBackend::IoUring;
+    } else if (backend == IoBackend::IoUring) {
+        return false;
+    } else {
+        m_backend = IoBackend::ThreadPool;
+        const unsigned workers = std::min(m_queueDepth, 4u);
+        for (unsigned i = 0; i < workers; ++i) {
+            m_workers.emplace_back(&AsyncFileWriter::poolWorkerLoop, this);
+        }
+    }
+
+    m_running = true;
+    return true;
+}
+
+void AsyncFileWriter::stop() {
+    if (!m_running) {
+        return;
+    }
+    drain();
+
+#ifdef __linux__
+    if (m_backend == IoBackend::IoUring) {
+        // A NOP with no op attached tells the reaper to exit
+        Ring& ring = *m_ring;
+        const unsigned tail = *ring.sqTail;
+        const unsigned index = tail & *ring.sqMask;
+        io_uring_sqe& sqe = ring.sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_NOP;
+        sqe.user_data = 0;
+        ring.sqArray[index] = index;
+        __atomic_store_n(ring.sqTail, tail + 1, __ATOMIC_RELEASE);
+        ring.enter(1, 0, 0);
+        m_reaper.join();
+        m_ring.reset();
+    }
+#endif
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_workAvailable.notify_all();
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+    m_workers.clear();
+    m_running = false;
+}
+
+bool AsyncFileWriter::write(int fd, const void* data, size_t size, uint64_t offset, uint64_t tag) {
+    if (size > UINT_MAX) {
+        return false; // One io_uring write carries at most 4 GiB
+    }
+    return submit(Op{fd, data, size, offset, tag, false});
+}
+
+bool AsyncFileWriter::sync(int fd, uint64_t tag) {
+    return submit(Op{fd, nullptr, 0, 0, tag, true});
+}
+
+void AsyncFileWriter::drain() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_slotFreed.wait(lock, [this] { return m_inFlight == 0; });
+}
+
+bool AsyncFileWriter::writeAndSync(int fd, const char* data, size_t size, IoBackend backend, size_t chunkSize,
+                                   unsigned queueDepth) {
+    std::atomic<bool> failed{false};
+    AsyncFileWriter writer;
+    if (!writer.start([&failed](uint64_t, int64_t result) { if (result < 0) failed = true; }, backend, queueDepth)) {
+        return false;
+    }
+
+    chunkSize = std::max<size_t>(chunkSize, 4096);
+    for (size_t offset = 0; offset < size && !failed; offset += chunkSize) {
+        if (!writer.write(fd, data + offset, std::min(chunkSize, size - offset), offset, 0)) {
+            failed = true;
+        }
+    }
+    if (!failed && !writer.sync(fd, 0)) {
+        failed = true;
+    }
+    writer.stop();
+    return !failed;
+}
+
+bool AsyncFileWriter::submit(const Op& op) {
+    if (!m_running) {
+        return false;
+    }
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_slotFreed.wait(lock, [this] { return m_inFlight < m_queueDepth; });
+        ++m_inFlight;
+        if (m_backend == IoBackend::ThreadPool) {
+            m_queue.push_back(op);
+        }
+    }
+
+    if (m_backend == IoBackend::ThreadPool) {
+        m_workAvailable.notify_one();
+        return true;
+    }
+
+    if (!submitRing(new Op(op))) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_inFlight;
+        m_slotFreed.notify_all();
+        return false;
+    }
+    return true;
+}
+
+void AsyncFileWriter::complete(const Op& op, int64_t result) {
+    // Report first, so drain() returning means every callback has run
+    if (m_onComplete) {
+        m_onComplete(op.tag, result);
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    --m_inFlight;
+    m_slotFreed.notify_all();
+}
+
+bool AsyncFileWriter::startRing(unsigned queueDepth) {
+#ifdef __linux__
+    auto ring = std::make_unique<Ring>();
+    // One extra entry for the shutdown NOP
+    if (!ring->setup(queueDepth + 1)) {
+        return false;
+    }
+    m_ring = std::move(ring);
+    m_reaper = std::thread(&AsyncFileWriter::ringReaperLoop, this);
+    return true;
+#else
+    (void)queueDepth;
+    return false;
+#endif
+}
+
+bool AsyncFileWriter::submitRing(Op* op) {
+#ifdef __linux__
+    // Only the submitting thread touches the SQ tail; the in-flight limit keeps a slot free
+    Ring& ring = *m_ring;
+    const unsigned tail = *ring.sqTail;
+    const unsigned index = tail & *ring.sqMask;
+    io_uring_sqe& sqe = ring.sqes[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.fd = op->fd;
+    sqe.user_data = reinterpret_cast<uint64_t>(op);
+    if (op->isSync) {
+        sqe.opcode = IORING_OP_FSYNC;
+        sqe.fsync_flags = IORING_FSYNC_DATASYNC;
+        sqe.flags = IOSQE_IO_DRAIN; // After everything before it, before everything after it
+    } else {
+        sqe.opcode = IORING_OP_WRITE;
+        sqe.addr = reinterpret_cast<uint64_t>(op->data);
+        sqe.len = static_cast<uint32_t>(op->size);
+        sqe.off = op->offset;
+    }
+    ring.sqArray[index] = index;
+    __atomic_store_n(ring.sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    if (ring.enter(1, 0, 0) < 0) {
+        __atomic_store_n(ring.sqTail, tail, __ATOMIC_RELEASE);
+        delete op;
+        return false;
+    }
+    return true;
+#else
+    delete op;
+    return false;
+#endif
+}
+
+void AsyncFileWriter::ringReaperLoop() {
+#ifdef __linux__
+    Ring& ring = *m_ring;
+    for (;;) {
+        unsigned head = *ring.cqHead;
+        const unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            ring.enter(0, 1, IORING_ENTER_GETEVENTS);
+            continue;
+        }
+
+        bool stopSeen = false;
+        for (; head != tail; ++head) {
+            const io_uring_cqe& cqe = ring.cqes[head & *ring.cqMask];
+            Op* op = reinterpret_cast<Op*>(cqe.user_data);
+            int64_t result = cqe.res;
+            __atomic_store_n(ring.cqHead, head + 1, __ATOMIC_RELEASE);
+
+            if (op == nullptr) {
+                stopSeen = true;
+                continue;
+            }
+            if (!op->isSync && result >= 0 && static_cast<size_t>(result) != op->size) {
+                result = -EIO; // Short write, e.g. the disk filled up
+            }
+            complete(*op, result);
+            delete op;
+        }
+        if (stopSeen) {
+            return;
+        }
+    }
+#endif
+}
+
+void AsyncFileWriter::poolWorkerLoop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_workAvailable.wait(lock, [this] {
+            const bool ready = !m_queue.empty() && !m_barrier && (!m_queue.front().isSync || m_executing == 0);
+            return ready || (m_stopping && m_queue.empty());
+        });
+        if (m_queue.empty()) {
+            return; // Stopping
+        }
+
+        const Op op = m_queue.front();
+        m_queue.pop_front();
+        ++m_executing;
+        if (op.isSync) {
+            m_barrier = true; // Nothing else starts until the sync is done
+        }
+        lock.unlock();
+
+        int64_t result = 0;
+        if (op.isSync) {
+#if defined(_WIN32)
+            result = ::_commit(op.fd) == 0 ? 0 : -errno;
+#elif defined(__APPLE__)
+            result = ::fsync(op.fd) == 0 ? 0 : -errno;
+#else
+            result = ::fdatasync(op.fd) == 0 ? 0 : -errno;
+#endif
+        } else {
+            const char* p = static_cast<const char*>(op.data);
+            size_t remaining = op.size;
+            uint64_t offset = op.offset;
+            while (remaining > 0) {
+#ifdef _WIN32
+                static std::mutex seekMutex; // _lseeki64 + _write is not positional
+                long long written;
+                {
+                    std::lock_guard<std::mutex> seekLock(seekMutex);
+                    written = ::_lseeki64(op.fd, static_cast<long long>(offset), SEEK_SET) < 0
+                                  ? -1
+                                  : ::_write(op.fd, p, static_cast<unsigned int>(std::min<size_t>(remaining, INT_MAX)));
+                }
+#else
+                const ssize_t written = ::pwrite(op.fd, p, remaining, static_cast<off_t>(offset));
+#endif
+                if (written < 0) {
+                    if (errno == EINTR) continue;
+                    result = -errno;
+                    break;
+                }
+                p += written;
+                offset += static_cast<uint64_t>(written);
+                remaining -= static_cast<size_t>(written);
+            }
+            if (result == 0) {
+                result = static_cast<int64_t>(op.size);
+            }
+        }
+
+        complete(op, result);
+
+        lock.lock();
+        --m_executing;
+        if (op.isSync) {
+            m_barrier = false;
+        }
+        m_workAvailable.notify_all();
+    }
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Which engine AsyncFileWriter uses to reach storage
+enum class IoBackend {
+    Auto,        // io_uring when the kernel offers it, otherwise the thread pool
+    IoUring,     // Linux io_uring, driven through raw syscalls
+    ThreadPool   // blocking pwrite/fdatasync on worker threads
+};
+
+// Asynchronous positional writes and data syncs with several operations in flight.
+// One thread submits; completions are delivered on an internal reaper thread through
+// the callback given to start(). A sync is ordered after every operation queued before
+// it, and operations queued after it wait for it, so a successful sync completion means
+// all earlier writes are durable. Buffers must stay valid until their completion.
+class AsyncFileWriter
+{
+ public:
+
+  // `result` is the number of bytes written (0 for syncs) or a negative errno
+  using CompletionFn = std::function<void(uint64_t tag, int64_t result)>;
+
+  AsyncFileWriter();
+  AsyncFileWriter(const AsyncFileWriter&) = delete;
+  AsyncFileWriter& operator=(const AsyncFileWriter&) = delete;
+  ~AsyncFileWriter();
+
+  // Start the engine. IoBackend::IoUring fails where io_uring is unavailable; Auto falls
+  // back to the thread pool.
+  bool start(CompletionFn onComplete, IoBackend backend = IoBackend::Auto, unsigned queueDepth = 8);
+
+  // Wait for everything in flight, then stop the engine
+  void stop();
+
+  bool isRunning() const noexcept { return m_running; }
+
+  // Engine actually in use (never Auto once started)
+  IoBackend backend() const noexcept { return m_backend; }
+
+  // Queue a write of `size` bytes at `offset`. Blocks only while `queueDepth` operations
+  // are already in flight.
+  bool write(int fd, const void* data, size_t size, uint64_t offset, uint64_t tag);
+
+  // Queue an fdatasync of `fd`, ordered after every operation queued before it
+  bool sync(int fd, uint64_t tag);
+
+  // Block until nothing is in flight
+  void drain();
+
+  // Write a whole buffer at offset 0 in chunks of `chunkSize` with up to `queueDepth`
+  // chunks in flight, then sync. Returns false if any chunk or the sync failed.
+  static bool writeAndSync(int fd, const char* data, size_t size, IoBackend backend = IoBackend::Auto,
+                           size_t chunkSize = 1 << 20, unsigned queueDepth = 8);
+
+ private:
+
+  struct Op {
+      int fd;
+      const void* data;
+      size_t size;
+      uint64_t offset;
+      uint64_t tag;
+      bool isSync;
+  };
+
+  struct Ring;
+
+  bool submit(const Op& op);
+  void complete(const Op& op, int64_t result);
+
+  bool startRing(unsigned queueDepth);
+  bool submitRing(Op* op);
+  void ringReaperLoop();
+
+  void poolWorkerLoop();
+
+  CompletionFn m_onComplete;
+  IoBackend m_backend = IoBackend::Auto;
+  unsigned m_queueDepth = 0;
+  bool m_running = false;
+
+  // In-flight accounting shared by both engines
+  std::mutex m_mutex;
+  std::condition_variable m_slotFreed;
+  unsigned m_inFlight = 0;
+
+  // io_uring engine
+  std::unique_ptr<Ring> m_ring;
+  std::thread m_reaper;
+
+  // Thread-pool engine: FIFO queue, syncs act as barriers
+  std::condition_variable m_workAvailable;
+  std::deque<Op> m_queue;
+  std::vector<std::thread> m_workers;
+  unsigned m_executing = 0;
+  bool m_barrier = false;
+  bool m_stopping = false;
+
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "OrderCache.h"
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+// The uniform books the benchmark tools and the regression gate time calls against, so
+// their numbers stay comparable
+
+constexpr int kSecurities = 1000;
+constexpr int kUsers = 1000;
+
+// Results of the timed queries land here so the calls cannot be optimized away
+inline volatile uint64_t sink = 0;
+
+// `numOrders` orders "OrdId0"... spread uniformly over kSecurities securities, kUsers
+// users and 100 companies, with 100 to 5000 qty; the same orders on every run
+inline std::vector<Order> generateOrders(unsigned int numOrders) {
+    std::mt19937 gen(12345);
+    std::uniform_int_distribution<int> userDist(0, kUsers - 1);
+    std::uniform_int_distribution<int> companyDist(0, 99);
+    std::uniform_int_distribution<int> secDist(0, kSecurities - 1);
+    std::uniform_int_distribution<int> sideDist(0, 1);
+    std::uniform_int_distribution<int> qtyDist(1, 50);
+
+    std::vector<Order> orders;
+    orders.reserve(numOrders);
+    for (unsigned int i = 0; i < numOrders; i++) {
+        orders.push_back(Order{"OrdId" + std::to_string(i), "SecId" + std::to_string(secDist(gen)),
+                               sideDist(gen) ? "Buy" : "Sell", static_cast<unsigned int>(qtyDist(gen) * 100),
+                               "User" + std::to_string(userDist(gen)), "Comp" + std::to_string(companyDist(gen))});
+    }
+    return orders;
+}
+
+// "<prefix>0" to "<prefix><count - 1>", e.g. every security of the generated books
+inline std::vector<std::string> names(const char* prefix, int count) {
+    std::vector<std::string> result;
+    result.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        result.push_back(prefix + std::to_string(i));
+    }
+    return result;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <type_traits>
+
+// Command-line helpers shared by the benchmark and gate executables
+
+// Parse the whole of `text` as a decimal count that fits in T. Signs, spaces, trailing
+// characters and overflow are rejected rather than wrapped or cut short.
+template <typename T>
+bool parseCount(const char* text, T& value) {
+    static_assert(std::is_unsigned<T>::value, "counts are unsigned");
+    if (!std::isdigit(static_cast<unsigned char>(*text))) {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    const unsigned long long parsed = std::strtoull(text, &end, 10);
+    if (errno == ERANGE || *end != '\0' || parsed > std::numeric_limits<T>::max()) {
+        return false;
+    }
+    value = static_cast<T>(parsed);
+    return true;
+}
+
+// Parse the whole of `text` as a finite, non-negative decimal number
+inline bool parseNonNegative(const char* text, double& value) {
+    if (!std::isdigit(static_cast<unsigned char>(*text)) && *text != '.') {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    const double parsed = std::strtod(text, &end);
+    if (errno == ERANGE || *end != '\0' || !std::isfinite(parsed)) {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+// Print "usage: <usage>" to stderr and return `status` for main() to exit with
+inline int usageError(const char* usage, int status = 1) {
+    std::cerr << "usage: " << usage << std::endl;
+    return status;
+}
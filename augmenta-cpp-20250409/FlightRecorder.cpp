@@ -0,0 +1,314 @@
+// Per-thread rings of recent operations
+#include "FlightRecorder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#ifdef __unix__
+    #include <signal.h>
+    #include <unistd.h>
+#endif
+
+// The last kCapacity operations of one thread. Only the owning thread writes the slots:
+// it bumps `claimed` before it overwrites one and `head` once the slot is complete, so a
+// reader that checks `claimed` after copying knows which copied slots may be torn.
+struct FlightRecorder::Ring {
+    struct Slot {
+        std::atomic<uint64_t> start;
+        std::atomic<uint64_t> keyHash;
+        std::atomic<uint64_t> result;
+        std::atomic<uint64_t> opDuration;   // op in the low kOpBits, duration in ticks above
+    };
+
+    static constexpr unsigned kOpBits = 8;
+    static constexpr uint64_t kMaxDuration = ~uint64_t{0} >> kOpBits;
+
+    std::atomic<uint64_t> head{0};          // operations ever recorded
+    std::atomic<uint64_t> claimed{0};       // operations ever started
+    std::atomic<uint64_t> clearedAt{0};     // head when clear() last ran
+    std::atomic<uint64_t> base{0};          // head when the current thread took the ring
+    std::atomic<uint32_t> thread{0};
+    std::atomic<bool> owned{true};          // false once the thread has exited
+    Slot slots[kCapacity];
+};
+
+// This thread's ring, claimed on its first record and handed back when the thread ends
+class FlightRecorder::ThreadSlot
+{
+ public:
+
+  Ring* get() noexcept {
+      if (!m_acquired) {
+          m_acquired = true;
+          m_ring = acquireRing();
+      }
+      return m_ring;
+  }
+
+  ~ThreadSlot() {
+      if (m_ring) {
+          s_ring = nullptr; // Later calls on this thread find m_acquired and record nothing
+          m_ring->owned.store(false, std::memory_order_release);
+          m_ring = nullptr;
+      }
+  }
+
+ private:
+
+  Ring* m_ring = nullptr;
+  bool m_acquired = false;      // acquisition fails for good once kMaxThreads rings are owned
+
+};
+
+std::atomic<FlightRecorder::Ring*> FlightRecorder::s_rings[kMaxThreads] = {};
+std::atomic<double> FlightRecorder::s_nanosPerTick{0};
+std::atomic<int> FlightRecorder::s_dumpFd{2};
+thread_local FlightRecorder::Ring* FlightRecorder::s_ring = nullptr;
+thread_local FlightRecorder::ThreadSlot FlightRecorder::s_slot;
+
+namespace {
+
+std::atomic<uint32_t> nextThread{0};
+
+// A retained record before conversion to nanoseconds
+struct RawRecord {
+    uint32_t op;
+    uint64_t sequence;
+    uint64_t keyHash;
+    uint64_t start;
+    uint64_t duration;
+    uint64_t result;
+};
+
+// Fixed-size text line for dump(): no allocation, no stdio
+class LineBuffer
+{
+ public:
+
+  void append(const char* text) noexcept {
+      while (*text && m_length < sizeof(m_data)) {
+          m_data[m_length++] = *text++;
+      }
+  }
+
+  void appendUnsigned(uint64_t value) noexcept {
+      char digits[20];
+      size_t count = 0;
+      do {
+          digits[count++] = static_cast<char>('0' + value % 10);
+          value /= 10;
+      } while (value != 0);
+      while (count > 0 && m_length < sizeof(m_data)) {
+          m_data[m_length++] = digits[--count];
+      }
+  }
+
+  void appendHex(uint64_t value) noexcept {
+      static const char hex[] = "0123456789abcdef";
+      for (int shift = 60; shift >= 0 && m_length < sizeof(m_data); shift -= 4) {
+          m_data[m_length++] = hex[(value >> shift) & 0xf];
+      }
+  }
+
+  void write(int fd) noexcept {
+#ifdef __unix__
+      size_t written = 0;
+      while (written < m_length) {
+          const ssize_t n = ::write(fd, m_data + written, m_length - written);
+          if (n < 0 && errno == EINTR) {
+              continue;
+          }
+          if (n <= 0) {
+              break;
+          }
+          written += static_cast<size_t>(n);
+      }
+#else
+      (void)fd;
+#endif
+      m_length = 0;
+  }
+
+ private:
+
+  char m_data[192];
+  size_t m_length = 0;
+
+};
+
+} // namespace
+
+FlightRecorder::Ring* FlightRecorder::acquireRing() noexcept {
+    for (auto& entry : s_rings) {
+        Ring* ring = entry.load(std::memory_order_acquire);
+        if (ring == nullptr) {
+            Ring* fresh = new (std::nothrow) Ring;
+            if (fresh == nullptr) {
+                return nullptr;
+            }
+            fresh->thread.store(nextThread.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+            if (entry.compare_exchange_strong(ring, fresh, std::memory_order_acq_rel)) {
+                return fresh;
+            }
+            delete fresh; // Another thread took this entry; `ring` now holds its ring
+        }
+        bool owned = false;
+        if (ring->owned.compare_exchange_strong(owned, true, std::memory_order_acq_rel)) {
+            // An exited thread's ring: start over under the new thread's number
+            const uint64_t head = ring->head.load(std::memory_order_relaxed);
+            ring->thread.store(nextThread.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+            ring->base.store(head, std::memory_order_relaxed);
+            ring->clearedAt.store(head, std::memory_order_relaxed);
+            return ring;
+        }
+    }
+    return nullptr;
+}
+
+void FlightRecorder::record(LatencyOp op, uint64_t keyHash, uint64_t startTicks, uint64_t endTicks,
+                            uint64_t result) noexcept {
+    Ring* ring = s_ring;
+    if (ring == nullptr) {
+        ring = s_ring = s_slot.get();
+        if (ring == nullptr) {
+            return;
+        }
+    }
+    const uint64_t head = ring->head.load(std::memory_order_relaxed);
+    Ring::Slot& slot = ring->slots[head % kCapacity];
+    ring->claimed.store(head + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    const uint64_t duration = endTicks > startTicks ? std::min(endTicks - startTicks, Ring::kMaxDuration) : 0;
+    slot.start.store(startTicks, std::memory_order_relaxed);
+    slot.keyHash.store(keyHash, std::memory_order_relaxed);
+    slot.result.store(result, std::memory_order_relaxed);
+    slot.opDuration.store(duration << Ring::kOpBits | static_cast<uint64_t>(op), std::memory_order_relaxed);
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+namespace {
+
+// Copy the complete records of `ring` into `out` (room for kCapacity); returns how many
+template <typename Ring>
+size_t copyRing(const Ring& ring, RawRecord* out) noexcept {
+    const uint64_t head = ring.head.load(std::memory_order_acquire);
+    const uint64_t oldest = head > FlightRecorder::kCapacity ? head - FlightRecorder::kCapacity : 0;
+    const uint64_t first = std::max(oldest, ring.clearedAt.load(std::memory_order_relaxed));
+    const uint64_t base = ring.base.load(std::memory_order_relaxed);
+    size_t count = 0;
+    for (uint64_t i = first; i < head; ++i) {
+        const auto& slot = ring.slots[i % FlightRecorder::kCapacity];
+        const uint64_t opDuration = slot.opDuration.load(std::memory_order_relaxed);
+        out[count++] = RawRecord{static_cast<uint32_t>(opDuration & ((1u << Ring::kOpBits) - 1)), i - base,
+                                 slot.keyHash.load(std::memory_order_relaxed),
+                                 slot.start.load(std::memory_order_relaxed), opDuration >> Ring::kOpBits,
+                                 slot.result.load(std::memory_order_relaxed)};
+    }
+
+    // Slots the owner reused while we copied may mix two records
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t claimed = ring.claimed.load(std::memory_order_relaxed);
+    const uint64_t torn = claimed > FlightRecorder::kCapacity + first ? claimed - FlightRecorder::kCapacity - first : 0;
+    if (torn >= count) {
+        return 0;
+    }
+    std::memmove(out, out + torn, (count - torn) * sizeof(RawRecord));
+    return count - static_cast<size_t>(torn);
+}
+
+uint64_t ticksToNanos(uint64_t ticks, double nanosPerTick) noexcept {
+    return nanosPerTick > 0 ? static_cast<uint64_t>(static_cast<double>(ticks) * nanosPerTick) : ticks;
+}
+
+} // namespace
+
+std::vector<FlightRecord> FlightRecorder::snapshot() {
+    const double nanosPerTick = TscClock::calibrate();
+    s_nanosPerTick.store(nanosPerTick, std::memory_order_relaxed);
+
+    std::vector<FlightRecord> records;
+    std::vector<RawRecord> raw(kCapacity);
+    const uint64_t now = TscClock::now();
+    for (const auto& entry : s_rings) {
+        const Ring* ring = entry.load(std::memory_order_acquire);
+        if (ring == nullptr) {
+            break;
+        }
+        const uint32_t thread = ring->thread.load(std::memory_order_relaxed);
+        const size_t count = copyRing(*ring, raw.data());
+        for (size_t i = 0; i < count; ++i) {
+            const RawRecord& r = raw[i];
+            records.push_back(FlightRecord{static_cast<LatencyOp>(r.op), thread, r.sequence, r.keyHash,
+                                           ticksToNanos(now > r.start ? now - r.start : 0, nanosPerTick),
+                                           ticksToNanos(r.duration, nanosPerTick), r.result});
+        }
+    }
+    return records;
+}
+
+void FlightRecorder::dump(int fd) noexcept {
+    const int savedErrno = errno;
+    const double nanosPerTick = s_nanosPerTick.load(std::memory_order_relaxed);
+    const uint64_t now = TscClock::now();
+    LineBuffer line;
+    line.append("flight recorder: recent operations per thread, oldest first (times in ");
+    line.append(nanosPerTick > 0 ? "ns)\n" : "TSC ticks)\n");
+    line.write(fd);
+
+    RawRecord raw[kCapacity];
+    for (const auto& entry : s_rings) {
+        const Ring* ring = entry.load(std::memory_order_acquire);
+        if (ring == nullptr) {
+            break;
+        }
+        const uint32_t thread = ring->thread.load(std::memory_order_relaxed);
+        const size_t count = copyRing(*ring, raw);
+        for (size_t i = 0; i < count; ++i) {
+            const RawRecord& r = raw[i];
+            line.append("thread ");
+            line.appendUnsigned(thread);
+            line.append(" #");
+            line.appendUnsigned(r.sequence);
+            line.append(" ");
+            line.append(latencyOpName(static_cast<LatencyOp>(r.op)));
+            line.append(" key ");
+            line.appendHex(r.keyHash);
+            line.append(" age ");
+            line.appendUnsigned(ticksToNanos(now > r.start ? now - r.start : 0, nanosPerTick));
+            line.append(" duration ");
+            line.appendUnsigned(ticksToNanos(r.duration, nanosPerTick));
+            line.append(" result ");
+            line.appendUnsigned(r.result);
+            line.append("\n");
+            line.write(fd);
+        }
+    }
+    errno = savedErrno;
+}
+
+bool FlightRecorder::installSignalHandler(int signal, int fd) {
+#ifdef __unix__
+    s_nanosPerTick.store(TscClock::calibrate(), std::memory_order_relaxed);
+    s_dumpFd.store(fd, std::memory_order_relaxed);
+    struct sigaction action {};
+    action.sa_handler = [](int) { dump(s_dumpFd.load(std::memory_order_relaxed)); };
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    return ::sigaction(signal, &action, nullptr) == 0;
+#else
+    (void)signal;
+    (void)fd;
+    return false;
+#endif
+}
+
+void FlightRecorder::clear() noexcept {
+    for (const auto& entry : s_rings) {
+        Ring* ring = entry.load(std::memory_order_acquire);
+        if (ring == nullptr) {
+            break;
+        }
+        ring->clearedAt.store(ring->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "LatencyHistogram.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+// One operation as the flight recorder kept it
+struct FlightRecord {
+    LatencyOp op;
+    uint32_t thread;           // small per-process thread number, in order of first record
+    uint64_t sequence;         // operations recorded on that thread before this one
+    uint64_t keyHash;          // FlightRecorder::keyHash of the order id, user or security id
+    uint64_t ageNs;            // time from the start of the operation to the snapshot
+    uint64_t durationNs;
+    uint64_t result;           // orders added or cancelled, matching size, orders returned
+};
+
+// The last kCapacity operations of every thread, for a look at what the cache was doing
+// when an alarm fired. Each thread writes its own fixed ring with relaxed atomic stores;
+// recording allocates nothing after a thread's first operation and takes no locks. A
+// record keeps the start tick and the duration, packed with the operation into one word.
+// dump() is async-signal-safe (no allocation, locks or stdio), so it can run from a signal
+// handler installed with installSignalHandler(), including on the thread being recorded;
+// an entry caught half-written is skipped. Up to kMaxThreads threads are recorded at a
+// time; the ring of an exited thread goes to the next new one.
+//
+// The cache records every public interface call here unless it is compiled with the
+// CMake option ORDERCACHE_FLIGHT_RECORDER=OFF. Calls a cache makes to itself are part of
+// the outer call.
+class FlightRecorder
+{
+ public:
+
+  static constexpr bool kCacheInstrumented =
+#ifdef ORDERCACHE_FLIGHT_RECORDER
+      true;
+#else
+      false;
+#endif
+
+  static constexpr size_t kCapacity = 256;
+  static constexpr size_t kMaxThreads = 256;
+
+  // Hash of a key as stored in the records: its length and its first and last 8 bytes, so
+  // keys of up to 16 bytes hash whole and longer ones cost the same
+  static uint64_t keyHash(std::string_view key) noexcept {
+      const size_t length = key.size();
+      uint64_t head = 0;
+      uint64_t tail = 0;
+      if (length >= 8) {
+          std::memcpy(&head, key.data(), 8);
+          std::memcpy(&tail, key.data() + length - 8, 8);
+      } else if (length >= 4) {
+          uint32_t first;
+          uint32_t last;
+          std::memcpy(&first, key.data(), 4);
+          std::memcpy(&last, key.data() + length - 4, 4);
+          head = first;
+          tail = last;
+      } else if (length > 0) {
+          head = static_cast<unsigned char>(key[0]) | static_cast<unsigned char>(key[length / 2]) << 8 |
+                 static_cast<uint64_t>(static_cast<unsigned char>(key[length - 1])) << 16;
+      }
+      const uint64_t hash = (head ^ 0x9e3779b97f4a7c15ull) * ((tail ^ length) | 1);
+      return (hash ^ (hash >> 29)) * 0xbf58476d1ce4e5b9ull;
+  }
+
+  static void record(LatencyOp op, uint64_t keyHash, uint64_t startTicks, uint64_t endTicks,
+                     uint64_t result) noexcept;
+
+  // Every thread's retained records, by thread then oldest first
+  static std::vector<FlightRecord> snapshot();
+
+  // Write the retained records to `fd` as text, one line per operation. Ages and durations
+  // are in nanoseconds once the TSC is calibrated (snapshot() and installSignalHandler()
+  // calibrate it), in ticks before.
+  static void dump(int fd) noexcept;
+
+  // Dump to `fd` whenever `signal` arrives. False where signals are not supported.
+  static bool installSignalHandler(int signal, int fd = 2);
+
+  // Forget every record so far
+  static void clear() noexcept;
+
+ private:
+
+  struct Ring;
+  class ThreadSlot;
+
+  static Ring* acquireRing() noexcept;
+
+  static std::atomic<Ring*> s_rings[kMaxThreads];
+  static std::atomic<double> s_nanosPerTick;
+  static std::atomic<int> s_dumpFd;
+  static thread_local Ring* s_ring;         // trivial, so the recording path reads it directly
+  static thread_local ThreadSlot s_slot;    // hands s_ring back when the thread ends
+};
+
+// Records one interface call from construction to destruction. The result defaults to the change in `version`
+// (orders added or cancelled); setResult() overrides it. `active` belongs to the cache and
+// is set while one of its calls is recorded, so calls it makes to itself are not.
+class FlightScope
+{
+ public:
+
+  FlightScope(LatencyOp op, std::string_view key, const uint64_t& version, bool& active) noexcept
+      : m_op(op), m_outermost(!active), m_active(active), m_version(version), m_startVersion(version),
+        m_keyHash(FlightRecorder::keyHash(key)), m_start(TscClock::now()) {
+      active = true;
+  }
+
+  FlightScope(const FlightScope&) = delete;
+  FlightScope& operator=(const FlightScope&) = delete;
+
+  ~FlightScope() {
+      if (m_outermost) {
+          FlightRecorder::record(m_op, m_keyHash, m_start, TscClock::now(),
+                                 m_hasResult ? m_result : m_version - m_startVersion);
+          m_active = false;
+      }
+  }
+
+  void setResult(uint64_t result) noexcept {
+      m_result = result;
+      m_hasResult = true;
+  }
+
+ private:
+
+  LatencyOp m_op;
+  bool m_outermost;
+  bool m_hasResult = false;
+  bool& m_active;
+  const uint64_t& m_version;
+  uint64_t m_startVersion;
+  uint64_t m_keyHash;
+  uint64_t m_start;
+  uint64_t m_result = 0;
+
+};
@@ -0,0 +1,77 @@
+// Add-path latency with and without a write-ahead journal on each I/O backend.
+//
+//   JournalBenchmark [numOrders] [journalDir]
+//
+// Orders are generated up front; only the addOrder() call itself is timed.
+#include "BenchmarkOrders.h"
+#include "OrderCache.h"
+#include "OrderJournal.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+void runScenario(const char* name, const std::vector<Order>& orders, OrderJournal* journal) {
+    OrderCache cache;
+    cache.attachJournal(journal);
+
+    std::vector<uint64_t> latencies;
+    latencies.reserve(orders.size());
+    const auto begin = std::chrono::steady_clock::now();
+    for (const auto& order : orders) {
+        const auto start = std::chrono::steady_clock::now();
+        cache.addOrder(order);
+        const auto end = std::chrono::steady_clock::now();
+        latencies.push_back(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    if (journal != nullptr) {
+        journal->sync();
+        cache.attachJournal(nullptr);
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto pct = [&](double p) { return latencies[static_cast<size_t>(p * (latencies.size() - 1))]; };
+    std::printf("%-22s %10.0f ops/s   p50 %6llu ns   p99 %6llu ns   p99.9 %7llu ns   max %9llu ns\n",
+                name, orders.size() / seconds,
+                static_cast<unsigned long long>(pct(0.50)), static_cast<unsigned long long>(pct(0.99)),
+                static_cast<unsigned long long>(pct(0.999)), static_cast<unsigned long long>(latencies.back()));
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const unsigned int numOrders = argc > 1 ? static_cast<unsigned int>(std::stoul(argv[1])) : 1000000;
+    const std::string dir = argc > 2 ? argv[2] : ".";
+    const std::vector<Order> orders = generateOrders(numOrders);
+
+    std::cout << "addOrder latency over " << numOrders << " orders" << std::endl;
+    runScenario("no journal", orders, nullptr);
+
+    const std::pair<const char*, IoBackend> backends[] = {
+        {"journal (io_uring)", IoBackend::IoUring},
+        {"journal (thread pool)", IoBackend::ThreadPool},
+    };
+    for (const auto& [name, backend] : backends) {
+        const std::string path = dir + "/JournalBenchmark.journal";
+        std::remove(path.c_str());
+
+        auto journal = std::make_unique<OrderJournal>();
+        JournalOptions options;
+        options.backend = backend;
+        if (!journal->open(path, options)) {
+            std::cout << name << ": unavailable on this system" << std::endl;
+            continue;
+        }
+        runScenario(name, orders, journal.get());
+        journal->close();
+        std::remove(path.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,316 @@
+// Latency histograms, TSC timestamps and the per-thread recorder
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+
+namespace {
+
+// Single-writer increment: a plain load and store, no locked instruction
+inline void bump(std::atomic<uint64_t>& counter, uint64_t n) noexcept {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+constexpr size_t kExactBuckets = 256;
+constexpr size_t kSubBuckets = size_t{1} << LatencyHistogram::kSubBucketBits;
+
+// Position of the highest set bit of a nonzero value
+inline unsigned highestBit(uint64_t v) noexcept {
+#if defined(__GNUC__)
+    return 63 - static_cast<unsigned>(__builtin_clzll(v));
+#else
+    unsigned bit = 0;
+    while (v >>= 1) {
+        ++bit;
+    }
+    return bit;
+#endif
+}
+
+double measureNanosPerTick() noexcept {
+#if ORDERCACHE_HAS_TSC
+    const auto start = std::chrono::steady_clock::now();
+    const uint64_t startTicks = TscClock::now();
+    auto end = start;
+    while (end - start < std::chrono::milliseconds(10)) {
+        end = std::chrono::steady_clock::now();
+    }
+    const uint64_t ticks = TscClock::now() - startTicks;
+    const double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    return ticks > 0 ? ns / static_cast<double>(ticks) : 1.0;
+#else
+    return 1.0;
+#endif
+}
+
+} // namespace
+
+double TscClock::calibrate() noexcept {
+    static const double nanosPerTick = measureNanosPerTick();
+    return nanosPerTick;
+}
+
+size_t LatencyHistogram::bucketIndex(uint64_t ns) noexcept {
+    if (ns < kExactBuckets) {
+        return static_cast<size_t>(ns);
+    }
+    ns = std::min(ns, kMaxTrackable);
+    const unsigned shift = highestBit(ns) - kSubBucketBits;
+    return kExactBuckets + (shift - 1) * kSubBuckets + static_cast<size_t>((ns >> shift) - kSubBuckets);
+}
+
+uint64_t LatencyHistogram::bucketLowest(size_t index) noexcept {
+    if (index < kExactBuckets) {
+        return index;
+    }
+    const unsigned shift = static_cast<unsigned>((index - kExactBuckets) / kSubBuckets) + 1;
+    return static_cast<uint64_t>((index - kExactBuckets) % kSubBuckets + kSubBuckets) << shift;
+}
+
+uint64_t LatencyHistogram::bucketHighest(size_t index) noexcept {
+    if (index < kExactBuckets) {
+        return index;
+    }
+    const unsigned shift = static_cast<unsigned>((index - kExactBuckets) / kSubBuckets) + 1;
+    return bucketLowest(index) + (uint64_t{1} << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns, uint64_t count) noexcept {
+    if (count == 0) {
+        return;
+    }
+    m_counts[bucketIndex(ns)] += count;
+    m_total += count;
+    m_sum += ns * count;
+    m_min = std::min(m_min, ns);
+    m_max = std::max(m_max, ns);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) noexcept {
+    for (size_t i = 0; i < kBucketCount; ++i) {
+        m_counts[i] += other.m_counts[i];
+    }
+    m_total += other.m_total;
+    m_sum += other.m_sum;
+    m_min = std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+}
+
+void LatencyHistogram::reset() noexcept {
+    std::fill(m_counts.begin(), m_counts.end(), 0);
+    m_total = 0;
+    m_sum = 0;
+    m_min = UINT64_MAX;
+    m_max = 0;
+}
+
+uint64_t LatencyHistogram::valueAtPercentile(double percentile) const noexcept {
+    if (m_total == 0) {
+        return 0;
+    }
+    if (percentile >= 100) {
+        return m_max;
+    }
+    const auto wanted = std::max<uint64_t>(
+        static_cast<uint64_t>(std::ceil(std::max(percentile, 0.0) / 100 * static_cast<double>(m_total))), 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBucketCount; ++i) {
+        seen += m_counts[i];
+        if (seen >= wanted) {
+            return std::min(bucketHighest(i), m_max);
+        }
+    }
+    return m_max;
+}
+
+void LatencyHistogram::writePercentiles(std::ostream& out, unsigned ticksPerHalfDistance) const {
+    char line[128];
+    out << "       Value     Percentile TotalCount 1/(1-Percentile)\n\n";
+
+    // Rows get denser towards the tail: ticksPerHalfDistance per halving of what is left
+    const unsigned ticks = std::max(ticksPerHalfDistance, 1u);
+    size_t bucket = 0;
+    uint64_t seen = 0;
+    double percentile = 0;
+    while (m_total > 0) {
+        const uint64_t value = valueAtPercentile(percentile);
+        while (bucket < kBucketCount && bucketLowest(bucket) <= value) {
+            seen += m_counts[bucket++];
+        }
+        if (seen >= m_total) {
+            break;
+        }
+        std::snprintf(line, sizeof(line), "%12llu %14.12f %10llu %14.2f\n", static_cast<unsigned long long>(value),
+                      percentile / 100, static_cast<unsigned long long>(seen), 100 / (100 - percentile));
+        out << line;
+        const double halvings = std::floor(std::log2(100 / (100 - percentile))) + 1;
+        percentile += 100 / (ticks * std::exp2(halvings));
+    }
+    std::snprintf(line, sizeof(line), "%12llu %14.12f %10llu\n", static_cast<unsigned long long>(m_max), 1.0,
+                  static_cast<unsigned long long>(m_total));
+    out << line;
+
+    double variance = 0;
+    for (size_t i = 0; i < kBucketCount; ++i) {
+        if (m_counts[i] != 0) {
+            const double mid = (static_cast<double>(bucketLowest(i)) + static_cast<double>(bucketHighest(i))) / 2;
+            variance += m_counts[i] * (mid - mean()) * (mid - mean());
+        }
+    }
+    std::snprintf(line, sizeof(line), "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", mean(),
+                  m_total ? std::sqrt(variance / m_total) : 0.0);
+    out << line;
+    std::snprintf(line, sizeof(line), "#[Max     = %12llu, Total count    = %12llu]\n",
+                  static_cast<unsigned long long>(m_max), static_cast<unsigned long long>(m_total));
+    out << line;
+    std::snprintf(line, sizeof(line), "#[Buckets = %12zu, SubBuckets     = %12zu]\n", kBucketCount, kSubBuckets);
+    out << line;
+}
+
+const char* latencyOpName(LatencyOp op) noexcept {
+    switch (op) {
+    case LatencyOp::Add:            return "addOrder";
+    case LatencyOp::Cancel:         return "cancelOrder";
+    case LatencyOp::CancelUser:     return "cancelOrdersForUser";
+    case LatencyOp::CancelSecurity: return "cancelOrdersForSecIdWithMinimumQty";
+    case LatencyOp::Match:          return "getMatchingSizeForSecurity";
+    case LatencyOp::GetAll:         return "getAllOrders";
+    }
+    return "unknown";
+}
+
+// One thread's histograms. Only the owning thread stores to them.
+struct LatencyRecorder::ThreadHistograms {
+    struct Op {
+        std::atomic<uint64_t> counts[LatencyHistogram::kBucketCount];
+        std::atomic<uint64_t> total;
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> min;
+        std::atomic<uint64_t> max;
+    };
+
+    ThreadHistograms() { clear(); }
+
+    void clear() noexcept {
+        for (Op& op : ops) {
+            for (auto& count : op.counts) {
+                count.store(0, std::memory_order_relaxed);
+            }
+            op.total.store(0, std::memory_order_relaxed);
+            op.sum.store(0, std::memory_order_relaxed);
+            op.min.store(UINT64_MAX, std::memory_order_relaxed);
+            op.max.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    Op ops[kLatencyOpCount];
+};
+
+struct LatencyRecorder::Registry {
+    std::mutex mutex;
+    std::vector<ThreadHistograms*> live;
+    LatencyHistogram exited[kLatencyOpCount];
+};
+
+// This thread's histograms, registered on first use and folded into the exited total when
+// the thread ends
+class LatencyRecorder::ThreadSlot
+{
+ public:
+
+  ThreadHistograms& get() {
+      if (!m_histograms) {
+          m_histograms = std::make_unique<ThreadHistograms>();
+          Registry& reg = registry();
+          std::lock_guard<std::mutex> lock(reg.mutex);
+          reg.live.push_back(m_histograms.get());
+      }
+      return *m_histograms;
+  }
+
+  ThreadHistograms* peek() const noexcept { return m_histograms.get(); }
+
+  ~ThreadSlot() {
+      if (!m_histograms) {
+          return;
+      }
+      Registry& reg = registry();
+      std::lock_guard<std::mutex> lock(reg.mutex);
+      for (size_t op = 0; op < kLatencyOpCount; ++op) {
+          addTo(reg.exited[op], *m_histograms, static_cast<LatencyOp>(op));
+      }
+      reg.live.erase(std::remove(reg.live.begin(), reg.live.end(), m_histograms.get()), reg.live.end());
+  }
+
+ private:
+
+  std::unique_ptr<ThreadHistograms> m_histograms;
+
+};
+
+thread_local LatencyRecorder::ThreadSlot LatencyRecorder::s_slot;
+
+// Never destroyed, so threads that exit during static destruction can still check out
+LatencyRecorder::Registry& LatencyRecorder::registry() {
+    static Registry* instance = new Registry;
+    return *instance;
+}
+
+void LatencyRecorder::addTo(LatencyHistogram& histogram, const ThreadHistograms& thread, LatencyOp op) {
+    const ThreadHistograms::Op& source = thread.ops[static_cast<size_t>(op)];
+    LatencyHistogram snapshot;
+    for (size_t i = 0; i < LatencyHistogram::kBucketCount; ++i) {
+        snapshot.m_counts[i] = source.counts[i].load(std::memory_order_relaxed);
+    }
+    snapshot.m_total = source.total.load(std::memory_order_relaxed);
+    snapshot.m_sum = source.sum.load(std::memory_order_relaxed);
+    snapshot.m_min = source.min.load(std::memory_order_relaxed);
+    snapshot.m_max = source.max.load(std::memory_order_relaxed);
+    histogram.merge(snapshot);
+}
+
+void LatencyRecorder::record(LatencyOp op, uint64_t ns) noexcept {
+    ThreadHistograms::Op& histogram = s_slot.get().ops[static_cast<size_t>(op)];
+    bump(histogram.counts[LatencyHistogram::bucketIndex(ns)], 1);
+    bump(histogram.total, 1);
+    bump(histogram.sum, ns);
+    if (ns < histogram.min.load(std::memory_order_relaxed)) {
+        histogram.min.store(ns, std::memory_order_relaxed);
+    }
+    if (ns > histogram.max.load(std::memory_order_relaxed)) {
+        histogram.max.store(ns, std::memory_order_relaxed);
+    }
+}
+
+LatencyHistogram LatencyRecorder::threadHistogram(LatencyOp op) {
+    LatencyHistogram histogram;
+    if (const ThreadHistograms* mine = s_slot.peek()) {
+        addTo(histogram, *mine, op);
+    }
+    return histogram;
+}
+
+LatencyHistogram LatencyRecorder::collect(LatencyOp op) {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    LatencyHistogram histogram = reg.exited[static_cast<size_t>(op)];
+    for (const ThreadHistograms* thread : reg.live) {
+        addTo(histogram, *thread, op);
+    }
+    return histogram;
+}
+
+void LatencyRecorder::reset() {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (LatencyHistogram& histogram : reg.exited) {
+        histogram.reset();
+    }
+    for (ThreadHistograms* thread : reg.live) {
+        thread->clear();
+    }
+}
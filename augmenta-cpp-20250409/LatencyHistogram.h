@@ -0,0 +1,177 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #include <intrin.h>
+    #define ORDERCACHE_HAS_TSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define ORDERCACHE_HAS_TSC 1
+#else
+    #define ORDERCACHE_HAS_TSC 0
+#endif
+
+// Cheap timestamps: the CPU's time-stamp counter on x86 (about 20 cycles to read, no
+// syscall), steady_clock nanoseconds elsewhere. The tick rate is calibrated against
+// steady_clock on first use, which busy-waits for about 10 ms; call calibrate() up front
+// to keep that out of a measurement. Assumes an invariant TSC, as on every x86 CPU of
+// the last decade.
+class TscClock
+{
+ public:
+
+  static uint64_t now() noexcept {
+#if ORDERCACHE_HAS_TSC
+      return __rdtsc();
+#else
+      return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+  }
+
+  // Measure the tick rate; later calls return the first result
+  static double calibrate() noexcept;
+
+  static double nanosPerTick() noexcept { return calibrate(); }
+
+  static uint64_t toNanos(uint64_t ticks) noexcept {
+      return static_cast<uint64_t>(static_cast<double>(ticks) * nanosPerTick());
+  }
+};
+
+// Latency histogram in the style of HdrHistogram: values in nanoseconds, exact below 256 ns
+// and above that in buckets 1/128 of their magnitude wide, so any value read back is
+// within 0.8% of what was recorded. Values from 2^40 ns (about 18 minutes) up share the top
+// bucket. The bucket layout is fixed, so histograms from different threads or runs merge
+// by adding counts.
+class LatencyHistogram
+{
+ public:
+
+  static constexpr unsigned kSubBucketBits = 7;
+  static constexpr uint64_t kMaxTrackable = (uint64_t{1} << 40) - 1;
+  static constexpr size_t kBucketCount = 256 + 32 * 128;
+
+  static size_t bucketIndex(uint64_t ns) noexcept;
+  static uint64_t bucketLowest(size_t index) noexcept;
+  static uint64_t bucketHighest(size_t index) noexcept;
+
+  LatencyHistogram() : m_counts(kBucketCount) {}
+
+  void record(uint64_t ns, uint64_t count = 1) noexcept;
+
+  // Add every value recorded in `other`
+  void merge(const LatencyHistogram& other) noexcept;
+
+  void reset() noexcept;
+
+  uint64_t count() const noexcept { return m_total; }
+  uint64_t min() const noexcept { return m_total ? m_min : 0; }
+  uint64_t max() const noexcept { return m_max; }
+  double mean() const noexcept { return m_total ? static_cast<double>(m_sum) / m_total : 0; }
+  uint64_t countAt(size_t index) const noexcept { return m_counts[index]; }
+
+  // Smallest recorded value, to bucket precision, that `percentile` (0..100) percent of the
+  // values do not exceed. 100 gives the exact maximum.
+  uint64_t valueAtPercentile(double percentile) const noexcept;
+
+  // The distribution in HdrHistogram's percentile format (.hgrm), readable by its plotting
+  // tools; values are nanoseconds
+  void writePercentiles(std::ostream& out, unsigned ticksPerHalfDistance = 5) const;
+
+ private:
+
+  std::vector<uint64_t> m_counts;
+  uint64_t m_total = 0;
+  uint64_t m_sum = 0;
+  uint64_t m_min = UINT64_MAX;
+  uint64_t m_max = 0;
+
+  friend class LatencyRecorder;
+
+};
+
+// The interface calls the cache records latencies for
+enum class LatencyOp : uint8_t { Add, Cancel, CancelUser, CancelSecurity, Match, GetAll };
+
+constexpr size_t kLatencyOpCount = 6;
+
+// Interface method name of an op, e.g. "cancelOrdersForUser"
+const char* latencyOpName(LatencyOp op) noexcept;
+
+// Latency histograms per interface call, kept per thread. Recording touches only the
+// calling thread's histograms, with relaxed atomic stores and no locks, so collect() may
+// run on any thread while others record (a reset() meanwhile may miss their calls in
+// flight). Histograms of threads that exit are folded into a shared total.
+//
+// A cache compiled with ORDERCACHE_LATENCY (CMake option) records every public interface
+// call here; calls a cache makes to itself, like the cancels of
+// cancelOrdersForSecIdWithMinimumQty, are part of the outer call.
+class LatencyRecorder
+{
+ public:
+
+  static constexpr bool kCacheInstrumented =
+#ifdef ORDERCACHE_LATENCY
+      true;
+#else
+      false;
+#endif
+
+  // Add one call of `op` that took `ns` to this thread's histogram
+  static void record(LatencyOp op, uint64_t ns) noexcept;
+
+  // This thread's histogram of `op`
+  static LatencyHistogram threadHistogram(LatencyOp op);
+
+  // Every thread's histogram of `op` merged, including threads that have exited
+  static LatencyHistogram collect(LatencyOp op);
+
+  // Clear every thread's histograms and the exited threads' total
+  static void reset();
+
+ private:
+
+  struct ThreadHistograms;
+  struct Registry;
+  class ThreadSlot;
+
+  static Registry& registry();
+  static void addTo(LatencyHistogram& histogram, const ThreadHistograms& thread, LatencyOp op);
+
+  static thread_local ThreadSlot s_slot;
+};
+
+// Times its own lifetime with TscClock and records it under `op`. Only the outermost
+// scope on a thread records, so nested interface calls are not counted twice.
+class LatencyScope
+{
+ public:
+
+  explicit LatencyScope(LatencyOp op) noexcept
+      : m_op(op), m_outermost(s_depth++ == 0), m_start(m_outermost ? TscClock::now() : 0) {}
+
+  LatencyScope(const LatencyScope&) = delete;
+  LatencyScope& operator=(const LatencyScope&) = delete;
+
+  ~LatencyScope() {
+      if (m_outermost) {
+          LatencyRecorder::record(m_op, TscClock::toNanos(TscClock::now() - m_start));
+      }
+      --s_depth;
+  }
+
+ private:
+
+  static inline thread_local unsigned s_depth = 0;
+
+  LatencyOp m_op;
+  bool m_outermost;
+  uint64_t m_start;
+
+};
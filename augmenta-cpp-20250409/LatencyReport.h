@@ -0,0 +1,44 @@
+#pragma once
+
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// One line of the benchmark tools' output: call count, throughput over `seconds` and
+// latency percentiles. Sorts `latencies` in place; prints nothing if there are none.
+inline void printLatencies(const char* name, std::vector<uint64_t>& latencies, double seconds) {
+    if (latencies.empty()) {
+        return;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto pct = [&](double p) { return latencies[static_cast<size_t>(p * (latencies.size() - 1))]; };
+    std::printf("  %-36s %8zu calls %12.0f ops/s   p50 %9llu ns   p99 %9llu ns   p99.9 %10llu ns   max %11llu ns\n",
+                name, latencies.size(), latencies.size() / seconds,
+                static_cast<unsigned long long>(pct(0.50)), static_cast<unsigned long long>(pct(0.99)),
+                static_cast<unsigned long long>(pct(0.999)), static_cast<unsigned long long>(latencies.back()));
+}
+
+// Sum of the latencies, in seconds: the time spent inside one kind of call
+inline double totalSeconds(const std::vector<uint64_t>& latencies) {
+    double seconds = 0;
+    for (uint64_t ns : latencies) {
+        seconds += ns * 1e-9;
+    }
+    return seconds;
+}
+
+// The same line from a histogram, whose percentiles are within its bucket precision
+inline void printHistogram(const char* name, const LatencyHistogram& histogram, double seconds) {
+    if (histogram.count() == 0) {
+        return;
+    }
+    std::printf("  %-36s %8llu calls %12.0f ops/s   p50 %9llu ns   p99 %9llu ns   p99.9 %10llu ns   max %11llu ns\n",
+                name, static_cast<unsigned long long>(histogram.count()), histogram.count() / seconds,
+                static_cast<unsigned long long>(histogram.valueAtPercentile(50)),
+                static_cast<unsigned long long>(histogram.valueAtPercentile(99)),
+                static_cast<unsigned long long>(histogram.valueAtPercentile(99.9)),
+                static_cast<unsigned long long>(histogram.max()));
+}
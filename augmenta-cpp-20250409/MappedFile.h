@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #define ORDERCACHE_HAS_MMAP 1
+#else
+    #include <fstream>
+    #include <iterator>
+    #define ORDERCACHE_HAS_MMAP 0
+#endif
+
+// Read-only view of a whole file. Maps it where mmap is available so the kernel pages
+// it in at disk speed; elsewhere falls back to reading it into memory.
+class MappedFile
+{
+ public:
+
+  MappedFile() = default;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() { close(); }
+
+  bool open(const std::string& path) {
+      close();
+#if ORDERCACHE_HAS_MMAP
+      const int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+          return false;
+      }
+
+      struct stat st {};
+      if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+          ::close(fd);
+          return false;
+      }
+
+      void* addr = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd); // The mapping keeps the file referenced
+      if (addr == MAP_FAILED) {
+          return false;
+      }
+
+      ::madvise(addr, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+      m_data = static_cast<const char*>(addr);
+      m_size = static_cast<size_t>(st.st_size);
+#else
+      std::ifstream in(path, std::ios::binary);
+      if (!in) {
+          return false;
+      }
+      m_buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+      if (m_buffer.empty()) {
+          return false;
+      }
+      m_data = m_buffer.data();
+      m_size = m_buffer.size();
+#endif
+      return true;
+  }
+
+  void close() {
+#if ORDERCACHE_HAS_MMAP
+      if (m_data != nullptr) {
+          ::munmap(const_cast<char*>(m_data), m_size);
+      }
+#else
+      m_buffer.clear();
+#endif
+      m_data = nullptr;
+      m_size = 0;
+  }
+
+  const char* data() const noexcept { return m_data; }
+  size_t size() const noexcept { return m_size; }
+
+ private:
+
+  const char* m_data = nullptr;
+  size_t m_size = 0;
+#if !ORDERCACHE_HAS_MMAP
+  std::vector<char> m_buffer;
+#endif
+
+};
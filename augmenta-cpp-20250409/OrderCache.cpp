@@ -1,8 +1,19 @@
 // Implementation of the OrderCache class
 #include "OrderCache.h"
+#include "FlightRecorder.h"
+#include "LatencyHistogram.h"
+#include "OrderJournal.h"
+#include "OrderReplication.h"
+#include "SpanTrace.h"
 #include <algorithm>
 #include <stdexcept>
 
+#ifdef __linux__
+    #include <sys/wait.h>
+    #include <unistd.h>
+    #include <cerrno>
+#endif
+
 // Prefetch hint for better cache performance
 #ifdef _MSC_VER
     #include <intrin.h>
@@ -22,7 +33,46 @@
     #define FORCE_INLINE inline
 #endif
 
+// Hot-path counters (see OrderCacheStats), compiled out unless ORDERCACHE_STATS is defined
+#ifdef ORDERCACHE_STATS
+    #define STATS_ADD(counter, n) (m_stats.counter += (n))
+    #define STATS_ONLY(...) __VA_ARGS__
+#else
+    #define STATS_ADD(counter, n) ((void)0)
+    #define STATS_ONLY(...)
+#endif
+
+// Per-call latency histograms (see LatencyRecorder), compiled out unless ORDERCACHE_LATENCY is defined
+#ifdef ORDERCACHE_LATENCY
+    #define LATENCY_SCOPE(op) LatencyScope latencyScope(LatencyOp::op)
+#else
+    #define LATENCY_SCOPE(op)
+#endif
+
+// Flight recorder of recent calls (see FlightRecorder), compiled out unless ORDERCACHE_FLIGHT_RECORDER is defined
+#ifdef ORDERCACHE_FLIGHT_RECORDER
+    #define FLIGHT_SCOPE(op, key) FlightScope flightScope(LatencyOp::op, key, m_version, m_flightActive)
+    #define FLIGHT_RESULT(result) flightScope.setResult(result)
+#else
+    #define FLIGHT_SCOPE(op, key)
+    #define FLIGHT_RESULT(result)
+#endif
+
+#ifdef ORDERCACHE_STATS
+namespace {
+
+// Entries in the bucket a lookup of `key` searches
+template <typename Map, typename Key>
+size_t bucketEntries(const Map& map, const Key& key) {
+    return map.bucket_count() == 0 ? 0 : map.bucket_size(map.bucket(key));
+}
+
+} // namespace
+#endif
+
 void OrderCache::addOrder(Order order) {
+    LATENCY_SCOPE(Add);
+    TRACE_SPAN("addOrder");
     // Fast validation first - exit early on invalid data
     const std::string& orderId = order.orderId();
     const std::string& securityId = order.securityId();  
@@ -30,15 +80,20 @@ void OrderCache::addOrder(Order order) {
     const std::string& user = order.user();
     const std::string& company = order.company();
     const unsigned int qty = order.qty();
+    FLIGHT_SCOPE(Add, orderId);
+    STATS_ADD(addCalls, 1);
     
     // Quick validation checks using bitwise operations where possible
     if (orderId.empty() | securityId.empty() | user.empty() | company.empty() | (qty == 0)) {
+        STATS_ONLY(++(orderId.empty() || securityId.empty() || user.empty() || company.empty()
+                       ? m_stats.rejectedEmptyField : m_stats.rejectedZeroQty));
         return;
     }
     
     // Ultra-fast side validation using branch-free comparison
     const size_t sideLen = side.size();
     if ((sideLen != 3) & (sideLen != 4)) {
+        STATS_ADD(rejectedBadSide, 1);
         return;
     }
     
@@ -46,80 +101,145 @@ void OrderCache::addOrder(Order order) {
     const bool isBuyCandidate = (sideLen == 3) & (side[0] == 'B');
     const bool isSellCandidate = (sideLen == 4) & (side[0] == 'S');
     
-    if (isBuyCandidate) {
-        if (side != "Buy") return;
-    } else if (isSellCandidate) {
-        if (side != "Sell") return;
-    } else {
+    if ((!isBuyCandidate || side != "Buy") && (!isSellCandidate || side != "Sell")) {
+        STATS_ADD(rejectedBadSide, 1);
         return;
     }
     
     // Check for duplicate order ID early
-    if (m_orders.find(orderId) != m_orders.end()) {
-        return;
+    {
+        TRACE_SPAN("lookup");
+        if (!m_imageSecurities.empty()) {
+            faultInImageOrder(orderId);
+        }
+        STATS_ADD(idLookups, 1);
+        STATS_ADD(idProbes, bucketEntries(m_orders, orderId));
+        if (m_orders.find(orderId) != m_orders.end() || isSpilledOrder(orderId)) {
+            STATS_ADD(rejectedDuplicate, 1);
+            return;
+        }
     }
     
     // Acquire order from pool
     InternalOrder* internalOrder = m_pool.acquire(order);
     
     // Insert into main orders map
+    STATS_ONLY(const size_t idBuckets = m_orders.bucket_count();)
     auto orderResult = m_orders.try_emplace(orderId, internalOrder);
+    STATS_ADD(rehashes, m_orders.bucket_count() != idBuckets);
     if (!orderResult.second) {
         return; // Duplicate (shouldn't happen with our check above)
     }
     
     // Optimized indexing - batch allocations and use emplace for better performance
+    touchUser(user);
+    touchSecurity(securityId);
     {
+        STATS_ONLY(const size_t buckets = m_ordersByUser.bucket_count();)
         auto [userIt, inserted] = m_ordersByUser.try_emplace(user);
+        STATS_ADD(rehashes, m_ordersByUser.bucket_count() != buckets);
         if (inserted) {
             userIt->second.reserve(128); // Conservative estimate to reduce reallocations
         }
+        STATS_ADD(indexReallocations, userIt->second.size() == userIt->second.capacity());
         userIt->second.push_back(internalOrder);
     }
     
     {
+        STATS_ONLY(const size_t buckets = m_ordersBySecId.bucket_count();)
         auto [secIt, inserted] = m_ordersBySecId.try_emplace(securityId);
+        STATS_ADD(rehashes, m_ordersBySecId.bucket_count() != buckets);
         if (inserted) {
             secIt->second.reserve(128); // Conservative estimate to reduce reallocations
         }
+        STATS_ADD(indexReallocations, secIt->second.size() == secIt->second.capacity());
         secIt->second.push_back(internalOrder);
     }
+
+    if (m_orderedIndexEnabled) {
+        addToOrderedIndex(internalOrder);
+    }
+
+    recordChange(ChangeType::Add, *internalOrder);
+    afterMutation();
 }
 
 void OrderCache::cancelOrder(const std::string& orderId) {
-    auto it = m_orders.find(orderId);
-    if (it == m_orders.end()) {
-        return; // Order not found
+    LATENCY_SCOPE(Cancel);
+    TRACE_SPAN("cancelOrder");
+    FLIGHT_SCOPE(Cancel, orderId);
+    STATS_ADD(cancelCalls, 1);
+    auto it = m_orders.end();
+    {
+        TRACE_SPAN("lookup");
+        if (!m_imageSecurities.empty()) {
+            faultInImageOrder(orderId);
+        }
+        STATS_ADD(idLookups, 1);
+        STATS_ADD(idProbes, bucketEntries(m_orders, orderId));
+        it = m_orders.find(orderId);
+        if (it == m_orders.end()) {
+            // The order may sit in a spilled book
+            auto spilledIt = m_spilledOrders.empty() ? m_spilledOrders.end() : m_spilledOrders.find(orderId);
+            if (spilledIt == m_spilledOrders.end() || !faultInSecurity(*spilledIt->second)) {
+                return; // Order not found
+            }
+            it = m_orders.find(orderId);
+        }
     }
     
     InternalOrder* orderPtr = it->second;
+    touchUser(orderPtr->user);
+    touchSecurity(orderPtr->securityId);
     
-    // Remove from user index
-    auto userIt = m_ordersByUser.find(orderPtr->user);
-    if (userIt != m_ordersByUser.end()) {
-        auto& userOrders = userIt->second;
-        userOrders.erase(std::remove(userOrders.begin(), userOrders.end(), orderPtr), userOrders.end());
-        if (userOrders.empty()) {
-            m_ordersByUser.erase(userIt);
+    {
+        TRACE_SPAN("index compaction");
+
+        // Remove from user index
+        auto userIt = m_ordersByUser.find(orderPtr->user);
+        if (userIt != m_ordersByUser.end()) {
+            auto& userOrders = userIt->second;
+            STATS_ADD(indexEntriesScanned, userOrders.size());
+            userOrders.erase(std::remove(userOrders.begin(), userOrders.end(), orderPtr), userOrders.end());
+            if (userOrders.empty()) {
+                m_ordersByUser.erase(userIt);
+            }
         }
-    }
-    
-    // Remove from security ID index
-    auto secIt = m_ordersBySecId.find(orderPtr->securityId);
-    if (secIt != m_ordersBySecId.end()) {
-        auto& secOrders = secIt->second;
-        secOrders.erase(std::remove(secOrders.begin(), secOrders.end(), orderPtr), secOrders.end());
-        if (secOrders.empty()) {
-            m_ordersBySecId.erase(secIt);
+        
+        // Remove from security ID index
+        auto secIt = m_ordersBySecId.find(orderPtr->securityId);
+        if (secIt != m_ordersBySecId.end()) {
+            auto& secOrders = secIt->second;
+            STATS_ADD(indexEntriesScanned, secOrders.size());
+            secOrders.erase(std::remove(secOrders.begin(), secOrders.end(), orderPtr), secOrders.end());
+            if (secOrders.empty()) {
+                m_ordersBySecId.erase(secIt);
+            }
         }
     }
     
+    if (m_orderedIndexEnabled) {
+        removeFromOrderedIndex(orderPtr);
+    }
+
+    recordChange(ChangeType::Cancel, *orderPtr);
+
     // Release order back to pool and remove from main map
     m_pool.release(orderPtr);
     m_orders.erase(it);
+
+    afterMutation();
 }
 
 void OrderCache::cancelOrdersForUser(const std::string& user) {
+    LATENCY_SCOPE(CancelUser);
+    TRACE_SPAN("cancelOrdersForUser");
+    FLIGHT_SCOPE(CancelUser, user);
+    STATS_ADD(cancelUserCalls, 1);
+    touchUser(user);
+    if (!m_spilledByUser.empty()) {
+        faultInUser(user);
+    }
     auto userIt = m_ordersByUser.find(user);
     if (userIt == m_ordersByUser.end()) {
         return; // No orders for this user
@@ -132,31 +252,49 @@ void OrderCache::cancelOrdersForUser(const std::string& user) {
     m_ordersByUser.erase(userIt);
     
     // Remove each order from all indices
-    for (InternalOrder* orderPtr : orderPtrs) {
-        // Remove from security ID index
-        auto secIt = m_ordersBySecId.find(orderPtr->securityId);
-        if (secIt != m_ordersBySecId.end()) {
-            auto& secOrders = secIt->second;
-            secOrders.erase(std::remove(secOrders.begin(), secOrders.end(), orderPtr), secOrders.end());
-            if (secOrders.empty()) {
-                m_ordersBySecId.erase(secIt);
+    {
+        TRACE_SPAN("index compaction");
+        for (InternalOrder* orderPtr : orderPtrs) {
+            // Remove from security ID index
+            touchSecurity(orderPtr->securityId);
+            auto secIt = m_ordersBySecId.find(orderPtr->securityId);
+            if (secIt != m_ordersBySecId.end()) {
+                auto& secOrders = secIt->second;
+                STATS_ADD(indexEntriesScanned, secOrders.size());
+                secOrders.erase(std::remove(secOrders.begin(), secOrders.end(), orderPtr), secOrders.end());
+                if (secOrders.empty()) {
+                    m_ordersBySecId.erase(secIt);
+                }
             }
-        }
         
-        // Remove from main orders map
-        m_orders.erase(orderPtr->orderId);
+            if (m_orderedIndexEnabled) {
+                removeFromOrderedIndex(orderPtr);
+            }
+
+            recordChange(ChangeType::Cancel, *orderPtr);
+
+            // Remove from main orders map
+            m_orders.erase(orderPtr->orderId);
         
-        // Release order back to pool
-        m_pool.release(orderPtr);
+            // Release order back to pool
+            m_pool.release(orderPtr);
+        }
     }
+
+    afterMutation();
 }
 
 void OrderCache::cancelOrdersForSecIdWithMinimumQty(const std::string& securityId, unsigned int minQty) {
+    LATENCY_SCOPE(CancelSecurity);
+    TRACE_SPAN("cancelOrdersForSecIdWithMinimumQty");
+    FLIGHT_SCOPE(CancelSecurity, securityId);
+    STATS_ADD(cancelSecurityCalls, 1);
     // Invalid inputs - don't cancel anything
     if (securityId.empty() || minQty == 0) {
         return;
     }
     
+    touchSecurity(securityId);
     auto secIt = m_ordersBySecId.find(securityId);
     if (secIt == m_ordersBySecId.end()) {
         return; // No orders for this security
@@ -164,10 +302,13 @@ void OrderCache::cancelOrdersForSecIdWithMinimumQty(const std::string& securityI
     
     // Collect order pointers to cancel (to avoid iterator invalidation)
     std::vector<InternalOrder*> orderPtrsToCancel;
-    
-    for (InternalOrder* orderPtr : secIt->second) {
-        if (orderPtr->qty >= minQty) {
-            orderPtrsToCancel.push_back(orderPtr);
+    STATS_ADD(indexEntriesScanned, secIt->second.size());
+    {
+        TRACE_SPAN("partition");
+        for (InternalOrder* orderPtr : secIt->second) {
+            if (orderPtr->qty >= minQty) {
+                orderPtrsToCancel.push_back(orderPtr);
+            }
         }
     }
     
@@ -175,13 +316,28 @@ void OrderCache::cancelOrdersForSecIdWithMinimumQty(const std::string& securityI
     for (InternalOrder* orderPtr : orderPtrsToCancel) {
         cancelOrder(orderPtr->orderId);
     }
+    STATS_ONLY(m_stats.cancelCalls -= orderPtrsToCancel.size();) // Not interface calls
 }
 
 unsigned int OrderCache::getMatchingSizeForSecurity(const std::string& securityId) {
+    LATENCY_SCOPE(Match);
+    TRACE_SPAN("getMatchingSizeForSecurity");
+    FLIGHT_SCOPE(Match, securityId);
+    STATS_ADD(matchCalls, 1);
     if (securityId.empty()) {
         return 0;
     }
+
+    // A spilled one-sided book cannot match; its aggregates answer without a fault-in
+    if (!m_spilledSecurities.empty()) {
+        auto spilledIt = m_spilledSecurities.find(securityId);
+        if (spilledIt != m_spilledSecurities.end() &&
+            (spilledIt->second.buyQty == 0 || spilledIt->second.sellQty == 0)) {
+            return 0;
+        }
+    }
     
+    touchSecurity(securityId);
     auto secIt = m_ordersBySecId.find(securityId);
     if (secIt == m_ordersBySecId.end()) {
         return 0; // No orders for this security
@@ -189,6 +345,8 @@ unsigned int OrderCache::getMatchingSizeForSecurity(const std::string& securityI
     
     const auto& orders = secIt->second;
     const size_t orderCount = orders.size();
+    STATS_ADD(matchOrdersScanned, orderCount);
+    STATS_ONLY(m_stats.matchMaxOrdersScanned = std::max<uint64_t>(m_stats.matchMaxOrdersScanned, orderCount));
     
     if (orderCount < 2) {
         return 0; // Need at least 2 orders to match
@@ -206,16 +364,19 @@ unsigned int OrderCache::getMatchingSizeForSecurity(const std::string& securityI
     sellOrders.reserve(orderCount);
     
     // Single pass through orders - no hash lookups needed since we have pointers
-    for (InternalOrder* orderPtr : orders) {
-        // Prefetch next order for better cache performance
-        if (&orderPtr != &orders.back()) {
-            PREFETCH_READ(*((&orderPtr) + 1));
-        }
-        
-        if (orderPtr->isBuy) {
-            buyOrders.emplace_back(orderPtr->qty, &orderPtr->company);
-        } else {
-            sellOrders.emplace_back(orderPtr->qty, &orderPtr->company);
+    {
+        TRACE_SPAN("partition");
+        for (InternalOrder* orderPtr : orders) {
+            // Prefetch next order for better cache performance
+            if (&orderPtr != &orders.back()) {
+                PREFETCH_READ(*((&orderPtr) + 1));
+            }
+            
+            if (orderPtr->isBuy) {
+                buyOrders.emplace_back(orderPtr->qty, &orderPtr->company);
+            } else {
+                sellOrders.emplace_back(orderPtr->qty, &orderPtr->company);
+            }
         }
     }
     
@@ -224,8 +385,11 @@ unsigned int OrderCache::getMatchingSizeForSecurity(const std::string& securityI
     }
     
     // Sort orders by quantity in descending order using parallel sort if available
-    std::sort(buyOrders.rbegin(), buyOrders.rend());
-    std::sort(sellOrders.rbegin(), sellOrders.rend());
+    {
+        TRACE_SPAN("sort");
+        std::sort(buyOrders.rbegin(), buyOrders.rend());
+        std::sort(sellOrders.rbegin(), sellOrders.rend());
+    }
     
     unsigned int totalMatched = 0;
     
@@ -236,12 +400,15 @@ unsigned int OrderCache::getMatchingSizeForSecurity(const std::string& securityI
     // Use raw pointers for maximum speed
     auto* buyPtr = buyOrders.data();
     auto* sellPtr = sellOrders.data();
+    STATS_ONLY(uint64_t pairs = 0;)
+    TRACE_SPAN("match");
     
     for (size_t i = 0; i < buySize; ++i) {
         auto& buyOrder = buyPtr[i];
         if (buyOrder.first == 0) continue;
         
         for (size_t j = 0; j < sellSize; ++j) {
+            STATS_ONLY(++pairs;)
             auto& sellOrder = sellPtr[j];
             if (sellOrder.first == 0) continue;
             
@@ -270,17 +437,274 @@ unsigned int OrderCache::getMatchingSizeForSecurity(const std::string& securityI
             }
         }
     }
+    STATS_ADD(matchPairsExamined, pairs);
+    FLIGHT_RESULT(totalMatched);
     
     return totalMatched;
 }
 
 std::vector<Order> OrderCache::getAllOrders() const {
+    LATENCY_SCOPE(GetAll);
+    TRACE_SPAN("getAllOrders");
+    FLIGHT_SCOPE(GetAll, std::string_view());
+    STATS_ADD(getAllCalls, 1);
     std::vector<Order> allOrders;
     allOrders.reserve(m_orders.size());
     
     for (const auto& pair : m_orders) {
         allOrders.push_back(pair.second->toOrder());
     }
+
+    std::vector<InternalOrder> spilled;
+    for (const auto& entry : m_spilledSecurities) {
+        spilled.clear();
+        readSpilledSecurity(entry.first, spilled);
+        for (const InternalOrder& order : spilled) {
+            allOrders.push_back(order.toOrder());
+        }
+    }
+    for (const auto& entry : m_imageSecurities) {
+        spilled.clear();
+        readImageSecurity(entry.first, spilled);
+        for (const InternalOrder& order : spilled) {
+            allOrders.push_back(order.toOrder());
+        }
+    }
+    FLIGHT_RESULT(allOrders.size());
     
     return allOrders;
 }
+
+namespace {
+
+// Bytes a string keeps on the heap beyond its inline buffer
+size_t stringHeapBytes(const std::string& text) noexcept {
+    static const size_t inlineCapacity = std::string().capacity();
+    return text.capacity() > inlineCapacity ? text.capacity() + 1 : 0;
+}
+
+// Bucket array plus one node (next pointer, cached hash, entry) per entry and heap-held keys
+template <typename Map>
+size_t hashMapBytes(const Map& map) noexcept {
+    size_t bytes = map.bucket_count() * sizeof(void*) +
+                   map.size() * (sizeof(typename Map::value_type) + sizeof(void*) + sizeof(size_t));
+    for (const auto& entry : map) {
+        bytes += stringHeapBytes(entry.first);
+    }
+    return bytes;
+}
+
+} // namespace
+
+OrderCacheMemory OrderCache::memoryUsage() const {
+    OrderCacheMemory memory;
+    memory.orderPool = m_pool.blocks.size() * OrderPool::kBlockSize * sizeof(OrderPool::Slot) +
+                       m_pool.blocks.capacity() * sizeof(void*) + m_pool.freeSlots.capacity() * sizeof(void*);
+    for (size_t slot = 0; slot < m_pool.size(); ++slot) {
+        const InternalOrder* order = m_pool.at(slot);
+        memory.orderStrings += stringHeapBytes(order->orderId) + stringHeapBytes(order->securityId) +
+                               stringHeapBytes(order->side) + stringHeapBytes(order->user) +
+                               stringHeapBytes(order->company);
+    }
+
+    memory.idIndex = hashMapBytes(m_orders);
+    memory.userIndex = hashMapBytes(m_ordersByUser);
+    for (const auto& entry : m_ordersByUser) {
+        memory.userIndex += entry.second.capacity() * sizeof(InternalOrder*);
+    }
+    memory.securityIndex = hashMapBytes(m_ordersBySecId);
+    for (const auto& entry : m_ordersBySecId) {
+        memory.securityIndex += entry.second.capacity() * sizeof(InternalOrder*);
+    }
+
+    // Red-black tree nodes: three links and a colour word next to each value
+    const size_t treeNode = 4 * sizeof(void*);
+    for (const auto& entry : m_orderedIndex) {
+        memory.orderedIndex += treeNode + sizeof(entry) + stringHeapBytes(entry.first) +
+                               (entry.second.buys.size() + entry.second.sells.size()) * (treeNode + sizeof(void*));
+    }
+
+    memory.changeLog = m_changeLog.capacity() * sizeof(ChangeRecord);
+    for (const ChangeRecord& record : m_changeLog) {
+        memory.changeLog += stringHeapBytes(record.orderId) + stringHeapBytes(record.securityId) +
+                            stringHeapBytes(record.user) + stringHeapBytes(record.company);
+    }
+    return memory;
+}
+
+void OrderCache::recordChange(ChangeType type, const InternalOrder& order) {
+    ++m_version;
+    if (m_journal != nullptr) {
+        m_journal->append(type, m_version, order.toView());
+    }
+    if (m_replication != nullptr) {
+        m_replication->append(type, m_version, order.toView());
+    }
+
+    if (m_changeLogCapacity == 0) {
+        return;
+    }
+
+    // Grow the ring lazily until it reaches capacity, then overwrite the oldest slot
+    const size_t slot = static_cast<size_t>(m_version % m_changeLogCapacity);
+    if (m_changeLog.size() <= slot) {
+        m_changeLog.resize(slot + 1);
+    }
+
+    ChangeRecord& record = m_changeLog[slot];
+    record.version = m_version;
+    record.type = type;
+    record.orderId = order.orderId;
+    record.securityId = order.securityId;
+    record.user = order.user;
+    record.company = order.company;
+    record.qty = order.qty;
+    record.isBuy = order.isBuy;
+
+    if (m_changeLogSize < m_changeLogCapacity) {
+        ++m_changeLogSize;
+    }
+}
+
+OrderDelta OrderCache::getChangesSince(uint64_t version) const {
+    OrderDelta delta;
+    delta.fromVersion = version;
+    delta.toVersion = m_version;
+
+    if (version >= m_version) {
+        return delta; // Up to date (or ahead of us) - nothing to send
+    }
+
+    // Oldest version still held by the ring; anything before it needs a full snapshot
+    const uint64_t oldest = m_version - m_changeLogSize + 1;
+    if (version + 1 < oldest) {
+        delta.isFullSnapshot = true;
+        delta.orders = getAllOrders();
+        return delta;
+    }
+
+    delta.changes.reserve(static_cast<size_t>(m_version - version));
+    for (uint64_t v = version + 1; v <= m_version; ++v) {
+        const ChangeRecord& record = m_changeLog[static_cast<size_t>(v % m_changeLogCapacity)];
+        delta.changes.push_back(OrderChange{
+            record.version,
+            record.type,
+            Order{record.orderId, record.securityId, record.isBuy ? "Buy" : "Sell",
+                  record.qty, record.user, record.company}});
+    }
+
+    return delta;
+}
+
+void OrderCache::setChangeLogCapacity(size_t capacity) {
+    m_changeLogCapacity = capacity;
+    m_changeLogSize = 0;
+    m_changeLog.clear();
+    m_changeLog.shrink_to_fit();
+}
+
+void OrderCache::setOrderedIndexEnabled(bool enabled) {
+    m_orderedIndex.clear();
+    m_orderedIndexEnabled = enabled;
+    if (!enabled) {
+        return;
+    }
+
+    // The index holds pointers, so books still in an opened image are built first
+    while (!m_imageSecurities.empty()) {
+        materializeSecurity(std::string(m_imageSecurities.begin()->first));
+    }
+
+    // Bulk build one security at a time so each book's sets stay hot while filling.
+    // Spilled books join the index when they are faulted back in.
+    auto build = [this](const std::string& securityId) {
+        OrderedBook& book = m_orderedIndex[securityId];
+        forEachOrderInSecurity(securityId, [&book](const InternalOrder* order) {
+            (order->isBuy ? book.buys : book.sells).insert(const_cast<InternalOrder*>(order));
+        });
+    };
+    for (const auto& entry : m_ordersBySecId) {
+        build(entry.first);
+    }
+    for (const auto& entry : m_pendingSecurities) {
+        build(entry.first);
+    }
+}
+
+void OrderCache::addToOrderedIndex(InternalOrder* order) {
+    OrderedBook& book = m_orderedIndex[order->securityId];
+    (order->isBuy ? book.buys : book.sells).insert(order);
+}
+
+void OrderCache::removeFromOrderedIndex(InternalOrder* order) {
+    auto it = m_orderedIndex.find(order->securityId);
+    if (it == m_orderedIndex.end()) {
+        return;
+    }
+
+    OrderedBook& book = it->second;
+    (order->isBuy ? book.buys : book.sells).erase(order);
+    if (book.buys.empty() && book.sells.empty()) {
+        m_orderedIndex.erase(it);
+    }
+}
+
+#ifdef __linux__
+pid_t OrderCache::forkSnapshot(const std::function<int(OrderCache&)>& job) {
+    const pid_t pid = ::fork();
+    if (pid != 0) {
+        return pid; // Parent (or -1 on failure) - keep serving
+    }
+
+    // Child: sees the cache frozen at the fork point. _exit skips the parent's atexit
+    // handlers and does not flush stdio buffers inherited from it.
+    // Segment files belong to the parent: the child neither spills nor deletes any
+    m_tieringIdleMutations = 0;
+    m_ownsSegments = false;
+    // So do the journal, the replication stream and checkpoints. The journal's writer
+    // thread does not exist here and may have held its lock at the fork, so the child's
+    // mutations must not reach them.
+    m_journal = nullptr;
+    m_replication = nullptr;
+    m_checkpointEvery = 0;
+    m_checkpointPid = -1;
+
+    int status = 1;
+    try {
+        status = job(*this);
+    } catch (...) {
+        status = 1;
+    }
+    ::_exit(status);
+}
+
+int OrderCache::waitForSnapshot(pid_t pid) {
+    if (pid <= 0) {
+        return -1;
+    }
+
+    int status = 0;
+    while (::waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+#endif
+
+void OrderCache::clearOrders() {
+    m_orders.clear();
+    m_ordersByUser.clear();
+    m_ordersBySecId.clear();
+    m_orderedIndex.clear();
+    m_pendingSecurities.clear();
+    m_pendingUsers.clear();
+    m_snapshotFile.reset();
+    m_imageSecurities.clear();
+    m_imageUsers.clear();
+    m_imagePoolBase.clear();
+    m_imageFile.reset();
+    dropSpilledSecurities();
+    m_pool.clear();
+}
@@ -4,9 +4,20 @@
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
+#include <map>
+#include <set>
 #include <memory>
 #include <array>
 #include <string_view>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+#include <new>
+#include <utility>
+
+#ifdef __linux__
+    #include <sys/types.h>
+#endif
 
 class Order
 {
@@ -79,6 +90,117 @@ class OrderCacheInterface
 
 };
 
+// Kind of mutation recorded in the cache change log
+enum class ChangeType : unsigned char { Add, Cancel };
+
+// One add or cancel, stamped with the cache version it produced
+struct OrderChange {
+    uint64_t version;
+    ChangeType type;
+    Order order;
+};
+
+// Result of OrderCache::getChangesSince()
+struct OrderDelta {
+    uint64_t fromVersion = 0;
+    uint64_t toVersion = 0;
+
+    // Set when the requested version has already left the change log;
+    // `orders` then holds the full book at toVersion and `changes` is empty
+    bool isFullSnapshot = false;
+
+    std::vector<OrderChange> changes;  // in version order
+    std::vector<Order> orders;
+};
+
+// Non-owning view of a cached order, only valid until the next mutation of the cache
+struct OrderView {
+    std::string_view orderId;
+    std::string_view securityId;
+    std::string_view side;
+    unsigned int qty;
+    std::string_view user;
+    std::string_view company;
+
+    Order toOrder() const {
+        return Order{std::string(orderId), std::string(securityId), std::string(side),
+                     qty, std::string(user), std::string(company)};
+    }
+};
+
+// Hot-path counters of OrderCache::getStats(). They are only maintained when the cache is
+// compiled with ORDERCACHE_STATS (CMake option ORDERCACHE_STATS); otherwise the counting
+// code is compiled out and every field stays 0.
+struct OrderCacheStats {
+    static constexpr bool kEnabled =
+#ifdef ORDERCACHE_STATS
+        true;
+#else
+        false;
+#endif
+
+    // Calls of each interface method. Cancels made by cancelOrdersForSecIdWithMinimumQty
+    // are not counted as cancelOrder calls.
+    uint64_t addCalls = 0;
+    uint64_t cancelCalls = 0;
+    uint64_t cancelUserCalls = 0;
+    uint64_t cancelSecurityCalls = 0;
+    uint64_t matchCalls = 0;
+    uint64_t getAllCalls = 0;
+
+    // Adds rejected, by reason
+    uint64_t rejectedEmptyField = 0;
+    uint64_t rejectedZeroQty = 0;
+    uint64_t rejectedBadSide = 0;
+    uint64_t rejectedDuplicate = 0;
+
+    // Matching work: orders read into the buy and sell lists, and (buy, sell) pairs
+    // visited by the matching loop
+    uint64_t matchOrdersScanned = 0;
+    uint64_t matchMaxOrdersScanned = 0;        // largest book of a single call
+    uint64_t matchPairsExamined = 0;
+
+    // Index maintenance: per-user / per-security vectors that had to grow, pointers
+    // scanned to remove cancelled orders from them, and rehashes of the id, user and
+    // security maps
+    uint64_t indexReallocations = 0;
+    uint64_t indexEntriesScanned = 0;
+    uint64_t rehashes = 0;
+
+    // Order id lookups and the entries in the buckets they searched
+    uint64_t idLookups = 0;
+    uint64_t idProbes = 0;
+};
+
+// Heap bytes held by a cache's main structures, as estimated by OrderCache::memoryUsage().
+// Container overhead is modelled on node-based hash maps (one node per entry plus the
+// bucket array); allocator headers and tiering or lazy-load bookkeeping are not counted.
+struct OrderCacheMemory {
+    size_t orderPool = 0;         // pool blocks, including the slots of cancelled orders
+    size_t orderStrings = 0;      // order fields too long for the inline string buffer
+    size_t idIndex = 0;
+    size_t userIndex = 0;
+    size_t securityIndex = 0;
+    size_t orderedIndex = 0;
+    size_t changeLog = 0;
+
+    size_t total() const noexcept {
+        return orderPool + orderStrings + idIndex + userIndex + securityIndex + orderedIndex + changeLog;
+    }
+};
+
+class OrderJournal;
+class ReplicationLeader;
+class MappedFile;
+
+// On-disk snapshot encodings (see SnapshotFormat.h). Fixed-width records keep per-user
+// lists in the file so users can be indexed lazily; Compact is several times smaller and
+// builds user indexes during the load.
+enum class SnapshotEncoding {
+    Fixed,
+    Compact
+};
+
 // Todo: Your implementation of the OrderCache...
 class OrderCache : public OrderCacheInterface
 {
@@ -104,28 +226,136 @@ class OrderCache : public OrderCacheInterface
            , company(order.company())
            , isBuy(side == "Buy")
        {}
+
+       // Bulk-load path: fields are already validated, so skip the Order round trip
+       InternalOrder(std::string_view ordId, std::string_view secId, bool buy, unsigned int quantity,
+                     std::string_view usr, std::string_view comp)
+           : orderId(ordId)
+           , securityId(secId)
+           , side(buy ? "Buy" : "Sell")
+           , qty(quantity)
+           , user(usr)
+           , company(comp)
+           , isBuy(buy)
+       {}
        
        Order toOrder() const {
            return Order{orderId, securityId, side, qty, user, company};
        }
+
+       OrderView toView() const {
+           return OrderView{orderId, securityId, side, qty, user, company};
+       }
+   };
+
+   // Largest qty first, order id breaks ties so iteration order is deterministic
+   struct QtyDescending {
+       bool operator()(const InternalOrder* a, const InternalOrder* b) const noexcept {
+           if (a->qty != b->qty) {
+               return a->qty > b->qty;
+           }
+           return a->orderId < b->orderId;
+       }
    };
 
-   // Simplified memory management - no pool for now to avoid bugs
+   // Per-security entry of the ordered index, one ordered set per side
+   struct OrderedBook {
+       std::set<InternalOrder*, QtyDescending> buys;
+       std::set<InternalOrder*, QtyDescending> sells;
+   };
+
+   // Block arena for orders: records are placement-constructed into fixed-size blocks
+   // that are never moved or reused, so pointers stay stable and a stream of adds only
+   // dirties the tail of the newest block (keeps copy-on-write forks cheap)
    struct OrderPool {
-       std::vector<std::unique_ptr<InternalOrder>> orders;
-       
-       OrderPool() { 
-           orders.reserve(1100000); // Pre-allocate for 1M+ orders
+       static constexpr size_t kBlockSize = 4096;
+       using Slot = std::aligned_storage_t<sizeof(InternalOrder), alignof(InternalOrder)>;
+
+       std::vector<std::unique_ptr<Slot[]>> blocks;
+       size_t used = kBlockSize; // slots taken in the newest block
+       std::vector<InternalOrder*> freeSlots; // recycled slots, each holding an empty order
+
+       OrderPool() {
+           blocks.reserve(1100000 / kBlockSize + 1); // Pre-allocate for 1M+ orders
        }
-       
-       InternalOrder* acquire(const Order& order) {
-           orders.emplace_back(std::make_unique<InternalOrder>(order));
-           return orders.back().get();
+
+       OrderPool(const OrderPool&) = delete;
+       OrderPool& operator=(const OrderPool&) = delete;
+
+       ~OrderPool() { clear(); }
+
+       // Destroy every order and return all blocks
+       void clear() {
+           for (size_t b = 0; b < blocks.size(); ++b) {
+               const size_t count = (b + 1 == blocks.size()) ? used : kBlockSize;
+               for (size_t i = 0; i < count; ++i) {
+                   std::launder(reinterpret_cast<InternalOrder*>(&blocks[b][i]))->~InternalOrder();
+               }
+           }
+           blocks.clear();
+           freeSlots.clear();
+           used = kBlockSize;
        }
-       
+
+       template <typename... Args>
+       InternalOrder* acquire(Args&&... args) {
+           if (!freeSlots.empty()) {
+               InternalOrder* slot = freeSlots.back();
+               freeSlots.pop_back();
+               slot->~InternalOrder();
+               return new (slot) InternalOrder(std::forward<Args>(args)...);
+           }
+           if (used == kBlockSize) {
+               blocks.emplace_back(new Slot[kBlockSize]);
+               used = 0;
+           }
+           return new (&blocks.back()[used++]) InternalOrder(std::forward<Args>(args)...);
+       }
+
        void release(InternalOrder*) {
            // No actual release - memory stays allocated until destruction
        }
+
+       // Free an order's strings and hand its slot to the next acquire(). Only used for
+       // spilled books; cancels keep release() a no-op so adds stay append-only.
+       void recycle(InternalOrder* order) {
+           order->~InternalOrder();
+           new (order) InternalOrder(std::string_view(), std::string_view(), false, 0, std::string_view(),
+                                     std::string_view());
+           freeSlots.push_back(order);
+       }
+
+       // Order in the given slot, counting from the first acquire()
+       InternalOrder* at(size_t slot) const {
+           return std::launder(reinterpret_cast<InternalOrder*>(&blocks[slot / kBlockSize][slot % kBlockSize]));
+       }
+
+       size_t size() const noexcept {
+           return blocks.empty() ? 0 : (blocks.size() - 1) * kBlockSize + used;
+       }
+
+       // Append `count` raw slots for constructAt(), which may be called from several
+       // threads at once. Every slot must be constructed before the pool is used again.
+       void extend(size_t count) {
+           const size_t target = size() + count;
+           while (blocks.size() * kBlockSize < target) {
+               blocks.emplace_back(new Slot[kBlockSize]);
+           }
+           if (count != 0) {
+               used = target - (blocks.size() - 1) * kBlockSize;
+           }
+       }
+
+       template <typename... Args>
+       InternalOrder* constructAt(size_t slot, Args&&... args) {
+           return new (&blocks[slot / kBlockSize][slot % kBlockSize]) InternalOrder(std::forward<Args>(args)...);
+       }
+
+       void swap(OrderPool& other) noexcept {
+           blocks.swap(other.blocks);
+           freeSlots.swap(other.freeSlots);
+           std::swap(used, other.used);
+       }
    };
 
  public:
@@ -142,6 +372,151 @@ class OrderCache : public OrderCacheInterface
 
   std::vector<Order> getAllOrders() const override;
 
+  // Counters since construction or the last resetStats(); all zero unless compiled with
+  // ORDERCACHE_STATS
+  OrderCacheStats getStats() const noexcept {
+#ifdef ORDERCACHE_STATS
+      return m_stats;
+#else
+      return {};
+#endif
+  }
+  void resetStats() noexcept {
+#ifdef ORDERCACHE_STATS
+      m_stats = {};
+#endif
+  }
+
+  // Estimated heap bytes of the order store and indexes. Walks every order, so it costs
+  // about as much as getAllOrders() without the copies.
+  OrderCacheMemory memoryUsage() const;
+
+  // Version of the last mutation; every accepted add and every cancelled order bumps it by one
+  uint64_t getVersion() const noexcept { return m_version; }
+
+  // Return the adds and cancels applied after `version`, or a full snapshot if the
+  // change log no longer reaches back that far
+  OrderDelta getChangesSince(uint64_t version) const;
+
+  // Bound the change log to `capacity` mutations (0 disables it); drops the current log
+  void setChangeLogCapacity(size_t capacity);
+
+  // Maintain orders sorted by (securityId, side, qty descending) on every add and cancel.
+  // Enabling builds the index from the current book; disabling drops it.
+  void setOrderedIndexEnabled(bool enabled);
+  bool isOrderedIndexEnabled() const noexcept { return m_orderedIndexEnabled; }
+
+  // Visit every order by securityId, then Buy before Sell, then descending qty.
+  // Streams straight out of the ordered index when enabled, otherwise sorts a pointer copy.
+  template <typename Visitor>
+  void forEachOrderOrdered(Visitor&& visit) const;
+
+  // Same ordering restricted to one security
+  template <typename Visitor>
+  void forEachOrderOrdered(const std::string& securityId, Visitor&& visit) const;
+
+  // Write the whole cache to `path` in the chosen snapshot encoding (see SnapshotFormat.h).
+  // Data goes to a temporary file that is flushed and then renamed over `path`.
+  bool saveSnapshot(const std::string& path, SnapshotEncoding encoding = SnapshotEncoding::Fixed) const;
+
+  // Replace the cache contents with the snapshot at `path`, in either encoding. The file is
+  // mapped and fully verified before anything is touched, so on failure the cache is left
+  // unchanged. Only the order store, the id index and (for Compact) the user indexes are
+  // built up front; every other index is built the first time an operation touches it.
+  bool loadSnapshot(const std::string& path);
+
+  // Threads used to decode a fixed-width snapshot; 0 (the default) uses one per core.
+  // Small snapshots are always decoded on the calling thread.
+  void setSnapshotLoadThreads(unsigned threads) noexcept { m_snapshotLoadThreads = threads; }
+
+  // Build every secondary index still pending after loadSnapshot()
+  void materializeIndexes();
+
+  // Securities plus users whose index has not been built yet
+  size_t pendingIndexCount() const noexcept {
+      return m_pendingSecurities.size() + m_pendingUsers.size() + m_imageSecurities.size() + m_imageUsers.size();
+  }
+
+  // Mapped images (layout in SnapshotFormat.h): saveImage() writes the cache in a form that
+  // is used in place, with the order id index prebuilt, through a temporary file renamed
+  // over `path`. openImage() replaces the cache contents by mapping such a file and
+  // checking its header; no order is decoded up front. A security's orders are built from
+  // the mapping the first time an operation touches it (looking up an order id touches the
+  // security the id lives in), so reopening takes the same time however many orders the
+  // image holds. With `verifyPayload` the whole file is checksummed first; otherwise
+  // records are only bounds-checked as they are used.
+  bool saveImage(const std::string& path) const;
+  bool openImage(const std::string& path, bool verifyPayload = false);
+
+  // Log every mutation to `journal` from now on (nullptr detaches). The cache does not
+  // own the journal, which must stay open while attached.
+  void attachJournal(OrderJournal* journal) noexcept { m_journal = journal; }
+
+  // Apply the records of the journal at `path` that are newer than getVersion(), in order.
+  // Fails, leaving the cache at the last version before the gap, if the journal skips a
+  // version, e.g. when it was truncated through a newer snapshot than the one loaded.
+  bool replayJournal(const std::string& path);
+
+  // Ship every mutation to `leader` from now on (nullptr detaches); not owned
+  void attachReplication(ReplicationLeader* leader) noexcept { m_replication = leader; }
+
+  // Apply one mutation taken from another cache's stream (journal replay, replication) so
+  // that it ends up with exactly `version`. Only getVersion() + 1 is applied; older
+  // versions are skipped and a newer one (a gap) is refused, both returning false.
+  bool applyChange(ChangeType type, uint64_t version, const OrderView& order);
+
+  // Crash recovery: load the snapshot at `snapshotPath` (start empty if there is none) and
+  // replay the journal on top of it. Attach the live journal only after this returns.
+  bool recover(const std::string& snapshotPath, const std::string& journalPath);
+
+#ifdef __linux__
+  // Fork the process and run `job` in the child against a copy-on-write image of this
+  // cache, e.g. for end-of-day analytics or writing a snapshot. The image is private to
+  // the child, so the job may call non-const methods; in the child they are not journaled,
+  // replicated or checkpointed. The child exits with the job's
+  // return value; the parent returns the child pid (-1 if fork failed) at once and keeps
+  // serving. Call only while no other thread is mutating the cache.
+  pid_t forkSnapshot(const std::function<int(OrderCache&)>& job);
+
+  // Block until a forkSnapshot() child finishes; returns its exit code, or -1 if it failed
+  static int waitForSnapshot(pid_t pid);
+#endif
+
+  // Checkpoint to `snapshotPath` every `everyMutations` mutations (0 disables). On Linux
+  // the snapshot is written by a forked child from a copy-on-write image, so the cache
+  // only pauses for the fork itself; elsewhere it is written inline. Once a snapshot is
+  // on disk, the attached journal drops the records it covers, so recovery replays at
+  // most one interval.
+  void enableCheckpointing(const std::string& snapshotPath, uint64_t everyMutations);
+
+  // Start a checkpoint of the current version now; false if one is already running
+  bool checkpoint();
+
+  // Block until the running checkpoint (if any) is finished; false if it failed
+  bool waitForCheckpoint();
+
+  // Finish the running checkpoint if its child has exited, without blocking; true when no
+  // checkpoint is running any more. Mutations poll every few dozen; a cache that goes idle
+  // should call this now and then (e.g. from a timer on its owner thread) so the journal
+  // is truncated, retired segments are purged and the child does not linger as a zombie.
+  bool pollCheckpoint();
+
+  // Version covered by the last snapshot that reached disk
+  uint64_t lastCheckpointVersion() const noexcept { return m_lastCheckpointVersion; }
+
+  // Tiered storage: a security whose book goes untouched for more than `idleMutations`
+  // mutations is written to a segment file under `directory` and dropped from memory.
+  // Only its aggregates, order ids and user list stay resident. Any operation on the book
+  // faults it back in; getAllOrders(), ordered iteration and snapshots read spilled books
+  // from disk without faulting them in. An `idleMutations` of 0 disables tiering and
+  // faults every book back in. The directory should be private to this cache.
+  void enableTiering(const std::string& directory, uint64_t idleMutations);
+
+  // Spill every book idle for longer than the tiering interval; returns how many were spilled
+  size_t spillIdleSecurities();
+
+  size_t spilledSecurityCount() const noexcept { return m_spilledSecurities.size(); }
+
  public:
    // Constructor to pre-allocate capacity
    OrderCache() {
@@ -156,6 +531,11 @@ class OrderCache : public OrderCacheInterface
        m_ordersBySecId.max_load_factor(0.7f);
    }
 
+   OrderCache(const OrderCache&) = delete;
+   OrderCache& operator=(const OrderCache&) = delete;
+
+   ~OrderCache();
+
  private:
 
    // Memory pool for efficient allocation
@@ -170,6 +550,191 @@ class OrderCache : public OrderCacheInterface
    // Store order pointers grouped by security ID for efficient matching calculations
    std::unordered_map<std::string, std::vector<InternalOrder*>> m_ordersBySecId;
    
+   // Change log entry - slots are reused so their strings keep their capacity
+   struct ChangeRecord {
+       uint64_t version = 0;
+       ChangeType type = ChangeType::Add;
+       std::string orderId;
+       std::string securityId;
+       std::string user;
+       std::string company;
+       unsigned int qty = 0;
+       bool isBuy = false;
+   };
+
+   // Monotonic mutation counter
+   uint64_t m_version = 0;
+
+#ifdef ORDERCACHE_STATS
+   mutable OrderCacheStats m_stats;   // getAllOrders() is const but counted
+#endif
+#ifdef ORDERCACHE_FLIGHT_RECORDER
+   mutable bool m_flightActive = false; // a call is being recorded (FlightScope)
+#endif
+
+   // Bounded ring of the most recent mutations, version v lives in slot v % capacity
+   std::vector<ChangeRecord> m_changeLog;
+   size_t m_changeLogCapacity = 65536;
+   size_t m_changeLogSize = 0;         // valid entries, capped at m_changeLogCapacity
+
+   void recordChange(ChangeType type, const InternalOrder& order);
+
+   // Write-ahead journal fed from recordChange(), not owned
+   OrderJournal* m_journal = nullptr;
+
+   // Log-shipping leader fed from recordChange(), not owned
+   ReplicationLeader* m_replication = nullptr;
+
+   // Periodic checkpoint state
+   std::string m_checkpointPath;
+   uint64_t m_checkpointEvery = 0;
+   uint64_t m_checkpointStartedVersion = 0;   // version of the last attempt, drives the interval
+   uint64_t m_lastCheckpointVersion = 0;
+#ifdef __linux__
+   pid_t m_checkpointPid = -1;
+   uint64_t m_checkpointPolledVersion = 0;    // version at which mutations last polled the child
+#endif
+
+   // Called at the end of every mutating public method, when the cache is consistent
+   void afterMutation() {
+       if (m_checkpointEvery != 0) {
+           maybeCheckpoint();
+       }
+       if (m_tieringIdleMutations != 0 && m_version >= m_nextSpillScan) {
+           spillIdleSecurities();
+       }
+   }
+   void maybeCheckpoint();
+   bool finishCheckpoint(bool succeeded);
+
+   // Encode the cache in the fixed-width / compact snapshot format
+   std::vector<char> encodeSnapshot() const;
+   std::vector<char> encodeCompactSnapshot() const;
+
+   // Drop every order and index; the version and change log settings are kept
+   void clearOrders();
+
+   // Secondary index ordered by securityId; only populated while enabled
+   std::map<std::string, OrderedBook> m_orderedIndex;
+   bool m_orderedIndexEnabled = false;
+
+   void addToOrderedIndex(InternalOrder* order);
+   void removeFromOrderedIndex(InternalOrder* order);
+
+   template <typename Visitor>
+   static void visitOrdered(std::vector<const InternalOrder*>& orders, Visitor& visit);
+
+   // Secondary indexes not built yet after loadSnapshot(). A pending security owns a run
+   // of consecutive pool slots; a pending user owns a slice of the snapshot's user
+   // entries, which stay readable through m_snapshotFile until the last user is built.
+   struct PendingSecurity {
+       size_t firstSlot;
+       uint32_t count;
+   };
+   struct PendingUser {
+       const char* entries;   // uint32 pool slots, unaligned
+       uint32_t count;
+   };
+   std::unordered_map<std::string, PendingSecurity> m_pendingSecurities;
+   std::unordered_map<std::string, PendingUser> m_pendingUsers;
+   std::shared_ptr<const MappedFile> m_snapshotFile;
+   unsigned m_snapshotLoadThreads = 0;
+
+   // Make sure the index of this security / user exists before it is read or modified
+   void touchSecurity(const std::string& securityId) {
+       if (!m_pendingSecurities.empty() || !m_imageSecurities.empty()) {
+           materializeSecurity(securityId);
+       }
+       if (!m_spilledSecurities.empty()) {
+           faultInSecurity(securityId);
+       }
+       if (m_tieringIdleMutations != 0) {
+           m_securityLastUse[securityId] = m_version;
+       }
+   }
+   void touchUser(const std::string& user) {
+       if (!m_pendingUsers.empty() || !m_imageUsers.empty()) {
+           materializeUser(user);
+       }
+   }
+   void materializeSecurity(const std::string& securityId);
+   void materializeUser(const std::string& user);
+
+   // Result of decoding a snapshot, built off to the side and swapped in only once the
+   // whole file has been accepted. Pool slot i holds the file's i-th order.
+   struct LoadedSnapshot {
+       OrderPool pool;
+       std::unordered_map<std::string, InternalOrder*> orders;
+       std::unordered_map<std::string, std::vector<InternalOrder*>> ordersByUser;
+       std::unordered_map<std::string, PendingSecurity> pendingSecurities;
+       std::unordered_map<std::string, PendingUser> pendingUsers;
+       uint64_t version = 0;
+   };
+   static bool decodeSnapshot(const char* data, size_t size, unsigned threads, LoadedSnapshot& loaded);
+   static bool decodeCompactSnapshot(const char* data, size_t size, LoadedSnapshot& loaded);
+   void installSnapshot(LoadedSnapshot& loaded, std::shared_ptr<const MappedFile> file);
+
+   // State of an opened image. Image securities have no orders built yet, image users no
+   // index; both are keyed to their record index in the file. Once a security is built,
+   // image order i of it lives in pool slot m_imagePoolBase[security] + (i - firstOrder).
+   std::shared_ptr<const MappedFile> m_imageFile;
+   std::unordered_map<std::string, uint32_t> m_imageSecurities;
+   std::unordered_map<std::string, uint32_t> m_imageUsers;
+   std::vector<size_t> m_imagePoolBase;
+
+   void materializeImageSecurity(uint32_t index);
+   void materializeImageUser(const std::string& user, uint32_t index);
+   // Build the security an image order id lives in, so m_orders answers for it
+   void faultInImageOrder(const std::string& orderId);
+   // Decode an unbuilt image security, appending to `orders`; false if it is not one
+   bool readImageSecurity(const std::string& securityId, std::vector<InternalOrder>& orders) const;
+   void releaseImageIfDone();
+
+   // Books moved to disk by tiering. The maps hold what must stay resident: per-security
+   // aggregates, which security each spilled order id lives in (keys point into
+   // m_spilledSecurities) and which spilled securities hold orders of each user.
+   struct SpilledSecurity {
+       std::string segmentPath;
+       uint32_t orderCount = 0;
+       uint64_t buyQty = 0;
+       uint64_t sellQty = 0;
+       std::vector<std::string> users;
+   };
+   std::unordered_map<std::string, SpilledSecurity> m_spilledSecurities;
+   std::unordered_map<std::string, const std::string*> m_spilledOrders;
+   std::unordered_map<std::string, std::vector<const std::string*>> m_spilledByUser;
+
+   std::string m_tieringDirectory;
+   uint64_t m_tieringIdleMutations = 0;
+   uint64_t m_nextSpillScan = 0;
+   std::unordered_map<std::string, uint64_t> m_securityLastUse; // only kept while tiering
+   std::vector<std::string> m_retiredSegments; // faulted-in segments not yet deleted
+   bool m_ownsSegments = true;                 // false in a forkSnapshot() child
+
+   bool spillSecurity(const std::string& securityId);
+   bool faultInSecurity(const std::string& securityId);
+   void faultInUser(const std::string& user);
+   bool isSpilledOrder(const std::string& orderId) const {
+       return !m_spilledOrders.empty() && m_spilledOrders.count(orderId) != 0;
+   }
+   // Decode a spilled book, appending to `orders`; false if the security is not spilled
+   // or its segment cannot be read
+   bool readSpilledSecurity(const std::string& securityId, std::vector<InternalOrder>& orders) const;
+   void dropSpilledSecurities();
+   void retireSegment(std::string path);
+   void purgeRetiredSegments();
+
+   // Visit every order of one security, whether or not its index has been built or its
+   // book spilled
+   template <typename Fn>
+   void forEachOrderInSecurity(const std::string& securityId, Fn&& fn) const;
+
+   // Call fn(securityId, orders) for every book. Spilled books are decoded into
+   // `spilledStorage`, so views into their orders live as long as the caller keeps it.
+   using SpilledStorage = std::vector<std::vector<InternalOrder>>;
+   template <typename Fn>
+   void forEachBook(SpilledStorage& spilledStorage, Fn&& fn) const;
+
    // Cache for string validation to avoid repeated checks
    mutable std::unordered_set<std::string> m_validatedUsers;
    mutable std::unordered_set<std::string> m_validatedCompanies;
@@ -185,3 +750,116 @@ class OrderCache : public OrderCacheInterface
    }
 
 };
+
+template <typename Visitor>
+void OrderCache::forEachOrderOrdered(Visitor&& visit) const {
+    if (m_orderedIndexEnabled && m_spilledSecurities.empty()) {
+        for (const auto& [securityId, book] : m_orderedIndex) {
+            for (const InternalOrder* order : book.buys) visit(order->toView());
+            for (const InternalOrder* order : book.sells) visit(order->toView());
+        }
+        return;
+    }
+
+    // Spilled and unbuilt image books are read into a local copy that lives until the visit is done
+    std::vector<InternalOrder> spilled;
+    for (const auto& entry : m_spilledSecurities) {
+        readSpilledSecurity(entry.first, spilled);
+    }
+    for (const auto& entry : m_imageSecurities) {
+        readImageSecurity(entry.first, spilled);
+    }
+
+    std::vector<const InternalOrder*> orders;
+    orders.reserve(m_orders.size() + spilled.size());
+    for (const auto& entry : m_orders) {
+        orders.push_back(entry.second);
+    }
+    for (const InternalOrder& order : spilled) {
+        orders.push_back(&order);
+    }
+    visitOrdered(orders, visit);
+}
+
+template <typename Visitor>
+void OrderCache::forEachOrderOrdered(const std::string& securityId, Visitor&& visit) const {
+    if (m_orderedIndexEnabled && m_spilledSecurities.count(securityId) == 0) {
+        auto it = m_orderedIndex.find(securityId);
+        if (it != m_orderedIndex.end()) {
+            for (const InternalOrder* order : it->second.buys) visit(order->toView());
+            for (const InternalOrder* order : it->second.sells) visit(order->toView());
+        }
+        return;
+    }
+
+    std::vector<InternalOrder> spilled;
+    std::vector<const InternalOrder*> orders;
+    if (readSpilledSecurity(securityId, spilled) || readImageSecurity(securityId, spilled)) {
+        for (const InternalOrder& order : spilled) orders.push_back(&order);
+    } else {
+        forEachOrderInSecurity(securityId, [&](const InternalOrder* order) { orders.push_back(order); });
+    }
+    visitOrdered(orders, visit);
+}
+
+template <typename Fn>
+void OrderCache::forEachOrderInSecurity(const std::string& securityId, Fn&& fn) const {
+    auto secIt = m_ordersBySecId.find(securityId);
+    if (secIt != m_ordersBySecId.end()) {
+        for (const InternalOrder* order : secIt->second) fn(order);
+        return;
+    }
+    auto pendingIt = m_pendingSecurities.find(securityId);
+    if (pendingIt != m_pendingSecurities.end()) {
+        const PendingSecurity& pending = pendingIt->second;
+        for (size_t slot = pending.firstSlot; slot < pending.firstSlot + pending.count; ++slot) {
+            fn(static_cast<const InternalOrder*>(m_pool.at(slot)));
+        }
+        return;
+    }
+    std::vector<InternalOrder> spilled;
+    if (readSpilledSecurity(securityId, spilled) || readImageSecurity(securityId, spilled)) {
+        for (const InternalOrder& order : spilled) fn(&order);
+    }
+}
+
+template <typename Fn>
+void OrderCache::forEachBook(SpilledStorage& spilledStorage, Fn&& fn) const {
+    std::vector<const InternalOrder*> orders;
+    for (const auto& entry : m_ordersBySecId) {
+        orders.assign(entry.second.begin(), entry.second.end());
+        fn(entry.first, orders);
+    }
+    for (const auto& entry : m_pendingSecurities) {
+        orders.clear();
+        forEachOrderInSecurity(entry.first, [&orders](const InternalOrder* order) { orders.push_back(order); });
+        fn(entry.first, orders);
+    }
+
+    for (const auto& entry : m_spilledSecurities) {
+        spilledStorage.emplace_back();
+        readSpilledSecurity(entry.first, spilledStorage.back());
+        orders.clear();
+        for (const InternalOrder& order : spilledStorage.back()) orders.push_back(&order);
+        fn(entry.first, orders);
+    }
+    for (const auto& entry : m_imageSecurities) {
+        spilledStorage.emplace_back();
+        readImageSecurity(entry.first, spilledStorage.back());
+        orders.clear();
+        for (const InternalOrder& order : spilledStorage.back()) orders.push_back(&order);
+        fn(entry.first, orders);
+    }
+}
+
+template <typename Visitor>
+void OrderCache::visitOrdered(std::vector<const InternalOrder*>& orders, Visitor& visit) {
+    std::sort(orders.begin(), orders.end(), [](const InternalOrder* a, const InternalOrder* b) {
+        if (a->securityId != b->securityId) return a->securityId < b->securityId;
+        if (a->isBuy != b->isBuy) return a->isBuy;
+        return QtyDescending{}(a, b);
+    });
+    for (const InternalOrder* order : orders) {
+        visit(order->toView());
+    }
+}
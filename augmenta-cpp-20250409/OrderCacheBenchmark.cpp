@@ -0,0 +1,338 @@
+// Per-operation throughput and latency of every OrderCacheInterface call.
+//
+//   OrderCacheBenchmark [--ops N] [--trace file] [--chrome-trace file] [bookSize...]
+//
+// For each book size (default 10000 100000 1000000) each operation is first measured on
+// its own against a book of that many uniformly generated orders. Then skewed mixed
+// streams of N operations (default 5000) from WorkloadGenerator run against a book
+// prefilled to that size, with latency reported per operation type. Orders and call
+// arguments are generated, and books are built, before each timed section; only the
+// calls themselves are timed. With --trace, a recorded trace (OrderTrace.h) is replayed
+// at full speed against an empty cache first. In a build with ORDERCACHE_STATS, each
+// mixed stream also prints the cache's hot-path counters; with ORDERCACHE_LATENCY, the
+// latency histograms the cache recorded itself. With ORDERCACHE_SPANS, --chrome-trace
+// writes the last spans of the cache's internal phases as Chrome trace JSON at the end.
+//
+// On Linux, hardware counters (cycles, instructions, cache and branch misses) are read
+// around every timed phase and printed per operation; they include the harness's own two
+// clock reads per call. Where the PMU is not available, as on many VMs, output is
+// timing only.
+#include "BenchmarkOrders.h"
+#include "BenchmarkSupport.h"
+#include "LatencyReport.h"
+#include "OrderCache.h"
+#include "OrderTrace.h"
+#include "PerfCounters.h"
+#include "SpanTrace.h"
+#include "WorkloadGenerator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Matching sweeps run over every security this many times
+constexpr int kMatchingRounds = 10;
+
+void fill(OrderCache& cache, const std::vector<Order>& orders) {
+    for (const auto& order : orders) {
+        cache.addOrder(order);
+    }
+}
+
+uint64_t elapsedNs(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
+
+// Opened once; stays unavailable where the PMU is not exposed
+PerfCounters& perfCounters() {
+    static PerfCounters counters;
+    return counters;
+}
+
+// Time call(i) for i in [0, count) and print throughput, latency percentiles and
+// hardware counts per call
+template <typename Call>
+void measure(const char* name, size_t count, Call&& call) {
+    std::vector<uint64_t> latencies;
+    latencies.reserve(count);
+    perfCounters().start();
+    const auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        call(i);
+        latencies.push_back(elapsedNs(start, std::chrono::steady_clock::now()));
+    }
+    const auto end = std::chrono::steady_clock::now();
+    const PerfReading counts = perfCounters().stop();
+    printLatencies(name, latencies, std::chrono::duration<double>(end - begin).count());
+    printPerfPerOp(counts, count);
+}
+
+void runBookSize(unsigned int bookSize) {
+    const std::vector<Order> orders = generateOrders(bookSize);
+    const std::vector<std::string> securities = names("SecId", kSecurities);
+    const std::vector<std::string> users = names("User", kUsers);
+    std::mt19937 gen(67890);
+
+    std::cout << "book of " << bookSize << " orders" << std::endl;
+
+    {
+        // Moved in, so the timed call does not include copying the order
+        std::vector<Order> incoming = orders;
+        OrderCache cache;
+        measure("addOrder", incoming.size(), [&](size_t i) { cache.addOrder(std::move(incoming[i])); });
+    }
+
+    {
+        OrderCache cache;
+        fill(cache, orders);
+        std::vector<const std::string*> sweep;
+        for (int round = 0; round < kMatchingRounds; ++round) {
+            for (const std::string& securityId : securities) {
+                sweep.push_back(&securityId);
+            }
+        }
+        std::shuffle(sweep.begin(), sweep.end(), gen);
+        measure("getMatchingSizeForSecurity", sweep.size(),
+                [&](size_t i) { sink = sink + cache.getMatchingSizeForSecurity(*sweep[i]); });
+
+        const size_t snapshots = std::max<size_t>(3, std::min<size_t>(100, 10000000 / std::max(bookSize, 1u)));
+        measure("getAllOrders", snapshots, [&](size_t) { sink = sink + cache.getAllOrders().size(); });
+    }
+
+    {
+        OrderCache cache;
+        fill(cache, orders);
+        std::vector<std::string> ids;
+        ids.reserve(orders.size());
+        for (const auto& order : orders) {
+            ids.push_back(order.orderId());
+        }
+        std::shuffle(ids.begin(), ids.end(), gen);
+        measure("cancelOrder", ids.size(), [&](size_t i) { cache.cancelOrder(ids[i]); });
+    }
+
+    {
+        OrderCache cache;
+        fill(cache, orders);
+        std::vector<const std::string*> sweep;
+        for (const std::string& securityId : securities) {
+            sweep.push_back(&securityId);
+        }
+        std::shuffle(sweep.begin(), sweep.end(), gen);
+        std::uniform_int_distribution<int> qtyDist(1, 50);
+        std::vector<unsigned int> minQty(sweep.size());
+        for (unsigned int& qty : minQty) {
+            qty = static_cast<unsigned int>(qtyDist(gen) * 100);
+        }
+        measure("cancelOrdersForSecIdWithMinimumQty", sweep.size(),
+                [&](size_t i) { cache.cancelOrdersForSecIdWithMinimumQty(*sweep[i], minQty[i]); });
+    }
+
+    {
+        OrderCache cache;
+        fill(cache, orders);
+        std::vector<const std::string*> sweep;
+        for (const std::string& user : users) {
+            sweep.push_back(&user);
+        }
+        std::shuffle(sweep.begin(), sweep.end(), gen);
+        measure("cancelOrdersForUser", sweep.size(), [&](size_t i) { cache.cancelOrdersForUser(*sweep[i]); });
+    }
+}
+
+void printStats(const OrderCacheStats& stats) {
+    std::printf("    counters: %llu adds (%llu duplicate, %llu invalid), %llu id lookups, %.2f entries per bucket\n",
+                static_cast<unsigned long long>(stats.addCalls),
+                static_cast<unsigned long long>(stats.rejectedDuplicate),
+                static_cast<unsigned long long>(stats.rejectedEmptyField + stats.rejectedZeroQty + stats.rejectedBadSide),
+                static_cast<unsigned long long>(stats.idLookups),
+                stats.idLookups ? static_cast<double>(stats.idProbes) / stats.idLookups : 0.0);
+    std::printf("    matching: %llu calls, %llu orders read (largest book %llu), %llu pairs\n",
+                static_cast<unsigned long long>(stats.matchCalls),
+                static_cast<unsigned long long>(stats.matchOrdersScanned),
+                static_cast<unsigned long long>(stats.matchMaxOrdersScanned),
+                static_cast<unsigned long long>(stats.matchPairsExamined));
+    std::printf("    indexes: %llu entries scanned by cancels, %llu vector growths, %llu rehashes\n",
+                static_cast<unsigned long long>(stats.indexEntriesScanned),
+                static_cast<unsigned long long>(stats.indexReallocations),
+                static_cast<unsigned long long>(stats.rehashes));
+}
+
+// Mixed streams, all with popular securities and users and mostly small orders
+struct Scenario {
+    const char* name;
+    WorkloadMix mix;
+};
+
+const Scenario kScenarios[] = {
+    {"balanced", {0.40, 0.35, 0.15, 0.0, 0.0, 0.10, 0.0}},
+    // 75% cancels and amends, as in real order flow
+    {"cancel-heavy", {0.20, 0.20, 0.55, 0.005, 0.005, 0.04, 0.0}},
+    {"match-heavy", {0.35, 0.35, 0.0, 0.0, 0.0, 0.30, 0.0}},
+};
+
+const char* const kOpNames[] = {"addOrder", "cancelOrder", "amend (cancel + add)", "cancelOrdersForUser",
+                                "cancelOrdersForSecIdWithMinimumQty", "getMatchingSizeForSecurity",
+                                "getAllOrders"};
+
+void runWorkload(const Scenario& scenario, unsigned int bookSize, size_t numOps) {
+    WorkloadOptions options;
+    options.securitySkew = 1.0;
+    options.userSkew = 0.8;
+    options.qtySkew = 1.0;
+    options.mix = scenario.mix;
+    WorkloadGenerator generator(options);
+
+    OrderCache cache;
+    for (const WorkloadOp& op : generator.generateAdds(bookSize)) {
+        generator.apply(cache, op);
+    }
+    const std::vector<WorkloadOp> ops = generator.generate(numOps);
+    cache.resetStats();
+    LatencyRecorder::reset();
+
+    // Submitted orders are built up front and moved in by the timed call
+    std::vector<Order> submitted;
+    for (const WorkloadOp& op : ops) {
+        if (op.type == WorkloadOpType::Add || op.type == WorkloadOpType::Amend) {
+            submitted.push_back(generator.toOrder(op));
+        }
+    }
+
+    std::vector<std::vector<uint64_t>> latencies(std::size(kOpNames));
+    size_t next = 0;
+    perfCounters().start();
+    const auto begin = std::chrono::steady_clock::now();
+    for (const WorkloadOp& op : ops) {
+        const auto start = std::chrono::steady_clock::now();
+        switch (op.type) {
+        case WorkloadOpType::Add:
+            cache.addOrder(std::move(submitted[next++]));
+            break;
+        case WorkloadOpType::Amend:
+            cache.cancelOrder(generator.orderId(op.order));
+            cache.addOrder(std::move(submitted[next++]));
+            break;
+        case WorkloadOpType::Match:
+            sink = sink + cache.getMatchingSizeForSecurity(generator.securityId(op.security));
+            break;
+        case WorkloadOpType::GetAll:
+            sink = sink + cache.getAllOrders().size();
+            break;
+        default:
+            generator.apply(cache, op);
+            break;
+        }
+        latencies[static_cast<size_t>(op.type)].push_back(elapsedNs(start, std::chrono::steady_clock::now()));
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    const PerfReading counts = perfCounters().stop();
+
+    const OrderCacheStats stats = cache.getStats();
+    std::vector<LatencyHistogram> recorded;
+    for (size_t op = 0; op < kLatencyOpCount; ++op) {
+        recorded.push_back(LatencyRecorder::collect(static_cast<LatencyOp>(op)));
+    }
+
+    std::printf("  %s: %zu ops %12.0f ops/s, %zu orders left\n", scenario.name, ops.size(), ops.size() / seconds,
+                cache.getAllOrders().size());
+    printPerfPerOp(counts, ops.size());
+    for (size_t type = 0; type < latencies.size(); ++type) {
+        printLatencies(kOpNames[type], latencies[type], totalSeconds(latencies[type]));
+    }
+    if (OrderCacheStats::kEnabled) {
+        printStats(stats);
+    }
+    if (LatencyRecorder::kCacheInstrumented) {
+        std::cout << "    as recorded by the cache:" << std::endl;
+        for (size_t op = 0; op < kLatencyOpCount; ++op) {
+            const LatencyHistogram& histogram = recorded[op];
+            printHistogram(latencyOpName(static_cast<LatencyOp>(op)), histogram, histogram.mean() * histogram.count() * 1e-9);
+        }
+    }
+}
+
+bool runTrace(const std::string& path) {
+    OrderTrace trace;
+    if (!trace.load(path)) {
+        std::cerr << path << ": not a readable trace" << std::endl;
+        return false;
+    }
+    OrderCache cache;
+    TraceReplayResult result = trace.replay(cache);
+    std::cout << "trace " << path << ": " << trace.records().size() << " calls, "
+              << result.mismatches << " result mismatches" << std::endl;
+    for (size_t call = 0; call < kTraceCallCount; ++call) {
+        printLatencies(traceCallName(static_cast<TraceCall>(call)), result.latencies[call],
+                       totalSeconds(result.latencies[call]));
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t numOps = 5000;
+    std::string tracePath;
+    std::string chromeTracePath;
+    std::vector<unsigned int> bookSizes;
+    const char* const usage = "OrderCacheBenchmark [--ops N] [--trace file] [--chrome-trace file] [bookSize...]";
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--ops" && i + 1 < argc) {
+            if (!parseCount(argv[++i], numOps)) {
+                return usageError(usage);
+            }
+        } else if (arg == "--trace" && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (arg == "--chrome-trace" && i + 1 < argc) {
+            chromeTracePath = argv[++i];
+        } else {
+            unsigned int bookSize = 0;
+            if (!parseCount(argv[i], bookSize)) {
+                return usageError(usage);
+            }
+            bookSizes.push_back(bookSize);
+        }
+    }
+    if (!tracePath.empty()) {
+        if (!runTrace(tracePath)) {
+            return 1;
+        }
+        if (bookSizes.empty()) {
+            return 0;
+        }
+    }
+    if (bookSizes.empty()) {
+        bookSizes = {10000, 100000, 1000000};
+    }
+    if (!perfCounters().available()) {
+        std::cout << "hardware counters unavailable (" << perfCounters().error() << "), timing only" << std::endl;
+    }
+
+    for (unsigned int bookSize : bookSizes) {
+        runBookSize(bookSize);
+        std::cout << "mixed streams over a book of " << bookSize << " skewed orders" << std::endl;
+        for (const Scenario& scenario : kScenarios) {
+            runWorkload(scenario, bookSize, numOps);
+        }
+    }
+    if (!chromeTracePath.empty()) {
+        if (!SpanTracer::kCacheInstrumented) {
+            std::cerr << "--chrome-trace needs a build with -DORDERCACHE_SPANS=ON" << std::endl;
+        }
+        if (!SpanTracer::writeChromeTrace(chromeTracePath)) {
+            std::cerr << chromeTracePath << ": cannot write" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
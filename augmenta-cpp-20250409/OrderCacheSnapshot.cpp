@@ -0,0 +1,1265 @@
+// Binary snapshot save/load and crash recovery for the OrderCache class
+#include "OrderCache.h"
+#include "AsyncFileWriter.h"
+#include "Crc32.h"
+#include "MappedFile.h"
+#include "OrderJournal.h"
+#include "SnapshotFormat.h"
+#include "SpanTrace.h"
+#include "Varint.h"
+
+#include <charconv>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+#ifdef __linux__
+    #include <sys/wait.h>
+#endif
+#if !defined(__unix__) && !defined(__APPLE__)
+    #include <fstream>
+#endif
+
+namespace {
+
+// Longest order id number the compact encoding splits off; larger ones are stored literally
+constexpr size_t kMaxSuffixDigits = 18;
+constexpr uint64_t kMaxSuffix = 999999999999999999ull;
+
+constexpr uint64_t kCompactBuyFlag = 1;
+constexpr uint64_t kCompactLiteralIdFlag = 2;
+
+size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+template <typename T>
+void putPod(std::vector<char>& buffer, size_t offset, const T& value) {
+    std::memcpy(buffer.data() + offset, &value, sizeof(T));
+}
+
+template <typename T>
+T getPod(const char* data) {
+    T value;
+    std::memcpy(&value, data, sizeof(T));
+    return value;
+}
+
+// Write to "<path>.tmp", flush it to disk and rename it over `path`, so a crash never
+// leaves a half-written snapshot under the real name
+bool writeFileAtomically(const std::string& path, const std::vector<char>& data) {
+    const std::string tmpPath = path + ".tmp";
+#if defined(__unix__) || defined(__APPLE__)
+    const int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    // Chunked writes with several in flight (io_uring where available), then one sync
+    if (!AsyncFileWriter::writeAndSync(fd, data.data(), data.size())) {
+        ::close(fd);
+        ::unlink(tmpPath.c_str());
+        return false;
+    }
+    ::close(fd);
+#else
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out.write(data.data(), static_cast<std::streamsize>(data.size())) || !out.flush()) {
+            return false;
+        }
+    }
+    std::remove(path.c_str()); // rename() does not replace existing files on Windows
+#endif
+    return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+// Snapshots smaller than this many orders per thread are decoded on fewer threads
+constexpr uint64_t kMinOrdersPerLoadThread = 65536;
+
+// Mutations check on a running checkpoint child once per this many, not each paying a
+// waitpid while a large snapshot is written
+constexpr uint64_t kCheckpointPollInterval = 64;
+
+// Run fn(shard) for every shard in [0, shards), one thread each with the calling thread
+// taking shard 0
+template <typename Fn>
+void runShards(unsigned shards, const Fn& fn) {
+    std::vector<std::thread> workers;
+    workers.reserve(shards > 0 ? shards - 1 : 0);
+    for (unsigned shard = 1; shard < shards; ++shard) {
+        workers.emplace_back([&fn, shard] { fn(shard); });
+    }
+    fn(0u);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+// Whether every shard reported success
+bool allShards(unsigned shards, const std::function<bool(unsigned)>& fn) {
+    std::vector<char> ok(shards, 0);
+    runShards(shards, [&](unsigned shard) { ok[shard] = fn(shard) ? 1 : 0; });
+    return std::find(ok.begin(), ok.end(), 0) == ok.end();
+}
+
+// CRC of one contiguous range, with each shard summing its own chunk
+uint32_t parallelCrc(const char* data, size_t size, unsigned shards) {
+    const size_t chunk = (size + shards - 1) / std::max(shards, 1u);
+    if (shards <= 1 || chunk == 0) {
+        return Crc32::compute(data, size);
+    }
+
+    std::vector<uint32_t> crcs(shards, 0);
+    runShards(shards, [&](unsigned shard) {
+        const size_t begin = std::min(size, shard * chunk);
+        crcs[shard] = Crc32::compute(data + begin, std::min(size, begin + chunk) - begin);
+    });
+
+    uint32_t crc = crcs[0];
+    for (unsigned shard = 1; shard < shards; ++shard) {
+        const size_t begin = std::min(size, shard * chunk);
+        crc = Crc32::combine(crc, crcs[shard], std::min(size, begin + chunk) - begin);
+    }
+    return crc;
+}
+
+// Split an order id ending in a canonical decimal number into prefix and number
+bool splitNumericSuffix(std::string_view id, std::string_view& prefix, uint64_t& number) {
+    size_t digits = 0;
+    while (digits < id.size() && id[id.size() - 1 - digits] >= '0' && id[id.size() - 1 - digits] <= '9') {
+        ++digits;
+    }
+    const size_t start = id.size() - digits;
+    if (digits == 0 || digits > kMaxSuffixDigits || (digits > 1 && id[start] == '0')) {
+        return false;
+    }
+
+    prefix = id.substr(0, start);
+    number = 0;
+    for (size_t i = start; i < id.size(); ++i) {
+        number = number * 10 + static_cast<uint64_t>(id[i] - '0');
+    }
+    return true;
+}
+
+// Order id hash of the image id index
+uint64_t imageIdHash(std::string_view id) {
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : id) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Record access into an opened image whose section bounds have been checked
+class ImageView
+{
+ public:
+
+  explicit ImageView(const MappedFile& file)
+      : m_data(file.data()), m_header(getPod<ImageHeader>(file.data())) {}
+
+  const ImageHeader& header() const noexcept { return m_header; }
+
+  ImageSecurity security(uint64_t index) const {
+      return getPod<ImageSecurity>(m_data + m_header.securitiesOffset + index * sizeof(ImageSecurity));
+  }
+  ImageOrder order(uint64_t index) const {
+      return getPod<ImageOrder>(m_data + m_header.ordersOffset + index * sizeof(ImageOrder));
+  }
+  ImageUser user(uint64_t index) const {
+      return getPod<ImageUser>(m_data + m_header.usersOffset + index * sizeof(ImageUser));
+  }
+  uint32_t userEntry(uint64_t index) const {
+      return getPod<uint32_t>(m_data + m_header.userEntriesOffset + index * sizeof(uint32_t));
+  }
+  uint32_t idSlot(uint64_t index) const {
+      return getPod<uint32_t>(m_data + m_header.idIndexOffset + index * sizeof(uint32_t));
+  }
+
+  // A reference outside the string bytes reads as empty
+  std::string_view string(ImageString ref) const {
+      if (ref.offset > m_header.stringsSize || ref.length > m_header.stringsSize - ref.offset) {
+          return {};
+      }
+      return std::string_view(m_data + m_header.stringsOffset + ref.offset, ref.length);
+  }
+
+ private:
+
+  const char* m_data;
+  ImageHeader m_header;
+
+};
+
+} // namespace
+
+std::vector<char> OrderCache::encodeSnapshot() const {
+    // Intern every distinct string once; views point into the pooled orders
+    std::unordered_map<std::string_view, uint32_t> stringIds;
+    std::vector<std::string_view> strings;
+    stringIds.reserve(m_orders.size() + m_ordersByUser.size() + m_ordersBySecId.size() + 128);
+    strings.reserve(stringIds.bucket_count());
+    size_t stringBytes = 0;
+
+    auto intern = [&](const std::string& str) -> uint32_t {
+        auto [it, inserted] = stringIds.try_emplace(str, static_cast<uint32_t>(strings.size()));
+        if (inserted) {
+            strings.push_back(str);
+            stringBytes += sizeof(uint32_t) + str.size();
+        }
+        return it->second;
+    };
+
+    std::vector<SnapshotSecurity> securities;
+    std::vector<SnapshotOrder> orders;
+    securities.reserve(m_ordersBySecId.size() + m_pendingSecurities.size());
+    orders.reserve(m_orders.size());
+
+    // Order indexes per user, keyed by the user's string id, in first-seen order
+    std::unordered_map<uint32_t, std::vector<uint32_t>> userOrders;
+    std::vector<uint32_t> userOrder;
+
+    // Pending securities are read straight from the pool, so saving builds no index.
+    // Spilled books are read from disk into storage that outlives the interned views.
+    SpilledStorage spilledStorage;
+    forEachBook(spilledStorage, [&](const std::string& securityId, const std::vector<const InternalOrder*>& secOrders) {
+        SnapshotSecurity security{intern(securityId), static_cast<uint32_t>(secOrders.size()), 0, 0};
+        for (const InternalOrder* orderPtr : secOrders) {
+            (orderPtr->isBuy ? security.buyQty : security.sellQty) += orderPtr->qty;
+            const uint32_t user = intern(orderPtr->user);
+            auto [userIt, inserted] = userOrders.try_emplace(user);
+            if (inserted) {
+                userOrder.push_back(user);
+            }
+            userIt->second.push_back(static_cast<uint32_t>(orders.size()));
+            orders.push_back(SnapshotOrder{intern(orderPtr->orderId), user, intern(orderPtr->company),
+                                           orderPtr->qty, orderPtr->isBuy ? 1u : 0u});
+        }
+        securities.push_back(security);
+    });
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+    header.formatVersion = kSnapshotFormatVersion;
+    header.headerSize = sizeof(SnapshotHeader);
+    header.cacheVersion = m_version;
+    header.orderCount = orders.size();
+    header.stringCount = strings.size();
+    header.securityCount = securities.size();
+    header.userCount = userOrder.size();
+    header.stringsOffset = sizeof(SnapshotHeader);
+    header.aggregatesOffset = alignUp(header.stringsOffset + stringBytes, 8);
+    header.ordersOffset = header.aggregatesOffset + securities.size() * sizeof(SnapshotSecurity);
+    header.usersOffset = alignUp(header.ordersOffset + orders.size() * sizeof(SnapshotOrder), 8);
+    header.userEntriesOffset = header.usersOffset + userOrder.size() * sizeof(SnapshotUser);
+    header.fileSize = header.userEntriesOffset + orders.size() * sizeof(uint32_t);
+
+    std::vector<char> buffer(header.fileSize, 0);
+
+    size_t offset = header.stringsOffset;
+    for (std::string_view str : strings) {
+        putPod(buffer, offset, static_cast<uint32_t>(str.size()));
+        std::memcpy(buffer.data() + offset + sizeof(uint32_t), str.data(), str.size());
+        offset += sizeof(uint32_t) + str.size();
+    }
+    if (!securities.empty()) {
+        std::memcpy(buffer.data() + header.aggregatesOffset, securities.data(),
+                    securities.size() * sizeof(SnapshotSecurity));
+    }
+    if (!orders.empty()) {
+        std::memcpy(buffer.data() + header.ordersOffset, orders.data(), orders.size() * sizeof(SnapshotOrder));
+    }
+
+    size_t userOffset = header.usersOffset;
+    size_t entryOffset = header.userEntriesOffset;
+    for (uint32_t user : userOrder) {
+        const std::vector<uint32_t>& entries = userOrders[user];
+        putPod(buffer, userOffset, SnapshotUser{user, static_cast<uint32_t>(entries.size())});
+        std::memcpy(buffer.data() + entryOffset, entries.data(), entries.size() * sizeof(uint32_t));
+        userOffset += sizeof(SnapshotUser);
+        entryOffset += entries.size() * sizeof(uint32_t);
+    }
+
+    header.payloadCrc = Crc32::compute(buffer.data() + header.headerSize, buffer.size() - header.headerSize);
+    header.headerCrc = 0;
+    header.headerCrc = Crc32::compute(&header, sizeof(header));
+    putPod(buffer, 0, header);
+
+    return buffer;
+}
+
+std::vector<char> OrderCache::encodeCompactSnapshot() const {
+    std::unordered_map<std::string_view, uint32_t> stringIds;
+    std::vector<std::string_view> strings;
+    stringIds.reserve(m_ordersByUser.size() + m_ordersBySecId.size() + 1024);
+
+    auto intern = [&](std::string_view str) -> uint32_t {
+        auto [it, inserted] = stringIds.try_emplace(str, static_cast<uint32_t>(strings.size()));
+        if (inserted) {
+            strings.push_back(str);
+        }
+        return it->second;
+    };
+
+    // Books go to their own buffer first, since the dictionary is only complete afterwards
+    std::vector<char> books;
+    books.reserve(m_orders.size() * 10 + 64);
+    uint64_t orderCount = 0;
+    uint64_t securityCount = 0;
+    uint64_t previousSuffix = 0;
+    std::unordered_set<uint32_t> users;
+
+    SpilledStorage spilledStorage;
+    forEachBook(spilledStorage, [&](const std::string& securityId, const std::vector<const InternalOrder*>& secOrders) {
+        Varint::append(books, intern(securityId));
+        Varint::append(books, secOrders.size());
+        ++securityCount;
+
+        for (const InternalOrder* orderPtr : secOrders) {
+            std::string_view prefix;
+            uint64_t suffix = 0;
+            const bool split = splitNumericSuffix(orderPtr->orderId, prefix, suffix);
+            Varint::append(books, (orderPtr->isBuy ? kCompactBuyFlag : 0) | (split ? 0 : kCompactLiteralIdFlag));
+            if (split) {
+                Varint::append(books, intern(prefix));
+                Varint::append(books, Varint::zigzag(static_cast<int64_t>(suffix - previousSuffix)));
+                previousSuffix = suffix;
+            } else {
+                Varint::append(books, orderPtr->orderId.size());
+                books.insert(books.end(), orderPtr->orderId.begin(), orderPtr->orderId.end());
+            }
+
+            const uint32_t user = intern(orderPtr->user);
+            users.insert(user);
+            Varint::append(books, user);
+            Varint::append(books, intern(orderPtr->company));
+            Varint::append(books, orderPtr->qty);
+            ++orderCount;
+        }
+    });
+
+    std::vector<char> buffer(sizeof(CompactSnapshotHeader));
+    for (std::string_view str : strings) {
+        Varint::append(buffer, str.size());
+        buffer.insert(buffer.end(), str.begin(), str.end());
+    }
+    buffer.insert(buffer.end(), books.begin(), books.end());
+
+    CompactSnapshotHeader header{};
+    std::memcpy(header.magic, kCompactSnapshotMagic, sizeof(header.magic));
+    header.formatVersion = kCompactSnapshotFormatVersion;
+    header.headerSize = sizeof(CompactSnapshotHeader);
+    header.cacheVersion = m_version;
+    header.orderCount = orderCount;
+    header.stringCount = strings.size();
+    header.securityCount = securityCount;
+    header.userCount = users.size();
+    header.payloadSize = buffer.size() - header.headerSize;
+    header.payloadCrc = Crc32::compute(buffer.data() + header.headerSize, header.payloadSize);
+    header.headerCrc = Crc32::compute(&header, sizeof(header));
+    putPod(buffer, 0, header);
+
+    return buffer;
+}
+
+bool OrderCache::saveSnapshot(const std::string& path, SnapshotEncoding encoding) const {
+    if (path.empty()) {
+        return false;
+    }
+    return writeFileAtomically(path, encoding == SnapshotEncoding::Compact ? encodeCompactSnapshot()
+                                                                          : encodeSnapshot());
+}
+
+bool OrderCache::loadSnapshot(const std::string& path) {
+    auto file = std::make_shared<MappedFile>();
+    if (path.empty() || !file->open(path)) {
+        return false;
+    }
+
+    const unsigned threads = m_snapshotLoadThreads != 0 ? m_snapshotLoadThreads
+                                                        : std::max(1u, std::thread::hardware_concurrency());
+    LoadedSnapshot loaded;
+    if (file->size() >= sizeof(kCompactSnapshotMagic) &&
+        std::memcmp(file->data(), kCompactSnapshotMagic, sizeof(kCompactSnapshotMagic)) == 0) {
+        if (!decodeCompactSnapshot(file->data(), file->size(), loaded)) {
+            return false;
+        }
+    } else if (!decodeSnapshot(file->data(), file->size(), threads, loaded)) {
+        return false;
+    }
+
+    // Pending users read their entries from the mapping
+    installSnapshot(loaded, loaded.pendingUsers.empty() ? nullptr : std::move(file));
+    return true;
+}
+
+void OrderCache::installSnapshot(LoadedSnapshot& loaded, std::shared_ptr<const MappedFile> file) {
+    clearOrders();
+    m_pool.swap(loaded.pool);
+    m_orders.swap(loaded.orders);
+    m_ordersByUser.swap(loaded.ordersByUser);
+    m_pendingSecurities.swap(loaded.pendingSecurities);
+    m_pendingUsers.swap(loaded.pendingUsers);
+    m_snapshotFile = std::move(file);
+
+    // A snapshot starts a new history: older versions are only reachable as a full snapshot
+    m_version = loaded.version;
+    m_changeLogSize = 0;
+    if (m_orderedIndexEnabled) {
+        setOrderedIndexEnabled(true);
+    }
+}
+
+bool OrderCache::decodeSnapshot(const char* data, size_t size, unsigned threads, LoadedSnapshot& loaded) {
+    if (size < sizeof(SnapshotHeader)) {
+        return false;
+    }
+
+    // Header and checksums
+    SnapshotHeader header = getPod<SnapshotHeader>(data);
+    if (std::memcmp(header.magic, kSnapshotMagic, sizeof(header.magic)) != 0 ||
+        header.formatVersion != kSnapshotFormatVersion ||
+        header.headerSize != sizeof(SnapshotHeader) ||
+        header.fileSize != size) {
+        return false;
+    }
+
+    const uint64_t usefulThreads = header.orderCount / kMinOrdersPerLoadThread + 1;
+    const unsigned shards = static_cast<unsigned>(std::max<uint64_t>(1, std::min<uint64_t>(threads, usefulThreads)));
+
+    const uint32_t headerCrc = header.headerCrc;
+    header.headerCrc = 0;
+    if (Crc32::compute(&header, sizeof(header)) != headerCrc ||
+        parallelCrc(data + header.headerSize, size - header.headerSize, shards) != header.payloadCrc) {
+        return false;
+    }
+
+    // Section bounds
+    if (header.stringsOffset != header.headerSize ||
+        header.aggregatesOffset < header.stringsOffset ||
+        header.securityCount > (size - header.aggregatesOffset) / sizeof(SnapshotSecurity) ||
+        header.ordersOffset != header.aggregatesOffset + header.securityCount * sizeof(SnapshotSecurity) ||
+        header.orderCount > (size - header.ordersOffset) / sizeof(SnapshotOrder) ||
+        header.usersOffset < header.ordersOffset + header.orderCount * sizeof(SnapshotOrder) ||
+        header.usersOffset > size ||
+        header.userCount > (size - header.usersOffset) / sizeof(SnapshotUser) ||
+        header.userEntriesOffset != header.usersOffset + header.userCount * sizeof(SnapshotUser) ||
+        header.orderCount > (size - header.userEntriesOffset) / sizeof(uint32_t) ||
+        header.fileSize != header.userEntriesOffset + header.orderCount * sizeof(uint32_t) ||
+        header.stringCount > (header.aggregatesOffset - header.stringsOffset) / sizeof(uint32_t)) {
+        return false;
+    }
+
+    // Intern table - views point straight into the mapping
+    std::vector<std::string_view> strings;
+    strings.reserve(header.stringCount);
+    size_t offset = header.stringsOffset;
+    for (uint64_t i = 0; i < header.stringCount; ++i) {
+        if (header.aggregatesOffset - offset < sizeof(uint32_t)) {
+            return false;
+        }
+        const uint32_t length = getPod<uint32_t>(data + offset);
+        offset += sizeof(uint32_t);
+        if (length == 0 || header.aggregatesOffset - offset < length) {
+            return false;
+        }
+        strings.emplace_back(data + offset, length);
+        offset += length;
+    }
+
+    // Each security's orders are one run of fixed-width records, so securities are the
+    // independently decodable sections. Shards take contiguous runs of about equal size.
+    const char* securityData = data + header.aggregatesOffset;
+    const char* orderData = data + header.ordersOffset;
+    const char* userData = data + header.usersOffset;
+    const char* entryData = data + header.userEntriesOffset;
+    std::vector<uint64_t> securityStart(header.securityCount + 1, 0);
+    for (uint64_t s = 0; s < header.securityCount; ++s) {
+        const auto security = getPod<SnapshotSecurity>(securityData + s * sizeof(SnapshotSecurity));
+        if (security.securityId >= strings.size()) {
+            return false;
+        }
+        securityStart[s + 1] = securityStart[s] + security.orderCount;
+    }
+    if (securityStart.back() != header.orderCount) {
+        return false;
+    }
+
+    std::vector<uint64_t> shardSecurity(shards + 1, header.securityCount);
+    for (unsigned shard = 0; shard < shards; ++shard) {
+        const uint64_t firstOrder = header.orderCount * shard / shards;
+        shardSecurity[shard] = static_cast<uint64_t>(
+            std::lower_bound(securityStart.begin(), securityStart.end() - 1, firstOrder) - securityStart.begin());
+    }
+
+    std::vector<uint64_t> userStart(header.userCount + 1, 0);
+    for (uint64_t u = 0; u < header.userCount; ++u) {
+        const auto user = getPod<SnapshotUser>(userData + u * sizeof(SnapshotUser));
+        if (user.user >= strings.size() || user.orderCount > header.orderCount - userStart[u]) {
+            return false;
+        }
+        userStart[u + 1] = userStart[u] + user.orderCount;
+    }
+    if (userStart.back() != header.orderCount) {
+        return false;
+    }
+
+    // Validate every reference before constructing anything. A user's entries must be
+    // strictly increasing and point at that user's orders; with the total checked above,
+    // that lists every order exactly once.
+    const bool valid = allShards(shards, [&](unsigned shard) {
+        const uint64_t firstOrder = securityStart[shardSecurity[shard]];
+        const uint64_t endOrder = securityStart[shardSecurity[shard + 1]];
+        for (uint64_t i = firstOrder; i < endOrder; ++i) {
+            const auto record = getPod<SnapshotOrder>(orderData + i * sizeof(SnapshotOrder));
+            if (record.orderId >= strings.size() || record.user >= strings.size() ||
+                record.company >= strings.size() || record.qty == 0 || record.isBuy > 1) {
+                return false;
+            }
+        }
+
+        const uint64_t lastUser = header.userCount * (shard + 1) / shards;
+        for (uint64_t u = header.userCount * shard / shards; u < lastUser; ++u) {
+            const uint32_t user = getPod<SnapshotUser>(userData + u * sizeof(SnapshotUser)).user;
+            uint64_t previous = 0;
+            for (uint64_t e = userStart[u]; e < userStart[u + 1]; ++e) {
+                const uint64_t index = getPod<uint32_t>(entryData + e * sizeof(uint32_t));
+                if (index >= header.orderCount || (e != userStart[u] && index <= previous) ||
+                    getPod<SnapshotOrder>(orderData + index * sizeof(SnapshotOrder)).user != user) {
+                    return false;
+                }
+                previous = index;
+            }
+        }
+        return true;
+    });
+    if (!valid) {
+        return false;
+    }
+
+    // Build each shard's orders in place; pool slot i is record i
+    OrderPool& pool = loaded.pool;
+    pool.extend(header.orderCount);
+    runShards(shards, [&](unsigned shard) {
+        for (uint64_t s = shardSecurity[shard]; s < shardSecurity[shard + 1]; ++s) {
+            const auto security = getPod<SnapshotSecurity>(securityData + s * sizeof(SnapshotSecurity));
+            const std::string_view securityId = strings[security.securityId];
+            for (uint64_t i = securityStart[s]; i < securityStart[s + 1]; ++i) {
+                const auto record = getPod<SnapshotOrder>(orderData + i * sizeof(SnapshotOrder));
+                pool.constructAt(i, strings[record.orderId], securityId, record.isBuy != 0, record.qty,
+                                 strings[record.user], strings[record.company]);
+            }
+        }
+    });
+
+    // Merge into the id index in one bulk pass; a duplicate id rejects the file
+    auto& orders = loaded.orders;
+    orders.max_load_factor(0.7f);
+    orders.reserve(header.orderCount);
+    for (uint64_t i = 0; i < header.orderCount; ++i) {
+        InternalOrder* orderPtr = pool.at(i);
+        if (!orders.try_emplace(orderPtr->orderId, orderPtr).second) {
+            return false;
+        }
+    }
+
+    auto& pendingSecurities = loaded.pendingSecurities;
+    pendingSecurities.reserve(header.securityCount);
+    for (uint64_t s = 0; s < header.securityCount; ++s) {
+        const auto security = getPod<SnapshotSecurity>(securityData + s * sizeof(SnapshotSecurity));
+        if (security.orderCount != 0 &&
+            !pendingSecurities.try_emplace(std::string(strings[security.securityId]),
+                                           PendingSecurity{securityStart[s], security.orderCount}).second) {
+            return false;
+        }
+    }
+
+    auto& pendingUsers = loaded.pendingUsers;
+    pendingUsers.reserve(header.userCount);
+    for (uint64_t u = 0; u < header.userCount; ++u) {
+        const auto user = getPod<SnapshotUser>(userData + u * sizeof(SnapshotUser));
+        if (user.orderCount != 0 &&
+            !pendingUsers.try_emplace(std::string(strings[user.user]),
+                                      PendingUser{entryData + userStart[u] * sizeof(uint32_t), user.orderCount}).second) {
+            return false;
+        }
+    }
+
+    loaded.version = header.cacheVersion;
+    return true;
+}
+
+bool OrderCache::decodeCompactSnapshot(const char* data, size_t size, LoadedSnapshot& loaded) {
+    if (size < sizeof(CompactSnapshotHeader)) {
+        return false;
+    }
+
+    CompactSnapshotHeader header = getPod<CompactSnapshotHeader>(data);
+    if (header.formatVersion != kCompactSnapshotFormatVersion ||
+        header.headerSize != sizeof(CompactSnapshotHeader) ||
+        header.payloadSize != size - header.headerSize) {
+        return false;
+    }
+    const uint32_t headerCrc = header.headerCrc;
+    header.headerCrc = 0;
+    if (Crc32::compute(&header, sizeof(header)) != headerCrc ||
+        Crc32::compute(data + header.headerSize, header.payloadSize) != header.payloadCrc) {
+        return false;
+    }
+
+    // Every order, string and book takes at least one byte, which bounds the counts
+    const char* p = data + header.headerSize;
+    const char* const end = data + size;
+    if (header.stringCount > header.payloadSize || header.securityCount > header.payloadSize ||
+        header.orderCount > header.payloadSize || header.userCount > header.stringCount) {
+        return false;
+    }
+
+    std::vector<std::string_view> strings;
+    strings.reserve(header.stringCount);
+    for (uint64_t i = 0; i < header.stringCount; ++i) {
+        uint64_t length = 0;
+        if (!Varint::read(p, end, length) || length > static_cast<uint64_t>(end - p)) {
+            return false;
+        }
+        strings.emplace_back(p, length);
+        p += length;
+    }
+
+    // Decode each order straight into the pool; user lists are collected per dictionary entry
+    OrderPool& pool = loaded.pool;
+    auto& orders = loaded.orders;
+    orders.max_load_factor(0.7f);
+    orders.reserve(header.orderCount);
+    auto& pendingSecurities = loaded.pendingSecurities;
+    pendingSecurities.reserve(header.securityCount);
+    std::vector<std::vector<InternalOrder*>> userOrders(strings.size());
+
+    auto readIndex = [&](uint64_t& index) {
+        return Varint::read(p, end, index) && index < strings.size() && !strings[index].empty();
+    };
+
+    std::string orderId;
+    char digits[24];
+    uint64_t previousSuffix = 0;
+    uint64_t next = 0;
+    for (uint64_t s = 0; s < header.securityCount; ++s) {
+        uint64_t security = 0;
+        uint64_t count = 0;
+        if (!readIndex(security) || !Varint::read(p, end, count) || count > header.orderCount - next) {
+            return false;
+        }
+        const std::string_view securityId = strings[security];
+        if (count != 0 &&
+            !pendingSecurities.try_emplace(std::string(securityId),
+                                           PendingSecurity{next, static_cast<uint32_t>(count)}).second) {
+            return false;
+        }
+
+        for (uint64_t i = 0; i < count; ++i, ++next) {
+            uint64_t flags = 0;
+            if (!Varint::read(p, end, flags) || flags > (kCompactBuyFlag | kCompactLiteralIdFlag)) {
+                return false;
+            }
+
+            std::string_view id;
+            if (flags & kCompactLiteralIdFlag) {
+                uint64_t length = 0;
+                if (!Varint::read(p, end, length) || length == 0 || length > static_cast<uint64_t>(end - p)) {
+                    return false;
+                }
+                id = std::string_view(p, length);
+                p += length;
+            } else {
+                uint64_t prefix = 0;
+                uint64_t delta = 0;
+                if (!Varint::read(p, end, prefix) || prefix >= strings.size() || !Varint::read(p, end, delta)) {
+                    return false;
+                }
+                const uint64_t suffix = previousSuffix + static_cast<uint64_t>(Varint::unzigzag(delta));
+                if (suffix > kMaxSuffix) {
+                    return false;
+                }
+                previousSuffix = suffix;
+                orderId.assign(strings[prefix]);
+                orderId.append(digits, std::to_chars(digits, digits + sizeof(digits), suffix).ptr);
+                id = orderId;
+            }
+
+            uint64_t user = 0;
+            uint64_t company = 0;
+            uint64_t qty = 0;
+            if (!readIndex(user) || !readIndex(company) || !Varint::read(p, end, qty) ||
+                qty == 0 || qty > UINT32_MAX) {
+                return false;
+            }
+
+            InternalOrder* orderPtr = pool.acquire(id, securityId, (flags & kCompactBuyFlag) != 0,
+                                                   static_cast<unsigned int>(qty), strings[user], strings[company]);
+            if (!orders.try_emplace(orderPtr->orderId, orderPtr).second) {
+                return false;
+            }
+            userOrders[user].push_back(orderPtr);
+        }
+    }
+    if (p != end || next != header.orderCount) {
+        return false;
+    }
+
+    auto& ordersByUser = loaded.ordersByUser;
+    ordersByUser.max_load_factor(0.7f);
+    ordersByUser.reserve(header.userCount);
+    for (size_t id = 0; id < userOrders.size(); ++id) {
+        if (!userOrders[id].empty()) {
+            ordersByUser.emplace(std::string(strings[id]), std::move(userOrders[id]));
+        }
+    }
+
+    loaded.version = header.cacheVersion;
+    return true;
+}
+
+bool OrderCache::saveImage(const std::string& path) const {
+    if (path.empty()) {
+        return false;
+    }
+
+    std::unordered_map<std::string_view, ImageString> stringRefs;
+    std::vector<char> stringBytes;
+    stringRefs.reserve(m_orders.size() + m_ordersByUser.size() + m_ordersBySecId.size() + 128);
+
+    auto intern = [&](std::string_view str) -> ImageString {
+        auto [it, inserted] = stringRefs.try_emplace(str, ImageString{static_cast<uint32_t>(stringBytes.size()),
+                                                                      static_cast<uint32_t>(str.size())});
+        if (inserted) {
+            stringBytes.insert(stringBytes.end(), str.begin(), str.end());
+        }
+        return it->second;
+    };
+
+    std::vector<ImageSecurity> securities;
+    std::vector<ImageOrder> orders;
+    securities.reserve(m_ordersBySecId.size() + m_pendingSecurities.size() + m_imageSecurities.size());
+    orders.reserve(m_orders.size());
+
+    // Order indexes per user, keyed by the user's string offset, in first-seen order
+    std::unordered_map<uint32_t, std::vector<uint32_t>> userOrders;
+    std::vector<ImageString> userOrder;
+
+    SpilledStorage spilledStorage;
+    forEachBook(spilledStorage, [&](const std::string& securityId, const std::vector<const InternalOrder*>& secOrders) {
+        ImageSecurity security{intern(securityId), static_cast<uint32_t>(orders.size()),
+                               static_cast<uint32_t>(secOrders.size()), 0, 0};
+        const uint32_t securityIndex = static_cast<uint32_t>(securities.size());
+        for (const InternalOrder* orderPtr : secOrders) {
+            (orderPtr->isBuy ? security.buyQty : security.sellQty) += orderPtr->qty;
+            const ImageString user = intern(orderPtr->user);
+            auto [userIt, inserted] = userOrders.try_emplace(user.offset);
+            if (inserted) {
+                userOrder.push_back(user);
+            }
+            userIt->second.push_back(static_cast<uint32_t>(orders.size()));
+            orders.push_back(ImageOrder{intern(orderPtr->orderId), user, intern(orderPtr->company), orderPtr->qty,
+                                        securityIndex, orderPtr->isBuy ? 1u : 0u, 0});
+        }
+        securities.push_back(security);
+    });
+    if (stringBytes.size() > UINT32_MAX || orders.size() >= UINT32_MAX) {
+        return false;
+    }
+
+    // At most half full, so probes stay short
+    uint64_t idIndexCapacity = 1;
+    while (idIndexCapacity < orders.size() * 2) {
+        idIndexCapacity *= 2;
+    }
+
+    ImageHeader header{};
+    std::memcpy(header.magic, kImageMagic, sizeof(header.magic));
+    header.formatVersion = kImageFormatVersion;
+    header.headerSize = sizeof(ImageHeader);
+    header.cacheVersion = m_version;
+    header.orderCount = orders.size();
+    header.securityCount = securities.size();
+    header.userCount = userOrder.size();
+    header.stringsOffset = sizeof(ImageHeader);
+    header.stringsSize = stringBytes.size();
+    header.securitiesOffset = alignUp(header.stringsOffset + header.stringsSize, 8);
+    header.ordersOffset = header.securitiesOffset + securities.size() * sizeof(ImageSecurity);
+    header.usersOffset = header.ordersOffset + orders.size() * sizeof(ImageOrder);
+    header.userEntriesOffset = header.usersOffset + userOrder.size() * sizeof(ImageUser);
+    header.idIndexOffset = alignUp(header.userEntriesOffset + orders.size() * sizeof(uint32_t), 8);
+    header.idIndexCapacity = idIndexCapacity;
+    header.fileSize = header.idIndexOffset + idIndexCapacity * sizeof(uint32_t);
+
+    std::vector<char> buffer(header.fileSize, 0);
+    if (!stringBytes.empty()) {
+        std::memcpy(buffer.data() + header.stringsOffset, stringBytes.data(), stringBytes.size());
+    }
+    if (!securities.empty()) {
+        std::memcpy(buffer.data() + header.securitiesOffset, securities.data(),
+                    securities.size() * sizeof(ImageSecurity));
+    }
+    if (!orders.empty()) {
+        std::memcpy(buffer.data() + header.ordersOffset, orders.data(), orders.size() * sizeof(ImageOrder));
+    }
+
+    size_t userOffset = header.usersOffset;
+    size_t entryOffset = header.userEntriesOffset;
+    uint32_t firstEntry = 0;
+    for (ImageString user : userOrder) {
+        const std::vector<uint32_t>& entries = userOrders[user.offset];
+        putPod(buffer, userOffset, ImageUser{user, firstEntry, static_cast<uint32_t>(entries.size())});
+        std::memcpy(buffer.data() + entryOffset, entries.data(), entries.size() * sizeof(uint32_t));
+        userOffset += sizeof(ImageUser);
+        entryOffset += entries.size() * sizeof(uint32_t);
+        firstEntry += static_cast<uint32_t>(entries.size());
+    }
+
+    const uint64_t mask = idIndexCapacity - 1;
+    for (size_t i = 0; i < orders.size(); ++i) {
+        const ImageString id = orders[i].orderId;
+        uint64_t slot = imageIdHash(std::string_view(stringBytes.data() + id.offset, id.length)) & mask;
+        while (getPod<uint32_t>(buffer.data() + header.idIndexOffset + slot * sizeof(uint32_t)) != 0) {
+            slot = (slot + 1) & mask;
+        }
+        putPod(buffer, header.idIndexOffset + slot * sizeof(uint32_t), static_cast<uint32_t>(i + 1));
+    }
+
+    header.payloadCrc = Crc32::compute(buffer.data() + header.headerSize, buffer.size() - header.headerSize);
+    header.headerCrc = 0;
+    header.headerCrc = Crc32::compute(&header, sizeof(header));
+    putPod(buffer, 0, header);
+
+    return writeFileAtomically(path, buffer);
+}
+
+bool OrderCache::openImage(const std::string& path, bool verifyPayload) {
+    auto file = std::make_shared<MappedFile>();
+    if (path.empty() || !file->open(path) || file->size() < sizeof(ImageHeader)) {
+        return false;
+    }
+
+    ImageHeader header = getPod<ImageHeader>(file->data());
+    const uint32_t headerCrc = header.headerCrc;
+    header.headerCrc = 0;
+    const uint64_t size = file->size();
+    if (Crc32::compute(&header, sizeof(header)) != headerCrc ||
+        std::memcmp(header.magic, kImageMagic, sizeof(header.magic)) != 0 ||
+        header.formatVersion != kImageFormatVersion || header.headerSize != sizeof(ImageHeader) ||
+        header.fileSize != size) {
+        return false;
+    }
+
+    // Every section must lie inside the file, in order; divisions keep the checks overflow-free
+    if (header.stringsOffset != header.headerSize || header.stringsSize > size - header.stringsOffset ||
+        header.securitiesOffset < header.stringsOffset + header.stringsSize || header.securitiesOffset > size ||
+        header.securityCount > (size - header.securitiesOffset) / sizeof(ImageSecurity) ||
+        header.ordersOffset != header.securitiesOffset + header.securityCount * sizeof(ImageSecurity) ||
+        header.orderCount >= UINT32_MAX || header.orderCount > (size - header.ordersOffset) / sizeof(ImageOrder) ||
+        header.usersOffset != header.ordersOffset + header.orderCount * sizeof(ImageOrder) ||
+        header.userCount > (size - header.usersOffset) / sizeof(ImageUser) ||
+        header.userEntriesOffset != header.usersOffset + header.userCount * sizeof(ImageUser) ||
+        header.orderCount > (size - header.userEntriesOffset) / sizeof(uint32_t) ||
+        header.idIndexOffset < header.userEntriesOffset + header.orderCount * sizeof(uint32_t) ||
+        header.idIndexOffset > size || header.idIndexCapacity == 0 ||
+        (header.idIndexCapacity & (header.idIndexCapacity - 1)) != 0 ||
+        header.idIndexCapacity > (size - header.idIndexOffset) / sizeof(uint32_t) ||
+        header.fileSize != header.idIndexOffset + header.idIndexCapacity * sizeof(uint32_t)) {
+        return false;
+    }
+    if (verifyPayload && Crc32::compute(file->data() + header.headerSize, size - header.headerSize) != header.payloadCrc) {
+        return false;
+    }
+
+    // Only the small per-security and per-user tables are read now. Their ranges must tile
+    // the orders and user entries, which is what makes per-record access safe later.
+    const ImageView image(*file);
+    std::unordered_map<std::string, uint32_t> securities;
+    std::unordered_map<std::string, uint32_t> users;
+    securities.reserve(header.securityCount);
+    users.reserve(header.userCount);
+
+    uint64_t nextOrder = 0;
+    for (uint32_t s = 0; s < header.securityCount; ++s) {
+        const ImageSecurity security = image.security(s);
+        const std::string_view securityId = image.string(security.securityId);
+        if (security.firstOrder != nextOrder || security.orderCount > header.orderCount - nextOrder ||
+            securityId.empty()) {
+            return false;
+        }
+        nextOrder += security.orderCount;
+        if (security.orderCount != 0 && !securities.try_emplace(std::string(securityId), s).second) {
+            return false;
+        }
+    }
+    uint64_t nextEntry = 0;
+    for (uint32_t u = 0; u < header.userCount; ++u) {
+        const ImageUser user = image.user(u);
+        const std::string_view userId = image.string(user.user);
+        if (user.firstEntry != nextEntry || user.orderCount > header.orderCount - nextEntry || userId.empty()) {
+            return false;
+        }
+        nextEntry += user.orderCount;
+        if (user.orderCount != 0 && !users.try_emplace(std::string(userId), u).second) {
+            return false;
+        }
+    }
+    if (nextOrder != header.orderCount || nextEntry != header.orderCount) {
+        return false;
+    }
+
+    clearOrders();
+    m_imageSecurities.swap(securities);
+    m_imageUsers.swap(users);
+    m_imagePoolBase.assign(header.securityCount, SIZE_MAX);
+    m_imageFile = std::move(file);
+    releaseImageIfDone();
+
+    m_version = header.cacheVersion;
+    m_changeLogSize = 0;
+    if (m_orderedIndexEnabled) {
+        setOrderedIndexEnabled(true);
+    }
+    return true;
+}
+
+void OrderCache::materializeImageSecurity(uint32_t index) {
+    // Held locally: building the last pending security releases the member
+    const std::shared_ptr<const MappedFile> file = m_imageFile;
+    if (!file || index >= m_imagePoolBase.size() || m_imagePoolBase[index] != SIZE_MAX) {
+        return;
+    }
+    TRACE_SPAN("materialize");
+    const ImageView image(*file);
+    const ImageSecurity security = image.security(index);
+    const std::string securityId(image.string(security.securityId));
+    auto it = m_imageSecurities.find(securityId);
+    if (it == m_imageSecurities.end() || it->second != index) {
+        return;
+    }
+    m_imageSecurities.erase(it);
+
+    const size_t base = m_pool.size();
+    m_pool.extend(security.orderCount);
+    auto& secOrders = m_ordersBySecId[securityId];
+    secOrders.reserve(secOrders.size() + security.orderCount);
+    for (uint32_t i = 0; i < security.orderCount; ++i) {
+        const ImageOrder record = image.order(security.firstOrder + i);
+        InternalOrder* orderPtr = m_pool.constructAt(base + i, image.string(record.orderId), securityId,
+                                                     record.isBuy != 0, record.qty, image.string(record.user),
+                                                     image.string(record.company));
+        m_orders.try_emplace(orderPtr->orderId, orderPtr);
+        secOrders.push_back(orderPtr);
+        if (m_orderedIndexEnabled) {
+            addToOrderedIndex(orderPtr);
+        }
+    }
+    m_imagePoolBase[index] = base;
+    releaseImageIfDone();
+}
+
+void OrderCache::materializeImageUser(const std::string& user, uint32_t index) {
+    const std::shared_ptr<const MappedFile> file = m_imageFile;
+    if (!file) {
+        return;
+    }
+    TRACE_SPAN("materialize");
+    const ImageView image(*file);
+    const ImageUser record = image.user(index);
+
+    // Collected first: building a security below may rehash m_ordersByUser
+    std::vector<InternalOrder*> orders;
+    orders.reserve(record.orderCount);
+    for (uint32_t e = record.firstEntry; e < record.firstEntry + record.orderCount; ++e) {
+        const uint32_t orderIndex = image.userEntry(e);
+        if (orderIndex >= image.header().orderCount) {
+            continue;
+        }
+        const uint32_t securityIndex = image.order(orderIndex).security;
+        if (securityIndex >= m_imagePoolBase.size()) {
+            continue;
+        }
+        materializeImageSecurity(securityIndex);
+        const ImageSecurity security = image.security(securityIndex);
+        if (m_imagePoolBase[securityIndex] == SIZE_MAX || orderIndex < security.firstOrder ||
+            orderIndex - security.firstOrder >= security.orderCount) {
+            continue;
+        }
+        orders.push_back(m_pool.at(m_imagePoolBase[securityIndex] + (orderIndex - security.firstOrder)));
+    }
+
+    const std::string userId = user; // May refer to the key erased below
+    m_imageUsers.erase(userId);
+    auto& userOrders = m_ordersByUser[userId];
+    userOrders.insert(userOrders.end(), orders.begin(), orders.end());
+    releaseImageIfDone();
+}
+
+void OrderCache::faultInImageOrder(const std::string& orderId) {
+    const std::shared_ptr<const MappedFile> file = m_imageFile;
+    if (!file) {
+        return;
+    }
+    const ImageView image(*file);
+    const uint64_t capacity = image.header().idIndexCapacity;
+    uint64_t slot = imageIdHash(orderId) & (capacity - 1);
+    for (uint64_t probes = 0; probes < capacity; ++probes, slot = (slot + 1) & (capacity - 1)) {
+        const uint32_t entry = image.idSlot(slot);
+        if (entry == 0 || entry > image.header().orderCount) {
+            return;
+        }
+        const ImageOrder record = image.order(entry - 1);
+        if (image.string(record.orderId) == orderId) {
+            materializeImageSecurity(record.security);
+            return;
+        }
+    }
+}
+
+bool OrderCache::readImageSecurity(const std::string& securityId, std::vector<InternalOrder>& orders) const {
+    auto it = m_imageSecurities.find(securityId);
+    if (it == m_imageSecurities.end()) {
+        return false;
+    }
+
+    const ImageView image(*m_imageFile);
+    const ImageSecurity security = image.security(it->second);
+    orders.reserve(orders.size() + security.orderCount);
+    for (uint32_t i = 0; i < security.orderCount; ++i) {
+        const ImageOrder record = image.order(security.firstOrder + i);
+        orders.emplace_back(image.string(record.orderId), securityId, record.isBuy != 0, record.qty,
+                            image.string(record.user), image.string(record.company));
+    }
+    return true;
+}
+
+void OrderCache::releaseImageIfDone() {
+    // Built orders own copies of their strings, so the mapping is only needed while
+    // something is still unbuilt
+    if (m_imageSecurities.empty() && m_imageUsers.empty()) {
+        m_imageFile.reset();
+        m_imagePoolBase.clear();
+        m_imagePoolBase.shrink_to_fit();
+    }
+}
+
+void OrderCache::materializeSecurity(const std::string& securityId) {
+    auto it = m_pendingSecurities.find(securityId);
+    if (it == m_pendingSecurities.end()) {
+        auto imageIt = m_imageSecurities.find(securityId);
+        if (imageIt != m_imageSecurities.end()) {
+            materializeImageSecurity(imageIt->second);
+        }
+        return;
+    }
+
+    // Nothing has touched this security since the load, so its slots are all live
+    TRACE_SPAN("materialize");
+    auto& secOrders = m_ordersBySecId[securityId];
+    secOrders.reserve(it->second.count);
+    for (size_t slot = it->second.firstSlot; slot < it->second.firstSlot + it->second.count; ++slot) {
+        secOrders.push_back(m_pool.at(slot));
+    }
+    m_pendingSecurities.erase(it);
+}
+
+void OrderCache::materializeUser(const std::string& user) {
+    auto it = m_pendingUsers.find(user);
+    if (it == m_pendingUsers.end()) {
+        auto imageIt = m_imageUsers.find(user);
+        if (imageIt != m_imageUsers.end()) {
+            materializeImageUser(user, imageIt->second);
+        }
+        return;
+    }
+
+    TRACE_SPAN("materialize");
+    auto& userOrders = m_ordersByUser[user];
+    userOrders.reserve(it->second.count);
+    for (uint32_t i = 0; i < it->second.count; ++i) {
+        userOrders.push_back(m_pool.at(getPod<uint32_t>(it->second.entries + i * sizeof(uint32_t))));
+    }
+    m_pendingUsers.erase(it);
+
+    // The mapping is only needed for user entries
+    if (m_pendingUsers.empty()) {
+        m_snapshotFile.reset();
+    }
+}
+
+void OrderCache::materializeIndexes() {
+    m_ordersBySecId.reserve(m_ordersBySecId.size() + m_pendingSecurities.size());
+    while (!m_pendingSecurities.empty()) {
+        materializeSecurity(std::string(m_pendingSecurities.begin()->first));
+    }
+    while (!m_imageSecurities.empty()) {
+        materializeSecurity(std::string(m_imageSecurities.begin()->first));
+    }
+    m_ordersByUser.reserve(m_ordersByUser.size() + m_pendingUsers.size() + m_imageUsers.size());
+    while (!m_pendingUsers.empty()) {
+        materializeUser(std::string(m_pendingUsers.begin()->first));
+    }
+    while (!m_imageUsers.empty()) {
+        materializeUser(std::string(m_imageUsers.begin()->first));
+    }
+}
+
+bool OrderCache::replayJournal(const std::string& path) {
+    // Replayed mutations must not be journaled again
+    OrderJournal* journal = m_journal;
+    m_journal = nullptr;
+
+    bool gap = false;
+    const bool ok = OrderJournal::replay(path, [this, &gap](ChangeType type, uint64_t version, const OrderView& order) {
+        if (!applyChange(type, version, order) && version > m_version) {
+            gap = true; // Mutations between the cache and this record are missing
+        }
+    });
+
+    m_journal = journal;
+    return ok && !gap;
+}
+
+bool OrderCache::applyChange(ChangeType type, uint64_t version, const OrderView& order) {
+    if (version <= m_version) {
+        return false; // Already covered, e.g. by the loaded snapshot
+    }
+    if (version != m_version + 1) {
+        return false; // A gap: applying it would skip the mutations in between
+    }
+
+    // Re-stamp so the mutation gets exactly its logged version
+    m_version = version - 1;
+    if (type == ChangeType::Add) {
+        addOrder(order.toOrder());
+    } else {
+        cancelOrder(std::string(order.orderId));
+    }
+    m_version = version;
+    return true;
+}
+
+bool OrderCache::recover(const std::string& snapshotPath, const std::string& journalPath) {
+    std::error_code ec;
+    if (!snapshotPath.empty() && std::filesystem::exists(snapshotPath, ec)) {
+        if (!loadSnapshot(snapshotPath)) {
+            return false;
+        }
+    } else {
+        clearOrders();
+        m_version = 0;
+        m_changeLogSize = 0;
+    }
+
+    // No journal yet simply means nothing happened after the snapshot
+    if (journalPath.empty() || !std::filesystem::exists(journalPath, ec)) {
+        return true;
+    }
+    return replayJournal(journalPath);
+}
+
+OrderCache::~OrderCache() {
+    // Do not leave a checkpoint child behind as a zombie, nor segment files on disk
+    waitForCheckpoint();
+    dropSpilledSecurities();
+    purgeRetiredSegments();
+}
+
+void OrderCache::enableCheckpointing(const std::string& snapshotPath, uint64_t everyMutations) {
+    waitForCheckpoint();
+    m_checkpointPath = snapshotPath;
+    m_checkpointEvery = snapshotPath.empty() ? 0 : everyMutations;
+    m_checkpointStartedVersion = m_version;
+}
+
+bool OrderCache::checkpoint() {
+    if (m_checkpointPath.empty()) {
+        return false;
+    }
+#ifdef __linux__
+    if (m_checkpointPid > 0) {
+        return false;
+    }
+
+    // The fork is the version fence: the child's image is exactly m_version
+    m_checkpointStartedVersion = m_version;
+    m_checkpointPolledVersion = m_version;
+    const std::string path = m_checkpointPath;
+    m_checkpointPid = forkSnapshot([path](OrderCache& image) { return image.saveSnapshot(path) ? 0 : 1; });
+    if (m_checkpointPid < 0) {
+        m_checkpointPid = -1;
+        return finishCheckpoint(false);
+    }
+    return true;
+#else
+    m_checkpointStartedVersion = m_version;
+    return finishCheckpoint(saveSnapshot(m_checkpointPath));
+#endif
+}
+
+bool OrderCache::waitForCheckpoint() {
+#ifdef __linux__
+    if (m_checkpointPid > 0) {
+        const pid_t pid = m_checkpointPid;
+        m_checkpointPid = -1;
+        return finishCheckpoint(waitForSnapshot(pid) == 0);
+    }
+#endif
+    return true;
+}
+
+bool OrderCache::pollCheckpoint() {
+#ifdef __linux__
+    if (m_checkpointPid > 0) {
+        int status = 0;
+        const pid_t reaped = ::waitpid(m_checkpointPid, &status, WNOHANG);
+        if (reaped == 0 || (reaped < 0 && errno == EINTR)) {
+            return false; // Still running
+        }
+        // Any other failure (e.g. ECHILD when SIGCHLD is ignored) loses the child's status:
+        // count the checkpoint as failed so the journal is kept and the next one can start
+        m_checkpointPid = -1;
+        finishCheckpoint(reaped > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+#endif
+    return true;
+}
+
+void OrderCache::maybeCheckpoint() {
+#ifdef __linux__
+    if (m_checkpointPid > 0) {
+        if (m_version - m_checkpointPolledVersion < kCheckpointPollInterval) {
+            return;
+        }
+        m_checkpointPolledVersion = m_version;
+        if (!pollCheckpoint()) {
+            return;
+        }
+    }
+#endif
+    if (m_version - m_checkpointStartedVersion >= m_checkpointEvery) {
+        checkpoint();
+    }
+}
+
+bool OrderCache::finishCheckpoint(bool succeeded) {
+    purgeRetiredSegments(); // The child no longer needs the segments faulted in meanwhile
+    if (!succeeded) {
+        return false; // Keep the whole journal; the next interval tries again
+    }
+
+    m_lastCheckpointVersion = m_checkpointStartedVersion;
+    if (m_journal != nullptr) {
+        m_journal->truncateThrough(m_lastCheckpointVersion);
+    }
+    return true;
+}
@@ -3,9 +3,29 @@
 #include <random>
 #include <chrono>
 #include <iostream>
+#include <thread>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
 #include "OrderCache.h"
+#include "FlightRecorder.h"
+#include "LatencyHistogram.h"
+#include "OrderJournal.h"
+#include "OrderReplication.h"
+#include "OrderSharedBook.h"
+#include "SpanTrace.h"
+#include "OrderTrace.h"
+#include "AsyncFileWriter.h"
+#include "Crc32.h"
+#include "WorkloadGenerator.h"
 #include "gtest/gtest.h"
 
+#ifdef __linux__
+    #include <sys/wait.h>
+#endif
+
 using namespace std::chrono_literals;
 
 // Global flag to indicate test failure
@@ -89,6 +109,17 @@ protected:
         return orders;
     }
 
+    // Canonical, order-independent description of every order in a cache
+    static std::vector<std::string> describeOrders(const OrderCache& orderCache) {
+        std::vector<std::string> rows;
+        for (const auto& order : orderCache.getAllOrders()) {
+            rows.push_back(order.orderId() + "|" + order.securityId() + "|" + order.side() + "|" +
+                           std::to_string(order.qty()) + "|" + order.user() + "|" + order.company());
+        }
+        std::sort(rows.begin(), rows.end());
+        return rows;
+    }
+
     static void SetUpTestCase() {
         const char* BLUE_COLOR = "\033[34m";
         const char* RESET_COLOR = "\033[0m";
@@ -848,6 +879,1243 @@ TEST_F(OrderCacheTest, EdgeCases_GetAllOrders_ResultNotModifiableExternally) {
     ASSERT_EQ(ordersAfter[0].orderId(), "OrdId1");
 }
 
+// DeltaQuery: Every accepted add and cancelled order bumps the version
+TEST_F(OrderCacheTest, DeltaQuery_GetVersion_AdvancesPerMutation) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    ASSERT_EQ(cache.getVersion(), 0);
+    cache.addOrder(Order{"OrdId1", "SecId1", "Buy", 100, "User1", "Company1"});
+    cache.addOrder(Order{"OrdId2", "SecId1", "Sell", 100, "User1", "Company1"});
+    ASSERT_EQ(cache.getVersion(), 2);
+
+    // Rejected adds and no-op cancels leave the version alone
+    cache.addOrder(Order{"OrdId1", "SecId1", "Buy", 100, "User1", "Company1"});
+    cache.addOrder(Order{"OrdId3", "SecId1", "Buy", 0, "User1", "Company1"});
+    cache.cancelOrder("OrdId9");
+    ASSERT_EQ(cache.getVersion(), 2);
+
+    cache.cancelOrdersForUser("User1");
+    ASSERT_EQ(cache.getVersion(), 4);
+}
+
+// DeltaQuery: Changes since a version come back in order with adds and cancels
+TEST_F(OrderCacheTest, DeltaQuery_GetChangesSince_ReturnsAddsAndCancels) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    cache.addOrder(Order{"OrdId1", "SecId1", "Buy", 100, "User1", "Company1"});
+    const uint64_t base = cache.getVersion();
+
+    cache.addOrder(Order{"OrdId2", "SecId2", "Sell", 300, "User2", "Company2"});
+    cache.cancelOrder("OrdId1");
+
+    OrderDelta delta = cache.getChangesSince(base);
+    ASSERT_FALSE(delta.isFullSnapshot);
+    ASSERT_EQ(delta.fromVersion, base);
+    ASSERT_EQ(delta.toVersion, cache.getVersion());
+    ASSERT_EQ(delta.changes.size(), 2);
+
+    ASSERT_EQ(delta.changes[0].type, ChangeType::Add);
+    ASSERT_EQ(delta.changes[0].order.orderId(), "OrdId2");
+    ASSERT_EQ(delta.changes[0].order.side(), "Sell");
+    ASSERT_EQ(delta.changes[0].order.qty(), 300);
+    ASSERT_EQ(delta.changes[1].type, ChangeType::Cancel);
+    ASSERT_EQ(delta.changes[1].order.orderId(), "OrdId1");
+
+    // Nothing new since the current version
+    ASSERT_TRUE(cache.getChangesSince(cache.getVersion()).changes.empty());
+}
+
+// DeltaQuery: A version older than the change log falls back to a full snapshot
+TEST_F(OrderCacheTest, DeltaQuery_GetChangesSince_FallsBackToSnapshotWhenTooOld) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    cache.setChangeLogCapacity(4);
+    for (int i = 0; i < 10; i++) {
+        cache.addOrder(Order{"OrdId" + std::to_string(i), "SecId1", "Buy", 100, "User1", "Company1"});
+    }
+
+    // The last four mutations are still available
+    OrderDelta recent = cache.getChangesSince(6);
+    ASSERT_FALSE(recent.isFullSnapshot);
+    ASSERT_EQ(recent.changes.size(), 4);
+    ASSERT_EQ(recent.changes.front().order.orderId(), "OrdId6");
+
+    OrderDelta old = cache.getChangesSince(5);
+    ASSERT_TRUE(old.isFullSnapshot);
+    ASSERT_TRUE(old.changes.empty());
+    ASSERT_EQ(old.orders.size(), 10);
+    ASSERT_EQ(old.toVersion, 10);
+}
+
+// OrderedIteration: Orders stream out by security, Buy before Sell, then descending qty
+TEST_F(OrderCacheTest, OrderedIteration_ForEachOrderOrdered_SortsBySecuritySideAndQty) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    cache.setOrderedIndexEnabled(true);
+    cache.addOrder(Order{"OrdId1", "SecId2", "Sell", 300, "User1", "Company1"});
+    cache.addOrder(Order{"OrdId2", "SecId1", "Buy", 100, "User2", "Company2"});
+    cache.addOrder(Order{"OrdId3", "SecId1", "Sell", 500, "User3", "Company3"});
+    cache.addOrder(Order{"OrdId4", "SecId1", "Buy", 900, "User4", "Company4"});
+    cache.addOrder(Order{"OrdId5", "SecId2", "Sell", 700, "User5", "Company5"});
+    cache.addOrder(Order{"OrdId6", "SecId1", "Buy", 400, "User6", "Company6"});
+    cache.cancelOrder("OrdId6");
+
+    std::vector<std::string> ids;
+    cache.forEachOrderOrdered([&](const OrderView& order) { ids.emplace_back(order.orderId); });
+    ASSERT_EQ(ids, (std::vector<std::string>{"OrdId4", "OrdId2", "OrdId3", "OrdId5", "OrdId1"}));
+
+    ids.clear();
+    cache.forEachOrderOrdered("SecId2", [&](const OrderView& order) { ids.emplace_back(order.orderId); });
+    ASSERT_EQ(ids, (std::vector<std::string>{"OrdId5", "OrdId1"}));
+}
+
+// OrderedIteration: The maintained index yields the same sequence as the sorting fallback
+TEST_F(OrderCacheTest, OrderedIteration_ForEachOrderOrdered_IndexMatchesFallback) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    for (const auto& order : generateOrders(2000)) {
+        cache.addOrder(order);
+    }
+    cache.setOrderedIndexEnabled(true);
+    cache.cancelOrdersForUser(users[0]);
+    cache.cancelOrdersForSecIdWithMinimumQty(secIds[0], 1000);
+    cache.cancelOrder("OrdId7");
+
+    std::vector<std::string> indexed;
+    cache.forEachOrderOrdered([&](const OrderView& order) { indexed.emplace_back(order.orderId); });
+
+    cache.setOrderedIndexEnabled(false);
+    std::vector<std::string> sorted;
+    cache.forEachOrderOrdered([&](const OrderView& order) { sorted.emplace_back(order.orderId); });
+
+    ASSERT_EQ(indexed.size(), cache.getAllOrders().size());
+    ASSERT_EQ(indexed, sorted);
+}
+
+#ifdef __linux__
+// ForkSnapshot: The child sees the book as of the fork while the parent keeps mutating
+TEST_F(OrderCacheTest, ForkSnapshot_ForkSnapshot_ChildSeesFrozenImage) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    for (const auto& order : generateOrders(5000)) {
+        cache.addOrder(order);
+    }
+    const unsigned int matchingBefore = cache.getMatchingSizeForSecurity(secIds[0]);
+
+    pid_t pid = cache.forkSnapshot([&](OrderCache& image) {
+        // Give the parent time to mutate its own copy
+        std::this_thread::sleep_for(50ms);
+        const bool ok = image.getAllOrders().size() == 5000 &&
+                        image.getMatchingSizeForSecurity(secIds[0]) == matchingBefore;
+        return ok ? 0 : 1;
+    });
+    ASSERT_GT(pid, 0);
+
+    cache.cancelOrdersForSecIdWithMinimumQty(secIds[0], 1);
+    for (const auto& user : users) {
+        cache.cancelOrdersForUser(user);
+    }
+    ASSERT_TRUE(cache.getAllOrders().empty());
+
+    ASSERT_EQ(OrderCache::waitForSnapshot(pid), 0);
+}
+
+// ForkSnapshot: A child that mutates its image leaves the parent's journal and checkpoints untouched
+TEST_F(OrderCacheTest, ForkSnapshot_MutatingJob_DoesNotReachParentJournal) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    const auto dir = std::filesystem::temp_directory_path();
+    const std::string journalPath = (dir / "OrderCacheTest_forkjournal.journal").string();
+    const std::string snapshotPath = (dir / "OrderCacheTest_forkjournal.snap").string();
+    std::filesystem::remove(journalPath);
+    std::filesystem::remove(snapshotPath);
+
+    OrderJournal journal;
+    ASSERT_TRUE(journal.open(journalPath, JournalOptions{4096, std::chrono::milliseconds(1)}));
+    cache.attachJournal(&journal);
+    for (const auto& order : generateOrders(2000)) {
+        cache.addOrder(order);
+    }
+    // The parent stays short of the interval; the child's cancels alone would pass it
+    cache.enableCheckpointing(snapshotPath, 1500);
+
+    pid_t pid = cache.forkSnapshot([&](OrderCache& image) {
+        for (const auto& user : users) {
+            image.cancelOrdersForUser(user);
+        }
+        image.addOrder(Order{"ChildOrder", "SecId1", "Buy", 100, "User1", "Comp1"});
+        image.waitForCheckpoint();
+        return image.getAllOrders().size() == 1 ? 0 : 1;
+    });
+    ASSERT_GT(pid, 0);
+    ASSERT_EQ(OrderCache::waitForSnapshot(pid), 0);
+    ASSERT_FALSE(std::filesystem::exists(snapshotPath));
+
+    cache.cancelOrder("OrdId7");
+    ASSERT_TRUE(journal.sync());
+    cache.enableCheckpointing("", 0);
+    cache.attachJournal(nullptr);
+    journal.close();
+
+    OrderCache restored;
+    ASSERT_TRUE(restored.recover("", journalPath));
+    ASSERT_EQ(restored.getVersion(), cache.getVersion());
+    ASSERT_EQ(describeOrders(restored), describeOrders(cache));
+    std::filesystem::remove(journalPath);
+}
+#endif
+
+// Snapshot: Saving and loading round-trips orders, matching sizes and the version
+TEST_F(OrderCacheTest, Snapshot_SaveAndLoad_RestoresIdenticalCache) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    for (const auto& order : generateOrders(20000)) {
+        cache.addOrder(order);
+    }
+    cache.cancelOrdersForUser(users[3]);
+    cache.cancelOrder("OrdId11");
+
+    const std::string path = (std::filesystem::temp_directory_path() / "OrderCacheTest_roundtrip.snap").string();
+    ASSERT_TRUE(cache.saveSnapshot(path));
+
+    OrderCache restored;
+    ASSERT_TRUE(restored.loadSnapshot(path));
+    std::filesystem::remove(path);
+
+    ASSERT_EQ(restored.getVersion(), cache.getVersion());
+    ASSERT_EQ(describeOrders(restored), describeOrders(cache));
+
+    // The restored indexes keep working for every operation
+    restored.cancelOrdersForUser(users[5]);
+    cache.cancelOrdersForUser(users[5]);
+    restored.cancelOrdersForSecIdWithMinimumQty(secIds[7], 2500);
+    cache.cancelOrdersForSecIdWithMinimumQty(secIds[7], 2500);
+    ASSERT_EQ(describeOrders(restored), describeOrders(cache));
+}
+
+// Snapshot: A corrupted or missing file is rejected and leaves the cache untouched
+TEST_F(OrderCacheTest, Snapshot_LoadSnapshot_RejectsCorruptFile) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    cache.addOrder(Order{"OrdId1", "SecId1", "Buy", 100, "User1", "Company1"});
+    cache.addOrder(Order{"OrdId2", "SecId1", "Sell", 200, "User2", "Company2"});
+    const std::string path = (std::filesystem::temp_directory_path() / "OrderCacheTest_corrupt.snap").string();
+    ASSERT_TRUE(cache.saveSnapshot(path));
+
+    // Flip one byte of the payload
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekg(-3, std::ios::end);
+        char byte = 0;
+        file.read(&byte, 1);
+        byte ^= 0x5A;
+        file.seekp(-3, std::ios::end);
+        file.write(&byte, 1);
+    }
+
+    OrderCache other;
+    other.addOrder(Order{"OrdId9", "SecId9", "Buy", 900, "User9", "Company9"});
+    ASSERT_FALSE(other.loadSnapshot(path));
+    ASSERT_FALSE(other.loadSnapshot(path + ".missing"));
+    std::filesystem::remove(path);
+
+    auto orders = other.getAllOrders();
+    ASSERT_EQ(orders.size(), 1);
+    ASSERT_EQ(orders[0].orderId(), "OrdId9");
+}
+
+// Journal: Mutations logged through the journal are replayed into an identical cache
+TEST_F(OrderCacheTest, Journal_Recover_ReplaysSnapshotPlusJournal) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    const auto dir = std::filesystem::temp_directory_path();
+    const std::string snapshotPath = (dir / "OrderCacheTest_recover.snap").string();
+    const std::string journalPath = (dir / "OrderCacheTest_recover.journal").string();
+    std::filesystem::remove(snapshotPath);
+    std::filesystem::remove(journalPath);
+
+    std::vector<Order> orders = generateOrders(6000);
+    uint64_t snapshotVersion = 0;
+    {
+        OrderJournal journal;
+        ASSERT_TRUE(journal.open(journalPath, JournalOptions{4096, std::chrono::milliseconds(1)}));
+        cache.attachJournal(&journal);
+
+        for (int i = 0; i < 3000; i++) {
+            cache.addOrder(orders[i]);
+        }
+        cache.cancelOrdersForUser(users[2]);
+        snapshotVersion = cache.getVersion();
+        ASSERT_TRUE(cache.saveSnapshot(snapshotPath));
+
+        for (int i = 3000; i < 6000; i++) {
+            cache.addOrder(orders[i]);
+        }
+        cache.cancelOrdersForSecIdWithMinimumQty(secIds[4], 1000);
+        cache.cancelOrder("OrdId5000");
+
+        ASSERT_TRUE(journal.sync());
+        ASSERT_EQ(journal.durableVersion(), cache.getVersion());
+        cache.attachJournal(nullptr);
+    }
+
+    // Snapshot plus the journal tail, and the journal alone, both rebuild the same book
+    OrderCache fromSnapshot;
+    ASSERT_TRUE(fromSnapshot.recover(snapshotPath, journalPath));
+    OrderCache fromJournal;
+    ASSERT_TRUE(fromJournal.recover("", journalPath));
+
+    for (OrderCache* restored : {&fromSnapshot, &fromJournal}) {
+        ASSERT_EQ(restored->getVersion(), cache.getVersion());
+        ASSERT_EQ(describeOrders(*restored), describeOrders(cache));
+    }
+
+    // Once the journal no longer reaches back to the snapshot, recovery fails at the gap
+    {
+        OrderJournal journal;
+        ASSERT_TRUE(journal.open(journalPath));
+        journal.truncateThrough(3500);
+        ASSERT_TRUE(journal.sync());
+    }
+    OrderCache withGap;
+    ASSERT_LT(snapshotVersion, 3500u);
+    ASSERT_FALSE(withGap.recover(snapshotPath, journalPath));
+    ASSERT_EQ(withGap.getVersion(), snapshotVersion);
+    ASSERT_FALSE(withGap.recover("", journalPath));
+    ASSERT_EQ(withGap.getVersion(), 0u);
+
+    std::filesystem::remove(snapshotPath);
+    std::filesystem::remove(journalPath);
+}
+
+// Journal: A torn record at the tail is ignored on replay and cut off when reopened
+TEST_F(OrderCacheTest, Journal_Open_TruncatesTornTail) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    const std::string journalPath = (std::filesystem::temp_directory_path() / "OrderCacheTest_torn.journal").string();
+    std::filesystem::remove(journalPath);
+    {
+        OrderJournal journal;
+        ASSERT_TRUE(journal.open(journalPath));
+        cache.attachJournal(&journal);
+        cache.addOrder(Order{"OrdId1", "SecId1", "Buy", 100, "User1", "Company1"});
+        cache.addOrder(Order{"OrdId2", "SecId1", "Sell", 200, "User2", "Company2"});
+        cache.cancelOrder("OrdId1");
+        cache.attachJournal(nullptr);
+    }
+
+    // Simulate a crash in the middle of writing the next record
+    const auto intactSize = std::filesystem::file_size(journalPath);
+    {
+        std::ofstream out(journalPath, std::ios::binary | std::ios::app);
+        out.write("\x30\x00\x00\x00garbage", 11);
+    }
+
+    OrderCache restored;
+    ASSERT_TRUE(restored.recover("", journalPath));
+    ASSERT_EQ(restored.getVersion(), 3);
+    auto orders = restored.getAllOrders();
+    ASSERT_EQ(orders.size(), 1);
+    ASSERT_EQ(orders[0].orderId(), "OrdId2");
+
+    // Reopening drops the torn bytes and appends after the last complete record
+    OrderJournal journal;
+    ASSERT_TRUE(journal.open(journalPath));
+    ASSERT_EQ(std::filesystem::file_size(journalPath), intactSize);
+    ASSERT_EQ(journal.durableVersion(), 3);
+    journal.close();
+
+    // A crash while the header was being written leaves a journal with no records
+    std::filesystem::resize_file(journalPath, 5);
+    ASSERT_TRUE(restored.recover("", journalPath));
+    ASSERT_EQ(restored.getVersion(), 0);
+    ASSERT_TRUE(journal.open(journalPath));
+    journal.close();
+    ASSERT_EQ(std::filesystem::file_size(journalPath), sizeof(JournalFileHeader));
+    ASSERT_TRUE(restored.recover("", journalPath));
+    ASSERT_EQ(restored.getVersion(), 0);
+    std::filesystem::remove(journalPath);
+}
+
+// Checkpoint: Periodic snapshots truncate the journal and recovery replays at most one interval
+TEST_F(OrderCacheTest, Checkpoint_EnableCheckpointing_TruncatesJournalAndRecovers) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    const auto dir = std::filesystem::temp_directory_path();
+    const std::string snapshotPath = (dir / "OrderCacheTest_checkpoint.snap").string();
+    const std::string journalPath = (dir / "OrderCacheTest_checkpoint.journal").string();
+    std::filesystem::remove(snapshotPath);
+    std::filesystem::remove(journalPath);
+
+    constexpr uint64_t INTERVAL = 2000;
+    {
+        OrderJournal journal;
+        ASSERT_TRUE(journal.open(journalPath));
+        cache.attachJournal(&journal);
+        cache.enableCheckpointing(snapshotPath, INTERVAL);
+
+        for (const auto& order : generateOrders(9000)) {
+            cache.addOrder(order);
+        }
+        cache.cancelOrdersForUser(users[1]);
+        ASSERT_TRUE(cache.waitForCheckpoint());
+        ASSERT_TRUE(journal.sync());
+        ASSERT_GT(cache.lastCheckpointVersion(), 0);
+        cache.attachJournal(nullptr);
+    }
+
+    // Only records newer than the last checkpoint are left in the journal
+    uint64_t replayed = 0;
+    uint64_t oldest = UINT64_MAX;
+    ASSERT_TRUE(OrderJournal::replay(journalPath, [&](ChangeType, uint64_t version, const OrderView&) {
+        replayed++;
+        oldest = std::min(oldest, version);
+    }));
+    ASSERT_LE(replayed, cache.getVersion() - cache.lastCheckpointVersion());
+    ASSERT_LT(cache.getVersion() - cache.lastCheckpointVersion(), 2 * INTERVAL);
+    if (replayed > 0) {
+        ASSERT_GT(oldest, cache.lastCheckpointVersion());
+    }
+
+    OrderCache restored;
+    ASSERT_TRUE(restored.recover(snapshotPath, journalPath));
+    ASSERT_EQ(restored.getVersion(), cache.getVersion());
+    ASSERT_EQ(describeOrders(restored), describeOrders(cache));
+
+    std::filesystem::remove(snapshotPath);
+    std::filesystem::remove(journalPath);
+}
+
+#ifdef __linux__
+// Checkpoint: An idle cache finishes its running checkpoint by polling
+TEST_F(OrderCacheTest, Checkpoint_PollCheckpoint_FinishesWhileIdle) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    const std::string snapshotPath = (std::filesystem::temp_directory_path() / "OrderCacheTest_poll.snap").string();
+    std::filesystem::remove(snapshotPath);
+
+    cache.enableCheckpointing(snapshotPath, 100);
+    for (const auto& order : generateOrders(100)) {
+        cache.addOrder(order);
+    }
+    ASSERT_EQ(cache.lastCheckpointVersion(), 0);
+
+    // No further mutations: only pollCheckpoint() can reap the child
+    const auto deadline = std::chrono::steady_clock::now() + 10s;
+    while (!cache.pollCheckpoint() && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(1ms);
+    }
+    ASSERT_EQ(cache.lastCheckpointVersion(), 100);
+    ASSERT_TRUE(std::filesystem::exists(snapshotPath));
+
+    // A child reaped behind the cache's back counts as a failed checkpoint, not a running one
+    ASSERT_TRUE(cache.checkpoint());
+    int status = 0;
+    ASSERT_GT(::waitpid(-1, &status, 0), 0);
+    ASSERT_TRUE(cache.pollCheckpoint());
+    ASSERT_EQ(cache.lastCheckpointVersion(), 100);
+    cache.addOrder(Order{"Late", secIds[0], "Buy", 100, users[0], companies[0]});
+    ASSERT_TRUE(cache.checkpoint());
+    ASSERT_TRUE(cache.waitForCheckpoint());
+    ASSERT_EQ(cache.lastCheckpointVersion(), 101);
+    std::filesystem::remove(snapshotPath);
+}
+#endif
+
+// AsyncIo: Both engines write chunks in parallel and report the sync after them
+TEST_F(OrderCacheTest, AsyncIo_WriteAndSync_WritesWholeBufferOnEveryBackend) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    std::vector<char> data(3 * 1000 * 1000);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<char>(i * 31 + 7);
+    }
+
+    for (IoBackend backend : {IoBackend::Auto, IoBackend::ThreadPool}) {
+        const std::string path = (std::filesystem::temp_directory_path() / "OrderCacheTest_async.bin").string();
+        std::FILE* file = std::fopen(path.c_str(), "wb");
+        ASSERT_NE(file, nullptr);
+        ASSERT_TRUE(AsyncFileWriter::writeAndSync(fileno(file), data.data(), data.size(), backend, 64 * 1024, 4));
+        std::fclose(file);
+
+        std::ifstream in(path, std::ios::binary);
+        std::vector<char> readBack((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        ASSERT_EQ(readBack, data);
+        std::filesystem::remove(path);
+    }
+}
+
+// AsyncIo: The journal commits through the thread-pool fallback just like through io_uring
+TEST_F(OrderCacheTest, AsyncIo_Journal_ThreadPoolBackendIsDurable) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    const std::string journalPath = (std::filesystem::temp_directory_path() / "OrderCacheTest_pool.journal").string();
+    std::filesystem::remove(journalPath);
+    {
+        OrderJournal journal;
+        JournalOptions options;
+        options.backend = IoBackend::ThreadPool;
+        options.groupCommitBytes = 1024;
+        ASSERT_TRUE(journal.open(journalPath, options));
+        ASSERT_EQ(journal.backend(), IoBackend::ThreadPool);
+        cache.attachJournal(&journal);
+        for (const auto& order : generateOrders(3000)) {
+            cache.addOrder(order);
+        }
+        cache.cancelOrdersForUser(users[0]);
+        ASSERT_TRUE(journal.sync());
+        ASSERT_EQ(journal.durableVersion(), cache.getVersion());
+        cache.attachJournal(nullptr);
+    }
+
+    OrderCache restored;
+    ASSERT_TRUE(restored.recover("", journalPath));
+    ASSERT_EQ(describeOrders(restored), describeOrders(cache));
+    std::filesystem::remove(journalPath);
+}
+
+// LazyIndex: Secondary indexes are built on first touch after a load and behave like eager ones
+TEST_F(OrderCacheTest, LazyIndex_LoadSnapshot_BuildsIndexesOnFirstTouch) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    for (const auto& order : generateOrders(20000)) {
+        cache.addOrder(order);
+    }
+    const std::string path = (std::filesystem::temp_directory_path() / "OrderCacheTest_lazy.snap").string();
+    ASSERT_TRUE(cache.saveSnapshot(path));
+
+    OrderCache restored;
+    ASSERT_TRUE(restored.loadSnapshot(path));
+    const size_t pending = restored.pendingIndexCount();
+    ASSERT_GT(pending, 0u);
+
+    // Each operation builds only what it touches
+    restored.cancelOrdersForUser(users[2]);
+    cache.cancelOrdersForUser(users[2]);
+    ASSERT_LT(restored.pendingIndexCount(), pending);
+    ASSERT_GT(restored.pendingIndexCount(), 0u);
+
+    restored.addOrder(Order{"LazyOrd1", secIds[4], "Buy", 500, users[6], "CompanyLazy"});
+    cache.addOrder(Order{"LazyOrd1", secIds[4], "Buy", 500, users[6], "CompanyLazy"});
+    restored.cancelOrder("OrdId17");
+    cache.cancelOrder("OrdId17");
+    restored.cancelOrdersForSecIdWithMinimumQty(secIds[1], 3000);
+    cache.cancelOrdersForSecIdWithMinimumQty(secIds[1], 3000);
+    ASSERT_EQ(describeOrders(restored), describeOrders(cache));
+
+    // Saving a partly built cache needs no index and round-trips
+    ASSERT_TRUE(restored.saveSnapshot(path));
+    OrderCache reloaded;
+    ASSERT_TRUE(reloaded.loadSnapshot(path));
+    std::filesystem::remove(path);
+    ASSERT_EQ(describeOrders(reloaded), describeOrders(cache));
+
+    restored.materializeIndexes();
+    ASSERT_EQ(restored.pendingIndexCount(), 0u);
+    for (const auto& user : users) {
+        restored.cancelOrdersForUser(user);
+        cache.cancelOrdersForUser(user);
+    }
+    ASSERT_EQ(describeOrders(restored), describeOrders(cache));
+}
+
+// CompactSnapshot: The compact encoding round-trips every id shape and is much smaller
+TEST_F(OrderCacheTest, CompactSnapshot_SaveAndLoad_RoundTripsSmallerFile) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    for (const auto& order : generateOrders(20000)) {
+        cache.addOrder(order);
+    }
+    cache.cancelOrdersForUser(users[1]);
+
+    // Ids that cannot be split into prefix and number are stored literally
+    cache.addOrder(Order{"Ord007", secIds[0], "Buy", 10, users[2], "CompanyX"});
+    cache.addOrder(Order{"123456789012345678901", secIds[0], "Sell", 20, users[2], "CompanyY"});
+    cache.addOrder(Order{"NoDigits", secIds[1], "Buy", 4000000000u, users[3], "CompanyX"});
+    cache.addOrder(Order{"0", secIds[1], "Sell", 1, users[3], "CompanyY"});
+    cache.addOrder(Order{"42", secIds[2], "Sell", 7, users[4], "CompanyY"});
+
+    const auto dir = std::filesystem::temp_directory_path();
+    const std::string fixedPath = (dir / "OrderCacheTest_fixed.snap").string();
+    const std::string compactPath = (dir / "OrderCacheTest_compact.snap").string();
+    ASSERT_TRUE(cache.saveSnapshot(fixedPath));
+    ASSERT_TRUE(cache.saveSnapshot(compactPath, SnapshotEncoding::Compact));
+    const auto fixedSize = std::filesystem::file_size(fixedPath);
+    const auto compactSize = std::filesystem::file_size(compactPath);
+    std::filesystem::remove(fixedPath);
+    EXPECT_LT(compactSize * 3, fixedSize);
+
+    OrderCache restored;
+    ASSERT_TRUE(restored.loadSnapshot(compactPath));
+    ASSERT_EQ(restored.getVersion(), cache.getVersion());
+    ASSERT_EQ(describeOrders(restored), describeOrders(cache));
+
+    // User indexes come with the load; securities are still built on first touch
+    restored.cancelOrdersForUser(users[2]);
+    cache.cancelOrdersForUser(users[2]);
+    restored.cancelOrdersForSecIdWithMinimumQty(secIds[1], 1);
+    cache.cancelOrdersForSecIdWithMinimumQty(secIds[1], 1);
+    ASSERT_EQ(describeOrders(restored), describeOrders(cache));
+
+    // A truncated file is rejected and leaves the cache untouched
+    std::filesystem::resize_file(compactPath, compactSize - 1);
+    ASSERT_FALSE(restored.loadSnapshot(compactPath));
+    std::filesystem::remove(compactPath);
+    ASSERT_EQ(describeOrders(restored), describeOrders(cache));
+}
+
+// ParallelLoad: A snapshot decoded on several threads restores an identical, working cache
+TEST_F(OrderCacheTest, ParallelLoad_LoadSnapshot_RestoresIdenticalCache) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    // Chunked CRCs combine to the CRC of the whole buffer
+    std::vector<char> bytes(100003);
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        bytes[i] = static_cast<char>(i * 131 + (i >> 7));
+    }
+    const uint32_t head = Crc32::compute(bytes.data(), 40000);
+    const uint32_t tail = Crc32::compute(bytes.data() + 40000, bytes.size() - 40000);
+    ASSERT_EQ(Crc32::combine(head, tail, bytes.size() - 40000), Crc32::compute(bytes.data(), bytes.size()));
+
+    // Enough orders for every thread to get a shard of its own
+    for (const auto& order : generateOrders(200000)) {
+        cache.addOrder(order);
+    }
+    cache.cancelOrdersForUser(users[0]);
+    const std::string path = (std::filesystem::temp_directory_path() / "OrderCacheTest_parallel.snap").string();
+    ASSERT_TRUE(cache.saveSnapshot(path));
+
+    OrderCache parallel;
+    parallel.setSnapshotLoadThreads(4);
+    ASSERT_TRUE(parallel.loadSnapshot(path));
+    std::filesystem::remove(path);
+
+    ASSERT_EQ(parallel.getVersion(), cache.getVersion());
+    parallel.cancelOrdersForUser(users[3]);
+    cache.cancelOrdersForUser(users[3]);
+    parallel.cancelOrdersForSecIdWithMinimumQty(secIds[2], 1);
+    cache.cancelOrdersForSecIdWithMinimumQty(secIds[2], 1);
+    ASSERT_EQ(describeOrders(parallel), describeOrders(cache));
+}
+
+// Tiering: Idle books are spilled to disk, stay visible, and fault back in on use
+TEST_F(OrderCacheTest, Tiering_IdleBooks_SpillAndFaultBackIn) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    const auto dir = std::filesystem::temp_directory_path() / "OrderCacheTest_tiering";
+    std::filesystem::remove_all(dir);
+
+    OrderCache reference;
+    auto addBoth = [&](const Order& order) {
+        cache.addOrder(order);
+        reference.addOrder(order);
+    };
+    for (const auto& order : generateOrders(5000)) {
+        addBoth(order);
+    }
+    addBoth(Order{"TierBuy", "TierSec", "Buy", 100, "TierUser1", "CompanyA"});
+    addBoth(Order{"TierSell", "TierSec", "Sell", 60, "TierUser2", "CompanyB"});
+    addBoth(Order{"OneSided", "OneSec", "Buy", 50, "TierUser1", "CompanyA"});
+
+    // Keep one book busy until every other book has been idle for the interval
+    cache.enableTiering(dir.string(), 100);
+    for (int i = 0; i < 300; ++i) {
+        addBoth(Order{"Hot" + std::to_string(i), secIds[0], "Buy", 10, users[0], "CompanyHot"});
+    }
+    const size_t spilled = cache.spilledSecurityCount();
+    ASSERT_GT(spilled, 2u);
+    ASSERT_EQ(describeOrders(cache), describeOrders(reference));
+
+    // Resident aggregates answer a one-sided book; a two-sided one is faulted in
+    ASSERT_EQ(cache.getMatchingSizeForSecurity("OneSec"), 0u);
+    ASSERT_EQ(cache.spilledSecurityCount(), spilled);
+    ASSERT_EQ(cache.getMatchingSizeForSecurity("TierSec"), 60u);
+    ASSERT_EQ(cache.spilledSecurityCount(), spilled - 1);
+
+    // Ids of spilled orders stay taken, and every cancel path reaches spilled books
+    addBoth(Order{"OneSided", "OtherSec", "Sell", 5, "TierUser3", "CompanyC"});
+    cache.cancelOrder("OneSided");
+    reference.cancelOrder("OneSided");
+    cache.cancelOrdersForUser(users[4]);
+    reference.cancelOrdersForUser(users[4]);
+    cache.cancelOrdersForSecIdWithMinimumQty(secIds[5], 2000);
+    reference.cancelOrdersForSecIdWithMinimumQty(secIds[5], 2000);
+    ASSERT_EQ(describeOrders(cache), describeOrders(reference));
+
+    // Snapshots include spilled books
+    const std::string path = (std::filesystem::temp_directory_path() / "OrderCacheTest_tiering.snap").string();
+    ASSERT_TRUE(cache.saveSnapshot(path));
+    OrderCache restored;
+    ASSERT_TRUE(restored.loadSnapshot(path));
+    std::filesystem::remove(path);
+    ASSERT_EQ(describeOrders(restored), describeOrders(reference));
+
+    // Disabling tiering brings every book back and deletes the segments
+    cache.enableTiering("", 0);
+    ASSERT_EQ(cache.spilledSecurityCount(), 0u);
+    ASSERT_EQ(describeOrders(cache), describeOrders(reference));
+    ASSERT_TRUE(std::filesystem::is_empty(dir));
+    std::filesystem::remove_all(dir);
+}
+
+// Replication: a follower applies the leader's stream, reports lag and can be promoted
+TEST_F(OrderCacheTest, Replication_Follower_AppliesStreamAndPromotes) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    const std::string socketPath = (std::filesystem::temp_directory_path() / "OrderCacheTest_repl.sock").string();
+    OrderCache follower;
+    ReplicationLeader leader(cache);
+    ReplicationFollower replica(follower);
+    ASSERT_TRUE(leader.listen(socketPath));
+    ASSERT_TRUE(replica.connect(socketPath));
+
+    const auto orders = generateOrders(2000);
+    for (const auto& order : orders) {
+        cache.addOrder(order);
+    }
+    cache.cancelOrdersForUser(users[2]);
+    cache.cancelOrdersForSecIdWithMinimumQty(secIds[3], 500);
+    cache.cancelOrder(orders[7].orderId());
+
+    // Wait until everything has arrived, then apply it in one go
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (replica.leaderVersion() < cache.getVersion() && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(replica.leaderVersion(), cache.getVersion());
+    ASSERT_EQ(replica.lag(), cache.getVersion());
+    ASSERT_EQ(replica.applyPending(), cache.getVersion());
+    ASSERT_EQ(replica.lag(), 0u);
+    ASSERT_FALSE(replica.hasFailed());
+    ASSERT_EQ(follower.getVersion(), cache.getVersion());
+    ASSERT_EQ(describeOrders(follower), describeOrders(cache));
+
+    while (leader.ackedVersion() < cache.getVersion() && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(leader.lag(), 0u);
+
+    // Promotion keeps the follower's state and version; it then takes writes itself
+    cache.addOrder(Order{"Unshipped", secIds[0], "Buy", 10, users[0], "CompanyA"});
+    leader.close();
+    const uint64_t promoted = replica.promote();
+    ASSERT_EQ(promoted, follower.getVersion());
+    ASSERT_FALSE(replica.isConnected());
+    follower.addOrder(Order{"AfterPromote", secIds[0], "Sell", 10, users[1], "CompanyB"});
+    ASSERT_EQ(follower.getVersion(), promoted + 1);
+    ASSERT_FALSE(std::filesystem::exists(socketPath));
+}
+
+// Shared memory: readers see the published aggregates and books, updated incrementally
+TEST_F(OrderCacheTest, SharedBook_Publish_ReadersSeeAggregatesAndBooks) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    for (const auto& order : generateOrders(3000)) {
+        cache.addOrder(order);
+    }
+
+    // A ring only a little larger than all books together makes rewrites relocate the others
+    size_t bookBytes = 0;
+    std::set<std::string> securities;
+    cache.forEachOrderOrdered([&](const OrderView& order) {
+        bookBytes += sizeof(SharedBookRecord) + order.orderId.size() + order.user.size() + order.company.size();
+        securities.emplace(order.securityId);
+    });
+
+    SharedBookPublisher publisher(cache);
+    SharedBookReader reader;
+    ASSERT_TRUE(publisher.create("/OrderCacheTest_shm", SharedBookOptions{2048, bookBytes + 4096}));
+    ASSERT_TRUE(reader.open("/OrderCacheTest_shm"));
+    ASSERT_EQ(reader.publishedVersion(), 0u);
+    ASSERT_EQ(publisher.publish(), securities.size());
+
+    auto checkAll = [&]() {
+        ASSERT_EQ(reader.publishedVersion(), cache.getVersion());
+        for (const auto& secId : securities) {
+            SharedSecurityStats stats;
+            ASSERT_TRUE(reader.readSecurity(secId, stats));
+            ASSERT_EQ(stats.matchingSize, cache.getMatchingSizeForSecurity(secId));
+
+            std::vector<Order> expected;
+            cache.forEachOrderOrdered(secId, [&](const OrderView& order) { expected.push_back(order.toOrder()); });
+            std::vector<Order> book;
+            ASSERT_TRUE(reader.readBook(secId, book));
+            ASSERT_EQ(book.size(), expected.size());
+            ASSERT_EQ(stats.orderCount, expected.size());
+            for (size_t i = 0; i < book.size(); ++i) {
+                ASSERT_EQ(book[i].orderId(), expected[i].orderId());
+                ASSERT_EQ(book[i].side(), expected[i].side());
+                ASSERT_EQ(book[i].qty(), expected[i].qty());
+                ASSERT_EQ(book[i].user(), expected[i].user());
+                ASSERT_EQ(book[i].company(), expected[i].company());
+            }
+        }
+    };
+    checkAll();
+
+    // Only touched securities are rewritten
+    for (int i = 0; i < 40; ++i) {
+        cache.addOrder(Order{"Shm" + std::to_string(i), *securities.begin(), i % 3 ? "Buy" : "Sell", 100,
+                             users[0], "CompanyA"});
+        ASSERT_EQ(publisher.publish(), 1u);
+    }
+    cache.cancelOrdersForSecIdWithMinimumQty(*securities.rbegin(), 1);
+    ASSERT_EQ(publisher.publish(), 1u);
+    ASSERT_EQ(publisher.publish(), 0u);
+    checkAll();
+    ASSERT_EQ(reader.getMatchingSizeForSecurity(*securities.rbegin()), 0u);
+    ASSERT_EQ(reader.getMatchingSizeForSecurity("NoSuchSecurity"), 0u);
+    ASSERT_EQ(reader.securityCount(), securities.size());
+
+    // A field too long for a record drops that book, never truncates it
+    const std::string& target = *std::next(securities.begin());
+    cache.addOrder(Order{"ShmLong", target, "Buy", 100, std::string(70000, 'u'), "CompanyA"});
+    ASSERT_EQ(publisher.publish(), 1u);
+    ASSERT_EQ(publisher.unencodableBookCount(), 1u);
+    std::vector<Order> dropped;
+    ASSERT_FALSE(reader.readBook(target, dropped));
+    SharedSecurityStats longStats;
+    ASSERT_TRUE(reader.readSecurity(target, longStats));
+    ASSERT_EQ(longStats.matchingSize, cache.getMatchingSizeForSecurity(target));
+    cache.cancelOrder("ShmLong");
+    ASSERT_EQ(publisher.publish(), 1u);
+    ASSERT_EQ(publisher.unencodableBookCount(), 0u);
+    checkAll();
+
+    publisher.close();
+    SharedBookReader late;
+    ASSERT_FALSE(late.open("/OrderCacheTest_shm"));
+    checkAll(); // An open mapping outlives the object
+}
+
+// MappedImage: An opened image builds orders on first touch and behaves like the original
+TEST_F(OrderCacheTest, MappedImage_OpenImage_BuildsOrdersOnFirstTouch) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    for (const auto& order : generateOrders(20000)) {
+        cache.addOrder(order);
+    }
+    cache.cancelOrdersForUser(users[1]);
+    const std::string path = (std::filesystem::temp_directory_path() / "OrderCacheTest.image").string();
+    ASSERT_TRUE(cache.saveImage(path));
+
+    OrderCache restored;
+    restored.addOrder(Order{"Stale", secIds[0], "Buy", 1, users[0], "CompanyA"});
+    ASSERT_TRUE(restored.openImage(path, true));
+    ASSERT_EQ(restored.getVersion(), cache.getVersion());
+    const size_t pending = restored.pendingIndexCount();
+    ASSERT_GT(pending, 0u);
+    ASSERT_EQ(describeOrders(restored), describeOrders(cache));
+    ASSERT_EQ(restored.pendingIndexCount(), pending); // Reads leave the image unbuilt
+
+    // Ids in the image are found by every mutation; each builds only what it touches
+    restored.addOrder(Order{"OrdId5", secIds[3], "Sell", 9, users[3], "CompanyB"});
+    cache.addOrder(Order{"OrdId5", secIds[3], "Sell", 9, users[3], "CompanyB"});
+    restored.cancelOrder("OrdId17");
+    cache.cancelOrder("OrdId17");
+    restored.addOrder(Order{"ImgOrd1", secIds[4], "Buy", 500, users[6], "CompanyImg"});
+    cache.addOrder(Order{"ImgOrd1", secIds[4], "Buy", 500, users[6], "CompanyImg"});
+    restored.cancelOrdersForUser(users[2]);
+    cache.cancelOrdersForUser(users[2]);
+    restored.cancelOrdersForSecIdWithMinimumQty(secIds[1], 3000);
+    cache.cancelOrdersForSecIdWithMinimumQty(secIds[1], 3000);
+    ASSERT_LT(restored.pendingIndexCount(), pending);
+    ASSERT_GT(restored.pendingIndexCount(), 0u);
+    ASSERT_EQ(describeOrders(restored), describeOrders(cache));
+    ASSERT_EQ(restored.getMatchingSizeForSecurity(secIds[5]), cache.getMatchingSizeForSecurity(secIds[5]));
+
+    // A partly built cache saves and reopens as well
+    const std::string copyPath = path + ".copy";
+    ASSERT_TRUE(restored.saveImage(copyPath));
+    OrderCache reopened;
+    ASSERT_TRUE(reopened.openImage(copyPath));
+    std::filesystem::remove(copyPath);
+    ASSERT_EQ(describeOrders(reopened), describeOrders(cache));
+
+    restored.materializeIndexes();
+    ASSERT_EQ(restored.pendingIndexCount(), 0u);
+    for (const auto& user : users) {
+        restored.cancelOrdersForUser(user);
+        cache.cancelOrdersForUser(user);
+    }
+    ASSERT_EQ(describeOrders(restored), describeOrders(cache));
+
+    // A damaged file is rejected and leaves the cache untouched
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+    ASSERT_FALSE(reopened.openImage(path));
+    std::filesystem::remove(path);
+    ASSERT_FALSE(reopened.openImage(path));
+    ASSERT_GT(reopened.getAllOrders().size(), 0u);
+}
+
+// Workload: Generated streams are deterministic, skewed, and track the cache exactly
+TEST_F(OrderCacheTest, Workload_CancelHeavyStream_TracksLiveOrders) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    WorkloadOptions options;
+    options.securities = 200;
+    options.users = 100;
+    options.companies = 10;
+    options.securitySkew = 1.2;
+    options.qtySkew = 1.0;
+    options.mix = WorkloadMix{0.2, 0.3, 0.4, 0.01, 0.02, 0.06, 0.01};
+
+    WorkloadGenerator generator(options);
+    WorkloadGenerator twin(options);
+    std::vector<WorkloadOp> ops = generator.generateAdds(5000);
+    const std::vector<WorkloadOp> stream = generator.generate(20000);
+    ops.insert(ops.end(), stream.begin(), stream.end());
+    std::vector<WorkloadOp> twinOps = twin.generateAdds(5000);
+    const std::vector<WorkloadOp> twinStream = twin.generate(20000);
+    twinOps.insert(twinOps.end(), twinStream.begin(), twinStream.end());
+    ASSERT_EQ(ops.size(), twinOps.size());
+    for (size_t i = 0; i < ops.size(); ++i) {
+        ASSERT_EQ(ops[i].type, twinOps[i].type);
+        ASSERT_EQ(ops[i].order, twinOps[i].order);
+        ASSERT_EQ(ops[i].security, twinOps[i].security);
+        ASSERT_EQ(ops[i].qty, twinOps[i].qty);
+    }
+
+    // The mix is honoured and the most popular security dominates
+    std::vector<size_t> byType(7, 0);
+    std::vector<size_t> bySecurity(options.securities, 0);
+    for (const WorkloadOp& op : stream) {
+        ++byType[static_cast<size_t>(op.type)];
+        if (op.type == WorkloadOpType::Add) {
+            ++bySecurity[op.security];
+        }
+    }
+    const size_t cancelsAndAmends = byType[static_cast<size_t>(WorkloadOpType::Cancel)] +
+                                    byType[static_cast<size_t>(WorkloadOpType::Amend)];
+    ASSERT_GT(cancelsAndAmends, stream.size() * 6 / 10);
+    ASSERT_GT(byType[static_cast<size_t>(WorkloadOpType::CancelUser)], 0u);
+    ASSERT_GT(byType[static_cast<size_t>(WorkloadOpType::CancelSecurity)], 0u);
+    ASSERT_GT(bySecurity[0], 10 * bySecurity[options.securities - 1] + 10);
+
+    // Every cancel and amend hits a live order, so the cache ends with what the generator tracked
+    for (const WorkloadOp& op : ops) {
+        generator.apply(cache, op);
+    }
+    ASSERT_EQ(cache.getAllOrders().size(), generator.liveOrderCount());
+    ASSERT_GT(generator.liveOrderCount(), 0u);
+}
+
+// Trace: A recorded session replays into an identical cache with the same results
+TEST_F(OrderCacheTest, Trace_RecordAndReplay_ReproducesSession) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    WorkloadOptions options;
+    options.securities = 50;
+    options.users = 40;
+    options.mix = WorkloadMix{0.3, 0.3, 0.2, 0.01, 0.02, 0.15, 0.02};
+    WorkloadGenerator generator(options);
+    std::vector<WorkloadOp> ops = generator.generateAdds(2000);
+    const std::vector<WorkloadOp> stream = generator.generate(5000);
+    ops.insert(ops.end(), stream.begin(), stream.end());
+
+    const std::string path = (std::filesystem::temp_directory_path() / "OrderCacheTest.trace").string();
+    OrderTraceWriter writer;
+    ASSERT_TRUE(writer.open(path));
+    TracingOrderCache traced(cache, writer);
+    for (const WorkloadOp& op : ops) {
+        generator.apply(traced, op);
+    }
+    // Rejected calls are traced too, bad sides included
+    traced.addOrder(Order{"BadSide", secIds[1], "buy", 100, users[1], companies[1]});
+    traced.addOrder(Order{"NoSide", secIds[1], "", 100, users[1], companies[1]});
+    traced.addOrder(Order{"", secIds[0], "Buy", 100, users[0], companies[0]});
+    const uint64_t calls = writer.recordCount();
+    writer.close();
+    ASSERT_GT(calls, ops.size()); // Amends are two calls
+
+    OrderTrace trace;
+    ASSERT_TRUE(trace.load(path));
+    ASSERT_FALSE(trace.isTruncated());
+    ASSERT_EQ(trace.records().size(), calls);
+    ASSERT_EQ(trace.records().back().call, TraceCall::Add);
+    ASSERT_TRUE(trace.records().back().isBuy);
+    ASSERT_EQ(trace.records().back().securityId, secIds[0]);
+    ASSERT_EQ(trace.records()[calls - 3].side, "buy");
+    ASSERT_EQ(trace.records()[calls - 2].side, "");
+    for (size_t i = 1; i < trace.records().size(); ++i) {
+        ASSERT_LE(trace.records()[i - 1].startNs, trace.records()[i].startNs);
+    }
+
+    OrderCache replayed;
+    const TraceReplayResult result = trace.replay(replayed);
+    ASSERT_EQ(result.mismatches, 0u);
+    ASSERT_EQ(describeOrders(replayed), describeOrders(cache));
+    size_t replayedCalls = 0;
+    for (size_t call = 0; call < kTraceCallCount; ++call) {
+        ASSERT_EQ(result.latencies[call].size(), result.recorded[call].size());
+        replayedCalls += result.latencies[call].size();
+    }
+    ASSERT_EQ(replayedCalls, calls);
+
+    // A trace cut short loads up to its last complete record
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 3);
+    OrderTrace torn;
+    ASSERT_TRUE(torn.load(path));
+    std::filesystem::remove(path);
+    ASSERT_TRUE(torn.isTruncated());
+    ASSERT_EQ(torn.records().size(), calls - 1);
+}
+
+// Hot-path counters record calls, rejections and matching work
+TEST_F(OrderCacheTest, Stats_CountCallsRejectionsAndMatchingWork) {
+    if (!OrderCacheStats::kEnabled) {
+        ASSERT_EQ(cache.getStats().addCalls, 0u);
+        GTEST_SKIP() << "built without ORDERCACHE_STATS";
+    }
+
+    cache.addOrder(Order{"OrdId1", secIds[0], "Buy", 300, users[0], companies[0]});
+    cache.addOrder(Order{"OrdId2", secIds[0], "Sell", 200, users[1], companies[1]});
+    cache.addOrder(Order{"OrdId3", secIds[0], "Sell", 100, users[2], companies[2]});
+    cache.addOrder(Order{"OrdId4", secIds[1], "Buy", 100, users[0], companies[0]});
+    cache.addOrder(Order{"", secIds[0], "Buy", 100, users[0], companies[0]});
+    cache.addOrder(Order{"OrdId5", secIds[0], "Buy", 0, users[0], companies[0]});
+    cache.addOrder(Order{"OrdId6", secIds[0], "Bid", 100, users[0], companies[0]});
+    cache.addOrder(Order{"OrdId1", secIds[0], "Buy", 100, users[0], companies[0]});
+
+    OrderCacheStats stats = cache.getStats();
+    ASSERT_EQ(stats.addCalls, 8u);
+    ASSERT_EQ(stats.rejectedEmptyField, 1u);
+    ASSERT_EQ(stats.rejectedZeroQty, 1u);
+    ASSERT_EQ(stats.rejectedBadSide, 1u);
+    ASSERT_EQ(stats.rejectedDuplicate, 1u);
+    ASSERT_EQ(stats.idLookups, 5u);
+    ASSERT_GE(stats.idProbes, 1u); // The duplicate's bucket holds at least OrdId1
+
+    ASSERT_EQ(cache.getMatchingSizeForSecurity(secIds[0]), 300u);
+    stats = cache.getStats();
+    ASSERT_EQ(stats.matchCalls, 1u);
+    ASSERT_EQ(stats.matchOrdersScanned, 3u);
+    ASSERT_EQ(stats.matchMaxOrdersScanned, 3u);
+    ASSERT_GE(stats.matchPairsExamined, 1u);
+    ASSERT_LE(stats.matchPairsExamined, 2u);
+
+    // Bulk cancels count once; the cancels they make internally are not interface calls
+    cache.cancelOrdersForSecIdWithMinimumQty(secIds[0], 100);
+    cache.cancelOrder("OrdId4");
+    cache.cancelOrdersForUser(users[9]);
+    cache.getAllOrders();
+    stats = cache.getStats();
+    ASSERT_EQ(stats.cancelSecurityCalls, 1u);
+    ASSERT_EQ(stats.cancelCalls, 1u);
+    ASSERT_EQ(stats.cancelUserCalls, 1u);
+    ASSERT_EQ(stats.getAllCalls, 1u);
+    ASSERT_GE(stats.indexEntriesScanned, 3u + 6u);
+
+    cache.resetStats();
+    ASSERT_EQ(cache.getStats().addCalls, 0u);
+    ASSERT_EQ(cache.getStats().matchOrdersScanned, 0u);
+}
+
+// Latency histograms keep bounded relative error, merge, export and collect across threads
+TEST_F(OrderCacheTest, LatencyHistogram_PercentilesMergeAndPerThreadRecording) {
+    LatencyHistogram low;
+    LatencyHistogram high;
+    for (uint64_t ns = 1; ns <= 10000; ++ns) {
+        (ns % 2 ? low : high).record(ns * 100);
+    }
+    LatencyHistogram merged = low;
+    merged.merge(high);
+    ASSERT_EQ(merged.count(), 10000u);
+    ASSERT_EQ(merged.min(), 100u);
+    ASSERT_EQ(merged.max(), 1000000u);
+    ASSERT_DOUBLE_EQ(merged.mean(), 500050.0);
+    for (double percentile : {1.0, 50.0, 90.0, 99.0, 99.9}) {
+        const double exact = percentile * 10000;
+        ASSERT_NEAR(static_cast<double>(merged.valueAtPercentile(percentile)), exact, exact / 128 + 1) << percentile;
+    }
+    ASSERT_EQ(merged.valueAtPercentile(100), 1000000u);
+    for (uint64_t ns : std::vector<uint64_t>{0, 255, 256, 1000, 123456789, LatencyHistogram::kMaxTrackable}) {
+        const size_t index = LatencyHistogram::bucketIndex(ns);
+        ASSERT_LT(index, LatencyHistogram::kBucketCount);
+        ASSERT_LE(LatencyHistogram::bucketLowest(index), ns);
+        ASSERT_GE(LatencyHistogram::bucketHighest(index), ns);
+    }
+
+    std::ostringstream hgrm;
+    merged.writePercentiles(hgrm);
+    ASSERT_NE(hgrm.str().find("Percentile TotalCount"), std::string::npos);
+    ASSERT_NE(hgrm.str().find("Total count    =        10000"), std::string::npos);
+
+    // Timestamps are calibrated against the steady clock
+    const uint64_t start = TscClock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    const uint64_t elapsed = TscClock::toNanos(TscClock::now() - start);
+    ASSERT_GE(elapsed, 15000000u);
+    ASSERT_LT(elapsed, 2000000000u);
+
+    // Each thread records into its own histograms; an exited thread's calls still count
+    LatencyRecorder::reset();
+    LatencyRecorder::record(LatencyOp::Match, 500);
+    std::thread worker([] {
+        for (int i = 0; i < 100; ++i) {
+            LatencyRecorder::record(LatencyOp::Match, 1000);
+        }
+        ASSERT_EQ(LatencyRecorder::threadHistogram(LatencyOp::Match).count(), 100u);
+    });
+    worker.join();
+    ASSERT_EQ(LatencyRecorder::threadHistogram(LatencyOp::Match).count(), 1u);
+    ASSERT_EQ(LatencyRecorder::collect(LatencyOp::Match).count(), 101u);
+    ASSERT_EQ(LatencyRecorder::collect(LatencyOp::Match).max(), 1000u);
+
+    // An instrumented cache records its own calls, the cancels inside a bulk cancel included in it
+    LatencyRecorder::reset();
+    cache.addOrder(Order{"OrdId1", secIds[0], "Buy", 100, users[0], companies[0]});
+    cache.addOrder(Order{"OrdId2", secIds[0], "Sell", 100, users[1], companies[1]});
+    cache.cancelOrdersForSecIdWithMinimumQty(secIds[0], 100);
+    const uint64_t expected = LatencyRecorder::kCacheInstrumented ? 1 : 0;
+    ASSERT_EQ(LatencyRecorder::collect(LatencyOp::Add).count(), 2 * expected);
+    ASSERT_EQ(LatencyRecorder::collect(LatencyOp::CancelSecurity).count(), expected);
+    ASSERT_EQ(LatencyRecorder::collect(LatencyOp::Cancel).count(), 0u);
+}
+
+// Trace spans go to per-thread rings and export as Chrome trace JSON
+TEST_F(OrderCacheTest, SpanTrace_PerThreadRingsExportChromeTrace) {
+    SpanTracer::clear();
+    {
+        SpanScope outer("outer");
+        SpanScope inner("inner");
+    }
+    std::thread worker([] {
+        for (size_t i = 0; i < SpanTracer::kRingCapacity + 10; ++i) {
+            SpanScope span("worker");
+        }
+    });
+    worker.join();
+
+    std::vector<SpanEvent> events = SpanTracer::collect();
+    ASSERT_EQ(events.size(), 2 + SpanTracer::kRingCapacity); // The worker's ring kept its last spans
+    const SpanEvent* outer = nullptr;
+    const SpanEvent* inner = nullptr;
+    for (const SpanEvent& event : events) {
+        outer = std::string(event.name) == "outer" ? &event : outer;
+        inner = std::string(event.name) == "inner" ? &event : inner;
+    }
+    ASSERT_NE(outer, nullptr);
+    ASSERT_NE(inner, nullptr);
+    ASSERT_EQ(outer->thread, inner->thread);
+    ASSERT_LE(outer->startNs, inner->startNs);
+    ASSERT_GE(outer->startNs + outer->durationNs, inner->startNs + inner->durationNs);
+
+    // Clearing drops the exited worker's ring
+    SpanTracer::clear();
+    ASSERT_TRUE(SpanTracer::collect().empty());
+
+    cache.addOrder(Order{"OrdId1", secIds[0], "Buy", 100, users[0], companies[0]});
+    cache.addOrder(Order{"OrdId2", secIds[0], "Sell", 100, users[1], companies[1]});
+    ASSERT_EQ(cache.getMatchingSizeForSecurity(secIds[0]), 100u);
+    std::ostringstream json;
+    SpanTracer::writeChromeTrace(json);
+    ASSERT_EQ(json.str().rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0), 0u);
+    ASSERT_EQ(json.str().substr(json.str().size() - 4), "\n]}\n");
+    if (SpanTracer::kCacheInstrumented) {
+        for (const char* phase : {"\"getMatchingSizeForSecurity\"", "\"partition\"", "\"sort\"", "\"match\"", "\"lookup\""}) {
+            ASSERT_NE(json.str().find(phase), std::string::npos) << phase;
+        }
+    } else {
+        ASSERT_EQ(json.str().find("\"ph\":\"X\""), std::string::npos);
+    }
+}
+
+// The flight recorder keeps each thread's most recent calls and dumps them as text
+TEST_F(OrderCacheTest, FlightRecorder_KeepsRecentCallsPerThread) {
+    FlightRecorder::clear();
+    FlightRecorder::record(LatencyOp::Match, FlightRecorder::keyHash("SecId7"), 100, 350, 42);
+    std::thread worker([] {
+        for (uint64_t i = 0; i < FlightRecorder::kCapacity + 5; ++i) {
+            FlightRecorder::record(LatencyOp::Cancel, i, 1000, 1010, i);
+        }
+    });
+    worker.join();
+
+    std::vector<FlightRecord> records = FlightRecorder::snapshot();
+    ASSERT_EQ(records.size(), 1 + FlightRecorder::kCapacity); // The worker's ring wrapped
+    size_t workerRecords = 0;
+    for (const FlightRecord& record : records) {
+        if (record.op == LatencyOp::Match) {
+            ASSERT_EQ(record.keyHash, FlightRecorder::keyHash("SecId7"));
+            ASSERT_EQ(record.result, 42u);
+            ASSERT_GT(record.durationNs, 0u);
+        } else {
+            ASSERT_EQ(record.result, record.keyHash);
+            ASSERT_EQ(record.sequence, record.result); // Oldest kept is #5
+            ASSERT_GE(record.sequence, 5u);
+            ++workerRecords;
+        }
+    }
+    ASSERT_EQ(workerRecords, FlightRecorder::kCapacity);
+
+    // The dump is plain text written straight to a descriptor
+    FILE* out = std::tmpfile();
+    ASSERT_NE(out, nullptr);
+    FlightRecorder::dump(fileno(out));
+    std::rewind(out);
+    std::string text;
+    char buffer[4096];
+    for (size_t n; (n = std::fread(buffer, 1, sizeof(buffer), out)) > 0;) {
+        text.append(buffer, n);
+    }
+    std::fclose(out);
+    ASSERT_EQ(std::count(text.begin(), text.end(), '\n'), static_cast<long>(2 + FlightRecorder::kCapacity));
+    ASSERT_NE(text.find("getMatchingSizeForSecurity key "), std::string::npos);
+    ASSERT_NE(text.find(" duration "), std::string::npos);
+    ASSERT_NE(text.find(" result 42\n"), std::string::npos);
+
+    // The cache records its calls, with the orders a bulk cancel removed as its result
+    FlightRecorder::clear();
+    cache.addOrder(Order{"OrdId1", secIds[0], "Buy", 100, users[0], companies[0]});
+    cache.addOrder(Order{"OrdId1", secIds[0], "Buy", 100, users[0], companies[0]});
+    cache.addOrder(Order{"OrdId2", secIds[0], "Sell", 300, users[1], companies[1]});
+    ASSERT_EQ(cache.getMatchingSizeForSecurity(secIds[0]), 100u);
+    cache.cancelOrdersForSecIdWithMinimumQty(secIds[0], 100);
+    records = FlightRecorder::snapshot();
+    if (!FlightRecorder::kCacheInstrumented) {
+        ASSERT_TRUE(records.empty());
+        return;
+    }
+    ASSERT_EQ(records.size(), 5u);
+    ASSERT_EQ(records[0].op, LatencyOp::Add);
+    ASSERT_EQ(records[0].keyHash, FlightRecorder::keyHash("OrdId1"));
+    ASSERT_NE(records[0].keyHash, records[2].keyHash);
+    ASSERT_EQ(records[0].result, 1u);
+    ASSERT_EQ(records[1].result, 0u); // Duplicate rejected
+    ASSERT_EQ(records[3].op, LatencyOp::Match);
+    ASSERT_EQ(records[3].result, 100u);
+    ASSERT_EQ(records[4].op, LatencyOp::CancelSecurity);
+    ASSERT_EQ(records[4].result, 2u);
+    ASSERT_GE(records[0].ageNs, records[4].ageNs);
+    ASSERT_GT(records[4].durationNs, 0u);
+}
+
+// Memory accounting: every structure grows with the book, long fields count their heap
+TEST_F(OrderCacheTest, MemoryUsage_GrowsWithBookAndCountsHeapStrings) {
+    CHECK_GLOBAL_FAILURE_FLAG();
+
+    const OrderCacheMemory empty = cache.memoryUsage();
+    EXPECT_EQ(empty.orderStrings, 0u);
+
+    for (const auto& order : generateOrders(10000)) {
+        cache.addOrder(order);
+    }
+    const OrderCacheMemory filled = cache.memoryUsage();
+    EXPECT_GE(filled.orderPool, 10000 * sizeof(void*) * 4);
+    EXPECT_GT(filled.idIndex, empty.idIndex);
+    EXPECT_GT(filled.userIndex, empty.userIndex);
+    EXPECT_GT(filled.securityIndex, empty.securityIndex);
+    EXPECT_EQ(filled.orderStrings, 0u);     // Generated fields all fit the inline buffer
+    EXPECT_GT(filled.total(), empty.total());
+
+    const std::string longUser(200, 'u');
+    cache.addOrder(Order{"LongOrder", "SecId1", "Buy", 100, longUser, "Comp1"});
+    const OrderCacheMemory withLong = cache.memoryUsage();
+    EXPECT_GE(withLong.orderStrings, longUser.size());
+    EXPECT_GE(withLong.userIndex, filled.userIndex + longUser.size());
+}
+
 // Performance: Add and match 1,000 orders
 TEST_F(OrderCacheTest, Performance_SmallDataset_1KOrders) {
     CHECK_GLOBAL_FAILURE_FLAG();
@@ -0,0 +1,344 @@
+// Tiered storage for the OrderCache class: idle books are spilled to segment files
+#include "OrderCache.h"
+#include "Crc32.h"
+#include "MappedFile.h"
+#include "SpanTrace.h"
+#include "Varint.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unordered_set>
+
+namespace {
+
+// Segment file, one per spilled book. Segments are a cache of data that snapshots and the
+// journal already make durable, so they are written without syncing.
+//
+//   SegmentHeader
+//   orderCount x { varint isBuy, varint qty, 3 x { varint length, bytes } }
+//
+// The strings are order id, user and company; the security is implied by the segment.
+struct SegmentHeader {
+    char     magic[8];
+    uint32_t orderCount;
+    uint32_t payloadCrc;
+    uint64_t payloadSize;
+};
+
+constexpr char kSegmentMagic[8] = {'O', 'C', 'S', 'E', 'G', '0', '0', '1'};
+
+static_assert(sizeof(SegmentHeader) == 24, "segment header layout changed");
+
+// Shared by every cache in the process so segment names never collide
+std::atomic<uint64_t> nextSegmentId{0};
+
+void appendString(std::vector<char>& out, const std::string& str) {
+    Varint::append(out, str.size());
+    out.insert(out.end(), str.begin(), str.end());
+}
+
+bool readString(const char*& p, const char* end, std::string_view& str) {
+    uint64_t length = 0;
+    if (!Varint::read(p, end, length) || length == 0 || length > static_cast<uint64_t>(end - p)) {
+        return false;
+    }
+    str = std::string_view(p, length);
+    p += length;
+    return true;
+}
+
+} // namespace
+
+void OrderCache::enableTiering(const std::string& directory, uint64_t idleMutations) {
+    if (directory.empty() || idleMutations == 0) {
+        m_tieringIdleMutations = 0;
+        m_securityLastUse.clear();
+
+        std::vector<std::string> spilled;
+        spilled.reserve(m_spilledSecurities.size());
+        for (const auto& entry : m_spilledSecurities) {
+            spilled.push_back(entry.first);
+        }
+        for (const std::string& securityId : spilled) {
+            faultInSecurity(securityId);
+        }
+        return;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    m_tieringDirectory = directory;
+    m_tieringIdleMutations = idleMutations;
+    m_nextSpillScan = m_version + idleMutations;
+
+    // Every resident book starts its idle clock now
+    for (const auto& entry : m_ordersBySecId) {
+        m_securityLastUse.try_emplace(entry.first, m_version);
+    }
+    for (const auto& entry : m_pendingSecurities) {
+        m_securityLastUse.try_emplace(entry.first, m_version);
+    }
+    for (const auto& entry : m_imageSecurities) {
+        m_securityLastUse.try_emplace(entry.first, m_version);
+    }
+}
+
+size_t OrderCache::spillIdleSecurities() {
+    if (m_tieringIdleMutations == 0) {
+        return 0;
+    }
+    m_nextSpillScan = m_version + std::max<uint64_t>(m_tieringIdleMutations / 2, 1);
+
+    // Forget books that are gone; a book seen for the first time starts its idle clock now
+    for (auto it = m_securityLastUse.begin(); it != m_securityLastUse.end();) {
+        if (m_ordersBySecId.count(it->first) == 0 && m_pendingSecurities.count(it->first) == 0 &&
+            m_imageSecurities.count(it->first) == 0) {
+            it = m_securityLastUse.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    std::vector<std::string> idle;
+    auto consider = [&](const std::string& securityId) {
+        auto [it, inserted] = m_securityLastUse.try_emplace(securityId, m_version);
+        if (!inserted && m_version - it->second > m_tieringIdleMutations) {
+            idle.push_back(securityId);
+        }
+    };
+    for (const auto& entry : m_ordersBySecId) {
+        consider(entry.first);
+    }
+    for (const auto& entry : m_pendingSecurities) {
+        consider(entry.first);
+    }
+    for (const auto& entry : m_imageSecurities) {
+        consider(entry.first);
+    }
+
+    size_t spilled = 0;
+    for (const std::string& securityId : idle) {
+        spilled += spillSecurity(securityId) ? 1 : 0;
+    }
+    return spilled;
+}
+
+bool OrderCache::spillSecurity(const std::string& securityId) {
+    materializeSecurity(securityId);
+    auto secIt = m_ordersBySecId.find(securityId);
+    if (secIt == m_ordersBySecId.end() || secIt->second.empty()) {
+        return false;
+    }
+    const std::vector<InternalOrder*> orders = std::move(secIt->second);
+
+    SpilledSecurity spilled;
+    spilled.orderCount = static_cast<uint32_t>(orders.size());
+    std::unordered_set<std::string_view> users;
+
+    std::vector<char> buffer(sizeof(SegmentHeader));
+    buffer.reserve(orders.size() * 32 + sizeof(SegmentHeader));
+    for (const InternalOrder* orderPtr : orders) {
+        (orderPtr->isBuy ? spilled.buyQty : spilled.sellQty) += orderPtr->qty;
+        if (users.insert(orderPtr->user).second) {
+            spilled.users.push_back(orderPtr->user);
+        }
+        Varint::append(buffer, orderPtr->isBuy ? 1 : 0);
+        Varint::append(buffer, orderPtr->qty);
+        appendString(buffer, orderPtr->orderId);
+        appendString(buffer, orderPtr->user);
+        appendString(buffer, orderPtr->company);
+    }
+
+    SegmentHeader header{};
+    std::memcpy(header.magic, kSegmentMagic, sizeof(header.magic));
+    header.orderCount = spilled.orderCount;
+    header.payloadSize = buffer.size() - sizeof(SegmentHeader);
+    header.payloadCrc = Crc32::compute(buffer.data() + sizeof(SegmentHeader), header.payloadSize);
+    std::memcpy(buffer.data(), &header, sizeof(header));
+
+    spilled.segmentPath = (std::filesystem::path(m_tieringDirectory) /
+                           ("segment-" + std::to_string(nextSegmentId++) + ".bin")).string();
+    {
+        std::ofstream out(spilled.segmentPath, std::ios::binary | std::ios::trunc);
+        if (!out.write(buffer.data(), static_cast<std::streamsize>(buffer.size())) || !out.flush()) {
+            out.close();
+            std::remove(spilled.segmentPath.c_str());
+            secIt->second = orders; // Keep the book resident
+            return false;
+        }
+    }
+
+    // The book is on disk; drop it from every index and free its orders
+    m_ordersBySecId.erase(secIt);
+    m_securityLastUse.erase(securityId);
+    auto [spilledIt, inserted] = m_spilledSecurities.emplace(securityId, std::move(spilled));
+    const std::string* key = &spilledIt->first;
+
+    const std::unordered_set<const InternalOrder*> leaving(orders.begin(), orders.end());
+    for (const std::string& user : spilledIt->second.users) {
+        materializeUser(user);
+        auto userIt = m_ordersByUser.find(user);
+        if (userIt != m_ordersByUser.end()) {
+            auto& userOrders = userIt->second;
+            userOrders.erase(std::remove_if(userOrders.begin(), userOrders.end(),
+                                            [&leaving](const InternalOrder* order) { return leaving.count(order) != 0; }),
+                             userOrders.end());
+            if (userOrders.empty()) {
+                m_ordersByUser.erase(userIt);
+            }
+        }
+        m_spilledByUser[user].push_back(key);
+    }
+
+    for (InternalOrder* orderPtr : orders) {
+        if (m_orderedIndexEnabled) {
+            removeFromOrderedIndex(orderPtr);
+        }
+        m_orders.erase(orderPtr->orderId);
+        m_spilledOrders.emplace(orderPtr->orderId, key);
+        m_pool.recycle(orderPtr);
+    }
+    return true;
+}
+
+bool OrderCache::faultInSecurity(const std::string& securityId) {
+    auto spilledIt = m_spilledSecurities.find(securityId);
+    if (spilledIt == m_spilledSecurities.end()) {
+        return false;
+    }
+
+    TRACE_SPAN("fault-in");
+
+    // Callers may pass a reference into the spilled maps, which are about to change
+    const std::string id = securityId;
+    std::vector<InternalOrder> orders;
+    orders.reserve(spilledIt->second.orderCount);
+    if (!readSpilledSecurity(id, orders)) {
+        return false; // Unreadable segment: the book stays spilled
+    }
+    SpilledSecurity spilled = std::move(spilledIt->second);
+    const std::string* key = &spilledIt->first;
+
+    for (const std::string& user : spilled.users) {
+        auto userIt = m_spilledByUser.find(user);
+        if (userIt != m_spilledByUser.end()) {
+            auto& securities = userIt->second;
+            securities.erase(std::remove(securities.begin(), securities.end(), key), securities.end());
+            if (securities.empty()) {
+                m_spilledByUser.erase(userIt);
+            }
+        }
+    }
+    for (const InternalOrder& order : orders) {
+        m_spilledOrders.erase(order.orderId);
+    }
+    m_spilledSecurities.erase(spilledIt);
+
+    auto& secOrders = m_ordersBySecId[id];
+    secOrders.reserve(orders.size());
+    for (InternalOrder& order : orders) {
+        InternalOrder* orderPtr = m_pool.acquire(std::move(order));
+        m_orders.try_emplace(orderPtr->orderId, orderPtr);
+        secOrders.push_back(orderPtr);
+        touchUser(orderPtr->user);
+        m_ordersByUser[orderPtr->user].push_back(orderPtr);
+        if (m_orderedIndexEnabled) {
+            addToOrderedIndex(orderPtr);
+        }
+    }
+    if (m_tieringIdleMutations != 0) {
+        m_securityLastUse[id] = m_version;
+    }
+
+    retireSegment(std::move(spilled.segmentPath));
+    return true;
+}
+
+void OrderCache::faultInUser(const std::string& user) {
+    auto userIt = m_spilledByUser.find(user);
+    if (userIt == m_spilledByUser.end()) {
+        return;
+    }
+
+    std::vector<std::string> securities;
+    securities.reserve(userIt->second.size());
+    for (const std::string* securityId : userIt->second) {
+        securities.push_back(*securityId);
+    }
+    for (const std::string& securityId : securities) {
+        faultInSecurity(securityId);
+    }
+}
+
+bool OrderCache::readSpilledSecurity(const std::string& securityId, std::vector<InternalOrder>& orders) const {
+    auto spilledIt = m_spilledSecurities.find(securityId);
+    if (spilledIt == m_spilledSecurities.end()) {
+        return false;
+    }
+
+    MappedFile file;
+    if (!file.open(spilledIt->second.segmentPath) || file.size() < sizeof(SegmentHeader)) {
+        return false;
+    }
+
+    SegmentHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    const char* p = file.data() + sizeof(SegmentHeader);
+    const char* const end = file.data() + file.size();
+    if (std::memcmp(header.magic, kSegmentMagic, sizeof(header.magic)) != 0 ||
+        header.payloadSize != file.size() - sizeof(SegmentHeader) ||
+        header.orderCount != spilledIt->second.orderCount ||
+        Crc32::compute(p, header.payloadSize) != header.payloadCrc) {
+        return false;
+    }
+
+    const size_t first = orders.size();
+    for (uint32_t i = 0; i < header.orderCount; ++i) {
+        uint64_t isBuy = 0;
+        uint64_t qty = 0;
+        std::string_view orderId;
+        std::string_view user;
+        std::string_view company;
+        if (!Varint::read(p, end, isBuy) || isBuy > 1 || !Varint::read(p, end, qty) || qty == 0 ||
+            qty > UINT32_MAX || !readString(p, end, orderId) || !readString(p, end, user) ||
+            !readString(p, end, company)) {
+            orders.erase(orders.begin() + static_cast<std::ptrdiff_t>(first), orders.end());
+            return false;
+        }
+        orders.emplace_back(orderId, securityId, isBuy != 0, static_cast<unsigned int>(qty), user, company);
+    }
+    return true;
+}
+
+void OrderCache::dropSpilledSecurities() {
+    for (auto& entry : m_spilledSecurities) {
+        retireSegment(std::move(entry.second.segmentPath));
+    }
+    m_spilledSecurities.clear();
+    m_spilledOrders.clear();
+    m_spilledByUser.clear();
+    m_securityLastUse.clear();
+}
+
+void OrderCache::retireSegment(std::string path) {
+    m_retiredSegments.push_back(std::move(path));
+#ifdef __linux__
+    if (m_checkpointPid > 0) {
+        return; // The checkpoint child may still read it; deleted once the child is done
+    }
+#endif
+    purgeRetiredSegments();
+}
+
+void OrderCache::purgeRetiredSegments() {
+    if (!m_ownsSegments) {
+        return;
+    }
+    for (const std::string& path : m_retiredSegments) {
+        std::remove(path.c_str());
+    }
+    m_retiredSegments.clear();
+}
@@ -0,0 +1,442 @@
+// Implementation of the OrderJournal class
+#include "OrderJournal.h"
+#include "Crc32.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#ifdef _WIN32
+    #include <io.h>
+    #include <fcntl.h>
+    #define JOURNAL_OPEN(path)        ::_open(path, _O_RDWR | _O_CREAT | _O_BINARY, 0644)
+    #define JOURNAL_WRITE(fd, p, n)   ::_write(fd, p, static_cast<unsigned int>(n))
+    #define JOURNAL_SYNC(fd)          ::_commit(fd)
+    #define JOURNAL_TRUNCATE(fd, n)   ::_chsize_s(fd, static_cast<long long>(n))
+    #define JOURNAL_SEEK_END(fd)      ::_lseeki64(fd, 0, SEEK_END)
+    #define JOURNAL_CLOSE(fd)         ::_close(fd)
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #define JOURNAL_OPEN(path)        ::open(path, O_RDWR | O_CREAT, 0644)
+    #define JOURNAL_WRITE(fd, p, n)   ::write(fd, p, n)
+    #define JOURNAL_TRUNCATE(fd, n)   ::ftruncate(fd, static_cast<off_t>(n))
+    #define JOURNAL_SEEK_END(fd)      ::lseek(fd, 0, SEEK_END)
+    #define JOURNAL_CLOSE(fd)         ::close(fd)
+    #if defined(__APPLE__)
+        #define JOURNAL_SYNC(fd)      ::fsync(fd)
+    #else
+        #define JOURNAL_SYNC(fd)      ::fdatasync(fd)
+    #endif
+#endif
+
+namespace {
+
+// Walk the records of a mapped journal, calling `apply` for each complete one. Returns the
+// offset just past the last good record, or 0 if the file header is not recognised.
+// With `stopAfter` set, stops at the first record whose version is greater than it.
+size_t scanRecords(const char* data, size_t size, const OrderJournal::ReplayFn* apply, uint64_t& lastVersion,
+                   uint64_t stopAfter = UINT64_MAX) {
+    JournalFileHeader fileHeader;
+    if (size < sizeof(fileHeader)) {
+        return 0;
+    }
+    std::memcpy(&fileHeader, data, sizeof(fileHeader));
+    if (std::memcmp(fileHeader.magic, kJournalMagic, sizeof(fileHeader.magic)) != 0 ||
+        fileHeader.formatVersion != kJournalFormatVersion) {
+        return 0;
+    }
+
+    return sizeof(fileHeader) + OrderJournal::decodeRecords(data + sizeof(fileHeader), size - sizeof(fileHeader),
+                                                            apply, lastVersion, stopAfter);
+}
+
+} // namespace
+
+void OrderJournal::encodeRecord(std::vector<char>& out, ChangeType type, uint64_t version, const OrderView& order) {
+    const bool isAdd = type == ChangeType::Add;
+
+    JournalRecordBody body{};
+    body.version = version;
+    body.qty = order.qty;
+    body.type = static_cast<uint8_t>(type);
+    body.isBuy = (!order.side.empty() && order.side[0] == 'B') ? 1 : 0;
+    body.orderIdLength = static_cast<uint32_t>(order.orderId.size());
+    body.securityIdLength = isAdd ? static_cast<uint32_t>(order.securityId.size()) : 0;
+    body.userLength = isAdd ? static_cast<uint32_t>(order.user.size()) : 0;
+    body.companyLength = isAdd ? static_cast<uint32_t>(order.company.size()) : 0;
+
+    const size_t payloadSize = sizeof(body) + body.orderIdLength + body.securityIdLength +
+                               body.userLength + body.companyLength;
+    const size_t start = out.size();
+    out.resize(start + sizeof(JournalRecordHeader) + payloadSize);
+
+    char* payload = out.data() + start + sizeof(JournalRecordHeader);
+    char* cursor = payload;
+    std::memcpy(cursor, &body, sizeof(body));
+    cursor += sizeof(body);
+    std::memcpy(cursor, order.orderId.data(), body.orderIdLength);
+    cursor += body.orderIdLength;
+    if (isAdd) {
+        std::memcpy(cursor, order.securityId.data(), body.securityIdLength);
+        cursor += body.securityIdLength;
+        std::memcpy(cursor, order.user.data(), body.userLength);
+        cursor += body.userLength;
+        std::memcpy(cursor, order.company.data(), body.companyLength);
+    }
+
+    const JournalRecordHeader header{static_cast<uint32_t>(payloadSize), Crc32::compute(payload, payloadSize)};
+    std::memcpy(out.data() + start, &header, sizeof(header));
+}
+
+size_t OrderJournal::decodeRecords(const char* data, size_t size, const ReplayFn* apply, uint64_t& lastVersion,
+                                   uint64_t stopAfter) {
+    size_t offset = 0;
+    while (size - offset >= sizeof(JournalRecordHeader) + sizeof(JournalRecordBody)) {
+        JournalRecordHeader recordHeader;
+        std::memcpy(&recordHeader, data + offset, sizeof(recordHeader));
+        const char* payload = data + offset + sizeof(recordHeader);
+        if (recordHeader.length < sizeof(JournalRecordBody) ||
+            recordHeader.length > size - offset - sizeof(recordHeader) ||
+            Crc32::compute(payload, recordHeader.length) != recordHeader.crc) {
+            break; // Torn or corrupt tail
+        }
+
+        JournalRecordBody body;
+        std::memcpy(&body, payload, sizeof(body));
+        const uint64_t stringBytes = uint64_t{body.orderIdLength} + body.securityIdLength +
+                                     body.userLength + body.companyLength;
+        if (sizeof(body) + stringBytes != recordHeader.length ||
+            body.type > static_cast<uint8_t>(ChangeType::Cancel) || body.version <= lastVersion ||
+            body.version > stopAfter) {
+            break;
+        }
+
+        if (apply != nullptr) {
+            const char* str = payload + sizeof(body);
+            OrderView order{};
+            order.orderId = std::string_view(str, body.orderIdLength);
+            str += body.orderIdLength;
+            order.securityId = std::string_view(str, body.securityIdLength);
+            str += body.securityIdLength;
+            order.user = std::string_view(str, body.userLength);
+            str += body.userLength;
+            order.company = std::string_view(str, body.companyLength);
+            order.side = body.isBuy ? "Buy" : "Sell";
+            order.qty = body.qty;
+            (*apply)(static_cast<ChangeType>(body.type), body.version, order);
+        }
+
+        lastVersion = body.version;
+        offset += sizeof(recordHeader) + recordHeader.length;
+    }
+    return offset;
+}
+
+OrderJournal::~OrderJournal() {
+    close();
+}
+
+bool OrderJournal::open(const std::string& path, JournalOptions options) {
+    close();
+
+    const int fd = JOURNAL_OPEN(path.c_str());
+    if (fd < 0) {
+        return false;
+    }
+
+    auto fileSize = JOURNAL_SEEK_END(fd);
+    uint64_t lastVersion = 0;
+    if (fileSize < static_cast<decltype(fileSize)>(sizeof(JournalFileHeader))) {
+        // New journal, or one whose creation was cut short mid-header: (re)write and
+        // persist the file header
+        JournalFileHeader header{};
+        std::memcpy(header.magic, kJournalMagic, sizeof(header.magic));
+        header.formatVersion = kJournalFormatVersion;
+        if ((fileSize > 0 && (JOURNAL_TRUNCATE(fd, 0) != 0 || JOURNAL_SEEK_END(fd) != 0)) ||
+            !writeAll(fd, reinterpret_cast<const char*>(&header), sizeof(header)) || JOURNAL_SYNC(fd) != 0) {
+            JOURNAL_CLOSE(fd);
+            return false;
+        }
+    } else {
+        // Existing journal: keep the complete records and cut off a torn tail
+        MappedFile file;
+        if (!file.open(path)) {
+            JOURNAL_CLOSE(fd);
+            return false;
+        }
+        const size_t validEnd = scanRecords(file.data(), file.size(), nullptr, lastVersion);
+        if (validEnd == 0 ||
+            (validEnd < file.size() && JOURNAL_TRUNCATE(fd, validEnd) != 0) ||
+            JOURNAL_SEEK_END(fd) != static_cast<decltype(fileSize)>(validEnd)) {
+            JOURNAL_CLOSE(fd);
+            return false;
+        }
+    }
+
+    if (!m_io.start([this](uint64_t tag, int64_t result) { onIoComplete(tag, result); },
+                    options.backend, options.queueDepth)) {
+        JOURNAL_CLOSE(fd);
+        return false;
+    }
+
+    m_fd = fd;
+    m_fileOffset = static_cast<uint64_t>(JOURNAL_SEEK_END(fd));
+    m_path = path;
+    m_options = options;
+    m_active.reserve(m_options.groupCommitBytes * 2);
+    m_inFlight.clear();
+    m_spare.clear();
+    m_appendedVersion = lastVersion;
+    m_durableVersion = lastVersion;
+    m_syncRequested = false;
+    m_truncateVersion = 0;
+    m_stop = false;
+    m_failed = false;
+    m_writer = std::thread(&OrderJournal::writerLoop, this);
+    return true;
+}
+
+void OrderJournal::close() {
+    if (m_writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_one();
+        m_writer.join();
+    }
+    m_io.stop();
+
+    if (m_fd >= 0) {
+        JOURNAL_CLOSE(m_fd);
+        m_fd = -1;
+    }
+}
+
+void OrderJournal::append(ChangeType type, uint64_t version, const OrderView& order) {
+    // Encode and checksum outside the lock; only the copy into the batch is serialised
+    static thread_local std::vector<char> scratch;
+    scratch.clear();
+    encodeRecord(scratch, type, version, order);
+
+    bool batchFull = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_fd < 0) {
+            return;
+        }
+        const size_t before = m_active.size();
+        m_active.insert(m_active.end(), scratch.begin(), scratch.end());
+        m_appendedVersion = version;
+        // Wake the writer once, when the batch crosses the size threshold
+        batchFull = before < m_options.groupCommitBytes && m_active.size() >= m_options.groupCommitBytes;
+    }
+    if (batchFull) {
+        m_wake.notify_one();
+    }
+}
+
+bool OrderJournal::sync() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_fd < 0) {
+        return false;
+    }
+
+    const uint64_t target = m_appendedVersion;
+    if ((m_durableVersion < target || m_truncateVersion != 0) && !m_failed) {
+        m_syncRequested = true;
+        m_wake.notify_one();
+        m_committed.wait(lock, [&] {
+            return (m_durableVersion >= target && m_truncateVersion == 0) || m_failed;
+        });
+    }
+    return !m_failed;
+}
+
+void OrderJournal::truncateThrough(uint64_t version) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_fd < 0 || version == 0) {
+            return;
+        }
+        m_truncateVersion = std::max(m_truncateVersion, version);
+    }
+    m_wake.notify_one();
+}
+
+uint64_t OrderJournal::durableVersion() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_durableVersion;
+}
+
+bool OrderJournal::hasFailed() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_failed;
+}
+
+bool OrderJournal::replay(const std::string& path, const ReplayFn& apply) {
+    // A journal cut short before its header was complete holds no records yet
+    std::error_code ec;
+    const uintmax_t fileSize = std::filesystem::file_size(path, ec);
+    if (!ec && fileSize < sizeof(JournalFileHeader)) {
+        return true;
+    }
+    MappedFile file;
+    if (!file.open(path)) {
+        return false;
+    }
+    uint64_t lastVersion = 0;
+    return scanRecords(file.data(), file.size(), &apply, lastVersion) != 0;
+}
+
+void OrderJournal::writerLoop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_wake.wait_for(lock, m_options.groupCommitInterval, [this] {
+            return m_stop || m_syncRequested || m_truncateVersion != 0 ||
+                   m_active.size() >= m_options.groupCommitBytes;
+        });
+        m_syncRequested = false;
+
+        if (!m_active.empty() && m_failed) {
+            m_active.clear(); // The journal is broken; do not pretend to commit
+        } else if (!m_active.empty()) {
+            // Take the whole batch and let appends continue into a recycled buffer
+            const uint64_t version = m_appendedVersion;
+            m_inFlight.emplace_back(version, std::move(m_active));
+            m_active = std::vector<char>();
+            if (!m_spare.empty()) {
+                m_active.swap(m_spare.back());
+                m_spare.pop_back();
+            } else {
+                m_active.reserve(m_options.groupCommitBytes * 2);
+            }
+            const std::vector<char>& batch = m_inFlight.back().second;
+            const uint64_t offset = m_fileOffset;
+            m_fileOffset += batch.size();
+            lock.unlock();
+
+            // One write plus one ordered fdatasync; completions arrive in onIoComplete()
+            const bool ok = m_io.write(m_fd, batch.data(), batch.size(), offset, kWriteTag) &&
+                            m_io.sync(m_fd, version);
+
+            lock.lock();
+            if (!ok) {
+                m_failed = true;
+                m_committed.notify_all();
+            }
+        }
+
+        if (m_truncateVersion != 0) {
+            const uint64_t version = m_truncateVersion;
+            const bool failed = m_failed;
+            lock.unlock();
+            // The rewrite reads the file, so every submitted batch must have landed
+            m_io.drain();
+            const bool ok = failed || rewriteWithoutPrefix(version);
+            lock.lock();
+            if (!ok) {
+                m_failed = true;
+            }
+            if (m_truncateVersion == version) {
+                m_truncateVersion = 0;
+            }
+            m_committed.notify_all();
+        }
+
+        if (m_stop && m_active.empty()) {
+            break;
+        }
+    }
+    lock.unlock();
+    m_io.drain();
+}
+
+void OrderJournal::onIoComplete(uint64_t tag, int64_t result) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (result < 0) {
+        m_failed = true;
+    } else if (tag != kWriteTag) {
+        // A completed sync covers every batch submitted before it
+        m_durableVersion = std::max(m_durableVersion, tag);
+        while (!m_inFlight.empty() && m_inFlight.front().first <= tag) {
+            std::vector<char> buffer = std::move(m_inFlight.front().second);
+            m_inFlight.pop_front();
+            buffer.clear();
+            m_spare.push_back(std::move(buffer));
+        }
+    }
+    m_committed.notify_all();
+}
+
+bool OrderJournal::writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        const auto written = JOURNAL_WRITE(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+bool OrderJournal::rewriteWithoutPrefix(uint64_t version) {
+    // Everything up to the current end of file has been committed by this thread
+    size_t keepFrom = 0;
+    size_t fileEnd = 0;
+    {
+        MappedFile file;
+        if (!file.open(m_path)) {
+            return false;
+        }
+        uint64_t lastVersion = 0;
+        keepFrom = scanRecords(file.data(), file.size(), nullptr, lastVersion, version);
+        fileEnd = file.size();
+        if (keepFrom == 0) {
+            return false;
+        }
+        if (keepFrom == sizeof(JournalFileHeader)) {
+            return true; // Nothing old enough to drop
+        }
+
+        // New file: header plus the retained tail, made durable before it replaces the journal
+        const std::string tmpPath = m_path + ".tmp";
+        const int tmpFd = JOURNAL_OPEN(tmpPath.c_str());
+        if (tmpFd < 0) {
+            return false;
+        }
+        const int liveFd = m_fd;
+        const bool ok = JOURNAL_TRUNCATE(tmpFd, 0) == 0 &&
+                        writeAll(tmpFd, file.data(), sizeof(JournalFileHeader)) &&
+                        writeAll(tmpFd, file.data() + keepFrom, fileEnd - keepFrom) &&
+                        JOURNAL_SYNC(tmpFd) == 0;
+        if (!ok) {
+            JOURNAL_CLOSE(tmpFd);
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+
+#ifdef _WIN32
+        // Windows cannot rename over an open file; close the live journal first
+        JOURNAL_CLOSE(liveFd);
+        std::remove(m_path.c_str());
+#endif
+        if (std::rename(tmpPath.c_str(), m_path.c_str()) != 0) {
+            JOURNAL_CLOSE(tmpFd);
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+#ifndef _WIN32
+        JOURNAL_CLOSE(liveFd);
+#endif
+        m_fd = tmpFd;
+        m_fileOffset = sizeof(JournalFileHeader) + (fileEnd - keepFrom);
+    }
+    return true;
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "OrderCache.h"
+#include "AsyncFileWriter.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// On-disk layout of the mutation journal. All integers are little-endian, as written by
+// the host.
+//
+//   JournalFileHeader
+//   records          { JournalRecordHeader, payload }...
+//
+// A record payload is a JournalRecordBody followed by the order id, security id, user and
+// company bytes (only the order id for cancels). Replay stops at the first short or
+// corrupt record, which is how a write torn by a crash shows up.
+
+constexpr char     kJournalMagic[8]      = {'O', 'C', 'J', 'R', 'N', 'L', '0', '1'};
+constexpr uint32_t kJournalFormatVersion = 1;
+
+struct JournalFileHeader {
+    char     magic[8];
+    uint32_t formatVersion;
+    uint32_t reserved;
+};
+
+struct JournalRecordHeader {
+    uint32_t length;           // payload bytes
+    uint32_t crc;              // CRC-32 of the payload
+};
+
+struct JournalRecordBody {
+    uint64_t version;          // cache version produced by this mutation
+    uint32_t qty;
+    uint8_t  type;             // ChangeType
+    uint8_t  isBuy;
+    uint16_t reserved;
+    uint32_t orderIdLength;
+    uint32_t securityIdLength;
+    uint32_t userLength;
+    uint32_t companyLength;
+};
+
+static_assert(sizeof(JournalFileHeader) == 16, "journal header layout changed");
+static_assert(sizeof(JournalRecordBody) == 32, "journal record layout changed");
+
+// Group commit thresholds: a batch goes to disk once it holds `groupCommitBytes` or once
+// `groupCommitInterval` has passed since the last commit, whichever comes first. Up to
+// `queueDepth` writes and syncs are kept in flight on the chosen I/O backend.
+struct JournalOptions {
+    size_t groupCommitBytes = 256 * 1024;
+    std::chrono::milliseconds groupCommitInterval{2};
+    IoBackend backend = IoBackend::Auto;
+    unsigned queueDepth = 8;
+};
+
+// Append-only journal of cache mutations with group commit. append() only encodes the
+// record into an in-memory buffer under a short lock; a background thread hands each
+// batch to an AsyncFileWriter as one write plus one fdatasync (io_uring where available)
+// and goes straight back to collecting the next batch while earlier ones are in flight.
+class OrderJournal
+{
+ public:
+
+  OrderJournal() = default;
+  OrderJournal(const OrderJournal&) = delete;
+  OrderJournal& operator=(const OrderJournal&) = delete;
+  ~OrderJournal();
+
+  // Open (or create) the journal at `path` for appending. A torn tail left by a crash is
+  // cut off first so new records follow the last complete one; a file shorter than the
+  // header (a crash while it was created) starts over as a new journal.
+  bool open(const std::string& path, JournalOptions options = {});
+
+  // Commit everything still buffered and stop the writer thread
+  void close();
+
+  bool isOpen() const noexcept { return m_fd >= 0; }
+
+  // I/O engine in use while open
+  IoBackend backend() const noexcept { return m_io.backend(); }
+
+  // Hot path: buffer one mutation. `order` only needs the order id for cancels.
+  void append(ChangeType type, uint64_t version, const OrderView& order);
+
+  // Block until every record appended so far is durable; false if a write failed
+  bool sync();
+
+  // Drop the records with version <= `version` (e.g. covered by a checkpoint snapshot).
+  // Runs on the writer thread: the retained tail is copied to a new file that replaces the
+  // journal, while append() keeps buffering. sync() also waits for it to finish.
+  void truncateThrough(uint64_t version);
+
+  // Highest version known to be on stable storage
+  uint64_t durableVersion() const;
+
+  // True once a write or fdatasync has failed; later commits are dropped
+  bool hasFailed() const;
+
+  using ReplayFn = std::function<void(ChangeType type, uint64_t version, const OrderView& order)>;
+
+  // Decode the journal at `path` in order. Returns false if the file is missing or not a
+  // journal; a torn tail simply ends the replay and a partial header holds no records.
+  static bool replay(const std::string& path, const ReplayFn& apply);
+
+  // Record codec, shared with log shipping. encodeRecord() appends one record to `out`;
+  // decodeRecords() walks a run of records (no file header), calling `apply` for each
+  // complete one whose version is above `lastVersion` and at most `stopAfter`, and returns
+  // the bytes consumed. A short, corrupt or out-of-order record ends the walk.
+  static void encodeRecord(std::vector<char>& out, ChangeType type, uint64_t version, const OrderView& order);
+  static size_t decodeRecords(const char* data, size_t size, const ReplayFn* apply, uint64_t& lastVersion,
+                              uint64_t stopAfter = UINT64_MAX);
+
+ private:
+
+  void writerLoop();
+  void onIoComplete(uint64_t tag, int64_t result);
+  static bool writeAll(int fd, const char* data, size_t size);
+  bool rewriteWithoutPrefix(uint64_t version);
+
+  // Completion tag for batch writes; syncs are tagged with the version they make durable
+  static constexpr uint64_t kWriteTag = UINT64_MAX;
+
+  std::string m_path;
+  JournalOptions m_options;
+  int m_fd = -1;
+  uint64_t m_fileOffset = 0;             // end of the journal, owned by the writer thread
+  AsyncFileWriter m_io;
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_wake;        // writer: batch ready, sync requested or stopping
+  std::condition_variable m_committed;   // sync() callers: durable version advanced
+  std::vector<char> m_active;            // filled by append()
+  std::deque<std::pair<uint64_t, std::vector<char>>> m_inFlight;  // submitted batches by version
+  std::vector<std::vector<char>> m_spare;                          // recycled batch buffers
+  uint64_t m_appendedVersion = 0;
+  uint64_t m_durableVersion = 0;
+  bool m_syncRequested = false;
+  uint64_t m_truncateVersion = 0;        // pending truncateThrough() request, 0 if none
+  bool m_stop = false;
+  bool m_failed = false;
+  std::thread m_writer;
+
+};
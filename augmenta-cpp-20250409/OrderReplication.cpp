@@ -0,0 +1,481 @@
+// Implementation of log shipping between OrderCache instances
+#include "OrderReplication.h"
+#include "OrderJournal.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifndef _WIN32
+    #include <cerrno>
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <sys/time.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+#endif
+
+#ifdef MSG_NOSIGNAL
+    #define REPLICATION_SEND_FLAGS MSG_NOSIGNAL
+#else
+    #define REPLICATION_SEND_FLAGS 0
+#endif
+
+namespace {
+
+// Time the leader waits for a new follower's hello, and for a stalled follower to drain
+// its socket before giving up on it
+constexpr int kHelloTimeoutMs = 1000;
+constexpr int kSendTimeoutSec = 1;
+
+#ifndef _WIN32
+
+bool makeAddress(const std::string& socketPath, sockaddr_un& address) {
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    std::memcpy(address.sun_path, socketPath.data(), socketPath.size());
+    return true;
+}
+
+int openSocket() {
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+#ifdef SO_NOSIGPIPE
+    if (fd >= 0) {
+        const int on = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+    }
+#endif
+    return fd;
+}
+
+bool sendAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        const auto sent = ::send(fd, data, size, REPLICATION_SEND_FLAGS);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+bool recvAll(int fd, char* data, size_t size) {
+    while (size > 0) {
+        const auto received = ::recv(fd, data, size, 0);
+        if (received == 0) {
+            return false; // Peer closed
+        }
+        if (received < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += received;
+        size -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+bool sendFrame(int fd, const char* records, size_t size, uint64_t leaderVersion) {
+    const ReplicationFrameHeader header{static_cast<uint32_t>(size), 0, leaderVersion};
+    return sendAll(fd, reinterpret_cast<const char*>(&header), sizeof(header)) &&
+           (size == 0 || sendAll(fd, records, size));
+}
+
+#endif
+
+} // namespace
+
+// ---------------------------------------------------------------------------------------
+// ReplicationLeader
+// ---------------------------------------------------------------------------------------
+
+ReplicationLeader::~ReplicationLeader() {
+    close();
+}
+
+#ifdef _WIN32
+
+bool ReplicationLeader::listen(const std::string&, ReplicationOptions) {
+    return false; // Unix domain sockets only
+}
+
+void ReplicationLeader::close() {}
+
+#else
+
+bool ReplicationLeader::listen(const std::string& socketPath, ReplicationOptions options) {
+    close();
+
+    sockaddr_un address;
+    if (!makeAddress(socketPath, address)) {
+        return false;
+    }
+    const int fd = openSocket();
+    if (fd < 0) {
+        return false;
+    }
+    ::unlink(socketPath.c_str());
+    if (::bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+        ::listen(fd, 1) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    m_socketPath = socketPath;
+    m_options = options;
+    m_listenFd = fd;
+    m_backlog.clear();
+    m_backlogSize = 0;
+    m_backlogFloor = m_cache.getVersion();
+    m_active.clear();
+    m_appendedVersion = m_backlogFloor;
+    m_ackedVersion.store(m_backlogFloor, std::memory_order_release);
+    m_stop = false;
+    m_server = std::thread(&ReplicationLeader::serverLoop, this);
+    m_cache.attachReplication(this);
+    return true;
+}
+
+void ReplicationLeader::close() {
+    if (m_listenFd < 0) {
+        return;
+    }
+    m_cache.attachReplication(nullptr);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_one();
+    m_server.join();
+
+    dropFollower();
+    ::close(m_listenFd);
+    m_listenFd = -1;
+    ::unlink(m_socketPath.c_str());
+    m_backlog.clear();
+    m_backlogSize = 0;
+}
+
+#endif
+
+void ReplicationLeader::append(ChangeType type, uint64_t version, const OrderView& order) {
+    // Encode outside the lock, like the journal; only the copy into the batch is serialised
+    static thread_local std::vector<char> scratch;
+    scratch.clear();
+    OrderJournal::encodeRecord(scratch, type, version, order);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_active.empty()) {
+        m_activeFirstVersion = version;
+    }
+    m_active.insert(m_active.end(), scratch.begin(), scratch.end());
+    m_appendedVersion = version;
+}
+
+uint64_t ReplicationLeader::appendedVersion() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_appendedVersion;
+}
+
+uint64_t ReplicationLeader::lag() const {
+    const uint64_t acked = ackedVersion();
+    const uint64_t appended = appendedVersion();
+    return appended > acked ? appended - acked : 0;
+}
+
+#ifndef _WIN32
+
+void ReplicationLeader::serverLoop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stop) {
+        m_wake.wait_for(lock, m_options.batchInterval, [this] { return m_stop; });
+
+        // Seal the current batch into the backlog and let appends start a new one
+        Batch batch{m_activeFirstVersion, m_appendedVersion, std::move(m_active)};
+        m_active = std::vector<char>();
+        lock.unlock();
+
+        if (!batch.records.empty()) {
+            m_backlogSize += batch.records.size();
+            m_backlog.push_back(std::move(batch));
+            while (m_backlogSize > m_options.backlogBytes && m_backlog.size() > 1) {
+                m_backlogFloor = m_backlog.front().lastVersion;
+                m_backlogSize -= m_backlog.front().records.size();
+                m_backlog.pop_front();
+            }
+        }
+
+        if (m_followerFd < 0) {
+            acceptFollower();
+        }
+        if (m_followerFd >= 0) {
+            readAcks();
+        }
+        if (m_followerFd >= 0 && !sendPending()) {
+            dropFollower();
+        }
+
+        lock.lock();
+    }
+}
+
+void ReplicationLeader::acceptFollower() {
+    pollfd listening{m_listenFd, POLLIN, 0};
+    if (::poll(&listening, 1, 0) <= 0) {
+        return;
+    }
+    const int fd = ::accept(m_listenFd, nullptr, nullptr);
+    if (fd < 0) {
+        return;
+    }
+
+    ReplicationHello hello{};
+    pollfd follower{fd, POLLIN, 0};
+    if (::poll(&follower, 1, kHelloTimeoutMs) <= 0 ||
+        !recvAll(fd, reinterpret_cast<char*>(&hello), sizeof(hello)) ||
+        std::memcmp(hello.magic, kReplicationMagic, sizeof(hello.magic)) != 0 ||
+        hello.version < m_backlogFloor || hello.version > appendedVersion()) {
+        // Not a follower, or one this backlog cannot bring up to date
+        ::close(fd);
+        return;
+    }
+
+    const timeval sendTimeout{kSendTimeoutSec, 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+#ifdef SO_NOSIGPIPE
+    const int on = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+    m_followerFd = fd;
+    m_sentVersion = hello.version;
+    m_lastSend = std::chrono::steady_clock::time_point{}; // Announce our version right away
+    m_ackedVersion.store(hello.version, std::memory_order_release);
+    m_hasFollower.store(true, std::memory_order_release);
+}
+
+bool ReplicationLeader::sendPending() {
+    if (m_sentVersion < m_backlogFloor) {
+        return false; // Fell behind the backlog; it has to be re-seeded
+    }
+
+    const uint64_t leaderVersion = appendedVersion();
+    bool sent = false;
+    for (const Batch& batch : m_backlog) {
+        if (batch.lastVersion <= m_sentVersion) {
+            continue;
+        }
+        const char* records = batch.records.data();
+        size_t size = batch.records.size();
+        if (batch.firstVersion <= m_sentVersion) {
+            // The follower joined mid-batch: skip the records it already has
+            uint64_t lastVersion = 0;
+            const size_t skip = OrderJournal::decodeRecords(records, size, nullptr, lastVersion, m_sentVersion);
+            records += skip;
+            size -= skip;
+        }
+        if (!sendFrame(m_followerFd, records, size, leaderVersion)) {
+            return false;
+        }
+        m_sentVersion = batch.lastVersion;
+        sent = true;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    if (sent) {
+        m_lastSend = now;
+    } else if (now - m_lastSend >= m_options.heartbeatInterval) {
+        if (!sendFrame(m_followerFd, nullptr, 0, leaderVersion)) {
+            return false;
+        }
+        m_lastSend = now;
+    }
+    return true;
+}
+
+void ReplicationLeader::readAcks() {
+    // Acks are 8-byte versions; only the newest complete one matters
+    char buffer[512];
+    for (;;) {
+        std::memcpy(buffer, m_ackPartial, m_ackFill);
+        const auto received = ::recv(m_followerFd, buffer + m_ackFill, sizeof(buffer) - m_ackFill, MSG_DONTWAIT);
+        if (received == 0) {
+            dropFollower();
+            return;
+        }
+        if (received < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                dropFollower();
+            }
+            return;
+        }
+
+        const size_t total = m_ackFill + static_cast<size_t>(received);
+        const size_t complete = total / sizeof(uint64_t);
+        if (complete > 0) {
+            uint64_t acked = 0;
+            std::memcpy(&acked, buffer + (complete - 1) * sizeof(uint64_t), sizeof(acked));
+            m_ackedVersion.store(acked, std::memory_order_release);
+        }
+        m_ackFill = total % sizeof(uint64_t);
+        std::memcpy(m_ackPartial, buffer + complete * sizeof(uint64_t), m_ackFill);
+    }
+}
+
+void ReplicationLeader::dropFollower() {
+    if (m_followerFd >= 0) {
+        ::close(m_followerFd);
+        m_followerFd = -1;
+    }
+    m_ackFill = 0;
+    m_hasFollower.store(false, std::memory_order_release);
+}
+
+#endif
+
+// ---------------------------------------------------------------------------------------
+// ReplicationFollower
+// ---------------------------------------------------------------------------------------
+
+ReplicationFollower::~ReplicationFollower() {
+    disconnect();
+}
+
+uint64_t ReplicationFollower::lag() const noexcept {
+    const uint64_t leader = leaderVersion();
+    const uint64_t applied = appliedVersion();
+    return leader > applied ? leader - applied : 0;
+}
+
+#ifdef _WIN32
+
+bool ReplicationFollower::connect(const std::string&) {
+    return false; // Unix domain sockets only
+}
+
+void ReplicationFollower::disconnect() {}
+
+void ReplicationFollower::sendAck() {}
+
+#else
+
+bool ReplicationFollower::connect(const std::string& socketPath) {
+    disconnect();
+
+    sockaddr_un address;
+    if (!makeAddress(socketPath, address)) {
+        return false;
+    }
+    const int fd = openSocket();
+    if (fd < 0) {
+        return false;
+    }
+
+    ReplicationHello hello{};
+    std::memcpy(hello.magic, kReplicationMagic, sizeof(hello.magic));
+    hello.version = m_cache.getVersion();
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+        !sendAll(fd, reinterpret_cast<const char*>(&hello), sizeof(hello))) {
+        ::close(fd);
+        return false;
+    }
+
+    m_fd = fd;
+    m_failed = false;
+    m_leaderVersion.store(hello.version, std::memory_order_release);
+    m_connected.store(true, std::memory_order_release);
+    m_receiver = std::thread(&ReplicationFollower::receiveLoop, this);
+    return true;
+}
+
+void ReplicationFollower::disconnect() {
+    if (m_fd < 0) {
+        return;
+    }
+    // Wakes the receiver out of recv()
+    ::shutdown(m_fd, SHUT_RDWR);
+    m_receiver.join();
+    ::close(m_fd);
+    m_fd = -1;
+    m_connected.store(false, std::memory_order_release);
+}
+
+void ReplicationFollower::receiveLoop() {
+    std::vector<char> records;
+    for (;;) {
+        ReplicationFrameHeader header;
+        if (!recvAll(m_fd, reinterpret_cast<char*>(&header), sizeof(header))) {
+            break;
+        }
+        records.resize(header.length);
+        if (header.length != 0 && !recvAll(m_fd, records.data(), records.size())) {
+            break;
+        }
+        if (!records.empty()) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_received.insert(m_received.end(), records.begin(), records.end());
+        }
+        // Published after the records: once leaderVersion() reads v, applyPending() reaches v
+        m_leaderVersion.store(header.leaderVersion, std::memory_order_release);
+    }
+    m_connected.store(false, std::memory_order_release);
+}
+
+void ReplicationFollower::sendAck() {
+    if (m_fd < 0) {
+        return;
+    }
+    const uint64_t version = m_cache.getVersion();
+    sendAll(m_fd, reinterpret_cast<const char*>(&version), sizeof(version)); // A lost ack only delays the lag metric
+}
+
+#endif
+
+size_t ReplicationFollower::applyPending() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_applying.swap(m_received);
+    }
+    if (m_applying.empty()) {
+        return 0;
+    }
+
+    size_t applied = 0;
+    if (!m_failed) {
+        const OrderJournal::ReplayFn apply = [this, &applied](ChangeType type, uint64_t version,
+                                                               const OrderView& order) {
+            if (m_failed || version <= m_cache.getVersion()) {
+                return;
+            }
+            if (version != m_cache.getVersion() + 1) {
+                m_failed = true; // A gap: the follower no longer mirrors the leader
+                return;
+            }
+            m_cache.applyChange(type, version, order);
+            ++applied;
+        };
+        uint64_t lastVersion = 0;
+        if (OrderJournal::decodeRecords(m_applying.data(), m_applying.size(), &apply, lastVersion) !=
+            m_applying.size()) {
+            m_failed = true;
+        }
+    }
+    m_applying.clear();
+
+    if (applied > 0) {
+        sendAck();
+    }
+    return applied;
+}
+
+uint64_t ReplicationFollower::promote() {
+    disconnect();
+    applyPending();
+    return m_cache.getVersion();
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include "OrderCache.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Log shipping between two caches over a local (Unix domain) stream socket. The leader
+// ships the same records the journal writes (OrderJournal::encodeRecord), so a follower
+// applies them exactly like a journal replay and ends up at the leader's version.
+//
+//   follower -> leader   ReplicationHello, then 8-byte acks (highest applied version)
+//   leader -> follower   { ReplicationFrameHeader, journal records }...
+//
+// A frame with no records is a heartbeat that only carries the leader's version.
+
+constexpr char kReplicationMagic[8] = {'O', 'C', 'R', 'E', 'P', 'L', '0', '1'};
+
+struct ReplicationHello {
+    char     magic[8];
+    uint64_t version;          // follower resumes after this version
+};
+
+struct ReplicationFrameHeader {
+    uint32_t length;           // record bytes that follow
+    uint32_t reserved;
+    uint64_t leaderVersion;    // highest version appended on the leader when sent
+};
+
+static_assert(sizeof(ReplicationHello) == 16, "replication hello layout changed");
+static_assert(sizeof(ReplicationFrameHeader) == 16, "replication frame layout changed");
+
+// The leader keeps the last `backlogBytes` of records so a follower that connects (or
+// reconnects) a little behind can catch up; one further behind must be re-seeded from a
+// snapshot. Batches are shipped every `batchInterval`, heartbeats every `heartbeatInterval`.
+struct ReplicationOptions {
+    size_t backlogBytes = 64 * 1024 * 1024;
+    std::chrono::milliseconds batchInterval{1};
+    std::chrono::milliseconds heartbeatInterval{100};
+};
+
+// Leader side. Attaches itself to the cache while listening; append() (called from the
+// cache's mutation path) only encodes into a buffer under a short lock, and a background
+// thread batches, keeps the backlog and streams it to one follower at a time. A slow or
+// dead follower never holds up the cache.
+class ReplicationLeader
+{
+ public:
+
+  explicit ReplicationLeader(OrderCache& cache) : m_cache(cache) {}
+  ReplicationLeader(const ReplicationLeader&) = delete;
+  ReplicationLeader& operator=(const ReplicationLeader&) = delete;
+  ~ReplicationLeader();
+
+  // Start shipping every mutation of the cache after its current version and accept a
+  // follower at `socketPath` (an existing socket file there is replaced)
+  bool listen(const std::string& socketPath, ReplicationOptions options = {});
+
+  // Detach from the cache, drop the follower and remove the socket file
+  void close();
+
+  bool isListening() const noexcept { return m_listenFd >= 0; }
+
+  // Hot path, called by the cache for each mutation
+  void append(ChangeType type, uint64_t version, const OrderView& order);
+
+  bool hasFollower() const noexcept { return m_hasFollower.load(std::memory_order_acquire); }
+
+  // Highest version appended, and highest version the follower has acknowledged applying
+  uint64_t appendedVersion() const;
+  uint64_t ackedVersion() const noexcept { return m_ackedVersion.load(std::memory_order_acquire); }
+
+  // Versions appended but not yet applied by the follower
+  uint64_t lag() const;
+
+ private:
+
+  struct Batch {
+      uint64_t firstVersion;
+      uint64_t lastVersion;
+      std::vector<char> records;
+  };
+
+  void serverLoop();
+  void acceptFollower();
+  bool sendPending();
+  void readAcks();
+  void dropFollower();
+
+  OrderCache& m_cache;
+  std::string m_socketPath;
+  ReplicationOptions m_options;
+  int m_listenFd = -1;
+
+  // Owned by the server thread
+  int m_followerFd = -1;
+  char m_ackPartial[sizeof(uint64_t)];   // partial ack carried to the next read
+  size_t m_ackFill = 0;
+  uint64_t m_sentVersion = 0;
+  std::chrono::steady_clock::time_point m_lastSend;
+  std::deque<Batch> m_backlog;
+  size_t m_backlogSize = 0;
+  uint64_t m_backlogFloor = 0;           // versions up to this one can no longer be sent
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::vector<char> m_active;            // filled by append()
+  uint64_t m_activeFirstVersion = 0;
+  uint64_t m_appendedVersion = 0;
+  bool m_stop = false;
+  std::thread m_server;
+
+  std::atomic<bool> m_hasFollower{false};
+  std::atomic<uint64_t> m_ackedVersion{0};
+
+};
+
+// Follower side. A background thread receives frames; applyPending(), called on the
+// thread that owns the cache, applies them in batches and acknowledges. The follower
+// cache must start from the same state as the leader at some version (both empty, or the
+// same snapshot) and must not be mutated otherwise until promote().
+class ReplicationFollower
+{
+ public:
+
+  explicit ReplicationFollower(OrderCache& cache) : m_cache(cache) {}
+  ReplicationFollower(const ReplicationFollower&) = delete;
+  ReplicationFollower& operator=(const ReplicationFollower&) = delete;
+  ~ReplicationFollower();
+
+  // Connect to the leader at `socketPath` and resume after the cache's current version
+  bool connect(const std::string& socketPath);
+
+  // Stop receiving; records already received stay pending
+  void disconnect();
+
+  // Apply every record received so far. Returns how many were applied.
+  size_t applyPending();
+
+  bool isConnected() const noexcept { return m_connected.load(std::memory_order_acquire); }
+
+  // True once the stream had a gap or a corrupt record; the cache stays consistent at
+  // appliedVersion() but must be re-seeded to follow again
+  bool hasFailed() const noexcept { return m_failed; }
+
+  uint64_t appliedVersion() const noexcept { return m_cache.getVersion(); }
+  uint64_t leaderVersion() const noexcept { return m_leaderVersion.load(std::memory_order_acquire); }
+
+  // Versions the leader has that this cache has not applied yet
+  uint64_t lag() const noexcept;
+
+  // Take over as the primary: stop following, apply what was received and return the
+  // version the cache now holds. Its indexes are live throughout, so nothing is rebuilt.
+  uint64_t promote();
+
+ private:
+
+  void receiveLoop();
+  void sendAck();
+
+  OrderCache& m_cache;
+  int m_fd = -1;
+  bool m_failed = false;
+  std::thread m_receiver;
+
+  std::mutex m_mutex;
+  std::vector<char> m_received;          // complete records, filled by the receiver
+  std::vector<char> m_applying;          // swapped with m_received by applyPending()
+
+  std::atomic<bool> m_connected{false};
+  std::atomic<uint64_t> m_leaderVersion{0};
+
+};
@@ -0,0 +1,528 @@
+// Implementation of the shared-memory view of the cache
+#include "OrderSharedBook.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace {
+
+// Attempts before a reader gives up on an entry the writer keeps changing
+constexpr int kReadAttempts = 64;
+
+uint64_t hashSecurityId(std::string_view securityId) noexcept {
+    // FNV-1a: identical in every process, unlike std::hash
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : securityId) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Writer half of an entry's seqlock
+template <typename Fn>
+void writeEntry(SharedSecurityEntry& entry, Fn&& update) {
+    const uint32_t sequence = entry.sequence.load(std::memory_order_relaxed);
+    entry.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    update(entry);
+    entry.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+// Reader half: runs `read` until it saw a stable even sequence; false if it never did
+template <typename Fn>
+bool readEntry(const SharedSecurityEntry& entry, Fn&& read) {
+    for (int attempt = 0; attempt < kReadAttempts; ++attempt) {
+        const uint32_t before = entry.sequence.load(std::memory_order_acquire);
+        if ((before & 1) == 0) {
+            read(entry);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (entry.sequence.load(std::memory_order_relaxed) == before) {
+                return true;
+            }
+        }
+        std::this_thread::yield();
+    }
+    return false;
+}
+
+// Copy `size` bytes starting at logical `offset` out of a ring of `capacity` bytes
+void copyFromRing(const char* ring, uint64_t capacity, uint64_t offset, char* out, size_t size) {
+    const size_t start = static_cast<size_t>(offset % capacity);
+    const size_t first = std::min<size_t>(size, capacity - start);
+    std::memcpy(out, ring + start, first);
+    std::memcpy(out + first, ring, size - first);
+}
+
+// Record lengths are 16-bit; an order with a longer field cannot be encoded
+bool fitsRecord(const OrderView& order) {
+    return order.orderId.size() <= UINT16_MAX && order.user.size() <= UINT16_MAX && order.company.size() <= UINT16_MAX;
+}
+
+// Append one record; the caller has checked fitsRecord()
+void appendRecord(std::vector<char>& out, const OrderView& order) {
+    SharedBookRecord record{};
+    record.qty = order.qty;
+    record.isBuy = (!order.side.empty() && order.side[0] == 'B') ? 1 : 0;
+    record.orderIdLength = static_cast<uint16_t>(order.orderId.size());
+    record.userLength = static_cast<uint16_t>(order.user.size());
+    record.companyLength = static_cast<uint16_t>(order.company.size());
+
+    const size_t start = out.size();
+    out.resize(start + sizeof(record) + record.orderIdLength + record.userLength + record.companyLength);
+    char* cursor = out.data() + start;
+    std::memcpy(cursor, &record, sizeof(record));
+    cursor += sizeof(record);
+    std::memcpy(cursor, order.orderId.data(), record.orderIdLength);
+    cursor += record.orderIdLength;
+    std::memcpy(cursor, order.user.data(), record.userLength);
+    cursor += record.userLength;
+    std::memcpy(cursor, order.company.data(), record.companyLength);
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------------------------
+// SharedBookPublisher
+// ---------------------------------------------------------------------------------------
+
+SharedBookPublisher::~SharedBookPublisher() {
+    close();
+}
+
+#ifdef _WIN32
+
+bool SharedBookPublisher::create(const std::string&, SharedBookOptions) {
+    return false; // POSIX shared memory only
+}
+
+void SharedBookPublisher::close() {}
+
+#else
+
+bool SharedBookPublisher::create(const std::string& name, SharedBookOptions options) {
+    close();
+    if (options.maxSecurities == 0) {
+        return false;
+    }
+
+    uint32_t tableCapacity = 1;
+    while (tableCapacity < options.maxSecurities * 2ull) {
+        tableCapacity <<= 1;
+    }
+    const size_t tableOffset = sizeof(SharedBookHeader);
+    const size_t ringOffset = tableOffset + size_t{tableCapacity} * sizeof(SharedSecurityEntry);
+    const size_t regionSize = ringOffset + options.bookBytes;
+
+    ::shm_unlink(name.c_str());
+    const int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    void* region = MAP_FAILED;
+    if (::ftruncate(fd, static_cast<off_t>(regionSize)) == 0) {
+        region = ::mmap(nullptr, regionSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (region == MAP_FAILED) {
+        ::shm_unlink(name.c_str());
+        return false;
+    }
+
+    char* base = static_cast<char*>(region);
+    m_header = new (base) SharedBookHeader();
+    m_table = reinterpret_cast<SharedSecurityEntry*>(base + tableOffset);
+    for (uint32_t i = 0; i < tableCapacity; ++i) {
+        new (&m_table[i]) SharedSecurityEntry();
+    }
+    m_ring = base + ringOffset;
+    m_regionSize = regionSize;
+    m_name = name;
+
+    m_header->formatVersion = kSharedBookFormatVersion;
+    m_header->tableCapacity = tableCapacity;
+    m_header->regionSize = regionSize;
+    m_header->tableOffset = tableOffset;
+    m_header->ringOffset = ringOffset;
+    m_header->ringCapacity = options.bookBytes;
+    // The magic goes last so a reader never accepts a half-initialised region
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(m_header->magic, kSharedBookMagic, sizeof(m_header->magic));
+
+    m_publishedVersion = 0;
+    m_slots.clear();
+    m_skipped.clear();
+    m_unencodableBooks.clear();
+    m_ringBooks.clear();
+    m_liveBookBytes = 0;
+    return true;
+}
+
+void SharedBookPublisher::close() {
+    if (m_header == nullptr) {
+        return;
+    }
+    ::munmap(m_header, m_regionSize);
+    ::shm_unlink(m_name.c_str());
+    m_header = nullptr;
+    m_table = nullptr;
+    m_ring = nullptr;
+    m_regionSize = 0;
+    m_slots.clear();
+    m_skipped.clear();
+    m_unencodableBooks.clear();
+    m_ringBooks.clear();
+}
+
+#endif
+
+size_t SharedBookPublisher::publish() {
+    if (m_header == nullptr) {
+        return 0;
+    }
+
+    // The change log names every security touched since the last publish; if it no longer
+    // reaches back that far, refresh everything we know of plus everything in the cache
+    const OrderDelta delta = m_cache.getChangesSince(m_publishedVersion);
+    std::unordered_set<std::string> dirty;
+    if (delta.isFullSnapshot) {
+        for (const auto& entry : m_slots) {
+            dirty.insert(entry.first);
+        }
+        for (const Order& order : delta.orders) {
+            dirty.insert(order.securityId());
+        }
+    } else {
+        for (const OrderChange& change : delta.changes) {
+            dirty.insert(change.order.securityId());
+        }
+    }
+
+    for (const std::string& securityId : dirty) {
+        publishSecurity(securityId);
+    }
+
+    m_publishedVersion = m_cache.getVersion();
+    m_header->securityCount.store(static_cast<uint32_t>(m_slots.size()), std::memory_order_relaxed);
+    m_header->publishedVersion.store(m_publishedVersion, std::memory_order_release);
+    return dirty.size();
+}
+
+void SharedBookPublisher::publishSecurity(const std::string& securityId) {
+    SharedSecurityEntry* entry = slotFor(securityId);
+    if (entry == nullptr) {
+        return;
+    }
+
+    uint64_t buyQty = 0;
+    uint64_t sellQty = 0;
+    uint32_t orderCount = 0;
+    m_book.clear();
+    const bool withBook = m_header->ringCapacity != 0;
+    bool encodable = true;
+    m_cache.forEachOrderOrdered(securityId, [&](const OrderView& order) {
+        const bool isBuy = !order.side.empty() && order.side[0] == 'B';
+        (isBuy ? buyQty : sellQty) += order.qty;
+        ++orderCount;
+        if (withBook && encodable) {
+            encodable = fitsRecord(order);
+            if (encodable) {
+                appendRecord(m_book, order);
+            }
+        }
+    });
+    if (encodable) {
+        m_unencodableBooks.erase(securityId);
+    } else {
+        m_unencodableBooks.insert(securityId);
+    }
+    const unsigned int matchingSize = (buyQty != 0 && sellQty != 0) ? m_cache.getMatchingSizeForSecurity(securityId) : 0;
+
+    uint64_t bookOffset = kNoBook;
+    if (withBook) {
+        bookOffset = writeBook(entry, encodable);
+    }
+
+    const uint64_t version = m_cache.getVersion();
+    const uint64_t bookBytes = bookOffset == kNoBook ? 0 : m_book.size();
+    writeEntry(*entry, [&](SharedSecurityEntry& e) {
+        e.buyQty.store(buyQty, std::memory_order_relaxed);
+        e.sellQty.store(sellQty, std::memory_order_relaxed);
+        e.matchingSize.store(matchingSize, std::memory_order_relaxed);
+        e.orderCount.store(orderCount, std::memory_order_relaxed);
+        e.version.store(version, std::memory_order_relaxed);
+        e.bookOffset.store(bookOffset, std::memory_order_relaxed);
+        e.bookBytes.store(bookBytes, std::memory_order_relaxed);
+    });
+}
+
+SharedSecurityEntry* SharedBookPublisher::slotFor(const std::string& securityId) {
+    auto it = m_slots.find(securityId);
+    if (it != m_slots.end()) {
+        return it->second;
+    }
+    const uint32_t capacity = m_header->tableCapacity;
+    if (securityId.empty() || securityId.size() > kSharedSecurityIdMax || m_slots.size() >= capacity / 2) {
+        m_skipped.insert(securityId);
+        return nullptr;
+    }
+
+    uint32_t index = static_cast<uint32_t>(hashSecurityId(securityId)) & (capacity - 1);
+    while (m_table[index].idLength.load(std::memory_order_relaxed) != 0) {
+        index = (index + 1) & (capacity - 1);
+    }
+
+    // The id is written once, before the length that makes the slot visible
+    SharedSecurityEntry* entry = &m_table[index];
+    entry->bookOffset.store(kNoBook, std::memory_order_relaxed);
+    std::memcpy(entry->securityId, securityId.data(), securityId.size());
+    entry->idLength.store(static_cast<uint32_t>(securityId.size()), std::memory_order_release);
+    m_slots.emplace(securityId, entry);
+    return entry;
+}
+
+uint64_t SharedBookPublisher::writeBook(SharedSecurityEntry* entry, bool encodable) {
+    const uint64_t capacity = m_header->ringCapacity;
+    const uint64_t oldBytes = entry->bookOffset.load(std::memory_order_relaxed) == kNoBook
+                                  ? 0 : entry->bookBytes.load(std::memory_order_relaxed);
+    if (!encodable) {
+        m_liveBookBytes -= oldBytes;
+        return kNoBook; // Readers get the aggregates only rather than a truncated field
+    }
+    if (m_book.empty()) {
+        m_liveBookBytes -= oldBytes;
+        return m_header->ringHead.load(std::memory_order_relaxed);
+    }
+    if (m_liveBookBytes + m_book.size() > capacity) {
+        m_liveBookBytes -= oldBytes;
+        return kNoBook; // Ring too small to hold the live books plus this one
+    }
+
+    // Move live books out of the way of the new one. Each one moved lands past every other
+    // live book, so this ends once the live bytes plus the new book fit in the ring.
+    std::vector<char> moved;
+    for (;;) {
+        while (!m_ringBooks.empty() &&
+               m_ringBooks.front().entry->bookOffset.load(std::memory_order_relaxed) != m_ringBooks.front().offset) {
+            m_ringBooks.pop_front(); // Superseded
+        }
+        const uint64_t head = m_header->ringHead.load(std::memory_order_relaxed);
+        if (m_ringBooks.empty() || m_ringBooks.front().offset + capacity >= head + m_book.size()) {
+            break;
+        }
+
+        const RingBook book = m_ringBooks.front();
+        m_ringBooks.pop_front();
+        moved.resize(book.bytes);
+        copyFromRing(m_ring, capacity, book.offset, moved.data(), moved.size());
+        const uint64_t offset = appendToRing(moved.data(), moved.size());
+        writeEntry(*book.entry, [offset](SharedSecurityEntry& e) {
+            e.bookOffset.store(offset, std::memory_order_relaxed);
+        });
+        m_ringBooks.push_back(RingBook{offset, book.bytes, book.entry});
+    }
+
+    const uint64_t offset = appendToRing(m_book.data(), m_book.size());
+    m_ringBooks.push_back(RingBook{offset, m_book.size(), entry});
+    m_liveBookBytes += m_book.size() - oldBytes;
+    return offset;
+}
+
+uint64_t SharedBookPublisher::appendToRing(const char* data, size_t size) {
+    // Advance the head before overwriting, so a reader of the old bytes sees it moved
+    const uint64_t capacity = m_header->ringCapacity;
+    const uint64_t offset = m_header->ringHead.load(std::memory_order_relaxed);
+    m_header->ringHead.store(offset + size, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const size_t start = static_cast<size_t>(offset % capacity);
+    const size_t first = std::min<size_t>(size, capacity - start);
+    std::memcpy(m_ring + start, data, first);
+    std::memcpy(m_ring, data + first, size - first);
+    return offset;
+}
+
+// ---------------------------------------------------------------------------------------
+// SharedBookReader
+// ---------------------------------------------------------------------------------------
+
+SharedBookReader::~SharedBookReader() {
+    close();
+}
+
+#ifdef _WIN32
+
+bool SharedBookReader::open(const std::string&) {
+    return false; // POSIX shared memory only
+}
+
+void SharedBookReader::close() {}
+
+#else
+
+bool SharedBookReader::open(const std::string& name) {
+    close();
+
+    const int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    void* region = MAP_FAILED;
+    if (::fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(SharedBookHeader)) {
+        region = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (region == MAP_FAILED) {
+        return false;
+    }
+
+    const size_t size = static_cast<size_t>(info.st_size);
+    const char* base = static_cast<const char*>(region);
+    const auto* header = reinterpret_cast<const SharedBookHeader*>(base);
+    const bool valid = std::memcmp(header->magic, kSharedBookMagic, sizeof(header->magic)) == 0 &&
+                       header->formatVersion == kSharedBookFormatVersion &&
+                       header->regionSize <= size && header->tableCapacity != 0 &&
+                       (header->tableCapacity & (header->tableCapacity - 1)) == 0 &&
+                       header->tableOffset + uint64_t{header->tableCapacity} * sizeof(SharedSecurityEntry) <=
+                           header->ringOffset &&
+                       header->ringOffset + header->ringCapacity <= header->regionSize;
+    if (!valid) {
+        ::munmap(region, size);
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    m_header = header;
+    m_table = reinterpret_cast<const SharedSecurityEntry*>(base + header->tableOffset);
+    m_ring = base + header->ringOffset;
+    m_regionSize = size;
+    return true;
+}
+
+void SharedBookReader::close() {
+    if (m_header == nullptr) {
+        return;
+    }
+    ::munmap(const_cast<SharedBookHeader*>(m_header), m_regionSize);
+    m_header = nullptr;
+    m_table = nullptr;
+    m_ring = nullptr;
+    m_regionSize = 0;
+}
+
+#endif
+
+uint64_t SharedBookReader::publishedVersion() const noexcept {
+    return m_header == nullptr ? 0 : m_header->publishedVersion.load(std::memory_order_acquire);
+}
+
+size_t SharedBookReader::securityCount() const noexcept {
+    return m_header == nullptr ? 0 : m_header->securityCount.load(std::memory_order_relaxed);
+}
+
+const SharedSecurityEntry* SharedBookReader::find(std::string_view securityId) const {
+    if (m_header == nullptr || securityId.empty() || securityId.size() > kSharedSecurityIdMax) {
+        return nullptr;
+    }
+    const uint32_t capacity = m_header->tableCapacity;
+    uint32_t index = static_cast<uint32_t>(hashSecurityId(securityId)) & (capacity - 1);
+    for (uint32_t probe = 0; probe < capacity; ++probe) {
+        const SharedSecurityEntry& entry = m_table[index];
+        const uint32_t length = entry.idLength.load(std::memory_order_acquire);
+        if (length == 0) {
+            return nullptr;
+        }
+        if (length == securityId.size() && std::memcmp(entry.securityId, securityId.data(), length) == 0) {
+            return &entry;
+        }
+        index = (index + 1) & (capacity - 1);
+    }
+    return nullptr;
+}
+
+bool SharedBookReader::readSecurity(std::string_view securityId, SharedSecurityStats& stats) const {
+    const SharedSecurityEntry* entry = find(securityId);
+    return entry != nullptr && readEntry(*entry, [&stats](const SharedSecurityEntry& e) {
+        stats.buyQty = e.buyQty.load(std::memory_order_relaxed);
+        stats.sellQty = e.sellQty.load(std::memory_order_relaxed);
+        stats.matchingSize = e.matchingSize.load(std::memory_order_relaxed);
+        stats.orderCount = e.orderCount.load(std::memory_order_relaxed);
+        stats.version = e.version.load(std::memory_order_relaxed);
+    });
+}
+
+unsigned int SharedBookReader::getMatchingSizeForSecurity(std::string_view securityId) const {
+    SharedSecurityStats stats;
+    return readSecurity(securityId, stats) ? stats.matchingSize : 0;
+}
+
+bool SharedBookReader::readBook(std::string_view securityId, std::vector<Order>& orders) const {
+    const SharedSecurityEntry* entry = find(securityId);
+    if (entry == nullptr || m_header->ringCapacity == 0) {
+        return false;
+    }
+    const uint64_t capacity = m_header->ringCapacity;
+
+    std::vector<char> book;
+    for (int attempt = 0; attempt < kReadAttempts; ++attempt) {
+        uint64_t offset = kNoBook;
+        uint64_t bytes = 0;
+        uint32_t count = 0;
+        if (!readEntry(*entry, [&](const SharedSecurityEntry& e) {
+                offset = e.bookOffset.load(std::memory_order_relaxed);
+                bytes = e.bookBytes.load(std::memory_order_relaxed);
+                count = e.orderCount.load(std::memory_order_relaxed);
+            })) {
+            return false;
+        }
+        if (offset == kNoBook || bytes > capacity) {
+            return false;
+        }
+
+        book.resize(static_cast<size_t>(bytes));
+        copyFromRing(m_ring, capacity, offset, book.data(), book.size());
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (bytes != 0 && m_header->ringHead.load(std::memory_order_relaxed) > offset + capacity) {
+            continue; // Overwritten while copying; the entry points somewhere newer by now
+        }
+
+        // Decode into orders; a malformed copy means we raced a relocation, so retry
+        std::vector<Order> decoded;
+        decoded.reserve(count);
+        const std::string security(securityId);
+        const char* p = book.data();
+        const char* const end = p + book.size();
+        while (end - p >= static_cast<std::ptrdiff_t>(sizeof(SharedBookRecord))) {
+            SharedBookRecord record;
+            std::memcpy(&record, p, sizeof(record));
+            p += sizeof(record);
+            const size_t strings = size_t{record.orderIdLength} + record.userLength + record.companyLength;
+            if (strings > static_cast<size_t>(end - p)) {
+                break;
+            }
+            std::string orderId(p, record.orderIdLength);
+            p += record.orderIdLength;
+            std::string user(p, record.userLength);
+            p += record.userLength;
+            std::string company(p, record.companyLength);
+            p += record.companyLength;
+            decoded.emplace_back(std::move(orderId), security, record.isBuy ? "Buy" : "Sell", record.qty,
+                                 std::move(user), std::move(company));
+        }
+        if (p != end || decoded.size() != count) {
+            continue;
+        }
+        orders = std::move(decoded);
+        return true;
+    }
+    return false;
+}
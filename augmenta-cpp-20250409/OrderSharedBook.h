@@ -0,0 +1,197 @@
+#pragma once
+
+#include "OrderCache.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Layout of the shared-memory region published by SharedBookPublisher. Everything is
+// addressed by offsets from the start of the region, so each process may map it anywhere.
+//
+//   SharedBookHeader
+//   tableCapacity x SharedSecurityEntry   open-addressed by FNV-1a of the security id
+//   book ring      ringCapacity bytes of { SharedBookRecord, order id, user, company }...
+//
+// Every entry is a seqlock: the writer makes `sequence` odd, updates the entry and makes
+// it even again; a reader retries until it sees the same even value before and after its
+// copy. A security keeps its slot once inserted, so the table never rehashes. A book is a
+// run of records at a logical offset into the ring; a copy is valid if `ringHead` has not
+// moved more than one ring length past it by the time the copy is done.
+
+constexpr char     kSharedBookMagic[8]      = {'O', 'C', 'S', 'H', 'M', '0', '0', '1'};
+constexpr uint32_t kSharedBookFormatVersion = 1;
+constexpr size_t   kSharedSecurityIdMax     = 48;
+
+struct SharedBookHeader {
+    char     magic[8];
+    uint32_t formatVersion;
+    uint32_t tableCapacity;                    // power of two
+    uint64_t regionSize;
+    uint64_t tableOffset;
+    uint64_t ringOffset;
+    uint64_t ringCapacity;                     // 0 when books are not published
+    std::atomic<uint64_t> publishedVersion;    // cache version of the last publish()
+    std::atomic<uint64_t> ringHead;            // bytes ever written to the ring
+    std::atomic<uint32_t> securityCount;
+    uint32_t reserved[15];
+};
+
+struct SharedSecurityEntry {
+    std::atomic<uint32_t> sequence;            // odd while the writer is updating
+    std::atomic<uint32_t> idLength;            // 0 for a free slot; set once
+    char     securityId[kSharedSecurityIdMax];
+    std::atomic<uint64_t> buyQty;
+    std::atomic<uint64_t> sellQty;
+    std::atomic<uint32_t> matchingSize;
+    std::atomic<uint32_t> orderCount;
+    std::atomic<uint64_t> version;             // cache version the values were taken at
+    std::atomic<uint64_t> bookOffset;          // logical ring offset, kNoBook if not published
+    std::atomic<uint64_t> bookBytes;
+    uint64_t reserved[3];
+};
+
+// Book records, in forEachOrderOrdered() order (Buy first, then descending qty)
+struct SharedBookRecord {
+    uint32_t qty;
+    uint8_t  isBuy;
+    uint8_t  reserved;
+    uint16_t orderIdLength;
+    uint16_t userLength;
+    uint16_t companyLength;
+};
+
+constexpr uint64_t kNoBook = UINT64_MAX;
+
+static_assert(sizeof(SharedBookHeader) == 128, "shared book header layout changed");
+static_assert(sizeof(SharedSecurityEntry) == 128, "shared security entry layout changed");
+static_assert(sizeof(SharedBookRecord) == 12, "shared book record layout changed");
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+              "shared-memory seqlocks need address-free atomics");
+
+// Region sizing. The table holds up to `maxSecurities` (at most half full); `bookBytes`
+// of ring enables book publishing and must comfortably exceed the largest book.
+struct SharedBookOptions {
+    uint32_t maxSecurities = 4096;
+    size_t bookBytes = 0;
+};
+
+// Values of one security as last published
+struct SharedSecurityStats {
+    uint64_t buyQty = 0;
+    uint64_t sellQty = 0;
+    unsigned int matchingSize = 0;
+    uint32_t orderCount = 0;
+    uint64_t version = 0;
+};
+
+// Writer side: owns a POSIX shared-memory object and refreshes it from the cache. publish()
+// runs on the thread that owns the cache (e.g. after each batch of mutations) and only
+// rewrites the securities touched since the previous call, found through the change log.
+class SharedBookPublisher
+{
+ public:
+
+  explicit SharedBookPublisher(OrderCache& cache) : m_cache(cache) {}
+  SharedBookPublisher(const SharedBookPublisher&) = delete;
+  SharedBookPublisher& operator=(const SharedBookPublisher&) = delete;
+  ~SharedBookPublisher();
+
+  // Create the shared-memory object `name` (e.g. "/ordercache"), replacing any old one.
+  // Nothing is visible to readers until the first publish().
+  bool create(const std::string& name, SharedBookOptions options = {});
+
+  // Unmap and unlink the object; readers that have it mapped keep their view
+  void close();
+
+  bool isOpen() const noexcept { return m_header != nullptr; }
+
+  // Bring the region up to the cache's current version; returns the securities rewritten
+  size_t publish();
+
+  uint64_t publishedVersion() const noexcept { return m_publishedVersion; }
+
+  // Securities left out because the id is too long or the table is full
+  size_t skippedSecurityCount() const noexcept { return m_skipped.size(); }
+
+  // Securities published without a book because an order's id, user or company is longer
+  // than a record's 16-bit length; their aggregates are still published
+  size_t unencodableBookCount() const noexcept { return m_unencodableBooks.size(); }
+
+ private:
+
+  // A book written to the ring; stale once its entry points elsewhere
+  struct RingBook {
+      uint64_t offset;
+      uint64_t bytes;
+      SharedSecurityEntry* entry;
+  };
+
+  void publishSecurity(const std::string& securityId);
+  SharedSecurityEntry* slotFor(const std::string& securityId);
+  uint64_t writeBook(SharedSecurityEntry* entry, bool encodable);
+  uint64_t appendToRing(const char* data, size_t size);
+
+  OrderCache& m_cache;
+  std::string m_name;
+  SharedBookHeader* m_header = nullptr;
+  SharedSecurityEntry* m_table = nullptr;
+  char* m_ring = nullptr;
+  size_t m_regionSize = 0;
+  uint64_t m_publishedVersion = 0;
+
+  std::unordered_map<std::string, SharedSecurityEntry*> m_slots;
+  std::unordered_set<std::string> m_skipped;
+  std::unordered_set<std::string> m_unencodableBooks;
+  std::deque<RingBook> m_ringBooks;      // in ring order, oldest first
+  uint64_t m_liveBookBytes = 0;
+  std::vector<char> m_book;              // reused encode buffer
+
+};
+
+// Reader side: maps a published region read-only. Queries are plain loads from the
+// mapping (no syscalls) and are safe to call from any number of threads and processes.
+class SharedBookReader
+{
+ public:
+
+  SharedBookReader() = default;
+  SharedBookReader(const SharedBookReader&) = delete;
+  SharedBookReader& operator=(const SharedBookReader&) = delete;
+  ~SharedBookReader();
+
+  bool open(const std::string& name);
+  void close();
+
+  bool isOpen() const noexcept { return m_header != nullptr; }
+
+  // Cache version of the last publish, 0 before the first one
+  uint64_t publishedVersion() const noexcept;
+
+  size_t securityCount() const noexcept;
+
+  // Consistent copy of one security's values; false if it was never published
+  bool readSecurity(std::string_view securityId, SharedSecurityStats& stats) const;
+
+  // Published matching size, 0 for an unknown security
+  unsigned int getMatchingSizeForSecurity(std::string_view securityId) const;
+
+  // Copy of one security's book as of its last publish. False if the security is unknown,
+  // books are not published, or the writer kept overtaking the copy.
+  bool readBook(std::string_view securityId, std::vector<Order>& orders) const;
+
+ private:
+
+  const SharedSecurityEntry* find(std::string_view securityId) const;
+
+  const SharedBookHeader* m_header = nullptr;
+  const SharedSecurityEntry* m_table = nullptr;
+  const char* m_ring = nullptr;
+  size_t m_regionSize = 0;
+
+};
@@ -0,0 +1,325 @@
+// Recording and replay of OrderCache call traces
+#include "OrderTrace.h"
+#include "MappedFile.h"
+#include "Varint.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+// Buffered bytes that trigger a write to the file
+constexpr size_t kTraceFlushBytes = 1 << 20;
+
+constexpr uint8_t kTraceBuyFlag = 0x80;
+constexpr uint8_t kTraceOtherSideFlag = 0x40;
+
+const std::string kBuy = "Buy";
+const std::string kSell = "Sell";
+
+uint64_t nanosBetween(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+    return static_cast<uint64_t>(std::max<int64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count(), 0));
+}
+
+} // namespace
+
+const char* traceCallName(TraceCall call) noexcept {
+    switch (call) {
+    case TraceCall::Add:            return "addOrder";
+    case TraceCall::Cancel:         return "cancelOrder";
+    case TraceCall::CancelUser:     return "cancelOrdersForUser";
+    case TraceCall::CancelSecurity: return "cancelOrdersForSecIdWithMinimumQty";
+    case TraceCall::Match:          return "getMatchingSizeForSecurity";
+    case TraceCall::GetAll:         return "getAllOrders";
+    }
+    return "unknown";
+}
+
+Order TraceRecord::toOrder() const {
+    return Order{std::string(orderId), std::string(securityId), std::string(side), qty, std::string(user),
+                 std::string(company)};
+}
+
+bool OrderTraceWriter::open(const std::string& path) {
+    close();
+    m_out.open(path, std::ios::binary | std::ios::trunc);
+    if (!m_out) {
+        return false;
+    }
+
+    TraceFileHeader header{};
+    std::memcpy(header.magic, kTraceMagic, sizeof(header.magic));
+    header.formatVersion = kTraceFormatVersion;
+    header.startEpochNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+    m_buffer.assign(reinterpret_cast<const char*>(&header), reinterpret_cast<const char*>(&header) + sizeof(header));
+    m_strings.clear();
+    m_origin = std::chrono::steady_clock::now();
+    m_lastStartNs = 0;
+    m_records = 0;
+    return true;
+}
+
+void OrderTraceWriter::close() {
+    if (m_out.is_open()) {
+        flush();
+        m_out.close();
+    }
+    m_strings.clear();
+}
+
+void OrderTraceWriter::flush() {
+    if (!m_buffer.empty()) {
+        m_out.write(m_buffer.data(), static_cast<std::streamsize>(m_buffer.size()));
+        m_buffer.clear();
+    }
+}
+
+void OrderTraceWriter::begin(TraceCall call, bool isBuy) {
+    m_buffer.push_back(static_cast<char>(static_cast<uint8_t>(call) | (isBuy ? kTraceBuyFlag : 0)));
+}
+
+void OrderTraceWriter::beginAdd(std::string_view side) {
+    if (side == kBuy || side == kSell) {
+        begin(TraceCall::Add, side == kBuy);
+        return;
+    }
+    m_buffer.push_back(static_cast<char>(static_cast<uint8_t>(TraceCall::Add) | kTraceOtherSideFlag));
+    putString(side);
+}
+
+void OrderTraceWriter::putString(std::string_view str) {
+    auto [it, inserted] = m_strings.try_emplace(std::string(str), m_strings.size());
+    if (!inserted) {
+        Varint::append(m_buffer, it->second + 1);
+        return;
+    }
+    Varint::append(m_buffer, 0);
+    Varint::append(m_buffer, str.size());
+    m_buffer.insert(m_buffer.end(), str.begin(), str.end());
+}
+
+void OrderTraceWriter::putNumber(uint64_t value) {
+    Varint::append(m_buffer, value);
+}
+
+void OrderTraceWriter::end(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point finish,
+                           uint64_t result) {
+    const uint64_t startNs = std::max(nanosBetween(m_origin, start), m_lastStartNs);
+    Varint::append(m_buffer, startNs - m_lastStartNs);
+    Varint::append(m_buffer, nanosBetween(start, finish));
+    Varint::append(m_buffer, result);
+    m_lastStartNs = startNs;
+    ++m_records;
+    if (m_buffer.size() >= kTraceFlushBytes) {
+        flush();
+    }
+}
+
+void TracingOrderCache::addOrder(Order order) {
+    m_writer.beginAdd(order.side());
+    m_writer.putString(order.orderId());
+    m_writer.putString(order.securityId());
+    m_writer.putString(order.user());
+    m_writer.putString(order.company());
+    m_writer.putNumber(order.qty());
+    const auto start = std::chrono::steady_clock::now();
+    m_cache.addOrder(std::move(order));
+    m_writer.end(start, std::chrono::steady_clock::now(), 0);
+}
+
+void TracingOrderCache::cancelOrder(const std::string& orderId) {
+    m_writer.begin(TraceCall::Cancel, false);
+    m_writer.putString(orderId);
+    const auto start = std::chrono::steady_clock::now();
+    m_cache.cancelOrder(orderId);
+    m_writer.end(start, std::chrono::steady_clock::now(), 0);
+}
+
+void TracingOrderCache::cancelOrdersForUser(const std::string& user) {
+    m_writer.begin(TraceCall::CancelUser, false);
+    m_writer.putString(user);
+    const auto start = std::chrono::steady_clock::now();
+    m_cache.cancelOrdersForUser(user);
+    m_writer.end(start, std::chrono::steady_clock::now(), 0);
+}
+
+void TracingOrderCache::cancelOrdersForSecIdWithMinimumQty(const std::string& securityId, unsigned int minQty) {
+    m_writer.begin(TraceCall::CancelSecurity, false);
+    m_writer.putString(securityId);
+    m_writer.putNumber(minQty);
+    const auto start = std::chrono::steady_clock::now();
+    m_cache.cancelOrdersForSecIdWithMinimumQty(securityId, minQty);
+    m_writer.end(start, std::chrono::steady_clock::now(), 0);
+}
+
+unsigned int TracingOrderCache::getMatchingSizeForSecurity(const std::string& securityId) {
+    m_writer.begin(TraceCall::Match, false);
+    m_writer.putString(securityId);
+    const auto start = std::chrono::steady_clock::now();
+    const unsigned int matched = m_cache.getMatchingSizeForSecurity(securityId);
+    m_writer.end(start, std::chrono::steady_clock::now(), matched);
+    return matched;
+}
+
+std::vector<Order> TracingOrderCache::getAllOrders() const {
+    m_writer.begin(TraceCall::GetAll, false);
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<Order> orders = m_cache.getAllOrders();
+    m_writer.end(start, std::chrono::steady_clock::now(), orders.size());
+    return orders;
+}
+
+bool OrderTrace::load(const std::string& path) {
+    MappedFile file;
+    if (!file.open(path) || file.size() < sizeof(TraceFileHeader)) {
+        return false;
+    }
+    TraceFileHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, kTraceMagic, sizeof(header.magic)) != 0 ||
+        header.formatVersion != kTraceFormatVersion) {
+        return false;
+    }
+
+    m_header = header;
+    m_strings.clear();
+    m_records.clear();
+    m_truncated = false;
+
+    // Views into m_strings, by reference number
+    std::vector<std::string_view> strings;
+    const char* p = file.data() + sizeof(TraceFileHeader);
+    const char* const end = file.data() + file.size();
+
+    auto readString = [&](std::string_view& str) {
+        uint64_t ref = 0;
+        if (!Varint::read(p, end, ref)) {
+            return false;
+        }
+        if (ref != 0) {
+            if (ref > strings.size()) {
+                return false;
+            }
+            str = strings[ref - 1];
+            return true;
+        }
+        uint64_t length = 0;
+        if (!Varint::read(p, end, length) || length > static_cast<uint64_t>(end - p)) {
+            return false;
+        }
+        m_strings.emplace_back(p, length);
+        p += length;
+        strings.push_back(m_strings.back());
+        str = strings.back();
+        return true;
+    };
+
+    uint64_t startNs = 0;
+    while (p < end) {
+        const auto tag = static_cast<uint8_t>(*p++);
+        TraceRecord record{};
+        record.call = static_cast<TraceCall>(tag & ~(kTraceBuyFlag | kTraceOtherSideFlag));
+        record.isBuy = (tag & kTraceBuyFlag) != 0;
+        const bool otherSide = (tag & kTraceOtherSideFlag) != 0;
+
+        uint64_t number = 0;
+        bool ok = true;
+        switch (record.call) {
+        case TraceCall::Add:
+            if (otherSide) {
+                ok = !record.isBuy && readString(record.side);
+            } else {
+                record.side = record.isBuy ? kBuy : kSell;
+            }
+            ok = ok && readString(record.orderId) && readString(record.securityId) && readString(record.user) &&
+                 readString(record.company) && Varint::read(p, end, number) && number <= UINT32_MAX;
+            record.qty = static_cast<uint32_t>(number);
+            break;
+        case TraceCall::Cancel:
+            ok = readString(record.orderId);
+            break;
+        case TraceCall::CancelUser:
+            ok = readString(record.user);
+            break;
+        case TraceCall::CancelSecurity:
+            ok = readString(record.securityId) && Varint::read(p, end, number) && number <= UINT32_MAX;
+            record.qty = static_cast<uint32_t>(number);
+            break;
+        case TraceCall::Match:
+            ok = readString(record.securityId);
+            break;
+        case TraceCall::GetAll:
+            break;
+        default:
+            ok = false;
+            break;
+        }
+        ok = ok && (!otherSide || record.call == TraceCall::Add);
+
+        uint64_t delta = 0;
+        if (!ok || !Varint::read(p, end, delta) || !Varint::read(p, end, record.durationNs) ||
+            !Varint::read(p, end, record.result)) {
+            m_truncated = true;
+            break;
+        }
+        startNs += delta;
+        record.startNs = startNs;
+        m_records.push_back(record);
+    }
+    return true;
+}
+
+TraceReplayResult OrderTrace::replay(OrderCacheInterface& cache, bool paced) const {
+    TraceReplayResult result;
+    std::vector<Order> orders;
+    for (const TraceRecord& record : m_records) {
+        if (record.call == TraceCall::Add) {
+            orders.push_back(record.toOrder());
+        }
+        result.recorded[static_cast<size_t>(record.call)].push_back(record.durationNs);
+    }
+    for (size_t call = 0; call < kTraceCallCount; ++call) {
+        result.latencies[call].reserve(result.recorded[call].size());
+    }
+
+    // Arguments are std::string in the interface; copy them once, outside the timed calls
+    std::vector<std::string> arguments;
+    arguments.reserve(m_records.size());
+    for (const TraceRecord& record : m_records) {
+        switch (record.call) {
+        case TraceCall::Add:
+        case TraceCall::GetAll:         arguments.emplace_back(); break;
+        case TraceCall::Cancel:         arguments.emplace_back(record.orderId); break;
+        case TraceCall::CancelUser:     arguments.emplace_back(record.user); break;
+        case TraceCall::CancelSecurity:
+        case TraceCall::Match:          arguments.emplace_back(record.securityId); break;
+        }
+    }
+
+    size_t nextOrder = 0;
+    const auto origin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < m_records.size(); ++i) {
+        const TraceRecord& record = m_records[i];
+        if (paced) {
+            std::this_thread::sleep_until(origin + std::chrono::nanoseconds(record.startNs));
+        }
+
+        uint64_t returned = record.result;
+        const auto start = std::chrono::steady_clock::now();
+        switch (record.call) {
+        case TraceCall::Add:            cache.addOrder(std::move(orders[nextOrder++])); break;
+        case TraceCall::Cancel:         cache.cancelOrder(arguments[i]); break;
+        case TraceCall::CancelUser:     cache.cancelOrdersForUser(arguments[i]); break;
+        case TraceCall::CancelSecurity: cache.cancelOrdersForSecIdWithMinimumQty(arguments[i], record.qty); break;
+        case TraceCall::Match:          returned = cache.getMatchingSizeForSecurity(arguments[i]); break;
+        case TraceCall::GetAll:         returned = cache.getAllOrders().size(); break;
+        }
+        result.latencies[static_cast<size_t>(record.call)].push_back(nanosBetween(start, std::chrono::steady_clock::now()));
+        result.mismatches += returned != record.result ? 1 : 0;
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - origin).count();
+    return result;
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "OrderCache.h"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// On-disk layout of an operation trace: every call made on a cache, with when it started,
+// how long it took and what it returned.
+//
+//   TraceFileHeader
+//   records   { uint8 call | 0x80 if Buy | 0x40 if neither Buy nor Sell, arguments,
+//               varint startDelta, varint duration, varint result }...
+//
+// Times are nanoseconds; startDelta is measured from the previous record's start (from
+// the header's start time for the first one). Arguments depend on the call:
+//
+//   Add             [side if 0x40], order id, security id, user, company, varint qty
+//   Cancel          order id
+//   CancelUser      user
+//   CancelSecurity  security id, varint min qty
+//   Match           security id
+//   GetAll          (none)
+//
+// A string is a varint reference: 0 introduces a new string (varint length, bytes) that
+// takes the next number, n > 0 repeats string n - 1. The result is the matching size of
+// a Match, the number of orders returned by a GetAll and 0 otherwise. A trace cut short
+// by a crash loads up to its last complete record. The 0x40 side string keeps adds the
+// cache rejects for their side (e.g. "buy" or "") rejected on replay.
+
+constexpr char     kTraceMagic[8]      = {'O', 'C', 'T', 'R', 'A', 'C', 'E', '1'};
+constexpr uint32_t kTraceFormatVersion = 1;
+
+struct TraceFileHeader {
+    char     magic[8];
+    uint32_t formatVersion;
+    uint32_t reserved;
+    uint64_t startEpochNs;     // wall clock at the start of recording
+};
+
+static_assert(sizeof(TraceFileHeader) == 24, "trace header layout changed");
+
+enum class TraceCall : uint8_t { Add, Cancel, CancelUser, CancelSecurity, Match, GetAll };
+
+constexpr size_t kTraceCallCount = 6;
+
+// Interface method name of a call, e.g. "cancelOrdersForUser"
+const char* traceCallName(TraceCall call) noexcept;
+
+// One decoded call. The strings point into the OrderTrace that loaded it.
+struct TraceRecord {
+    TraceCall call;
+    bool isBuy;
+    uint32_t qty;              // order qty of an Add, min qty of a CancelSecurity
+    std::string_view side;     // side of an Add exactly as submitted
+    uint64_t startNs;          // since the start of recording
+    uint64_t durationNs;
+    uint64_t result;
+    std::string_view orderId;
+    std::string_view securityId;
+    std::string_view user;
+    std::string_view company;
+
+    Order toOrder() const;
+};
+
+// Encodes records to a trace file through a user-space buffer
+class OrderTraceWriter
+{
+ public:
+
+  OrderTraceWriter() = default;
+  OrderTraceWriter(const OrderTraceWriter&) = delete;
+  OrderTraceWriter& operator=(const OrderTraceWriter&) = delete;
+  ~OrderTraceWriter() { close(); }
+
+  // Create (or replace) the trace at `path`; time starts now
+  bool open(const std::string& path);
+
+  // Write out what is buffered and close the file
+  void close();
+
+  bool isOpen() const noexcept { return m_out.is_open(); }
+
+  // Records so far
+  uint64_t recordCount() const noexcept { return m_records; }
+
+  // One record: begin() (beginAdd() for an Add, which also writes the side when it is
+  // neither "Buy" nor "Sell"), the other arguments in layout order, then end() with the
+  // call's timing
+  void begin(TraceCall call, bool isBuy);
+  void beginAdd(std::string_view side);
+  void putString(std::string_view str);
+  void putNumber(uint64_t value);
+  void end(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point finish,
+           uint64_t result);
+
+ private:
+
+  void flush();
+
+  std::ofstream m_out;
+  std::vector<char> m_buffer;
+  std::unordered_map<std::string, uint64_t> m_strings;
+  std::chrono::steady_clock::time_point m_origin;
+  uint64_t m_lastStartNs = 0;
+  uint64_t m_records = 0;
+
+};
+
+// Recording wrapper: forwards every call to `cache` and logs it to `writer`. Recording
+// costs a few string copies and hash lookups per call; leave it out of measured runs.
+class TracingOrderCache : public OrderCacheInterface
+{
+ public:
+
+  TracingOrderCache(OrderCacheInterface& cache, OrderTraceWriter& writer) : m_cache(cache), m_writer(writer) {}
+
+  void addOrder(Order order) override;
+  void cancelOrder(const std::string& orderId) override;
+  void cancelOrdersForUser(const std::string& user) override;
+  void cancelOrdersForSecIdWithMinimumQty(const std::string& securityId, unsigned int minQty) override;
+  unsigned int getMatchingSizeForSecurity(const std::string& securityId) override;
+  std::vector<Order> getAllOrders() const override;
+
+ private:
+
+  OrderCacheInterface& m_cache;
+  OrderTraceWriter& m_writer;
+
+};
+
+// Latencies of one replay, per call type
+struct TraceReplayResult {
+    std::vector<uint64_t> latencies[kTraceCallCount];
+    std::vector<uint64_t> recorded[kTraceCallCount];   // durations stored in the trace
+    double seconds = 0;
+    size_t mismatches = 0;     // Match and GetAll results that differ from the trace
+};
+
+// A trace loaded into memory, ready to replay
+class OrderTrace
+{
+ public:
+
+  // Decode the trace at `path`. False if it is missing or not a trace.
+  bool load(const std::string& path);
+
+  const std::vector<TraceRecord>& records() const noexcept { return m_records; }
+  uint64_t startEpochNs() const noexcept { return m_header.startEpochNs; }
+
+  // True if the file ended in a partial or corrupt record
+  bool isTruncated() const noexcept { return m_truncated; }
+
+  // Run every call against `cache` and time it. Orders are built before the timed
+  // section. With `paced`, each call waits until its recorded start time.
+  TraceReplayResult replay(OrderCacheInterface& cache, bool paced = false) const;
+
+ private:
+
+  TraceFileHeader m_header{};
+  std::deque<std::string> m_strings;     // stable addresses for the records' views
+  std::vector<TraceRecord> m_records;
+  bool m_truncated = false;
+
+};
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+    #include <cerrno>
+    #define ORDERCACHE_HAS_PERF_EVENTS 1
+#else
+    #define ORDERCACHE_HAS_PERF_EVENTS 0
+#endif
+
+// Counts of one measured phase. A counter the PMU could not provide is marked missing.
+struct PerfReading {
+    enum Counter { Cycles, Instructions, CacheMisses, BranchMisses, kCounterCount };
+
+    uint64_t values[kCounterCount] = {};
+    bool present[kCounterCount] = {};
+
+    bool any() const noexcept {
+        for (bool counter : present) {
+            if (counter) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Hardware counters of the calling thread, user space only, read through Linux
+// perf_event_open as one group so every counter covers the same instructions. Where the
+// PMU is not available (non-Linux, many VMs, perf_event_paranoid > 2) the counters stay
+// closed, available() is false and readings are empty, so callers fall back to timing.
+// When the kernel multiplexes the group, counts are scaled to the full phase.
+class PerfCounters
+{
+ public:
+
+  PerfCounters() {
+#if ORDERCACHE_HAS_PERF_EVENTS
+      static const uint64_t configs[PerfReading::kCounterCount] = {
+          PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+          PERF_COUNT_HW_BRANCH_MISSES};
+      for (int counter = 0; counter < PerfReading::kCounterCount; ++counter) {
+          perf_event_attr attr {};
+          attr.size = sizeof(attr);
+          attr.type = PERF_TYPE_HARDWARE;
+          attr.config = configs[counter];
+          attr.disabled = m_leader < 0 ? 1 : 0;
+          attr.exclude_kernel = 1;
+          attr.exclude_hv = 1;
+          attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+          const int fd = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, m_leader, 0));
+          if (fd < 0) {
+              if (m_error.empty()) {
+                  m_error = std::strerror(errno);
+              }
+              continue;
+          }
+          if (m_leader < 0) {
+              m_leader = fd;
+          }
+          m_fds[counter] = fd;
+          m_order[m_opened++] = counter;
+      }
+#else
+      m_error = "perf_event_open is Linux only";
+#endif
+  }
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  ~PerfCounters() {
+#if ORDERCACHE_HAS_PERF_EVENTS
+      for (int fd : m_fds) {
+          if (fd >= 0) {
+              ::close(fd);
+          }
+      }
+#endif
+  }
+
+  bool available() const noexcept { return m_leader >= 0; }
+
+  // Why the first counter could not be opened, e.g. "No such file or directory" when the
+  // machine exposes no PMU
+  const std::string& error() const noexcept { return m_error; }
+
+  // Zero the counters and start counting
+  void start() noexcept {
+#if ORDERCACHE_HAS_PERF_EVENTS
+      if (available()) {
+          ::ioctl(m_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+          ::ioctl(m_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+      }
+#endif
+  }
+
+  // Stop counting and return the counts since start()
+  PerfReading stop() noexcept {
+      PerfReading reading;
+#if ORDERCACHE_HAS_PERF_EVENTS
+      if (!available()) {
+          return reading;
+      }
+      ::ioctl(m_leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+      // { nr, time_enabled, time_running, value[nr] }
+      uint64_t buffer[3 + PerfReading::kCounterCount] = {};
+      const ssize_t bytes = ::read(m_leader, buffer, sizeof(buffer));
+      if (bytes < static_cast<ssize_t>(3 * sizeof(uint64_t)) || buffer[0] != static_cast<uint64_t>(m_opened) ||
+          buffer[2] == 0) {
+          return reading;
+      }
+      const double scale = static_cast<double>(buffer[1]) / static_cast<double>(buffer[2]);
+      for (int i = 0; i < m_opened; ++i) {
+          reading.values[m_order[i]] = static_cast<uint64_t>(static_cast<double>(buffer[3 + i]) * scale);
+          reading.present[m_order[i]] = true;
+      }
+#endif
+      return reading;
+  }
+
+ private:
+
+  int m_leader = -1;
+  int m_fds[PerfReading::kCounterCount] = {-1, -1, -1, -1};
+  int m_order[PerfReading::kCounterCount] = {};   // counter of each group member, in read order
+  int m_opened = 0;
+  std::string m_error;
+
+};
+
+// The per-op line under a latency line: counts divided by `ops`; prints nothing when no
+// counter was read
+inline void printPerfPerOp(const PerfReading& reading, uint64_t ops) {
+    if (!reading.any() || ops == 0) {
+        return;
+    }
+    static const char* const names[PerfReading::kCounterCount] = {"cycles", "instructions", "cache-misses",
+                                                                  "branch-misses"};
+    std::printf("  %-36s", "  per op:");
+    for (int counter = 0; counter < PerfReading::kCounterCount; ++counter) {
+        if (reading.present[counter]) {
+            std::printf(" %12.1f %s", static_cast<double>(reading.values[counter]) / ops, names[counter]);
+        }
+    }
+    if (reading.present[PerfReading::Cycles] && reading.present[PerfReading::Instructions] &&
+        reading.values[PerfReading::Cycles] != 0) {
+        std::printf("   IPC %.2f", static_cast<double>(reading.values[PerfReading::Instructions]) /
+                                       static_cast<double>(reading.values[PerfReading::Cycles]));
+    }
+    std::printf("\n");
+}
@@ -0,0 +1,514 @@
+// Performance regression gate: times fixed scenarios in NCUs and compares them with a
+// checked-in baseline.
+//
+//   RegressionGate [--baseline file] [--tolerance fraction] [--runs N] [--update]
+//
+// One NCU is the time of a recursive fib(30), as in the Performance_* tests. The process
+// is pinned to one CPU, and the NCU is the fastest of several timings: interference only
+// ever slows a timing down, so the minimum is what stays put. Each scenario is run --runs
+// times (default 7) on a freshly built book, each run right after a calibration of its
+// own, so drifting clock speed moves both alike. The median run in NCUs is compared with
+// the baseline (default PerfBaseline.json next to this file). A scenario slower than
+// baseline * (1 + tolerance) is a regression; the tolerance comes from --tolerance, else
+// from the file, else 0.5.
+//
+// NCUs still differ between machines, so the baseline keeps numbers per machine (CPU
+// model and count) and, under it, per build flavour: "optimized" or "unoptimized", plus
+// "+stats", "+latency", "+spans" or "+flight-recorder" for each diagnostic compiled in.
+// --update times every scenario twice and records the slower pass for this machine and
+// flavour, but only if the two passes agree within the tolerance; a machine too noisy to
+// reproduce its own numbers gets no baseline, so the gate never blocks there.
+//
+// Exit status: 0 when every scenario is within tolerance, 1 on a regression, 2 when the
+// baseline cannot be read or written or does not reproduce, and 77 (CTest's skip) when
+// the baseline has no numbers for this machine and flavour.
+#include "BenchmarkOrders.h"
+#include "BenchmarkSupport.h"
+#include "FlightRecorder.h"
+#include "LatencyHistogram.h"
+#include "OrderCache.h"
+#include "SpanTrace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+    #include <sched.h>
+#endif
+
+#ifndef ORDERCACHE_DEFAULT_BASELINE
+    #define ORDERCACHE_DEFAULT_BASELINE "PerfBaseline.json"
+#endif
+
+namespace {
+
+constexpr int kCalibrationSamples = 21;       // up front, for the NCU reported
+constexpr int kRunCalibrationSamples = 5;     // right before each timed run
+constexpr double kDefaultTolerance = 0.5;
+
+constexpr int kExitRegression = 1;
+constexpr int kExitBaselineError = 2;
+constexpr int kExitSkipped = 77;
+
+int fibRecursive(int n) {
+    if (n <= 1) return n;
+    return fibRecursive(n - 1) + fibRecursive(n - 2);
+}
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+double median(std::vector<double> samples) {
+    std::sort(samples.begin(), samples.end());
+    const size_t middle = samples.size() / 2;
+    return samples.size() % 2 ? samples[middle] : (samples[middle - 1] + samples[middle]) / 2;
+}
+
+// Fastest of `count` fib(30) timings, in ms; `spread` gets how much slower the median was
+double calibrateNcu(int count, double* spread = nullptr) {
+    volatile int n = 30;
+    std::vector<double> samples;
+    for (int i = 0; i < count; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        sink = sink + fibRecursive(n);
+        samples.push_back(elapsedMs(start));
+    }
+    const double ncu = *std::min_element(samples.begin(), samples.end());
+    if (spread != nullptr) {
+        *spread = (median(samples) - ncu) / ncu;
+    }
+    return ncu;
+}
+
+// Keep the process on the CPU it is running on, so calibrations and scenarios share a core
+void pinToCurrentCpu() {
+#ifdef __linux__
+    const int cpu = ::sched_getcpu();
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        ::sched_setaffinity(0, sizeof(set), &set);
+    }
+#endif
+}
+
+// The machine the baseline numbers are kept under: CPU model and logical CPU count
+std::string machineKey() {
+    std::string model = "unknown CPU";
+#ifdef __linux__
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        const size_t colon = line.find(':');
+        if (line.compare(0, 10, "model name") == 0 && colon != std::string::npos) {
+            const size_t start = line.find_first_not_of(" \t", colon + 1);
+            model = start == std::string::npos ? model : line.substr(start);
+            break;
+        }
+    }
+#endif
+    std::string key;
+    for (char c : model) {
+        key += c == '"' || c == '\\' ? '_' : c; // The baseline's JSON subset has no escapes
+    }
+    return key + " x" + std::to_string(std::thread::hardware_concurrency());
+}
+
+// The build flavour the baseline numbers are kept under
+std::string buildFlavour() {
+#ifdef __OPTIMIZE__
+    std::string flavour = "optimized";
+#else
+    std::string flavour = "unoptimized";
+#endif
+    if (OrderCacheStats::kEnabled) {
+        flavour += "+stats";
+    }
+    if (LatencyRecorder::kCacheInstrumented) {
+        flavour += "+latency";
+    }
+    if (SpanTracer::kCacheInstrumented) {
+        flavour += "+spans";
+    }
+    if (FlightRecorder::kCacheInstrumented) {
+        flavour += "+flight-recorder";
+    }
+    return flavour;
+}
+
+// One timed scenario: `run` gets a cache already holding `prefill` orders (unless the
+// scenario builds its own book) and returns after the timed work
+struct Scenario {
+    const char* name;
+    unsigned int bookSize;
+    bool prefill;
+    std::function<void(OrderCache&, const std::vector<Order>&)> run;
+};
+
+std::vector<Scenario> scenarios() {
+    static const std::vector<std::string> securities = names("SecId", kSecurities);
+    static const std::vector<std::string> users = names("User", kUsers);
+
+    auto addAndMatch = [](OrderCache& cache, const std::vector<Order>& orders) {
+        for (const auto& order : orders) {
+            cache.addOrder(order);
+        }
+        for (const auto& securityId : securities) {
+            sink = sink + cache.getMatchingSizeForSecurity(securityId);
+        }
+    };
+    return {
+        {"add_match_10k", 10000, false, addAndMatch},
+        {"add_match_100k", 100000, false, addAndMatch},
+        {"match_100k", 100000, true,
+         [](OrderCache& cache, const std::vector<Order>&) {
+             for (const auto& securityId : securities) {
+                 sink = sink + cache.getMatchingSizeForSecurity(securityId);
+             }
+         }},
+        {"cancel_order_100k", 100000, true,
+         [](OrderCache& cache, const std::vector<Order>& orders) {
+             for (const auto& order : orders) {
+                 cache.cancelOrder(order.orderId());
+             }
+         }},
+        {"cancel_user_100k", 100000, true,
+         [](OrderCache& cache, const std::vector<Order>&) {
+             for (const auto& user : users) {
+                 cache.cancelOrdersForUser(user);
+             }
+         }},
+        {"cancel_security_100k", 100000, true,
+         [](OrderCache& cache, const std::vector<Order>&) {
+             for (const auto& securityId : securities) {
+                 cache.cancelOrdersForSecIdWithMinimumQty(securityId, 2500);
+             }
+         }},
+        {"get_all_orders_100k", 100000, true,
+         [](OrderCache& cache, const std::vector<Order>&) {
+             for (int i = 0; i < 5; ++i) {
+                 sink = sink + cache.getAllOrders().size();
+             }
+         }},
+    };
+}
+
+struct ScenarioTiming {
+    double ncus;
+    double ms;
+};
+
+// The scenario's best of `runs` runs, in NCUs of a calibration taken just before each
+// run. Interference only slows a run down relative to the CPU's speed at the time, so the
+// lowest ratio is what moves least; books are built untimed.
+ScenarioTiming timeScenario(const Scenario& scenario, const std::vector<Order>& orders, unsigned runs) {
+    ScenarioTiming best{0, 0};
+    for (unsigned run = 0; run < runs; ++run) {
+        OrderCache cache;
+        if (scenario.prefill) {
+            for (const auto& order : orders) {
+                cache.addOrder(order);
+            }
+        }
+        const double ncu = calibrateNcu(kRunCalibrationSamples);
+        const auto start = std::chrono::steady_clock::now();
+        scenario.run(cache, orders);
+        const double ms = elapsedMs(start);
+        if (run == 0 || ms / ncu < best.ncus) {
+            best = ScenarioTiming{ms / ncu, ms};
+        }
+    }
+    return best;
+}
+
+// The subset of JSON the baseline file uses: objects, strings as keys, numbers
+struct JsonValue {
+    double number = 0;
+    bool isObject = false;
+    std::vector<std::pair<std::string, JsonValue>> members;
+
+    const JsonValue* find(const std::string& key) const {
+        for (const auto& member : members) {
+            if (member.first == key) {
+                return &member.second;
+            }
+        }
+        return nullptr;
+    }
+
+    JsonValue& at(const std::string& key) {
+        for (auto& member : members) {
+            if (member.first == key) {
+                return member.second;
+            }
+        }
+        members.emplace_back(key, JsonValue{});
+        return members.back().second;
+    }
+};
+
+class JsonParser
+{
+ public:
+
+  explicit JsonParser(const std::string& text) : m_text(text) {}
+
+  // False on anything outside the subset, or trailing text
+  bool parse(JsonValue& value) {
+      if (!parseValue(value)) {
+          return false;
+      }
+      skipSpace();
+      return m_pos == m_text.size();
+  }
+
+ private:
+
+  void skipSpace() {
+      while (m_pos < m_text.size() && std::isspace(static_cast<unsigned char>(m_text[m_pos]))) {
+          ++m_pos;
+      }
+  }
+
+  bool consume(char c) {
+      skipSpace();
+      if (m_pos < m_text.size() && m_text[m_pos] == c) {
+          ++m_pos;
+          return true;
+      }
+      return false;
+  }
+
+  bool parseString(std::string& out) {
+      if (!consume('"')) {
+          return false;
+      }
+      while (m_pos < m_text.size() && m_text[m_pos] != '"') {
+          if (m_text[m_pos] == '\\') {
+              return false;
+          }
+          out += m_text[m_pos++];
+      }
+      return consume('"');
+  }
+
+  bool parseValue(JsonValue& value) {
+      skipSpace();
+      if (m_pos >= m_text.size()) {
+          return false;
+      }
+      if (m_text[m_pos] != '{') {
+          const char* begin = m_text.c_str() + m_pos;
+          char* end = nullptr;
+          value.number = std::strtod(begin, &end);
+          if (end == begin) {
+              return false;
+          }
+          m_pos += static_cast<size_t>(end - begin);
+          return true;
+      }
+      ++m_pos;
+      value.isObject = true;
+      if (consume('}')) {
+          return true;
+      }
+      do {
+          std::string key;
+          JsonValue member;
+          if (!parseString(key) || !consume(':') || !parseValue(member)) {
+              return false;
+          }
+          value.members.emplace_back(std::move(key), std::move(member));
+      } while (consume(','));
+      return consume('}');
+  }
+
+  const std::string& m_text;
+  size_t m_pos = 0;
+
+};
+
+void writeJson(std::ostream& out, const JsonValue& value, int indent) {
+    if (!value.isObject) {
+        char number[32];
+        std::snprintf(number, sizeof(number), "%.4g", value.number);
+        out << number;
+        return;
+    }
+    out << "{";
+    const std::string pad(indent + 2, ' ');
+    for (size_t i = 0; i < value.members.size(); ++i) {
+        out << (i ? ",\n" : "\n") << pad << '"' << value.members[i].first << "\": ";
+        writeJson(out, value.members[i].second, indent + 2);
+    }
+    out << "\n" << std::string(indent, ' ') << "}";
+}
+
+bool readBaseline(const std::string& path, JsonValue& baseline) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::stringstream text;
+    text << in.rdbuf();
+    return JsonParser(text.str()).parse(baseline) && baseline.isObject;
+}
+
+bool writeBaseline(const std::string& path, const JsonValue& baseline) {
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+    writeJson(out, baseline, 0);
+    out << "\n";
+    return static_cast<bool>(out.flush());
+}
+
+// One pass over every scenario, printed against `expected` (may be null)
+struct SuiteResult {
+    JsonValue ncus;
+    int slower = 0;      // beyond the tolerance
+    int faster = 0;      // beyond the tolerance
+    int missing = 0;
+};
+
+SuiteResult runSuite(unsigned runs, const JsonValue* expected, double tolerance) {
+    SuiteResult result;
+    result.ncus.isObject = true;
+    for (const Scenario& scenario : scenarios()) {
+        const std::vector<Order> orders = generateOrders(scenario.bookSize);
+        const ScenarioTiming timing = timeScenario(scenario, orders, runs);
+        result.ncus.at(scenario.name).number = timing.ncus;
+
+        const JsonValue* reference = expected ? expected->find(scenario.name) : nullptr;
+        if (reference == nullptr || reference->isObject || reference->number <= 0) {
+            std::printf("  %-24s %9.3f NCU (%9.3f ms)   no baseline\n", scenario.name, timing.ncus, timing.ms);
+            ++result.missing;
+            continue;
+        }
+        const double ratio = timing.ncus / reference->number;
+        const bool slower = ratio > 1 + tolerance;
+        const bool faster = ratio < 1 / (1 + tolerance);
+        result.slower += slower ? 1 : 0;
+        result.faster += faster ? 1 : 0;
+        std::printf("  %-24s %9.3f NCU (%9.3f ms)   baseline %9.3f NCU   %5.2fx%s\n", scenario.name, timing.ncus,
+                    timing.ms, reference->number, ratio, slower ? "   SLOWER" : faster ? "   FASTER" : "");
+    }
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string baselinePath = ORDERCACHE_DEFAULT_BASELINE;
+    double tolerance = -1;
+    unsigned runs = 7;
+    bool update = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        bool ok = true;
+        if (arg == "--baseline" && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (arg == "--tolerance" && i + 1 < argc) {
+            ok = parseNonNegative(argv[++i], tolerance);
+        } else if (arg == "--runs" && i + 1 < argc) {
+            ok = parseCount(argv[++i], runs);
+        } else if (arg == "--update") {
+            update = true;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            return usageError("RegressionGate [--baseline file] [--tolerance fraction] [--runs N] [--update]",
+                              kExitBaselineError);
+        }
+    }
+    runs = std::max(1u, runs);
+
+    JsonValue baseline;
+    const bool haveBaseline = readBaseline(baselinePath, baseline);
+    if (!haveBaseline && !update) {
+        std::cerr << baselinePath << ": not a readable baseline" << std::endl;
+        return kExitBaselineError;
+    }
+    if (!haveBaseline) {
+        baseline = JsonValue{};
+        baseline.isObject = true;
+    }
+    if (tolerance < 0) {
+        const JsonValue* stored = baseline.find("tolerance");
+        tolerance = stored && !stored->isObject ? stored->number : kDefaultTolerance;
+    }
+
+    const std::string flavour = buildFlavour();
+    const std::string machine = machineKey();
+    const JsonValue* machines = baseline.find("machines");
+    const JsonValue* recorded = machines ? machines->find(machine) : nullptr;
+    const JsonValue* expected = recorded ? recorded->find(flavour) : nullptr;
+    if (!update && (expected == nullptr || !expected->isObject)) {
+        std::cout << "no baseline for the " << flavour << " build on this machine (" << machine << ") in "
+                  << baselinePath << "; record one with --update" << std::endl;
+        return kExitSkipped;
+    }
+
+    pinToCurrentCpu();
+    double spread = 0;
+    const double ncu = calibrateNcu(kCalibrationSamples, &spread);
+    std::printf("build %s on %s, 1 NCU = %.3f ms (fastest of %d, median %.0f%% slower), tolerance %.0f%%\n",
+                flavour.c_str(), machine.c_str(), ncu, kCalibrationSamples, spread * 100, tolerance * 100);
+
+    SuiteResult result = runSuite(runs, update ? nullptr : expected, tolerance);
+
+    if (update) {
+        // Only numbers this machine reproduces may block: repeat the pass and compare
+        std::printf("repeating to check that the numbers reproduce\n");
+        const SuiteResult repeat = runSuite(runs, &result.ncus, tolerance);
+        if (repeat.slower + repeat.faster > 0) {
+            std::cerr << repeat.slower + repeat.faster << " scenario(s) did not reproduce within " << tolerance * 100
+                      << "% on this machine; baseline not recorded" << std::endl;
+            return kExitBaselineError;
+        }
+        for (auto& member : result.ncus.members) {
+            const JsonValue* second = repeat.ncus.find(member.first);
+            member.second.number = std::max(member.second.number, second ? second->number : 0);
+        }
+
+        baseline.at("tolerance").number = tolerance;
+        JsonValue& allMachines = baseline.at("machines");
+        allMachines.isObject = true;
+        JsonValue& builds = allMachines.at(machine);
+        builds.isObject = true;
+        builds.at(flavour) = result.ncus;
+        if (!writeBaseline(baselinePath, baseline)) {
+            std::cerr << baselinePath << ": cannot write" << std::endl;
+            return kExitBaselineError;
+        }
+        std::cout << "recorded the " << flavour << " baseline for " << machine << " in " << baselinePath << std::endl;
+        return 0;
+    }
+    if (result.slower > 0) {
+        std::cout << result.slower << " scenario(s) regressed beyond " << tolerance * 100 << "%" << std::endl;
+        return kExitRegression;
+    }
+    if (result.faster > 0) {
+        std::cout << result.faster << " scenario(s) got faster beyond " << tolerance * 100
+                  << "%; consider --update" << std::endl;
+    }
+    if (result.missing > 0) {
+        std::cout << result.missing << " scenario(s) have no baseline yet; record them with --update" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,372 @@
+// Throughput, tail latency and scaling efficiency of concurrent cache access from 1 up to
+// the number of cores.
+//
+//   ScalingBenchmark [--max-threads N] [--ops N] [--book N] [--shards N]
+//
+// OrderCache serves one thread at a time, and even getMatchingSizeForSecurity() may write
+// (lazy indexes, tiering, counters), so concurrent access here goes through a lock. Two
+// modes are compared: one cache behind one mutex, and --shards caches (default 16) split by
+// security, each behind its own mutex. Adds, cancels and matching go to the one shard of
+// their security; cancels carry the security the generator recorded for the order.
+//
+// For each mode, workload (writer: adds, cancels, amends; reader: matching only; mixed)
+// and thread count from 1 to --max-threads (default: the core count), every thread runs
+// --ops operations (default 20000) from its own skewed WorkloadGenerator stream against a
+// book prefilled with --book orders (default 100000). Each line gives the total
+// throughput, its efficiency against n times the 1-thread throughput, latency percentiles
+// over all threads, and the share of lock acquisitions that had to wait.
+//
+// Where more than 5% of acquisitions wait, the shard with most of the waiting is flagged
+// with its share of the calls. In a build with ORDERCACHE_STATS, its hot-path counters
+// show what the calls did while holding the lock; rehashes and long id lookups under the
+// lock are flagged in any run.
+#include "BenchmarkSupport.h"
+#include "OrderCache.h"
+#include "WorkloadGenerator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// A shard is flagged when more than this share of all acquisitions waited
+constexpr double kContentionThreshold = 0.05;
+
+// Results of the timed queries land here so the calls cannot be optimized away
+std::atomic<uint64_t> sink{0};
+
+uint64_t elapsedNs(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
+
+// Caches split by security, each behind its own mutex; one shard is a single locked cache
+class ShardedBook
+{
+ public:
+
+  struct Shard {
+      std::mutex mutex;
+      OrderCache cache;
+      std::atomic<uint64_t> acquisitions{0};
+      std::atomic<uint64_t> contended{0};
+      std::atomic<uint64_t> waitNs{0};
+  };
+
+  explicit ShardedBook(size_t shards) {
+      for (size_t i = 0; i < shards; ++i) {
+          m_shards.push_back(std::make_unique<Shard>());
+      }
+  }
+
+  size_t shardCount() const noexcept { return m_shards.size(); }
+  Shard& shard(size_t index) { return *m_shards[index]; }
+
+  Shard& shardFor(const std::string& securityId) {
+      return *m_shards[std::hash<std::string>{}(securityId) % m_shards.size()];
+  }
+
+  // Run call(cache) under the shard's lock, counting acquisitions that had to wait
+  template <typename Call>
+  auto withLock(Shard& shard, Call&& call) {
+      std::unique_lock<std::mutex> lock(shard.mutex, std::try_to_lock);
+      if (!lock.owns_lock()) {
+          const auto start = std::chrono::steady_clock::now();
+          lock.lock();
+          shard.waitNs.fetch_add(elapsedNs(start, std::chrono::steady_clock::now()), std::memory_order_relaxed);
+          shard.contended.fetch_add(1, std::memory_order_relaxed);
+      }
+      shard.acquisitions.fetch_add(1, std::memory_order_relaxed);
+      return call(shard.cache);
+  }
+
+  void resetCounters() {
+      for (auto& shard : m_shards) {
+          shard->acquisitions.store(0, std::memory_order_relaxed);
+          shard->contended.store(0, std::memory_order_relaxed);
+          shard->waitNs.store(0, std::memory_order_relaxed);
+          shard->cache.resetStats();
+      }
+  }
+
+ private:
+
+  std::vector<std::unique_ptr<Shard>> m_shards;
+
+};
+
+// One thread's calls, fully built before the timed run. Order ids carry the thread's
+// prefix so the threads' streams never collide.
+struct PreparedOp {
+    WorkloadOpType type;
+    Order order;
+    std::string orderId;
+    const std::string* securityId;
+};
+
+std::vector<PreparedOp> prepare(const WorkloadGenerator& generator, const std::vector<WorkloadOp>& ops,
+                                const std::string& prefix) {
+    std::vector<PreparedOp> prepared;
+    prepared.reserve(ops.size());
+    for (const WorkloadOp& op : ops) {
+        const bool submits = op.type == WorkloadOpType::Add || op.type == WorkloadOpType::Amend;
+        const bool names = submits || op.type == WorkloadOpType::Cancel;
+        Order order = submits ? generator.toOrder(op) : Order{"", "", "", 0, "", ""};
+        const std::string orderId = names ? prefix + generator.orderId(op.order) : std::string();
+        if (submits) {
+            order = Order{orderId, order.securityId(), order.side(), order.qty(), order.user(), order.company()};
+        }
+        prepared.push_back(PreparedOp{op.type, std::move(order), orderId, &generator.securityId(op.security)});
+    }
+    return prepared;
+}
+
+void run(ShardedBook& book, PreparedOp& op) {
+    switch (op.type) {
+    case WorkloadOpType::Add:
+        book.withLock(book.shardFor(*op.securityId), [&](OrderCache& cache) { cache.addOrder(std::move(op.order)); });
+        break;
+    case WorkloadOpType::Cancel:
+        book.withLock(book.shardFor(*op.securityId), [&](OrderCache& cache) { cache.cancelOrder(op.orderId); });
+        break;
+    case WorkloadOpType::Amend:
+        book.withLock(book.shardFor(*op.securityId), [&](OrderCache& cache) {
+            cache.cancelOrder(op.orderId);
+            cache.addOrder(std::move(op.order));
+        });
+        break;
+    case WorkloadOpType::Match:
+        sink.fetch_add(book.withLock(book.shardFor(*op.securityId),
+                                     [&](OrderCache& cache) { return cache.getMatchingSizeForSecurity(*op.securityId); }),
+                       std::memory_order_relaxed);
+        break;
+    default:
+        break;   // The workloads here make no bulk cancels or getAllOrders calls
+    }
+}
+
+struct Workload {
+    const char* name;
+    WorkloadMix mix;
+};
+
+const Workload kWorkloads[] = {
+    {"writer", {0.50, 0.30, 0.20, 0.0, 0.0, 0.0, 0.0}},
+    {"reader", {0.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0}},
+    {"mixed", {0.40, 0.35, 0.15, 0.0, 0.0, 0.10, 0.0}},
+};
+
+struct RunResult {
+    double throughput = 0;
+    std::vector<uint64_t> latencies;
+};
+
+// Prefill `book` with bookSize orders split over the threads' own streams, then run every
+// thread's ops at once
+RunResult runThreads(ShardedBook& book, const Workload& workload, unsigned threads, size_t opsPerThread,
+                     size_t bookSize) {
+    std::vector<std::unique_ptr<WorkloadGenerator>> generators;
+    std::vector<std::vector<PreparedOp>> streams;
+    for (unsigned t = 0; t < threads; ++t) {
+        WorkloadOptions options;
+        options.seed = 12345 + t;
+        options.securitySkew = 1.0;
+        options.userSkew = 0.8;
+        options.qtySkew = 1.0;
+        options.mix = workload.mix;
+        generators.push_back(std::make_unique<WorkloadGenerator>(options));
+        const std::string prefix = "T" + std::to_string(t) + ".";
+        std::vector<PreparedOp> fill = prepare(*generators[t], generators[t]->generateAdds(bookSize / threads), prefix);
+        for (PreparedOp& op : fill) {
+            run(book, op);
+        }
+        streams.push_back(prepare(*generators[t], generators[t]->generate(opsPerThread), prefix));
+    }
+    book.resetCounters();
+
+    std::vector<std::vector<uint64_t>> latencies(threads);
+    std::atomic<unsigned> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::vector<uint64_t>& mine = latencies[t];
+            mine.reserve(streams[t].size());
+            ready.fetch_add(1, std::memory_order_acq_rel);
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (PreparedOp& op : streams[t]) {
+                const auto start = std::chrono::steady_clock::now();
+                run(book, op);
+                mine.push_back(elapsedNs(start, std::chrono::steady_clock::now()));
+            }
+        });
+    }
+    while (ready.load(std::memory_order_acquire) < threads) {
+        std::this_thread::yield();
+    }
+    const auto begin = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    RunResult result;
+    for (const auto& mine : latencies) {
+        result.latencies.insert(result.latencies.end(), mine.begin(), mine.end());
+    }
+    result.throughput = result.latencies.size() / seconds;
+    return result;
+}
+
+uint64_t percentile(const std::vector<uint64_t>& sorted, double p) {
+    return sorted.empty() ? 0 : sorted[static_cast<size_t>(p * (sorted.size() - 1))];
+}
+
+// Flag the shard that most of the lock waiting went to, and lock hold times the counters explain
+void reportContention(ShardedBook& book) {
+    uint64_t acquisitions = 0;
+    uint64_t contended = 0;
+    uint64_t waitNs = 0;
+    size_t hottest = 0;
+    for (size_t i = 0; i < book.shardCount(); ++i) {
+        ShardedBook::Shard& shard = book.shard(i);
+        acquisitions += shard.acquisitions.load(std::memory_order_relaxed);
+        contended += shard.contended.load(std::memory_order_relaxed);
+        waitNs += shard.waitNs.load(std::memory_order_relaxed);
+        if (shard.waitNs.load(std::memory_order_relaxed) > book.shard(hottest).waitNs.load(std::memory_order_relaxed)) {
+            hottest = i;
+        }
+    }
+
+    if (acquisitions != 0 && static_cast<double>(contended) / acquisitions > kContentionThreshold) {
+        ShardedBook::Shard& shard = book.shard(hottest);
+        if (book.shardCount() == 1) {
+            std::printf("      hotspot: the cache lock, %.1f%% of acquisitions waited %.0f ns on average\n",
+                        100.0 * contended / acquisitions, contended ? static_cast<double>(waitNs) / contended : 0.0);
+        } else {
+            std::printf("      hotspot: shard %zu has %.0f%% of the lock waiting and %.0f%% of the calls "
+                        "(fair share %.0f%%)\n",
+                        hottest, waitNs ? 100.0 * shard.waitNs.load(std::memory_order_relaxed) / waitNs : 0.0,
+                        100.0 * shard.acquisitions.load(std::memory_order_relaxed) / acquisitions,
+                        100.0 / book.shardCount());
+        }
+        if (OrderCacheStats::kEnabled) {
+            const OrderCacheStats stats = shard.cache.getStats();
+            std::printf("      under its lock: %.1f orders read per match, %.1f index entries scanned per cancel, "
+                        "%llu rehashes\n",
+                        stats.matchCalls ? static_cast<double>(stats.matchOrdersScanned) / stats.matchCalls : 0.0,
+                        stats.cancelCalls ? static_cast<double>(stats.indexEntriesScanned) / stats.cancelCalls : 0.0,
+                        static_cast<unsigned long long>(stats.rehashes));
+        }
+    }
+
+    if (OrderCacheStats::kEnabled) {
+        uint64_t rehashes = 0;
+        uint64_t idLookups = 0;
+        uint64_t idProbes = 0;
+        for (size_t i = 0; i < book.shardCount(); ++i) {
+            const OrderCacheStats stats = book.shard(i).cache.getStats();
+            rehashes += stats.rehashes;
+            idLookups += stats.idLookups;
+            idProbes += stats.idProbes;
+        }
+        if (rehashes != 0) {
+            std::printf("      hotspot: %llu hash map rehashes ran under a lock\n",
+                        static_cast<unsigned long long>(rehashes));
+        }
+        if (idLookups != 0 && static_cast<double>(idProbes) / idLookups > 2.0) {
+            std::printf("      hotspot: id lookups search %.1f bucket entries on average\n",
+                        static_cast<double>(idProbes) / idLookups);
+        }
+    }
+}
+
+void runMode(size_t shards, unsigned maxThreads, size_t opsPerThread, size_t bookSize) {
+    std::printf("%s\n", shards == 1 ? "one cache behind one mutex"
+                                    : (std::to_string(shards) + " caches split by security, one mutex each").c_str());
+    for (const Workload& workload : kWorkloads) {
+        std::printf("  %s\n", workload.name);
+        double single = 0;
+        double peak = 0;
+        unsigned peakThreads = 1;
+        for (unsigned threads = 1; threads <= maxThreads; ++threads) {
+            ShardedBook book(shards);
+            RunResult result = runThreads(book, workload, threads, opsPerThread, bookSize);
+            std::sort(result.latencies.begin(), result.latencies.end());
+            if (threads == 1) {
+                single = result.throughput;
+            }
+            if (result.throughput > peak) {
+                peak = result.throughput;
+                peakThreads = threads;
+            }
+            uint64_t acquisitions = 0;
+            uint64_t contended = 0;
+            for (size_t i = 0; i < book.shardCount(); ++i) {
+                acquisitions += book.shard(i).acquisitions.load(std::memory_order_relaxed);
+                contended += book.shard(i).contended.load(std::memory_order_relaxed);
+            }
+            std::printf("    %3u threads %12.0f ops/s  efficiency %5.1f%%   p50 %8llu ns   p99 %9llu ns   "
+                        "p99.9 %10llu ns   max %11llu ns   waited %5.1f%%\n",
+                        threads, result.throughput, single ? 100.0 * result.throughput / (threads * single) : 0.0,
+                        static_cast<unsigned long long>(percentile(result.latencies, 0.50)),
+                        static_cast<unsigned long long>(percentile(result.latencies, 0.99)),
+                        static_cast<unsigned long long>(percentile(result.latencies, 0.999)),
+                        static_cast<unsigned long long>(result.latencies.empty() ? 0 : result.latencies.back()),
+                        acquisitions ? 100.0 * contended / acquisitions : 0.0);
+            reportContention(book);
+        }
+        std::printf("    peak %.0f ops/s at %u thread%s\n", peak, peakThreads, peakThreads == 1 ? "" : "s");
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    size_t opsPerThread = 20000;
+    size_t bookSize = 100000;
+    size_t shards = 16;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        bool ok = i + 1 < argc;
+        if (ok && arg == "--max-threads") {
+            ok = parseCount(argv[++i], maxThreads);
+        } else if (ok && arg == "--ops") {
+            ok = parseCount(argv[++i], opsPerThread);
+        } else if (ok && arg == "--book") {
+            ok = parseCount(argv[++i], bookSize);
+        } else if (ok && arg == "--shards") {
+            ok = parseCount(argv[++i], shards);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            return usageError("ScalingBenchmark [--max-threads N] [--ops N] [--book N] [--shards N]");
+        }
+    }
+    maxThreads = std::max(1u, maxThreads);
+    shards = std::max<size_t>(1, shards);
+    if (!OrderCacheStats::kEnabled) {
+        std::cout << "hot-path counters are compiled out; configure with -DORDERCACHE_STATS=ON to see what "
+                     "contended calls do"
+                  << std::endl;
+    }
+
+    runMode(1, maxThreads, opsPerThread, bookSize);
+    if (shards > 1) {
+        runMode(shards, maxThreads, opsPerThread, bookSize);
+    }
+    return 0;
+}
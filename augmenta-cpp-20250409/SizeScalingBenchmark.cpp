@@ -0,0 +1,271 @@
+// Per-operation cost and memory per order as the book grows.
+//
+//   SizeScalingBenchmark [--budget seconds] [bookSize...]
+//
+// For each book size (default 1K, 10K, 100K, 1M, 10M and 50M orders) a cache is filled
+// with uniformly generated orders over 1000 securities and 1000 users, so the books per
+// security and per user grow with the size. Orders are generated in chunks, and only the
+// addOrder calls are timed. The built book then reports its bytes per live order, both
+// from OrderCache::memoryUsage() and from the growth of the process RSS (/proc/self/statm),
+// and the peak RSS of the size (VmHWM, reset between sizes where /proc/self/clear_refs
+// allows it).
+//
+// Then each other call runs on a sample of arguments for up to --budget seconds each
+// (default 2): matching, cancelOrder, cancelOrdersForSecIdWithMinimumQty,
+// cancelOrdersForUser and getAllOrders. A closing table gives the ns per call of every
+// operation at each size and the exponent of its growth from the previous size. 0 means
+// the cost per call does not depend on the book, and 1 means it grows linearly, as when a
+// cancel has to scan a per-user or per-security vector.
+//
+// A size whose estimated footprint exceeds MemAvailable is skipped.
+#include "BenchmarkSupport.h"
+#include "OrderCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+    #include <unistd.h>
+#endif
+
+namespace {
+
+constexpr int kSecurities = 1000;
+constexpr int kUsers = 1000;
+constexpr size_t kChunk = 65536;
+
+// Results of the timed queries land here so the calls cannot be optimized away
+volatile uint64_t sink = 0;
+
+const char* const kOpNames[] = {"addOrder", "getMatchingSizeForSecurity", "cancelOrder",
+                                "cancelOrdersForSecIdWithMinimumQty", "cancelOrdersForUser", "getAllOrders"};
+constexpr size_t kOpCount = sizeof(kOpNames) / sizeof(kOpNames[0]);
+
+// Resident and peak resident bytes of this process; zero where /proc is not available
+size_t residentBytes() {
+#ifdef __linux__
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0;
+    size_t resident = 0;
+    if (statm >> pages >> resident) {
+        return resident * static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    }
+#endif
+    return 0;
+}
+
+// A "Name:  value kB" line of a /proc status file, in bytes
+size_t procKilobytes(const char* path, const std::string& field) {
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, field.size(), field) == 0) {
+            return std::stoull(line.substr(field.size())) * 1024;
+        }
+    }
+    return 0;
+}
+
+size_t peakResidentBytes() { return procKilobytes("/proc/self/status", "VmHWM:"); }
+size_t availableBytes() { return procKilobytes("/proc/meminfo", "MemAvailable:"); }
+
+// Restart VmHWM from the current RSS; false where the kernel does not allow it
+bool resetPeakResident() {
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+    return static_cast<bool>(clearRefs.flush());
+}
+
+// SplitMix64 finalizer: the fields of order i depend on i alone, so books of every size
+// share their first orders
+uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+std::vector<Order> generateOrders(size_t first, size_t count) {
+    std::vector<Order> orders;
+    orders.reserve(count);
+    for (size_t i = first; i < first + count; i++) {
+        const uint64_t bits = mix(i);
+        orders.push_back(Order{"OrdId" + std::to_string(i), "SecId" + std::to_string(bits % kSecurities),
+                               (bits >> 20) & 1 ? "Buy" : "Sell", static_cast<unsigned int>((bits >> 21) % 50 + 1) * 100,
+                               "User" + std::to_string((bits >> 32) % kUsers),
+                               "Comp" + std::to_string((bits >> 48) % 100)});
+    }
+    return orders;
+}
+
+// Calls made and time spent in one operation at one size
+struct OpTiming {
+    size_t calls = 0;
+    double seconds = 0;
+
+    double nsPerCall() const { return calls ? seconds * 1e9 / calls : 0; }
+};
+
+// Call call(i) for i = 0, 1, ... until `limit` calls or `budget` seconds
+template <typename Call>
+OpTiming timeCalls(size_t limit, double budget, Call&& call) {
+    OpTiming timing;
+    const auto begin = std::chrono::steady_clock::now();
+    while (timing.calls < limit) {
+        call(timing.calls++);
+        timing.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        if (timing.seconds >= budget) {
+            break;
+        }
+    }
+    return timing;
+}
+
+void printTiming(const char* name, const OpTiming& timing) {
+    std::printf("  %-36s %9zu calls %12.0f ops/s %14.0f ns/call\n", name, timing.calls,
+                timing.seconds > 0 ? timing.calls / timing.seconds : 0.0, timing.nsPerCall());
+}
+
+// Build a book of `bookSize` orders, print its memory and time every operation on it
+std::vector<OpTiming> runBookSize(size_t bookSize, double budget, double& bytesPerOrder) {
+    std::vector<OpTiming> timings(kOpCount);
+    const bool peakReset = resetPeakResident();
+    const size_t rssBefore = residentBytes();
+    std::printf("book of %zu orders\n", bookSize);
+
+    OrderCache cache;
+    {
+        OpTiming& adds = timings[0];
+        for (size_t first = 0; first < bookSize; first += kChunk) {
+            std::vector<Order> chunk = generateOrders(first, std::min(kChunk, bookSize - first));
+            const auto begin = std::chrono::steady_clock::now();
+            for (Order& order : chunk) {
+                cache.addOrder(std::move(order));
+            }
+            adds.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            adds.calls += chunk.size();
+        }
+        printTiming(kOpNames[0], adds);
+    }
+
+    const size_t rssGrowth = residentBytes() > rssBefore ? residentBytes() - rssBefore : 0;
+    const OrderCacheMemory memory = cache.memoryUsage();
+    bytesPerOrder = static_cast<double>(std::max(memory.total(), rssGrowth)) / bookSize;
+    std::printf("  memory: %.1f bytes per order by the cache's accounting (pool %.1f, strings %.1f, id index %.1f, "
+                "user index %.1f, security index %.1f, change log %.1f), %.1f by RSS growth\n",
+                static_cast<double>(memory.total()) / bookSize, static_cast<double>(memory.orderPool) / bookSize,
+                static_cast<double>(memory.orderStrings) / bookSize, static_cast<double>(memory.idIndex) / bookSize,
+                static_cast<double>(memory.userIndex) / bookSize, static_cast<double>(memory.securityIndex) / bookSize,
+                static_cast<double>(memory.changeLog) / bookSize, static_cast<double>(rssGrowth) / bookSize);
+
+    std::mt19937 gen(67890);
+    std::vector<std::string> securities;
+    std::vector<std::string> users;
+    for (int i = 0; i < kSecurities; ++i) {
+        securities.push_back("SecId" + std::to_string(i));
+    }
+    for (int i = 0; i < kUsers; ++i) {
+        users.push_back("User" + std::to_string(i));
+    }
+    std::shuffle(securities.begin(), securities.end(), gen);
+    std::shuffle(users.begin(), users.end(), gen);
+
+    timings[1] = timeCalls(securities.size(), budget,
+                           [&](size_t i) { sink = sink + cache.getMatchingSizeForSecurity(securities[i]); });
+
+    // Ids of a random sample of the book, spread over the whole id range
+    std::vector<std::string> ids;
+    std::uniform_int_distribution<size_t> idDist(0, bookSize - 1);
+    for (size_t i = 0; i < std::min<size_t>(bookSize, 10000); ++i) {
+        ids.push_back("OrdId" + std::to_string(idDist(gen)));
+    }
+    timings[2] = timeCalls(ids.size(), budget, [&](size_t i) { cache.cancelOrder(ids[i]); });
+
+    // Bulk cancels each take a tenth of their securities or users at most, so the later
+    // calls still run on full-sized books
+    timings[3] = timeCalls(securities.size() / 10, budget,
+                           [&](size_t i) { cache.cancelOrdersForSecIdWithMinimumQty(securities[i], 2500); });
+    timings[4] = timeCalls(users.size() / 10, budget, [&](size_t i) { cache.cancelOrdersForUser(users[i]); });
+    timings[5] = timeCalls(3, budget, [&](size_t) { sink = sink + cache.getAllOrders().size(); });
+    for (size_t op = 1; op < kOpCount; ++op) {
+        printTiming(kOpNames[op], timings[op]);
+    }
+
+    std::printf("  peak RSS %.1f MB%s\n", peakResidentBytes() / 1048576.0,
+                peakReset ? "" : " (whole process: VmHWM could not be reset)");
+    return timings;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    double budget = 2.0;
+    std::vector<size_t> bookSizes;
+    const char* const usage = "SizeScalingBenchmark [--budget seconds] [bookSize...]";
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--budget" && i + 1 < argc) {
+            if (!parseNonNegative(argv[++i], budget)) {
+                return usageError(usage);
+            }
+        } else {
+            size_t bookSize = 0;
+            if (!parseCount(argv[i], bookSize)) {
+                return usageError(usage);
+            }
+            bookSizes.push_back(bookSize);
+        }
+    }
+    if (bookSizes.empty()) {
+        bookSizes = {1000, 10000, 100000, 1000000, 10000000, 50000000};
+    }
+    std::sort(bookSizes.begin(), bookSizes.end());
+
+    std::vector<size_t> measured;
+    std::vector<std::vector<OpTiming>> results;
+    double bytesPerOrder = 0;
+    for (size_t bookSize : bookSizes) {
+        if (bookSize == 0) {
+            continue;
+        }
+        // Generated chunks and the cache's own growth come on top of the book itself
+        const double needed = bytesPerOrder * bookSize * 1.25;
+        const size_t available = availableBytes();
+        if (bytesPerOrder > 0 && available != 0 && needed > available) {
+            std::printf("book of %zu orders skipped: needs about %.1f GB, %.1f GB available\n", bookSize,
+                        needed / 1e9, available / 1e9);
+            continue;
+        }
+        results.push_back(runBookSize(bookSize, budget, bytesPerOrder));
+        measured.push_back(bookSize);
+    }
+
+    std::printf("ns per call by book size (growth exponent from the previous size)\n");
+    std::printf("  %-36s", "");
+    for (size_t bookSize : measured) {
+        std::printf(" %20zu", bookSize);
+    }
+    std::printf("\n");
+    for (size_t op = 0; op < kOpCount; ++op) {
+        std::printf("  %-36s", kOpNames[op]);
+        for (size_t i = 0; i < measured.size(); ++i) {
+            const double ns = results[i][op].nsPerCall();
+            const double previous = i > 0 ? results[i - 1][op].nsPerCall() : 0;
+            if (previous > 0 && ns > 0) {
+                const double exponent = std::log(ns / previous) / std::log(static_cast<double>(measured[i]) / measured[i - 1]);
+                std::printf(" %12.0f (%5.2f)", ns, exponent);
+            } else {
+                std::printf(" %12.0f        ", ns);
+            }
+        }
+        std::printf("\n");
+    }
+    return 0;
+}
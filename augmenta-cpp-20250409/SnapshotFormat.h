@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstdint>
+
+// On-disk layout of OrderCache snapshots. All integers are little-endian, as written
+// by the host; the loader rejects files whose magic or format version it does not know.
+//
+//   SnapshotHeader
+//   string table     stringCount x { uint32 length, bytes }   (intern table)
+//   aggregates       securityCount x SnapshotSecurity
+//   orders           orderCount x SnapshotOrder, grouped by security in aggregate order
+//   users            userCount x SnapshotUser
+//   user entries     orderCount x uint32 order index, grouped by user in users order
+//
+// Every string (order id, security, user, company) is stored once in the string table and
+// referenced by index. The payload CRC covers everything after the header.
+//
+// Version 2 added the user sections, so a loader can build each user's index on demand
+// straight from the mapped file.
+
+constexpr char     kSnapshotMagic[8]      = {'O', 'C', 'S', 'N', 'A', 'P', '0', '1'};
+constexpr uint32_t kSnapshotFormatVersion = 2;
+
+struct SnapshotHeader {
+    char     magic[8];
+    uint32_t formatVersion;
+    uint32_t headerSize;
+    uint64_t cacheVersion;     // OrderCache::getVersion() when the snapshot was taken
+    uint64_t orderCount;
+    uint64_t stringCount;
+    uint64_t securityCount;
+    uint64_t userCount;
+    uint64_t stringsOffset;
+    uint64_t aggregatesOffset;
+    uint64_t ordersOffset;
+    uint64_t usersOffset;
+    uint64_t userEntriesOffset;
+    uint64_t fileSize;
+    uint32_t payloadCrc;
+    uint32_t headerCrc;        // CRC of the header with this field zeroed
+};
+
+// Per-security aggregate, lets the loader size each book exactly before filling it
+struct SnapshotSecurity {
+    uint32_t securityId;       // string table index
+    uint32_t orderCount;
+    uint64_t buyQty;
+    uint64_t sellQty;
+};
+
+struct SnapshotOrder {
+    uint32_t orderId;          // string table index
+    uint32_t user;             // string table index
+    uint32_t company;          // string table index
+    uint32_t qty;
+    uint32_t isBuy;
+};
+
+// Per-user entry; its orders are the next orderCount user entries
+struct SnapshotUser {
+    uint32_t user;             // string table index
+    uint32_t orderCount;
+};
+
+// Compact encoding, several times smaller for typical books. The same content is stored
+// as one varint stream (see Varint.h) that is decoded straight into pooled orders:
+//
+//   CompactSnapshotHeader
+//   dictionary       stringCount x { varint length, bytes }
+//   books            securityCount x { varint security, varint orderCount, orders }
+//   order            varint flags           bit 0 buy, bit 1 literal order id
+//                    literal id:            varint length, bytes
+//                    otherwise:             varint prefix, zigzag varint (suffix - previous suffix)
+//                    varint user, varint company, varint qty
+//
+// Securities, users, companies and order id prefixes are dictionary indexes. An order id
+// ending in a canonical decimal number (no leading zero, at most 18 digits) is split into
+// prefix and number; the number is delta coded against the previous such order id in the
+// file. The payload CRC covers everything after the header.
+
+constexpr char     kCompactSnapshotMagic[8]      = {'O', 'C', 'S', 'N', 'A', 'P', 'Z', '1'};
+constexpr uint32_t kCompactSnapshotFormatVersion = 1;
+
+struct CompactSnapshotHeader {
+    char     magic[8];
+    uint32_t formatVersion;
+    uint32_t headerSize;
+    uint64_t cacheVersion;     // OrderCache::getVersion() when the snapshot was taken
+    uint64_t orderCount;
+    uint64_t stringCount;
+    uint64_t securityCount;
+    uint64_t userCount;        // distinct users, lets the loader size its user index
+    uint64_t payloadSize;
+    uint32_t payloadCrc;
+    uint32_t headerCrc;        // CRC of the header with this field zeroed
+};
+
+// Mapped image: a layout meant to be used in place rather than decoded (see
+// OrderCache::openImage()). Nothing in it is an address: strings are (offset, length)
+// pairs into the string bytes and everything else is an index.
+//
+//   ImageHeader
+//   string bytes     deduplicated, referenced by ImageString
+//   securities       securityCount x ImageSecurity
+//   orders           orderCount x ImageOrder, grouped by security in securities order
+//   users            userCount x ImageUser
+//   user entries     orderCount x uint32 order index, grouped by user in users order
+//   id index         idIndexCapacity x uint32, order index + 1 (0 = empty), open-addressed
+//                    by FNV-1a of the order id with linear probing
+//
+// Opening checks only the header CRC; the payload CRC lets a caller verify the rest.
+
+constexpr char     kImageMagic[8]      = {'O', 'C', 'I', 'M', 'A', 'G', 'E', '1'};
+constexpr uint32_t kImageFormatVersion = 1;
+
+struct ImageString {
+    uint32_t offset;           // from the start of the string bytes
+    uint32_t length;
+};
+
+struct ImageHeader {
+    char     magic[8];
+    uint32_t formatVersion;
+    uint32_t headerSize;
+    uint64_t cacheVersion;     // OrderCache::getVersion() when the image was written
+    uint64_t orderCount;
+    uint64_t securityCount;
+    uint64_t userCount;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+    uint64_t securitiesOffset;
+    uint64_t ordersOffset;
+    uint64_t usersOffset;
+    uint64_t userEntriesOffset;
+    uint64_t idIndexOffset;
+    uint64_t idIndexCapacity;  // power of two
+    uint64_t fileSize;
+    uint32_t payloadCrc;
+    uint32_t headerCrc;        // CRC of the header with this field zeroed
+};
+
+struct ImageSecurity {
+    ImageString securityId;
+    uint32_t firstOrder;
+    uint32_t orderCount;
+    uint64_t buyQty;
+    uint64_t sellQty;
+};
+
+struct ImageOrder {
+    ImageString orderId;
+    ImageString user;
+    ImageString company;
+    uint32_t qty;
+    uint32_t security;         // ImageSecurity index
+    uint32_t isBuy;
+    uint32_t reserved;
+};
+
+// Per-user entry; its orders are user entries [firstEntry, firstEntry + orderCount)
+struct ImageUser {
+    ImageString user;
+    uint32_t firstEntry;
+    uint32_t orderCount;
+};
+
+static_assert(sizeof(SnapshotHeader) == 112, "snapshot header layout changed");
+static_assert(sizeof(SnapshotSecurity) == 24, "snapshot aggregate layout changed");
+static_assert(sizeof(SnapshotOrder) == 20, "snapshot order layout changed");
+static_assert(sizeof(SnapshotUser) == 8, "snapshot user layout changed");
+static_assert(sizeof(CompactSnapshotHeader) == 72, "compact snapshot header layout changed");
+static_assert(sizeof(ImageHeader) == 128, "image header layout changed");
+static_assert(sizeof(ImageSecurity) == 32, "image security layout changed");
+static_assert(sizeof(ImageOrder) == 40, "image order layout changed");
+static_assert(sizeof(ImageUser) == 16, "image user layout changed");
@@ -0,0 +1,192 @@
+// Per-thread span rings and their Chrome trace export
+#include "SpanTrace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+#ifdef __unix__
+    #include <unistd.h>
+#endif
+
+// The last kRingCapacity spans of one thread. Only the owning thread writes. It bumps
+// `claimed` before it overwrites a slot and `head` once the slot is complete, so a reader
+// that checks `claimed` after copying knows which copied slots may be torn.
+struct SpanTracer::Ring {
+    struct Slot {
+        std::atomic<const char*> name;
+        std::atomic<uint64_t> start;
+        std::atomic<uint64_t> end;
+    };
+
+    explicit Ring(uint32_t number) : thread(number) {}
+
+    uint32_t thread;
+    std::atomic<uint64_t> head{0};          // spans ever written
+    std::atomic<uint64_t> claimed{0};       // spans ever started
+    std::atomic<uint64_t> clearedAt{0};     // head when clear() last ran
+    std::atomic<bool> exited{false};
+    Slot slots[kRingCapacity];
+};
+
+struct SpanTracer::Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Ring>> rings;
+    uint32_t nextThread = 0;
+};
+
+// This thread's ring, created on its first span
+class SpanTracer::ThreadSlot
+{
+ public:
+
+  Ring& get() {
+      if (!m_ring) {
+          Registry& reg = registry();
+          std::lock_guard<std::mutex> lock(reg.mutex);
+          reg.rings.push_back(std::make_unique<Ring>(reg.nextThread++));
+          m_ring = reg.rings.back().get();
+      }
+      return *m_ring;
+  }
+
+  ~ThreadSlot() {
+      if (m_ring) {
+          m_ring->exited.store(true, std::memory_order_release);
+      }
+  }
+
+ private:
+
+  Ring* m_ring = nullptr;
+
+};
+
+thread_local SpanTracer::ThreadSlot SpanTracer::s_slot;
+
+// Never destroyed, so threads that exit during static destruction can still check out
+SpanTracer::Registry& SpanTracer::registry() {
+    static Registry* instance = new Registry;
+    return *instance;
+}
+
+void SpanTracer::record(const char* name, uint64_t startTicks, uint64_t endTicks) noexcept {
+    Ring& ring = s_slot.get();
+    const uint64_t head = ring.head.load(std::memory_order_relaxed);
+    Ring::Slot& slot = ring.slots[head % kRingCapacity];
+    ring.claimed.store(head + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.start.store(startTicks, std::memory_order_relaxed);
+    slot.end.store(endTicks, std::memory_order_relaxed);
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+std::vector<SpanEvent> SpanTracer::collect() {
+    struct RawSpan {
+        const char* name;
+        uint32_t thread;
+        uint64_t start;
+        uint64_t end;
+    };
+    std::vector<RawSpan> raw;
+    {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for (const auto& ring : reg.rings) {
+            const uint64_t head = ring->head.load(std::memory_order_acquire);
+            const uint64_t first = std::max(head > kRingCapacity ? head - kRingCapacity : 0,
+                                            ring->clearedAt.load(std::memory_order_relaxed));
+            const size_t copied = raw.size();
+            for (uint64_t i = first; i < head; ++i) {
+                const Ring::Slot& slot = ring->slots[i % kRingCapacity];
+                raw.push_back(RawSpan{slot.name.load(std::memory_order_relaxed), ring->thread,
+                                      slot.start.load(std::memory_order_relaxed),
+                                      slot.end.load(std::memory_order_relaxed)});
+            }
+
+            // Slots the owner reused while we copied may mix two spans
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const uint64_t claimed = ring->claimed.load(std::memory_order_relaxed);
+            const uint64_t overwritten = claimed > kRingCapacity + first ? claimed - kRingCapacity - first : 0;
+            raw.erase(raw.begin() + copied, raw.begin() + copied + std::min<uint64_t>(overwritten, raw.size() - copied));
+        }
+    }
+
+    uint64_t origin = UINT64_MAX;
+    for (const RawSpan& span : raw) {
+        origin = std::min(origin, span.start);
+    }
+    std::vector<SpanEvent> events;
+    events.reserve(raw.size());
+    for (const RawSpan& span : raw) {
+        events.push_back(SpanEvent{span.name, span.thread, TscClock::toNanos(span.start - origin),
+                                   TscClock::toNanos(span.end > span.start ? span.end - span.start : 0)});
+    }
+    std::stable_sort(events.begin(), events.end(), [](const SpanEvent& a, const SpanEvent& b) {
+        return a.thread != b.thread ? a.thread < b.thread : a.startNs < b.startNs;
+    });
+    return events;
+}
+
+void SpanTracer::writeChromeTrace(std::ostream& out) {
+#ifdef __unix__
+    const long pid = static_cast<long>(::getpid());
+#else
+    const long pid = 1;
+#endif
+    const std::vector<SpanEvent> events = collect();
+    char line[256];
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    uint32_t lastThread = UINT32_MAX;
+    for (const SpanEvent& event : events) {
+        if (event.thread != lastThread) {
+            lastThread = event.thread;
+            std::snprintf(line, sizeof(line),
+                          "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%u,"
+                          "\"args\":{\"name\":\"cache thread %u\"}}",
+                          first ? "" : ",", pid, event.thread, event.thread);
+            out << line;
+            first = false;
+        }
+        // Names are identifiers chosen in the code; anything that would need escaping is dropped
+        std::string name;
+        for (const char* c = event.name; *c; ++c) {
+            if (*c != '"' && *c != '\\' && static_cast<unsigned char>(*c) >= 0x20) {
+                name += *c;
+            }
+        }
+        std::snprintf(line, sizeof(line),
+                      ",\n{\"name\":\"%s\",\"cat\":\"ordercache\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                      "\"pid\":%ld,\"tid\":%u}",
+                      name.c_str(), event.startNs / 1000.0, event.durationNs / 1000.0, pid, event.thread);
+        out << line;
+    }
+    out << "\n]}\n";
+}
+
+bool SpanTracer::writeChromeTrace(const std::string& path) {
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+    writeChromeTrace(out);
+    return static_cast<bool>(out.flush());
+}
+
+void SpanTracer::clear() {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.rings.erase(std::remove_if(reg.rings.begin(), reg.rings.end(),
+                                   [](const std::unique_ptr<Ring>& ring) {
+                                       return ring->exited.load(std::memory_order_acquire);
+                                   }),
+                    reg.rings.end());
+    for (const auto& ring : reg.rings) {
+        ring->clearedAt.store(ring->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "LatencyHistogram.h"
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// One finished span. Times are nanoseconds; starts are relative to the earliest span
+// collected with it.
+struct SpanEvent {
+    const char* name;
+    uint32_t thread;           // small per-process thread number, in order of first span
+    uint64_t startNs;
+    uint64_t durationNs;
+};
+
+// Scoped spans of the cache's internal phases, exported as Chrome trace-event JSON that
+// about:tracing and Perfetto open. Each thread writes into its own ring of the last
+// kRingCapacity spans with relaxed atomic stores and no locks; collect() may run on any
+// thread and skips slots overwritten while it reads. Rings of exited threads are kept
+// until clear().
+//
+// A cache compiled with ORDERCACHE_SPANS (CMake option) opens a span for each public call
+// and, inside it, for the phases: lookup, index compaction, partition, sort, match,
+// materialize and copy.
+class SpanTracer
+{
+ public:
+
+  static constexpr bool kCacheInstrumented =
+#ifdef ORDERCACHE_SPANS
+      true;
+#else
+      false;
+#endif
+
+  static constexpr size_t kRingCapacity = size_t{1} << 15;
+
+  // Add a span to this thread's ring. `name` must outlive the tracer (a string literal).
+  static void record(const char* name, uint64_t startTicks, uint64_t endTicks) noexcept;
+
+  // Every thread's retained spans, by thread then start time
+  static std::vector<SpanEvent> collect();
+
+  // The retained spans as a Chrome trace ("X" complete events, one track per thread)
+  static void writeChromeTrace(std::ostream& out);
+  static bool writeChromeTrace(const std::string& path);
+
+  // Forget every span recorded so far and the rings of exited threads
+  static void clear();
+
+ private:
+
+  struct Ring;
+  struct Registry;
+  class ThreadSlot;
+
+  static Registry& registry();
+
+  static thread_local ThreadSlot s_slot;
+};
+
+// Records its own lifetime as a span of `name`
+class SpanScope
+{
+ public:
+
+  explicit SpanScope(const char* name) noexcept : m_name(name), m_start(TscClock::now()) {}
+
+  SpanScope(const SpanScope&) = delete;
+  SpanScope& operator=(const SpanScope&) = delete;
+
+  ~SpanScope() { SpanTracer::record(m_name, m_start, TscClock::now()); }
+
+ private:
+
+  const char* m_name;
+  uint64_t m_start;
+
+};
+
+#define ORDERCACHE_SPAN_JOIN2(a, b) a##b
+#define ORDERCACHE_SPAN_JOIN(a, b) ORDERCACHE_SPAN_JOIN2(a, b)
+
+// Span from here to the end of the enclosing block, compiled out unless ORDERCACHE_SPANS is defined
+#ifdef ORDERCACHE_SPANS
+    #define TRACE_SPAN(name) SpanScope ORDERCACHE_SPAN_JOIN(traceSpan, __LINE__)(name)
+#else
+    #define TRACE_SPAN(name)
+#endif
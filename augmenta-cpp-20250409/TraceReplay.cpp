@@ -0,0 +1,45 @@
+// Replay a recorded operation trace (see OrderTrace.h) against a fresh cache.
+//
+//   TraceReplay trace [--paced]
+//
+// Runs every recorded call at full speed, or with --paced at its original start time,
+// and prints the latency of each call type next to what the trace recorded. Results of
+// matching and getAllOrders calls that differ from the recording are counted, which
+// flags a build that behaves differently.
+#include "LatencyReport.h"
+#include "OrderCache.h"
+#include "OrderTrace.h"
+
+#include <iostream>
+#include <string>
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: TraceReplay trace [--paced]" << std::endl;
+        return 2;
+    }
+    const bool paced = argc > 2 && std::string(argv[2]) == "--paced";
+
+    OrderTrace trace;
+    if (!trace.load(argv[1])) {
+        std::cerr << argv[1] << ": not a readable trace" << std::endl;
+        return 1;
+    }
+    std::cout << trace.records().size() << " calls" << (trace.isTruncated() ? " (trace ends in a partial record)" : "")
+              << (paced ? ", paced" : ", full speed") << std::endl;
+
+    OrderCache cache;
+    TraceReplayResult result = trace.replay(cache, paced);
+
+    std::cout << "replayed in " << result.seconds << " s, " << result.mismatches << " result mismatches" << std::endl;
+    for (size_t call = 0; call < kTraceCallCount; ++call) {
+        printLatencies(traceCallName(static_cast<TraceCall>(call)), result.latencies[call],
+                       totalSeconds(result.latencies[call]));
+    }
+    std::cout << "as recorded" << std::endl;
+    for (size_t call = 0; call < kTraceCallCount; ++call) {
+        printLatencies(traceCallName(static_cast<TraceCall>(call)), result.recorded[call],
+                       totalSeconds(result.recorded[call]));
+    }
+    return result.mismatches == 0 ? 0 : 3;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// LEB128 varints (7 bits per byte, low group first) plus zigzag mapping for signed
+// deltas, used by the compact snapshot encoding
+class Varint
+{
+ public:
+
+  static constexpr size_t kMaxBytes = 10;
+
+  static void append(std::vector<char>& out, uint64_t value) {
+      while (value >= 0x80) {
+          out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+          value >>= 7;
+      }
+      out.push_back(static_cast<char>(value));
+  }
+
+  // Decode one varint at `p`, advancing it. Fails on truncation or more than 64 bits.
+  static bool read(const char*& p, const char* end, uint64_t& value) noexcept {
+      // Single-byte values (small counts, dictionary indexes, flags) dominate
+      if (p < end && static_cast<unsigned char>(*p) < 0x80) {
+          value = static_cast<unsigned char>(*p++);
+          return true;
+      }
+
+      uint64_t result = 0;
+      for (unsigned shift = 0; shift < 64 && p < end; shift += 7) {
+          const auto byte = static_cast<unsigned char>(*p++);
+          result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+          if (byte < 0x80) {
+              value = result;
+              return true;
+          }
+      }
+      return false;
+  }
+
+  static uint64_t zigzag(int64_t value) noexcept {
+      return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+  }
+
+  static int64_t unzigzag(uint64_t value) noexcept {
+      return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+  }
+};
@@ -0,0 +1,217 @@
+// Deterministic, skewed operation streams for benchmarks and tests
+#include "WorkloadGenerator.h"
+
+#include <algorithm>
+#include <cmath>
+
+WorkloadGenerator::WorkloadGenerator(WorkloadOptions options)
+    : m_options(options), m_gen(options.seed) {
+    m_options.securities = std::max(m_options.securities, 1u);
+    m_options.users = std::max(m_options.users, 1u);
+    m_options.companies = std::max(m_options.companies, 1u);
+    m_options.minLots = std::max(m_options.minLots, 1u);
+    m_options.maxLots = std::max(m_options.maxLots, m_options.minLots);
+    m_options.lotSize = std::max(m_options.lotSize, 1u);
+
+    m_securityCdf = zipfCdf(m_options.securities, m_options.securitySkew);
+    m_userCdf = zipfCdf(m_options.users, m_options.userSkew);
+    m_lotCdf = zipfCdf(m_options.maxLots - m_options.minLots + 1, m_options.qtySkew);
+
+    const WorkloadMix& mix = m_options.mix;
+    const double weights[] = {mix.add, mix.cancel, mix.amend, mix.cancelUser, mix.cancelSecurity, mix.match, mix.getAll};
+    double total = 0;
+    for (double weight : weights) {
+        total += std::max(weight, 0.0);
+        m_mixCdf.push_back(total);
+    }
+    if (total <= 0) {
+        m_mixCdf.assign(m_mixCdf.size(), 1.0); // No weights at all: adds only
+    } else {
+        for (double& bound : m_mixCdf) {
+            bound /= total;
+        }
+    }
+
+    for (uint32_t i = 0; i < m_options.securities; ++i) {
+        m_securityIds.push_back("SecId" + std::to_string(i));
+    }
+    for (uint32_t i = 0; i < m_options.users; ++i) {
+        m_users.push_back("User" + std::to_string(i));
+    }
+    for (uint32_t i = 0; i < m_options.companies; ++i) {
+        m_companies.push_back("Company" + std::to_string(i));
+    }
+    m_byUser.resize(m_options.users);
+    m_bySecurity.resize(m_options.securities);
+}
+
+std::vector<double> WorkloadGenerator::zipfCdf(uint32_t n, double skew) {
+    std::vector<double> cdf(n);
+    double total = 0;
+    for (uint32_t rank = 0; rank < n; ++rank) {
+        total += skew > 0 ? 1.0 / std::pow(rank + 1.0, skew) : 1.0;
+        cdf[rank] = total;
+    }
+    for (double& bound : cdf) {
+        bound /= total;
+    }
+    return cdf;
+}
+
+double WorkloadGenerator::uniform() {
+    return static_cast<double>(m_gen() >> 11) * 0x1.0p-53;
+}
+
+uint32_t WorkloadGenerator::pick(const std::vector<double>& cdf) {
+    const auto it = std::upper_bound(cdf.begin(), cdf.end(), uniform());
+    return static_cast<uint32_t>(std::min<size_t>(it - cdf.begin(), cdf.size() - 1));
+}
+
+uint32_t WorkloadGenerator::drawQty() {
+    return (m_options.minLots + pick(m_lotCdf)) * m_options.lotSize;
+}
+
+WorkloadOp WorkloadGenerator::makeAdd() {
+    const uint64_t order = m_orders.size();
+    const uint32_t security = pick(m_securityCdf);
+    const uint32_t user = pick(m_userCdf);
+    const bool isBuy = uniform() < m_options.buyShare;
+    const uint32_t qty = drawQty();
+
+    m_orders.push_back(TrackedOrder{security, user, qty, isBuy, true});
+    m_orderIds.push_back("OrdId" + std::to_string(order));
+    m_live.push_back(order);
+    m_byUser[user].push_back(order);
+    m_bySecurity[security].push_back(order);
+    ++m_liveCount;
+    return WorkloadOp{WorkloadOpType::Add, isBuy, qty, security, user, user % m_options.companies, order};
+}
+
+bool WorkloadGenerator::pickLive(uint64_t& order) {
+    while (!m_live.empty()) {
+        const size_t index = static_cast<size_t>(m_gen() % m_live.size());
+        order = m_live[index];
+        if (m_orders[order].live) {
+            return true;
+        }
+        m_live[index] = m_live.back(); // Cancelled by a bulk operation; drop it now
+        m_live.pop_back();
+    }
+    return false;
+}
+
+void WorkloadGenerator::retire(uint64_t order) {
+    if (m_orders[order].live) {
+        m_orders[order].live = false;
+        --m_liveCount;
+    }
+}
+
+std::vector<WorkloadOp> WorkloadGenerator::generateAdds(size_t count) {
+    std::vector<WorkloadOp> ops;
+    ops.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        ops.push_back(makeAdd());
+    }
+    return ops;
+}
+
+std::vector<WorkloadOp> WorkloadGenerator::generate(size_t count) {
+    std::vector<WorkloadOp> ops;
+    ops.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        const auto type = static_cast<WorkloadOpType>(pick(m_mixCdf));
+        uint64_t order = 0;
+        switch (type) {
+        case WorkloadOpType::Add:
+            ops.push_back(makeAdd());
+            break;
+
+        case WorkloadOpType::Cancel:
+        case WorkloadOpType::Amend: {
+            if (!pickLive(order)) {
+                ops.push_back(makeAdd());
+                break;
+            }
+            TrackedOrder& tracked = m_orders[order];
+            if (type == WorkloadOpType::Cancel) {
+                retire(order);
+            } else {
+                tracked.qty = drawQty();
+            }
+            ops.push_back(WorkloadOp{type, tracked.isBuy, type == WorkloadOpType::Amend ? tracked.qty : 0,
+                                     tracked.security, tracked.user, tracked.user % m_options.companies, order});
+            break;
+        }
+
+        case WorkloadOpType::CancelUser: {
+            const uint32_t user = pick(m_userCdf);
+            for (uint64_t userOrder : m_byUser[user]) {
+                retire(userOrder);
+            }
+            m_byUser[user].clear();
+            ops.push_back(WorkloadOp{type, false, 0, 0, user, 0, 0});
+            break;
+        }
+
+        case WorkloadOpType::CancelSecurity: {
+            const uint32_t security = pick(m_securityCdf);
+            const uint32_t minQty = drawQty();
+            auto& orders = m_bySecurity[security];
+            orders.erase(std::remove_if(orders.begin(), orders.end(),
+                                        [&](uint64_t secOrder) {
+                                            if (m_orders[secOrder].live && m_orders[secOrder].qty >= minQty) {
+                                                retire(secOrder);
+                                            }
+                                            return !m_orders[secOrder].live;
+                                        }),
+                         orders.end());
+            ops.push_back(WorkloadOp{type, false, minQty, security, 0, 0, 0});
+            break;
+        }
+
+        case WorkloadOpType::Match:
+            ops.push_back(WorkloadOp{type, false, 0, pick(m_securityCdf), 0, 0, 0});
+            break;
+
+        case WorkloadOpType::GetAll:
+            ops.push_back(WorkloadOp{type, false, 0, 0, 0, 0, 0});
+            break;
+        }
+    }
+    return ops;
+}
+
+Order WorkloadGenerator::toOrder(const WorkloadOp& op) const {
+    static const std::string buy = "Buy";
+    static const std::string sell = "Sell";
+    return Order{m_orderIds[op.order], m_securityIds[op.security], op.isBuy ? buy : sell, op.qty,
+                 m_users[op.user], m_companies[op.company]};
+}
+
+void WorkloadGenerator::apply(OrderCacheInterface& cache, const WorkloadOp& op) const {
+    switch (op.type) {
+    case WorkloadOpType::Add:
+        cache.addOrder(toOrder(op));
+        break;
+    case WorkloadOpType::Cancel:
+        cache.cancelOrder(m_orderIds[op.order]);
+        break;
+    case WorkloadOpType::Amend:
+        cache.cancelOrder(m_orderIds[op.order]);
+        cache.addOrder(toOrder(op));
+        break;
+    case WorkloadOpType::CancelUser:
+        cache.cancelOrdersForUser(m_users[op.user]);
+        break;
+    case WorkloadOpType::CancelSecurity:
+        cache.cancelOrdersForSecIdWithMinimumQty(m_securityIds[op.security], op.qty);
+        break;
+    case WorkloadOpType::Match:
+        cache.getMatchingSizeForSecurity(m_securityIds[op.security]);
+        break;
+    case WorkloadOpType::GetAll:
+        cache.getAllOrders();
+        break;
+    }
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "OrderCache.h"
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+// Relative weights of the operation types in a generated stream; they need not sum to 1
+struct WorkloadMix {
+    double add = 1.0;
+    double cancel = 0.0;
+    double amend = 0.0;            // cancelOrder then addOrder of the same id with a new qty
+    double cancelUser = 0.0;
+    double cancelSecurity = 0.0;   // cancelOrdersForSecIdWithMinimumQty
+    double match = 0.0;            // getMatchingSizeForSecurity
+    double getAll = 0.0;
+};
+
+// Shape of the generated flow. Securities and users are picked by Zipf rank (rank 0, e.g.
+// "SecId0", is the most popular); a skew of 0 picks uniformly. Each user belongs to one
+// company. Quantities are a number of lots, Zipf-distributed over [minLots, maxLots] with
+// small orders most common when qtySkew > 0.
+struct WorkloadOptions {
+    uint64_t seed = 12345;
+    uint32_t securities = 1000;
+    uint32_t users = 1000;
+    uint32_t companies = 100;
+    double securitySkew = 1.0;
+    double userSkew = 1.0;
+    uint32_t minLots = 1;
+    uint32_t maxLots = 50;
+    uint32_t lotSize = 100;
+    double qtySkew = 0.0;
+    double buyShare = 0.5;
+    WorkloadMix mix;
+};
+
+enum class WorkloadOpType : uint8_t { Add, Cancel, Amend, CancelUser, CancelSecurity, Match, GetAll };
+
+// One generated call. Fields a type does not use are zero; `qty` is the minimum qty of a
+// CancelSecurity.
+struct WorkloadOp {
+    WorkloadOpType type;
+    bool isBuy;
+    uint32_t qty;
+    uint32_t security;
+    uint32_t user;
+    uint32_t company;
+    uint64_t order;                // order number, named by orderId()
+};
+
+// Deterministic generator of operation streams: the same options always give the same
+// stream, on any platform (sampling uses std::mt19937_64 output directly, not the
+// implementation-defined standard distributions). The generator tracks which orders are
+// live, so cancels and amends always target an order that exists; when none does, an add
+// is emitted instead.
+class WorkloadGenerator
+{
+ public:
+
+  explicit WorkloadGenerator(WorkloadOptions options = {});
+
+  // The next `count` operations of the stream
+  std::vector<WorkloadOp> generate(size_t count);
+
+  // `count` adds, e.g. to fill a book before a measured stream
+  std::vector<WorkloadOp> generateAdds(size_t count);
+
+  // Orders the stream generated so far leaves in the cache
+  size_t liveOrderCount() const noexcept { return m_liveCount; }
+
+  const WorkloadOptions& options() const noexcept { return m_options; }
+  const std::string& orderId(uint64_t order) const { return m_orderIds[order]; }
+  const std::string& securityId(uint32_t security) const { return m_securityIds[security]; }
+  const std::string& user(uint32_t user) const { return m_users[user]; }
+  const std::string& company(uint32_t company) const { return m_companies[company]; }
+
+  // The order an Add or Amend submits
+  Order toOrder(const WorkloadOp& op) const;
+
+  // Run one operation against a cache
+  void apply(OrderCacheInterface& cache, const WorkloadOp& op) const;
+
+ private:
+
+  struct TrackedOrder {
+      uint32_t security;
+      uint32_t user;
+      uint32_t qty;
+      bool isBuy;
+      bool live;
+  };
+
+  // Cumulative distribution of a Zipf law over n ranks
+  static std::vector<double> zipfCdf(uint32_t n, double skew);
+
+  double uniform();
+  uint32_t pick(const std::vector<double>& cdf);
+  uint32_t drawQty();
+  WorkloadOp makeAdd();
+  bool pickLive(uint64_t& order);
+  void retire(uint64_t order);
+
+  WorkloadOptions m_options;
+  std::mt19937_64 m_gen;
+  std::vector<double> m_securityCdf;
+  std::vector<double> m_userCdf;
+  std::vector<double> m_lotCdf;
+  std::vector<double> m_mixCdf;
+
+  std::vector<std::string> m_securityIds;
+  std::vector<std::string> m_users;
+  std::vector<std::string> m_companies;
+  std::vector<std::string> m_orderIds;
+
+  // Every order ever added, by number; the live lists are pruned lazily
+  std::vector<TrackedOrder> m_orders;
+  std::vector<uint64_t> m_live;
+  std::vector<std::vector<uint64_t>> m_byUser;
+  std::vector<std::vector<uint64_t>> m_bySecurity;
+  size_t m_liveCount = 0;
+
+};